@@ -31,8 +31,10 @@
 #include <stdint.h>
 #include <errno.h>
 #include <unistd.h>
+#include <limits.h>
 #include <assert.h>
 #include <signal.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 
 #include <bluetooth/bluetooth.h>
@@ -48,6 +50,7 @@
 #include "../src/adapter.h"
 #include "../src/manager.h"
 #include "../src/device.h"
+#include "../src/textfile.h"
 
 #include "device.h"
 #include "manager.h"
@@ -95,6 +98,7 @@
 #define REQ_TIMEOUT 6
 #endif
 #define ABORT_TIMEOUT 2
+#define MAX_PIPELINED 4
 #define DISCONNECT_TIMEOUT 1
 #define STREAM_TIMEOUT 20
 
@@ -312,6 +316,7 @@ struct in_buf {
 };
 
 struct pending_req {
+	struct avdtp *session;
 	uint8_t transaction;
 	uint8_t signal_id;
 	void *data;
@@ -393,6 +398,7 @@ struct avdtp {
 	int free_lock;
 
 	uint16_t version;
+	uint16_t sdp_version; /* Advertised version, version may be raised */
 
 	struct avdtp_server *server;
 	bdaddr_t dst;
@@ -409,6 +415,8 @@ struct avdtp {
 	guint io_id;
 
 	GSList *seps; /* Elements of type struct avdtp_remote_sep * */
+	gboolean seps_cached; /* seps were restored from storage */
+	gboolean seps_stale; /* cached seps were rejected by the peer */
 
 	GSList *streams; /* Elements of type struct avdtp_stream * */
 
@@ -429,6 +437,10 @@ struct avdtp {
 
 	struct pending_req *req;
 
+	/* Requests outstanding next to req, each with its own transaction
+	 * label. Only used for signals that don't change stream state. */
+	GSList *pipelined;
+
 	guint dc_timer;
 
 	/* Attempt stream setup instead of disconnecting */
@@ -443,6 +455,8 @@ static GSList *avdtp_callbacks = NULL;
 
 static gboolean auto_connect = TRUE;
 
+static gboolean pipelining = FALSE;
+
 static int send_request(struct avdtp *session, gboolean priority,
 			struct avdtp_stream *stream, uint8_t signal_id,
 			void *buffer, size_t size);
@@ -615,6 +629,57 @@ static void pending_req_free(struct pending_req *req)
 	g_free(req);
 }
 
+static struct pending_req *find_pending_req(struct avdtp *session,
+							uint8_t transaction)
+{
+	GSList *l;
+
+	if (session->req && session->req->transaction == transaction)
+		return session->req;
+
+	for (l = session->pipelined; l != NULL; l = g_slist_next(l)) {
+		struct pending_req *req = l->data;
+
+		if (req->transaction == transaction)
+			return req;
+	}
+
+	return NULL;
+}
+
+static gboolean is_getcap(uint8_t signal_id)
+{
+	return signal_id == AVDTP_GET_CAPABILITIES ||
+				signal_id == AVDTP_GET_ALL_CAPABILITIES;
+}
+
+/* Whether capability requests other than the given one are still due */
+static gboolean getcap_pending(struct avdtp *session, uint8_t transaction)
+{
+	GSList *queues[] = { session->pipelined, session->prio_queue,
+							session->req_queue };
+	unsigned int i;
+	GSList *l;
+
+	if (session->req && is_getcap(session->req->signal_id) &&
+				session->req->transaction != transaction)
+		return TRUE;
+
+	for (i = 0; i < G_N_ELEMENTS(queues); i++) {
+		for (l = queues[i]; l != NULL; l = g_slist_next(l)) {
+			struct pending_req *req = l->data;
+
+			if (!is_getcap(req->signal_id))
+				continue;
+
+			if (i > 0 || req->transaction != transaction)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
 static void close_stream(struct avdtp_stream *stream)
 {
 	int sock;
@@ -1177,6 +1242,10 @@ static void connection_lost(struct avdtp *session, int err)
 
 	session->free_lock = 1;
 
+	g_slist_free_full(session->pipelined,
+					(GDestroyNotify) pending_req_free);
+	session->pipelined = NULL;
+
 	finalize_discovery(session, err);
 
 	g_slist_foreach(session->streams, (GFunc) release_stream, session);
@@ -1208,6 +1277,14 @@ static void connection_lost(struct avdtp *session, int err)
 		avdtp_unref(session);
 }
 
+static void remote_sep_free(void *data)
+{
+	struct avdtp_remote_sep *sep = data;
+
+	g_slist_free_full(sep->caps, g_free);
+	g_free(sep);
+}
+
 void avdtp_unref(struct avdtp *session)
 {
 	struct avdtp_server *server;
@@ -1252,7 +1329,10 @@ void avdtp_unref(struct avdtp *session)
 	if (session->req)
 		pending_req_free(session->req);
 
-	g_slist_free_full(session->seps, g_free);
+	g_slist_free_full(session->pipelined,
+					(GDestroyNotify) pending_req_free);
+
+	g_slist_free_full(session->seps, remote_sep_free);
 
 	g_free(session->buf);
 
@@ -1361,6 +1441,164 @@ static GSList *caps_to_list(uint8_t *data, int size,
 	return caps;
 }
 
+static void create_seps_name(struct avdtp *session, char *filename,
+						size_t size, char *key)
+{
+	char addr[18];
+
+	ba2str(&session->server->src, addr);
+	create_name(filename, size, STORAGEDIR, addr, "avdtp");
+
+	ba2str(&session->dst, key);
+}
+
+/* The stored value starts with the AVDTP version the remote advertised in
+ * SDP (16 bit), followed by each remote SEP as seid, type, media type and
+ * the length of its capabilities (16 bit) and the raw capability elements
+ * as received in the GET_(ALL_)CAPABILITIES response. */
+static void store_remote_seps(struct avdtp *session)
+{
+	char filename[PATH_MAX + 1], key[18];
+	GString *value;
+	GSList *l, *c;
+	unsigned int count = 0;
+
+	if (session->seps_cached)
+		return;
+
+	value = g_string_new(NULL);
+	g_string_append_printf(value, "%04X", session->sdp_version);
+
+	for (l = session->seps; l != NULL; l = l->next) {
+		struct avdtp_remote_sep *sep = l->data;
+		unsigned int len = 0;
+
+		if (sep->codec == NULL)
+			continue;
+
+		for (c = sep->caps; c != NULL; c = c->next) {
+			struct avdtp_service_capability *cap = c->data;
+			len += 2 + cap->length;
+		}
+
+		g_string_append_printf(value, "%02X%02X%02X%04X", sep->seid,
+					sep->type, sep->media_type, len);
+		count++;
+
+		for (c = sep->caps; c != NULL; c = c->next) {
+			struct avdtp_service_capability *cap = c->data;
+			uint8_t *data = (uint8_t *) cap;
+			int i;
+
+			for (i = 0; i < 2 + cap->length; i++)
+				g_string_append_printf(value, "%02X", data[i]);
+		}
+	}
+
+	create_seps_name(session, filename, sizeof(filename), key);
+
+	if (count > 0) {
+		create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		textfile_put(filename, key, value->str);
+	} else
+		textfile_del(filename, key);
+
+	g_string_free(value, TRUE);
+}
+
+static gboolean load_remote_seps(struct avdtp *session)
+{
+	char filename[PATH_MAX + 1], key[18];
+	uint8_t *buf;
+	char *str;
+	size_t len, i, offset;
+	GSList *seps = NULL;
+
+	create_seps_name(session, filename, sizeof(filename), key);
+
+	str = textfile_get(filename, key);
+	if (str == NULL)
+		return FALSE;
+
+	len = strlen(str) / 2;
+	buf = g_malloc0(len + 1);
+
+	for (i = 0; i < len; i++) {
+		if (sscanf(str + (i * 2), "%02hhX", &buf[i]) != 1)
+			break;
+	}
+
+	free(str);
+
+	/* Endpoints may differ between versions, drop them on upgrades */
+	if (i == len && len >= 2 &&
+			(buf[0] << 8 | buf[1]) != session->sdp_version) {
+		DBG("Stored endpoints for %s are for version %04X", key,
+							buf[0] << 8 | buf[1]);
+		g_free(buf);
+		textfile_del(filename, key);
+		return FALSE;
+	}
+
+	for (offset = 2; i == len && offset + 5 <= len;) {
+		struct avdtp_remote_sep *sep;
+		size_t caps_len;
+
+		caps_len = buf[offset + 3] << 8 | buf[offset + 4];
+		if (offset + 5 + caps_len > len)
+			break;
+
+		sep = g_new0(struct avdtp_remote_sep, 1);
+		sep->seid = buf[offset];
+		sep->type = buf[offset + 1];
+		sep->media_type = buf[offset + 2];
+		sep->caps = caps_to_list(buf + offset + 5, caps_len,
+					&sep->codec, &sep->delay_reporting);
+		sep->stream = find_stream_by_rseid(session, sep->seid);
+
+		seps = g_slist_append(seps, sep);
+
+		if (sep->codec == NULL)
+			break;
+
+		offset += 5 + caps_len;
+	}
+
+	g_free(buf);
+
+	if (seps == NULL || i != len || offset != len) {
+		error("Invalid stored endpoints for %s", key);
+		g_slist_free_full(seps, remote_sep_free);
+		textfile_del(filename, key);
+		return FALSE;
+	}
+
+	DBG("Restored %u endpoints for %s", g_slist_length(seps), key);
+
+	session->seps = seps;
+	session->seps_cached = TRUE;
+
+	return TRUE;
+}
+
+static void invalidate_remote_seps(struct avdtp *session)
+{
+	char filename[PATH_MAX + 1], key[18];
+
+	if (!session->seps_cached)
+		return;
+
+	DBG("Dropping stored endpoints");
+
+	create_seps_name(session, filename, sizeof(filename), key);
+	textfile_del(filename, key);
+
+	/* Keep the entries themselves around since streams may still refer
+	 * to them; the next discovery rebuilds the list from the response */
+	session->seps_cached = FALSE;
+	session->seps_stale = TRUE;
+}
+
 static gboolean avdtp_unknown_cmd(struct avdtp *session, uint8_t transaction,
 							uint8_t signal_id)
 {
@@ -2199,6 +2437,7 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 {
 	struct avdtp *session = data;
 	struct avdtp_common_header *header;
+	struct pending_req *req;
 	ssize_t size;
 	int fd;
 
@@ -2242,7 +2481,8 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 			goto failed;
 		}
 
-		if (session->ref == 1 && !session->streams && !session->req)
+		if (session->ref == 1 && !session->streams && !session->req &&
+							!session->pipelined)
 			set_disconnect_timer(session);
 
 		if (session->streams && session->dc_timer)
@@ -2250,33 +2490,35 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 
 		if (session->req && session->req->collided) {
 			DBG("Collision detected");
+			req = session->req;
 			goto next;
 		}
 
 		return TRUE;
 	}
 
-	if (session->req == NULL) {
+	if (session->req == NULL && session->pipelined == NULL) {
 		error("No pending request, ignoring message");
 		return TRUE;
 	}
 
-	if (header->transaction != session->req->transaction) {
+	req = find_pending_req(session, header->transaction);
+	if (req == NULL) {
 		error("Transaction label doesn't match");
 		return TRUE;
 	}
 
-	if (session->in.signal_id != session->req->signal_id) {
+	if (session->in.signal_id != req->signal_id) {
 		error("Response signal doesn't match");
 		return TRUE;
 	}
 
-	g_source_remove(session->req->timeout);
-	session->req->timeout = 0;
+	g_source_remove(req->timeout);
+	req->timeout = 0;
 
 	switch (header->message_type) {
 	case AVDTP_MSG_TYPE_ACCEPT:
-		if (!avdtp_parse_resp(session, session->req->stream,
+		if (!avdtp_parse_resp(session, req->stream,
 						session->in.transaction,
 						session->in.signal_id,
 						session->in.buf,
@@ -2286,7 +2528,7 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 		}
 		break;
 	case AVDTP_MSG_TYPE_REJECT:
-		if (!avdtp_parse_rej(session, session->req->stream,
+		if (!avdtp_parse_rej(session, req->stream,
 						session->in.transaction,
 						session->in.signal_id,
 						session->in.buf,
@@ -2304,8 +2546,12 @@ static gboolean session_cb(GIOChannel *chan, GIOCondition cond,
 	}
 
 next:
-	pending_req_free(session->req);
-	session->req = NULL;
+	if (req == session->req)
+		session->req = NULL;
+	else
+		session->pipelined = g_slist_remove(session->pipelined, req);
+
+	pending_req_free(req);
 
 	process_queue(session);
 
@@ -2400,7 +2646,8 @@ static struct avdtp *avdtp_get_internal(const bdaddr_t *src, const bdaddr_t *dst
 	session->state = AVDTP_SESSION_STATE_DISCONNECTED;
 	session->auto_dc = TRUE;
 
-	session->version = get_version(session);
+	session->sdp_version = get_version(session);
+	session->version = session->sdp_version;
 
 	server->sessions = g_slist_append(server->sessions, session);
 
@@ -2641,18 +2888,15 @@ static uint8_t req_get_seid(struct pending_req *req)
 	return ((struct seid_req *) (req->data))->acp_seid;
 }
 
-static int cancel_request(struct avdtp *session, int err)
+static int cancel_req(struct avdtp *session, struct pending_req *req,
+								int err)
 {
-	struct pending_req *req;
 	struct seid_req sreq;
 	struct avdtp_local_sep *lsep;
 	struct avdtp_stream *stream;
 	uint8_t seid;
 	struct avdtp_error averr;
 
-	req = session->req;
-	session->req = NULL;
-
 	avdtp_error_init(&averr, AVDTP_ERRNO, err);
 
 	seid = req_get_seid(req);
@@ -2714,8 +2958,12 @@ static int cancel_request(struct avdtp *session, int err)
 		error("Discover: %s (%d)", strerror(err), err);
 		goto failed;
 	case AVDTP_GET_CAPABILITIES:
+	case AVDTP_GET_ALL_CAPABILITIES:
 		error("GetCapabilities: %s (%d)", strerror(err), err);
 		goto failed;
+	case AVDTP_GET_CONFIGURATION:
+		error("GetConfiguration: %s (%d)", strerror(err), err);
+		goto failed;
 	case AVDTP_ABORT:
 		error("Abort: %s (%d)", strerror(err), err);
 		goto failed;
@@ -2743,6 +2991,15 @@ done:
 	return err;
 }
 
+static int cancel_request(struct avdtp *session, int err)
+{
+	struct pending_req *req = session->req;
+
+	session->req = NULL;
+
+	return cancel_req(session, req, err);
+}
+
 static gboolean request_timeout(gpointer user_data)
 {
 	struct avdtp *session = user_data;
@@ -2752,29 +3009,87 @@ static gboolean request_timeout(gpointer user_data)
 	return FALSE;
 }
 
-static int send_req(struct avdtp *session, gboolean priority,
-			struct pending_req *req)
+static gboolean pipelined_timeout(gpointer user_data)
+{
+	struct pending_req *req = user_data;
+	struct avdtp *session = req->session;
+
+	DBG("transaction %u timed out", req->transaction);
+
+	req->timeout = 0;
+	session->pipelined = g_slist_remove(session->pipelined, req);
+
+	cancel_req(session, req, ETIMEDOUT);
+
+	return FALSE;
+}
+
+/*
+ * Signals that only query the remote side may be sent while others are
+ * outstanding; anything changing stream state stays serialized.
+ */
+static gboolean can_pipeline(struct avdtp *session, struct pending_req *req)
+{
+	if (!pipelining)
+		return FALSE;
+
+	if (session->req != NULL)
+		return FALSE;
+
+	if (g_slist_length(session->pipelined) >= MAX_PIPELINED)
+		return FALSE;
+
+	switch (req->signal_id) {
+	case AVDTP_GET_CAPABILITIES:
+	case AVDTP_GET_ALL_CAPABILITIES:
+	case AVDTP_GET_CONFIGURATION:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+static gboolean can_send(struct avdtp *session, struct pending_req *req)
+{
+	if (session->req != NULL)
+		return FALSE;
+
+	if (session->pipelined == NULL)
+		return TRUE;
+
+	return can_pipeline(session, req);
+}
+
+static int alloc_transaction(struct avdtp *session)
 {
 	static int transaction = 0;
-	int err;
+	int i;
 
-	if (session->state == AVDTP_SESSION_STATE_DISCONNECTED) {
-		session->io = l2cap_connect(session);
-		if (!session->io) {
-			err = -EIO;
-			goto failed;
-		}
-		avdtp_set_state(session, AVDTP_SESSION_STATE_CONNECTING);
+	for (i = 0; i < 16; i++) {
+		uint8_t label = transaction++;
+
+		transaction %= 16;
+
+		if (find_pending_req(session, label) == NULL)
+			return label;
 	}
 
-	if (session->state < AVDTP_SESSION_STATE_CONNECTED ||
-			session->req != NULL) {
-		queue_request(session, req, priority);
-		return 0;
+	return -EBUSY;
+}
+
+static int transmit_req(struct avdtp *session, struct pending_req *req)
+{
+	gboolean pipelined = can_pipeline(session, req);
+	int transaction, err;
+
+	transaction = alloc_transaction(session);
+	if (transaction < 0) {
+		err = transaction;
+		goto failed;
 	}
 
-	req->transaction = transaction++;
-	transaction %= 16;
+	req->session = session;
+	req->transaction = transaction;
 
 	/* FIXME: Should we retry to send if the buffer
 	was not totally sent or in case of EINTR? */
@@ -2784,6 +3099,14 @@ static int send_req(struct avdtp *session, gboolean priority,
 		goto failed;
 	}
 
+	if (pipelined) {
+		session->pipelined = g_slist_append(session->pipelined, req);
+		req->timeout = g_timeout_add_seconds(REQ_TIMEOUT,
+							pipelined_timeout,
+							req);
+		return 0;
+	}
+
 	session->req = req;
 
 	req->timeout = g_timeout_add_seconds(req->signal_id == AVDTP_ABORT ?
@@ -2798,6 +3121,36 @@ failed:
 	return err;
 }
 
+static int send_req(struct avdtp *session, gboolean priority,
+			struct pending_req *req)
+{
+	int err;
+
+	if (session->state == AVDTP_SESSION_STATE_DISCONNECTED) {
+		session->io = l2cap_connect(session);
+		if (!session->io) {
+			err = -EIO;
+			goto failed;
+		}
+		avdtp_set_state(session, AVDTP_SESSION_STATE_CONNECTING);
+	}
+
+	/* Don't overtake queued requests waiting for pipelined ones */
+	if (session->state < AVDTP_SESSION_STATE_CONNECTED ||
+			!can_send(session, req) || (session->pipelined &&
+			(session->prio_queue || session->req_queue))) {
+		queue_request(session, req, priority);
+		return 0;
+	}
+
+	return transmit_req(session, req);
+
+failed:
+	g_free(req->data);
+	g_free(req);
+	return err;
+}
+
 static int send_request(struct avdtp *session, gboolean priority,
 			struct avdtp_stream *stream, uint8_t signal_id,
 			void *buffer, size_t size)
@@ -2826,6 +3179,7 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 	uint8_t getcap_cmd;
 	int ret = 0;
 	gboolean getcap_pending = FALSE;
+	GSList *old = NULL, *l;
 
 	if (session->version >= 0x0103 && session->server->version >= 0x0103)
 		getcap_cmd = AVDTP_GET_ALL_CAPABILITIES;
@@ -2834,6 +3188,14 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 
 	sep_count = size / sizeof(struct seid_info);
 
+	/* The stored endpoints were rejected by the peer, so rebuild the
+	 * list from this response instead of updating it in place; stale
+	 * SEIDs must not shadow the ones the peer reports now */
+	if (session->seps_stale) {
+		old = session->seps;
+		session->seps = NULL;
+	}
+
 	for (i = 0; i < sep_count; i++) {
 		struct avdtp_remote_sep *sep;
 		struct avdtp_stream *stream;
@@ -2846,6 +3208,14 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 		stream = find_stream_by_rseid(session, resp->seps[i].seid);
 
 		sep = find_remote_sep(session->seps, resp->seps[i].seid);
+		if (!sep && old) {
+			sep = find_remote_sep(old, resp->seps[i].seid);
+			if (sep) {
+				old = g_slist_remove(old, sep);
+				session->seps = g_slist_append(session->seps,
+									sep);
+			}
+		}
 		if (!sep) {
 			if (resp->seps[i].inuse && !stream)
 				continue;
@@ -2868,6 +3238,19 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 		getcap_pending = TRUE;
 	}
 
+	/* Endpoints no longer reported are only kept while a stream uses
+	 * them */
+	for (l = old; l != NULL; l = l->next) {
+		struct avdtp_remote_sep *sep = l->data;
+
+		if (sep->stream)
+			session->seps = g_slist_append(session->seps, sep);
+		else
+			remote_sep_free(sep);
+	}
+
+	g_slist_free(old);
+
 	if (!getcap_pending)
 		finalize_discovery(session, -ret);
 
@@ -2875,10 +3258,12 @@ static gboolean avdtp_discover_resp(struct avdtp *session,
 }
 
 static gboolean avdtp_get_capabilities_resp(struct avdtp *session,
+						uint8_t transaction,
 						struct getcap_resp *resp,
 						unsigned int size)
 {
 	struct avdtp_remote_sep *sep;
+	struct pending_req *req;
 	uint8_t seid;
 
 	/* Check for minimum required packet size includes:
@@ -2893,9 +3278,14 @@ static gboolean avdtp_get_capabilities_resp(struct avdtp *session,
 		return FALSE;
 	}
 
-	seid = ((struct seid_req *) session->req->data)->acp_seid;
+	req = find_pending_req(session, transaction);
+	seid = ((struct seid_req *) req->data)->acp_seid;
 
 	sep = find_remote_sep(session->seps, seid);
+	if (sep == NULL) {
+		error("Capabilities for unknown seid %d", seid);
+		return TRUE;
+	}
 
 	DBG("seid %d type %d media %d", sep->seid,
 					sep->type, sep->media_type);
@@ -3029,16 +3419,8 @@ static gboolean avdtp_parse_resp(struct avdtp *session,
 					uint8_t transaction, uint8_t signal_id,
 					void *buf, int size)
 {
-	struct pending_req *next;
 	const char *get_all = "";
 
-	if (session->prio_queue)
-		next = session->prio_queue->data;
-	else if (session->req_queue)
-		next = session->req_queue->data;
-	else
-		next = NULL;
-
 	switch (signal_id) {
 	case AVDTP_DISCOVER:
 		DBG("DISCOVER request succeeded");
@@ -3047,11 +3429,14 @@ static gboolean avdtp_parse_resp(struct avdtp *session,
 		get_all = "ALL_";
 	case AVDTP_GET_CAPABILITIES:
 		DBG("GET_%sCAPABILITIES request succeeded", get_all);
-		if (!avdtp_get_capabilities_resp(session, buf, size))
+		if (!avdtp_get_capabilities_resp(session, transaction,
+								buf, size))
 			return FALSE;
-		if (!(next && (next->signal_id == AVDTP_GET_CAPABILITIES ||
-				next->signal_id == AVDTP_GET_ALL_CAPABILITIES)))
+		if (!getcap_pending(session, transaction)) {
+			session->seps_stale = FALSE;
+			store_remote_seps(session);
 			finalize_discovery(session, 0);
+		}
 		return TRUE;
 	}
 
@@ -3159,6 +3544,8 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("GET_CAPABILITIES request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		if (!getcap_pending(session, transaction))
+			finalize_discovery(session, 0);
 		return TRUE;
 	case AVDTP_OPEN:
 		if (!seid_rej_to_err(buf, size, &err))
@@ -3174,6 +3561,7 @@ static gboolean avdtp_parse_rej(struct avdtp *session,
 			return FALSE;
 		error("SET_CONFIGURATION request rejected: %s (%d)",
 				avdtp_strerror(&err), err.err.error_code);
+		invalidate_remote_seps(session);
 		if (sep && sep->cfm && sep->cfm->set_configuration)
 			sep->cfm->set_configuration(session, sep, stream,
 							&err, sep->user_data);
@@ -3339,26 +3727,39 @@ gboolean avdtp_stream_get_transport(struct avdtp_stream *stream, int *sock,
 
 static int process_queue(struct avdtp *session)
 {
-	GSList **queue, *l;
+	GSList **queue;
 	struct pending_req *req;
+	int err;
 
-	if (session->req)
+	if (session->state < AVDTP_SESSION_STATE_CONNECTED)
 		return 0;
 
-	if (session->prio_queue)
-		queue = &session->prio_queue;
-	else
-		queue = &session->req_queue;
+	/* Keep sending while the head of the queue may go out next to
+	 * the requests already outstanding */
+	while (TRUE) {
+		if (session->prio_queue)
+			queue = &session->prio_queue;
+		else
+			queue = &session->req_queue;
 
-	if (!*queue)
-		return 0;
+		if (!*queue)
+			return 0;
 
-	l = *queue;
-	req = l->data;
+		req = (*queue)->data;
+		if (!can_send(session, req))
+			return 0;
 
-	*queue = g_slist_remove(*queue, req);
+		*queue = g_slist_remove(*queue, req);
 
-	return send_req(session, FALSE, req);
+		err = transmit_req(session, req);
+		if (err < 0)
+			return err;
+	}
+}
+
+gboolean avdtp_discovery_stale(struct avdtp *session)
+{
+	return session->seps_stale;
 }
 
 struct avdtp_remote_sep *avdtp_get_remote_sep(struct avdtp *session,
@@ -3434,7 +3835,8 @@ int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 	if (session->discov_cb)
 		return -EBUSY;
 
-	if (session->seps) {
+	if ((session->seps && !session->seps_stale) ||
+			(!session->seps && load_remote_seps(session))) {
 		session->discov_cb = cb;
 		session->user_data = user_data;
 		g_idle_add(process_discover, session);
@@ -3956,6 +4358,9 @@ int avdtp_init(const bdaddr_t *src, GKeyFile *config, uint16_t *version)
 	if (g_key_file_get_boolean(config, "A2DP", "DelayReporting", NULL))
 		ver = 0x0103;
 
+	pipelining = g_key_file_get_boolean(config, "A2DP", "Pipelining",
+									NULL);
+
 proceed:
 	server = g_new0(struct avdtp_server, 1);
 	if (!server)
@@ -238,6 +238,7 @@ struct avdtp_stream *avdtp_get_stream(struct avdtp_remote_sep *sep);
 
 int avdtp_discover(struct avdtp *session, avdtp_discover_cb_t cb,
 			void *user_data);
+gboolean avdtp_discovery_stale(struct avdtp *session);
 
 gboolean avdtp_has_stream(struct avdtp *session, struct avdtp_stream *stream);
 
@@ -0,0 +1,550 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "rtp.h"
+
+#include "gstpragma.h"
+#include "gstsbcutil.h"
+#include "gsta2dpsbcpay.h"
+
+#define RTP_SBC_PAYLOAD_HEADER_SIZE 1
+#define RTP_SBC_MAX_FRAMES 15
+
+#define DEFAULT_BITPOOL 0
+
+enum {
+	PROP_0,
+	PROP_BITPOOL
+};
+
+GST_DEBUG_CATEGORY_STATIC(gst_a2dp_sbc_pay_debug);
+#define GST_CAT_DEFAULT gst_a2dp_sbc_pay_debug
+
+GST_BOILERPLATE(GstA2dpSbcPay, gst_a2dp_sbc_pay, GstBaseRTPPayload,
+		GST_TYPE_BASE_RTP_PAYLOAD);
+
+static const GstElementDetails gst_a2dp_sbc_pay_details =
+	GST_ELEMENT_DETAILS("A2DP SBC encoder and payloader",
+				"Codec/Encoder/Payloader/Network",
+				"Encode audio into SBC RTP packets",
+				"Marcel Holtmann <marcel@holtmann.org>");
+
+static GstStaticPadTemplate gst_a2dp_sbc_pay_sink_factory =
+	GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+		GST_STATIC_CAPS("audio/x-raw-int, "
+				"rate = (int) { 16000, 32000, 44100, 48000 }, "
+				"channels = (int) [ 1, 2 ], "
+				"endianness = (int) BYTE_ORDER, "
+				"signed = (boolean) true, "
+				"width = (int) 16, "
+				"depth = (int) 16"));
+
+static GstStaticPadTemplate gst_a2dp_sbc_pay_src_factory =
+	GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+		GST_STATIC_CAPS(
+			"application/x-rtp, "
+			"media = (string) \"audio\","
+			"payload = (int) " GST_RTP_PAYLOAD_DYNAMIC_STRING ", "
+			"clock-rate = (int) { 16000, 32000, 44100, 48000 },"
+			"encoding-name = (string) \"SBC\"")
+	);
+
+static GstStaticCaps gst_a2dp_sbc_pay_sbc_caps =
+	GST_STATIC_CAPS("audio/x-sbc, "
+			"rate = (int) { 16000, 32000, 44100, 48000 }, "
+			"channels = (int) [ 1, 2 ], "
+			"mode = (string) { \"mono\", \"dual\", \"stereo\", \"joint\" }, "
+			"blocks = (int) { 4, 8, 12, 16 }, "
+			"subbands = (int) { 4, 8 }, "
+			"allocation = (string) { \"snr\", \"loudness\" }, "
+			"bitpool = (int) [ 2, 64 ]");
+
+static void gst_a2dp_sbc_pay_set_property(GObject *object, guint prop_id,
+				const GValue *value, GParamSpec *pspec);
+static void gst_a2dp_sbc_pay_get_property(GObject *object, guint prop_id,
+				GValue *value, GParamSpec *pspec);
+
+static void gst_a2dp_sbc_pay_update_frame(GstA2dpSbcPay *self)
+{
+	self->codesize = sbc_get_codesize(&self->sbc);
+	self->frame_length = sbc_get_frame_length(&self->sbc);
+	self->frame_duration = sbc_get_frame_duration(&self->sbc);
+
+	GST_DEBUG_OBJECT(self, "bitpool: %d, codesize: %d, frame_length: %d, "
+			"frame_duration: %d", self->sbc.bitpool,
+			self->codesize, self->frame_length,
+			self->frame_duration);
+}
+
+/* Frames of the current size that fit into one packet of the link MTU */
+static guint gst_a2dp_sbc_pay_get_frame_count(GstA2dpSbcPay *self)
+{
+	guint max_payload, frames;
+
+	max_payload = gst_rtp_buffer_calc_payload_len(
+		GST_BASE_RTP_PAYLOAD_MTU(self) - RTP_SBC_PAYLOAD_HEADER_SIZE,
+		0, 0);
+
+	frames = max_payload / self->frame_length;
+
+	return CLAMP(frames, 1, RTP_SBC_MAX_FRAMES);
+}
+
+/*
+ * Applies a bitpool change requested through the property. Called
+ * between packets only, so all frames of a packet have the same size.
+ */
+static void gst_a2dp_sbc_pay_apply_bitpool(GstA2dpSbcPay *self)
+{
+	gint bitpool;
+
+	GST_OBJECT_LOCK(self);
+	bitpool = self->bitpool;
+	GST_OBJECT_UNLOCK(self);
+
+	if (bitpool == DEFAULT_BITPOOL)
+		return;
+
+	bitpool = CLAMP(bitpool, self->min_bitpool, self->max_bitpool);
+	if (bitpool == self->sbc.bitpool)
+		return;
+
+	GST_LOG_OBJECT(self, "bitpool %d -> %d", self->sbc.bitpool, bitpool);
+
+	self->sbc.bitpool = bitpool;
+	gst_a2dp_sbc_pay_update_frame(self);
+}
+
+static void gst_a2dp_sbc_pay_bitpool_range(GstA2dpSbcPay *self,
+						GstStructure *structure)
+{
+	const GValue *value;
+
+	value = gst_structure_get_value(structure, "bitpool");
+
+	if (value != NULL && GST_VALUE_HOLDS_INT_RANGE(value)) {
+		self->min_bitpool = gst_value_get_int_range_min(value);
+		self->max_bitpool = gst_value_get_int_range_max(value);
+	} else if (value != NULL && G_VALUE_HOLDS_INT(value)) {
+		self->min_bitpool = g_value_get_int(value);
+		self->max_bitpool = self->min_bitpool;
+	} else {
+		self->min_bitpool = 2;
+		self->max_bitpool = 64;
+	}
+}
+
+/*
+ * Restricts the configurations the encoder may pick, usually to the
+ * capabilities of the remote device.
+ */
+void gst_a2dp_sbc_pay_set_sbc_caps(GstA2dpSbcPay *self, GstCaps *caps)
+{
+	if (self->sbc_caps != NULL)
+		gst_caps_unref(self->sbc_caps);
+
+	self->sbc_caps = caps != NULL ? gst_caps_ref(caps) : NULL;
+}
+
+/*
+ * Picks the SBC configuration for the given raw audio caps and sets up
+ * the encoder. Returns the fixed audio/x-sbc caps, which the caller
+ * uses to configure the stream endpoint, or NULL if nothing matches.
+ */
+GstCaps *gst_a2dp_sbc_pay_configure(GstA2dpSbcPay *self, GstCaps *caps)
+{
+	GstStructure *structure;
+	GstCaps *allowed, *filter, *sbc_caps, *fixed;
+	gchar *error_message = NULL;
+	gint rate, channels;
+
+	structure = gst_caps_get_structure(caps, 0);
+
+	if (!gst_structure_get_int(structure, "rate", &rate))
+		return NULL;
+	if (!gst_structure_get_int(structure, "channels", &channels))
+		return NULL;
+
+	if (self->sbc_caps != NULL)
+		allowed = gst_caps_copy(self->sbc_caps);
+	else
+		allowed = gst_static_caps_get(&gst_a2dp_sbc_pay_sbc_caps);
+
+	filter = gst_caps_new_simple("audio/x-sbc",
+				"rate", G_TYPE_INT, rate,
+				"channels", G_TYPE_INT, channels, NULL);
+
+	sbc_caps = gst_caps_intersect(allowed, filter);
+	gst_caps_unref(filter);
+	gst_caps_unref(allowed);
+
+	if (gst_caps_is_empty(sbc_caps)) {
+		GST_ERROR_OBJECT(self, "No SBC configuration for %d Hz, "
+					"%d channels", rate, channels);
+		gst_caps_unref(sbc_caps);
+		return NULL;
+	}
+
+	gst_a2dp_sbc_pay_bitpool_range(self,
+				gst_caps_get_structure(sbc_caps, 0));
+
+	fixed = gst_sbc_util_caps_fixate(sbc_caps, &error_message);
+	gst_caps_unref(sbc_caps);
+
+	if (fixed == NULL) {
+		GST_ERROR_OBJECT(self, "Couldn't fixate SBC caps: %s",
+							error_message);
+		g_free(error_message);
+		return NULL;
+	}
+
+	if (self->configured)
+		sbc_reinit(&self->sbc, 0);
+	else
+		sbc_init(&self->sbc, 0);
+
+	if (!gst_sbc_util_fill_sbc_params(&self->sbc, fixed)) {
+		GST_ERROR_OBJECT(self, "Invalid SBC caps");
+		sbc_finish(&self->sbc);
+		self->configured = FALSE;
+		gst_caps_unref(fixed);
+		return NULL;
+	}
+
+	self->configured = TRUE;
+	gst_a2dp_sbc_pay_update_frame(self);
+
+	gst_adapter_clear(self->adapter);
+
+	return fixed;
+}
+
+static gboolean gst_a2dp_sbc_pay_set_caps(GstBaseRTPPayload *payload,
+			GstCaps *caps)
+{
+	GstA2dpSbcPay *self = GST_A2DP_SBC_PAY(payload);
+	GstCaps *sbc_caps;
+	gint rate;
+
+	sbc_caps = gst_a2dp_sbc_pay_configure(self, caps);
+	if (sbc_caps == NULL)
+		return FALSE;
+
+	gst_caps_unref(sbc_caps);
+
+	rate = gst_sbc_parse_rate_from_sbc(self->sbc.frequency);
+
+	gst_basertppayload_set_options(payload, "audio", TRUE, "SBC", rate);
+
+	return gst_basertppayload_set_outcaps(payload, NULL);
+}
+
+/*
+ * Encodes the frames straight into the payload of a single RTP buffer,
+ * which is the only allocation made per packet.
+ */
+static GstFlowReturn gst_a2dp_sbc_pay_push_packet(GstA2dpSbcPay *self,
+							guint frame_count)
+{
+	struct rtp_payload *header;
+	GstBuffer *outbuf;
+	GstClockTime duration;
+	guint8 *data;
+	guint i, len = 0;
+
+	outbuf = gst_rtp_buffer_new_allocate(RTP_SBC_PAYLOAD_HEADER_SIZE +
+				frame_count * self->frame_length, 0, 0);
+
+	gst_rtp_buffer_set_payload_type(outbuf,
+			GST_BASE_RTP_PAYLOAD_PT(self));
+
+	data = gst_rtp_buffer_get_payload(outbuf);
+	header = (struct rtp_payload *) data;
+	memset(header, 0, sizeof(*header));
+	header->frame_count = frame_count;
+	data += RTP_SBC_PAYLOAD_HEADER_SIZE;
+
+	for (i = 0; i < frame_count; i++) {
+		const guint8 *pcm;
+		ssize_t consumed, written;
+
+		pcm = gst_adapter_peek(self->adapter, self->codesize);
+
+		consumed = sbc_encode(&self->sbc, pcm, self->codesize,
+					data + len, self->frame_length,
+					&written);
+		if (consumed <= 0 || written <= 0) {
+			GST_ERROR_OBJECT(self, "Encoding failed");
+			gst_buffer_unref(outbuf);
+			return GST_FLOW_ERROR;
+		}
+
+		gst_adapter_flush(self->adapter, consumed);
+		len += written;
+	}
+
+	gst_rtp_buffer_set_packet_len(outbuf,
+			gst_rtp_buffer_calc_header_len(0) +
+			RTP_SBC_PAYLOAD_HEADER_SIZE + len);
+
+	duration = frame_count * self->frame_duration * GST_USECOND;
+
+	GST_BUFFER_TIMESTAMP(outbuf) = self->timestamp;
+	GST_BUFFER_DURATION(outbuf) = duration;
+
+	if (GST_CLOCK_TIME_IS_VALID(self->timestamp))
+		self->timestamp += duration;
+
+	GST_LOG_OBJECT(self, "Pushing %d frames, %d bytes", frame_count, len);
+
+	return gst_basertppayload_push(GST_BASE_RTP_PAYLOAD(self), outbuf);
+}
+
+static GstFlowReturn gst_a2dp_sbc_pay_handle_buffer(GstBaseRTPPayload *payload,
+			GstBuffer *buffer)
+{
+	GstA2dpSbcPay *self = GST_A2DP_SBC_PAY(payload);
+	GstFlowReturn res = GST_FLOW_OK;
+
+	if (!self->configured) {
+		GST_ERROR_OBJECT(self, "Not negotiated");
+		gst_buffer_unref(buffer);
+		return GST_FLOW_NOT_NEGOTIATED;
+	}
+
+	/* Timestamp of the oldest sample still waiting to be encoded */
+	if (gst_adapter_available(self->adapter) == 0 ||
+			!GST_CLOCK_TIME_IS_VALID(self->timestamp))
+		self->timestamp = GST_BUFFER_TIMESTAMP(buffer);
+
+	gst_adapter_push(self->adapter, buffer);
+
+	while (res == GST_FLOW_OK) {
+		guint frame_count;
+
+		gst_a2dp_sbc_pay_apply_bitpool(self);
+
+		frame_count = gst_a2dp_sbc_pay_get_frame_count(self);
+		if (gst_adapter_available(self->adapter) <
+						frame_count * self->codesize)
+			break;
+
+		res = gst_a2dp_sbc_pay_push_packet(self, frame_count);
+	}
+
+	return res;
+}
+
+static gboolean gst_a2dp_sbc_pay_handle_event(GstPad *pad,
+				GstEvent *event)
+{
+	GstA2dpSbcPay *self = GST_A2DP_SBC_PAY(GST_PAD_PARENT(pad));
+	guint frame_count;
+
+	switch (GST_EVENT_TYPE(event)) {
+	case GST_EVENT_EOS:
+		if (!self->configured)
+			break;
+
+		/* Send out whatever complete frames are left */
+		frame_count = gst_adapter_available(self->adapter) /
+							self->codesize;
+		while (frame_count > 0) {
+			guint count = MIN(frame_count,
+				gst_a2dp_sbc_pay_get_frame_count(self));
+
+			if (gst_a2dp_sbc_pay_push_packet(self, count) !=
+								GST_FLOW_OK)
+				break;
+
+			frame_count -= count;
+		}
+		break;
+	case GST_EVENT_FLUSH_STOP:
+		gst_adapter_clear(self->adapter);
+		self->timestamp = GST_CLOCK_TIME_NONE;
+		break;
+	default:
+		break;
+	}
+
+	return FALSE;
+}
+
+static GstStateChangeReturn gst_a2dp_sbc_pay_change_state(
+			GstElement *element, GstStateChange transition)
+{
+	GstA2dpSbcPay *self = GST_A2DP_SBC_PAY(element);
+	GstStateChangeReturn ret;
+
+	ret = GST_ELEMENT_CLASS(parent_class)->change_state(element,
+								transition);
+
+	switch (transition) {
+	case GST_STATE_CHANGE_PAUSED_TO_READY:
+		gst_adapter_clear(self->adapter);
+		self->timestamp = GST_CLOCK_TIME_NONE;
+
+		if (self->configured) {
+			GST_DEBUG("Finish subband codec");
+			sbc_finish(&self->sbc);
+			self->configured = FALSE;
+		}
+		break;
+	default:
+		break;
+	}
+
+	return ret;
+}
+
+static void gst_a2dp_sbc_pay_base_init(gpointer g_class)
+{
+	GstElementClass *element_class = GST_ELEMENT_CLASS(g_class);
+
+	gst_element_class_add_pad_template(element_class,
+		gst_static_pad_template_get(&gst_a2dp_sbc_pay_sink_factory));
+	gst_element_class_add_pad_template(element_class,
+		gst_static_pad_template_get(&gst_a2dp_sbc_pay_src_factory));
+
+	gst_element_class_set_details(element_class,
+					&gst_a2dp_sbc_pay_details);
+}
+
+static void gst_a2dp_sbc_pay_finalize(GObject *object)
+{
+	GstA2dpSbcPay *self = GST_A2DP_SBC_PAY(object);
+
+	if (self->configured)
+		sbc_finish(&self->sbc);
+
+	if (self->sbc_caps != NULL)
+		gst_caps_unref(self->sbc_caps);
+
+	g_object_unref(self->adapter);
+
+	GST_CALL_PARENT(G_OBJECT_CLASS, finalize, (object));
+}
+
+static void gst_a2dp_sbc_pay_class_init(GstA2dpSbcPayClass *klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	GstBaseRTPPayloadClass *payload_class =
+		GST_BASE_RTP_PAYLOAD_CLASS(klass);
+
+	parent_class = g_type_class_peek_parent(klass);
+
+	gobject_class->finalize = GST_DEBUG_FUNCPTR(
+			gst_a2dp_sbc_pay_finalize);
+	gobject_class->set_property = GST_DEBUG_FUNCPTR(
+			gst_a2dp_sbc_pay_set_property);
+	gobject_class->get_property = GST_DEBUG_FUNCPTR(
+			gst_a2dp_sbc_pay_get_property);
+
+	element_class->change_state = GST_DEBUG_FUNCPTR(
+			gst_a2dp_sbc_pay_change_state);
+
+	payload_class->set_caps = GST_DEBUG_FUNCPTR(
+			gst_a2dp_sbc_pay_set_caps);
+	payload_class->handle_buffer = GST_DEBUG_FUNCPTR(
+			gst_a2dp_sbc_pay_handle_buffer);
+	payload_class->handle_event = GST_DEBUG_FUNCPTR(
+			gst_a2dp_sbc_pay_handle_event);
+
+	/* properties */
+	g_object_class_install_property(G_OBJECT_CLASS(klass),
+		PROP_BITPOOL,
+		g_param_spec_int("bitpool", "Bitpool",
+		"Bitpool used for the next packets, clamped to the "
+		"negotiated range (0 for the negotiated value)",
+		0, 64, DEFAULT_BITPOOL, G_PARAM_READWRITE));
+
+	GST_DEBUG_CATEGORY_INIT(gst_a2dp_sbc_pay_debug, "a2dpsbcpay", 0,
+				"A2DP SBC encoder and payloader");
+}
+
+static void gst_a2dp_sbc_pay_set_property(GObject *object, guint prop_id,
+					const GValue *value, GParamSpec *pspec)
+{
+	GstA2dpSbcPay *self = GST_A2DP_SBC_PAY(object);
+
+	switch (prop_id) {
+	case PROP_BITPOOL:
+		/* Picked up by the streaming thread at the next packet */
+		GST_OBJECT_LOCK(self);
+		self->bitpool = g_value_get_int(value);
+		GST_OBJECT_UNLOCK(self);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void gst_a2dp_sbc_pay_get_property(GObject *object, guint prop_id,
+					GValue *value, GParamSpec *pspec)
+{
+	GstA2dpSbcPay *self = GST_A2DP_SBC_PAY(object);
+
+	switch (prop_id) {
+	case PROP_BITPOOL:
+		GST_OBJECT_LOCK(self);
+		g_value_set_int(value, self->bitpool);
+		GST_OBJECT_UNLOCK(self);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
+		break;
+	}
+}
+
+static void gst_a2dp_sbc_pay_init(GstA2dpSbcPay *self,
+					GstA2dpSbcPayClass *klass)
+{
+	self->adapter = gst_adapter_new();
+	self->timestamp = GST_CLOCK_TIME_NONE;
+	self->sbc_caps = NULL;
+	self->configured = FALSE;
+
+	self->codesize = 0;
+	self->frame_length = 0;
+	self->frame_duration = 0;
+
+	self->bitpool = DEFAULT_BITPOOL;
+	self->min_bitpool = 2;
+	self->max_bitpool = 64;
+}
+
+gboolean gst_a2dp_sbc_pay_plugin_init(GstPlugin *plugin)
+{
+	return gst_element_register(plugin, "a2dpsbcpay", GST_RANK_NONE,
+							GST_TYPE_A2DP_SBC_PAY);
+}
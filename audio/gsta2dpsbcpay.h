@@ -0,0 +1,82 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gst/gst.h>
+#include <gst/rtp/gstbasertppayload.h>
+#include <gst/base/gstadapter.h>
+#include <gst/rtp/gstrtpbuffer.h>
+
+#include "sbc.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_A2DP_SBC_PAY \
+	(gst_a2dp_sbc_pay_get_type())
+#define GST_A2DP_SBC_PAY(obj) \
+	(G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_A2DP_SBC_PAY,\
+		GstA2dpSbcPay))
+#define GST_A2DP_SBC_PAY_CLASS(klass) \
+	(G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_A2DP_SBC_PAY,\
+		GstA2dpSbcPayClass))
+#define GST_IS_A2DP_SBC_PAY(obj) \
+	(G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_A2DP_SBC_PAY))
+#define GST_IS_A2DP_SBC_PAY_CLASS(obj) \
+	(G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_A2DP_SBC_PAY))
+
+typedef struct _GstA2dpSbcPay GstA2dpSbcPay;
+typedef struct _GstA2dpSbcPayClass GstA2dpSbcPayClass;
+
+struct _GstA2dpSbcPay {
+	GstBaseRTPPayload base;
+
+	GstAdapter *adapter;
+	GstClockTime timestamp;
+
+	/* Configurations accepted by the remote device, NULL for any */
+	GstCaps *sbc_caps;
+
+	sbc_t sbc;
+	gboolean configured;
+
+	guint codesize;
+	guint frame_length;
+	guint frame_duration;
+
+	/* Requested bitpool, clamped to the negotiated range */
+	gint bitpool;
+	gint min_bitpool;
+	gint max_bitpool;
+};
+
+struct _GstA2dpSbcPayClass {
+	GstBaseRTPPayloadClass parent_class;
+};
+
+GType gst_a2dp_sbc_pay_get_type(void);
+
+gboolean gst_a2dp_sbc_pay_plugin_init(GstPlugin *plugin);
+
+void gst_a2dp_sbc_pay_set_sbc_caps(GstA2dpSbcPay *self, GstCaps *caps);
+GstCaps *gst_a2dp_sbc_pay_configure(GstA2dpSbcPay *self, GstCaps *caps);
+
+G_END_DECLS
@@ -30,6 +30,7 @@
 
 #include "gstpragma.h"
 #include "gsta2dpsink.h"
+#include "gsta2dpsbcpay.h"
 
 GST_DEBUG_CATEGORY_STATIC(gst_a2dp_sink_debug);
 #define GST_CAT_DEFAULT gst_a2dp_sink_debug
@@ -65,7 +66,14 @@ static GstStaticPadTemplate gst_a2dp_sink_factory =
 				"allocation = (string) { \"snr\", \"loudness\" }, "
 				"bitpool = (int) [ 2, "
 				TEMPLATE_MAX_BITPOOL_STR " ]; "
-				"audio/mpeg"
+				"audio/mpeg; "
+				"audio/x-raw-int, "
+				"rate = (int) { 16000, 32000, 44100, 48000 }, "
+				"channels = (int) [ 1, 2 ], "
+				"endianness = (int) BYTE_ORDER, "
+				"signed = (boolean) true, "
+				"width = (int) 16, "
+				"depth = (int) 16"
 				));
 
 static gboolean gst_a2dp_sink_handle_event(GstPad *pad, GstEvent *event);
@@ -399,6 +407,39 @@ GstCaps *gst_a2dp_sink_get_device_caps(GstA2dpSink *self)
 	return gst_avdtp_sink_get_device_caps(self->sink);
 }
 
+/* Raw audio that a2dpsbcpay can encode for one of the SBC configurations */
+static GstCaps *gst_a2dp_sink_get_raw_caps(GstCaps *sbc_caps)
+{
+	GstCaps *caps = gst_caps_new_empty();
+	guint i;
+
+	for (i = 0; i < gst_caps_get_size(sbc_caps); i++) {
+		GstStructure *sbc = gst_caps_get_structure(sbc_caps, i);
+		const GValue *rate, *channels;
+		GstStructure *raw;
+
+		if (!gst_structure_has_name(sbc, "audio/x-sbc"))
+			continue;
+
+		rate = gst_structure_get_value(sbc, "rate");
+		channels = gst_structure_get_value(sbc, "channels");
+		if (rate == NULL || channels == NULL)
+			continue;
+
+		raw = gst_structure_new("audio/x-raw-int",
+				"endianness", G_TYPE_INT, G_BYTE_ORDER,
+				"signed", G_TYPE_BOOLEAN, TRUE,
+				"width", G_TYPE_INT, 16,
+				"depth", G_TYPE_INT, 16, NULL);
+		gst_structure_set_value(raw, "rate", rate);
+		gst_structure_set_value(raw, "channels", channels);
+
+		gst_caps_append_structure(caps, raw);
+	}
+
+	return caps;
+}
+
 static GstCaps *gst_a2dp_sink_get_caps(GstPad *pad)
 {
 	GstCaps *caps;
@@ -416,6 +457,9 @@ static GstCaps *gst_a2dp_sink_get_caps(GstPad *pad)
 		if (caps == NULL)
 			caps = gst_static_pad_template_get_caps(
 					&gst_a2dp_sink_factory);
+		else
+			gst_caps_append(caps,
+					gst_a2dp_sink_get_raw_caps(caps));
 	}
 	caps_aux = gst_caps_copy(caps);
 	g_object_set(self->capsfilter, "caps", caps_aux, NULL);
@@ -501,6 +545,65 @@ static gboolean gst_a2dp_sink_init_rtp_sbc_element(GstA2dpSink *self)
 	return TRUE;
 }
 
+static gboolean gst_a2dp_sink_init_sbc_pay_element(GstA2dpSink *self)
+{
+	GstElement *rtppay;
+
+	/* if we already have a rtp, we don't need a new one */
+	if (self->rtp != NULL)
+		return TRUE;
+
+	rtppay = gst_a2dp_sink_init_element(self, "a2dpsbcpay", "rtp",
+						self->capsfilter);
+	if (rtppay == NULL)
+		return FALSE;
+
+	self->rtp = GST_BASE_RTP_PAYLOAD(rtppay);
+
+	gst_element_set_state(rtppay, GST_STATE_PAUSED);
+
+	return TRUE;
+}
+
+/*
+ * Lets a2dpsbcpay pick the SBC configuration for raw input among the
+ * device capabilities and configures the endpoint with it. The stream
+ * is set up for the whole bitpool range below the chosen value, so the
+ * encoder may lower it later on.
+ */
+static gboolean gst_a2dp_sink_set_sbc_pay_caps(GstA2dpSink *self,
+						GstCaps *caps)
+{
+	GstA2dpSbcPay *pay = GST_A2DP_SBC_PAY(self->rtp);
+	GstCaps *dev_caps, *sbc_caps;
+	gboolean ret;
+
+	dev_caps = gst_avdtp_sink_get_device_caps(self->sink);
+	gst_a2dp_sbc_pay_set_sbc_caps(pay, dev_caps);
+	if (dev_caps != NULL)
+		gst_caps_unref(dev_caps);
+
+	sbc_caps = gst_a2dp_sbc_pay_configure(pay, caps);
+	if (sbc_caps == NULL)
+		return FALSE;
+
+	if (pay->min_bitpool < pay->sbc.bitpool) {
+		GValue value = { 0 };
+
+		g_value_init(&value, GST_TYPE_INT_RANGE);
+		gst_value_set_int_range(&value, pay->min_bitpool,
+							pay->sbc.bitpool);
+		gst_structure_set_value(gst_caps_get_structure(sbc_caps, 0),
+							"bitpool", &value);
+		g_value_unset(&value);
+	}
+
+	ret = gst_avdtp_sink_set_device_caps(self->sink, sbc_caps);
+	gst_caps_unref(sbc_caps);
+
+	return ret;
+}
+
 static gboolean gst_a2dp_sink_init_rtp_mpeg_element(GstA2dpSink *self)
 {
 	GstElement *rtppay;
@@ -549,6 +652,10 @@ static gboolean gst_a2dp_sink_init_dynamic_elements(GstA2dpSink *self,
 		GST_LOG_OBJECT(self, "mp3 media received");
 		if (!gst_a2dp_sink_init_rtp_mpeg_element(self))
 			return FALSE;
+	} else if (gst_structure_has_name(structure, "audio/x-raw-int")) {
+		GST_LOG_OBJECT(self, "raw audio received");
+		if (!gst_a2dp_sink_init_sbc_pay_element(self))
+			return FALSE;
 	} else {
 		GST_ERROR_OBJECT(self, "Unexpected media type");
 		return FALSE;
@@ -578,7 +685,10 @@ static gboolean gst_a2dp_sink_init_dynamic_elements(GstA2dpSink *self,
 		g_free(mode);
 	}
 
-	if (!gst_avdtp_sink_set_device_caps(self->sink, caps))
+	if (GST_IS_A2DP_SBC_PAY(self->rtp)) {
+		if (!gst_a2dp_sink_set_sbc_pay_caps(self, caps))
+			return FALSE;
+	} else if (!gst_avdtp_sink_set_device_caps(self->sink, caps))
 		return FALSE;
 
 	g_object_set(G_OBJECT(self->rtp), "mtu",
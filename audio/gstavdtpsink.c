@@ -25,8 +25,12 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -56,6 +60,10 @@ GST_DEBUG_CATEGORY_STATIC(avdtp_sink_debug);
 
 #define DEFAULT_AUTOCONNECT TRUE
 
+/* Scatter entries per RTP packet and packets per sendmmsg() call */
+#define MAX_PACKET_IOV 8
+#define MAX_BATCH_PACKETS 16
+
 #define GST_AVDTP_SINK_MUTEX_LOCK(s) G_STMT_START {	\
 		g_mutex_lock(s->sink_lock);		\
 	} G_STMT_END
@@ -397,7 +405,12 @@ static gboolean gst_avdtp_sink_init_sbc_pkt_conf(GstAvdtpSink *sink,
 	}
 
 	value = gst_structure_get_value(structure, "bitpool");
-	cfg->max_bitpool = cfg->min_bitpool = g_value_get_int(value);
+	if (GST_VALUE_HOLDS_INT_RANGE(value)) {
+		/* The encoder may change the bitpool within the range */
+		cfg->min_bitpool = gst_value_get_int_range_min(value);
+		cfg->max_bitpool = gst_value_get_int_range_max(value);
+	} else
+		cfg->max_bitpool = cfg->min_bitpool = g_value_get_int(value);
 
 	memcpy(pkt, cfg, sizeof(*pkt));
 
@@ -1738,6 +1751,148 @@ static GstFlowReturn gst_avdtp_sink_render(GstBaseSink *basesink,
 	return GST_FLOW_OK;
 }
 
+struct avdtp_sink_batch {
+	struct mmsghdr msgs[MAX_BATCH_PACKETS];
+	struct iovec iov[MAX_BATCH_PACKETS][MAX_PACKET_IOV];
+	GstBuffer *merged[MAX_BATCH_PACKETS];
+	unsigned int count;
+};
+
+static int batch_send_one(int fd, struct msghdr *msg)
+{
+	while (sendmsg(fd, msg, 0) < 0) {
+		if (errno != EINTR)
+			return -errno;
+	}
+
+	return 0;
+}
+
+static int batch_flush(int fd, struct avdtp_sink_batch *batch)
+{
+	unsigned int i, sent = 0;
+	int err = 0;
+
+	while (sent < batch->count) {
+		int ret;
+
+		ret = sendmmsg(fd, batch->msgs + sent, batch->count - sent, 0);
+		if (ret >= 0) {
+			sent += ret;
+			continue;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		if (errno != ENOSYS) {
+			err = -errno;
+			break;
+		}
+
+		/* Kernel without sendmmsg(), one packet per syscall */
+		for (; sent < batch->count; sent++) {
+			err = batch_send_one(fd, &batch->msgs[sent].msg_hdr);
+			if (err < 0)
+				break;
+		}
+
+		break;
+	}
+
+	for (i = 0; i < batch->count; i++) {
+		if (batch->merged[i] != NULL)
+			gst_buffer_unref(batch->merged[i]);
+		batch->merged[i] = NULL;
+	}
+
+	batch->count = 0;
+
+	return err;
+}
+
+static void batch_add(struct avdtp_sink_batch *batch,
+				GstBufferListIterator *it, guint n_buffers)
+{
+	struct mmsghdr *mmsg = &batch->msgs[batch->count];
+	struct iovec *iov = batch->iov[batch->count];
+	GstBuffer *buf;
+	guint n = 0;
+
+	memset(mmsg, 0, sizeof(*mmsg));
+
+	/* Groups with too many fragments are flattened into one buffer,
+	 * which is only kept alive until the batch has been sent */
+	if (n_buffers > MAX_PACKET_IOV) {
+		buf = gst_buffer_list_iterator_merge_group(it);
+		batch->merged[batch->count] = buf;
+
+		iov[0].iov_base = GST_BUFFER_DATA(buf);
+		iov[0].iov_len = GST_BUFFER_SIZE(buf);
+		n = 1;
+	} else {
+		while ((buf = gst_buffer_list_iterator_next(it)) != NULL) {
+			if (GST_BUFFER_SIZE(buf) == 0)
+				continue;
+
+			iov[n].iov_base = GST_BUFFER_DATA(buf);
+			iov[n].iov_len = GST_BUFFER_SIZE(buf);
+			n++;
+		}
+	}
+
+	mmsg->msg_hdr.msg_iov = iov;
+	mmsg->msg_hdr.msg_iovlen = n;
+
+	batch->count++;
+}
+
+static GstFlowReturn gst_avdtp_sink_render_list(GstBaseSink *basesink,
+						GstBufferList *list)
+{
+	GstAvdtpSink *self = GST_AVDTP_SINK(basesink);
+	struct avdtp_sink_batch batch;
+	GstBufferListIterator *it;
+	int fd, err = 0;
+
+	fd = g_io_channel_unix_get_fd(self->stream);
+
+	memset(batch.merged, 0, sizeof(batch.merged));
+	batch.count = 0;
+
+	/* Each group is one RTP packet (header plus payload sub-buffers),
+	 * sent as a single L2CAP frame straight from the buffer memory */
+	it = gst_buffer_list_iterate(list);
+
+	while (gst_buffer_list_iterator_next_group(it)) {
+		guint n_buffers = gst_buffer_list_iterator_n_buffers(it);
+
+		if (n_buffers == 0)
+			continue;
+
+		batch_add(&batch, it, n_buffers);
+
+		if (batch.count == MAX_BATCH_PACKETS) {
+			err = batch_flush(fd, &batch);
+			if (err < 0)
+				break;
+		}
+	}
+
+	gst_buffer_list_iterator_free(it);
+
+	if (err == 0 && batch.count > 0)
+		err = batch_flush(fd, &batch);
+
+	if (err < 0) {
+		GST_ERROR_OBJECT(self, "Error while writting to socket: %s",
+							strerror(-err));
+		return GST_FLOW_ERROR;
+	}
+
+	return GST_FLOW_OK;
+}
+
 static gboolean gst_avdtp_sink_unlock(GstBaseSink *basesink)
 {
 	GstAvdtpSink *self = GST_AVDTP_SINK(basesink);
@@ -1785,6 +1940,8 @@ static void gst_avdtp_sink_class_init(GstAvdtpSinkClass *klass)
 	basesink_class->stop = GST_DEBUG_FUNCPTR(gst_avdtp_sink_stop);
 	basesink_class->render = GST_DEBUG_FUNCPTR(
 					gst_avdtp_sink_render);
+	basesink_class->render_list = GST_DEBUG_FUNCPTR(
+					gst_avdtp_sink_render_list);
 	basesink_class->preroll = GST_DEBUG_FUNCPTR(
 					gst_avdtp_sink_preroll);
 	basesink_class->unlock = GST_DEBUG_FUNCPTR(
@@ -38,6 +38,7 @@
 #include "gstavdtpsink.h"
 #include "gsta2dpsink.h"
 #include "gstrtpsbcpay.h"
+#include "gsta2dpsbcpay.h"
 
 static GstStaticCaps sbc_caps = GST_STATIC_CAPS("audio/x-sbc");
 
@@ -99,6 +100,9 @@ static gboolean plugin_init(GstPlugin *plugin)
 	if (!gst_rtp_sbc_pay_plugin_init(plugin))
 		return FALSE;
 
+	if (!gst_a2dp_sbc_pay_plugin_init(plugin))
+		return FALSE;
+
 	return TRUE;
 }
 
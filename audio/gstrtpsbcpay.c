@@ -165,8 +165,9 @@ static GstFlowReturn gst_rtp_sbc_pay_flush_buffers(GstRtpSBCPay *sbcpay)
 {
 	guint available;
 	guint max_payload;
-	GstBuffer *outbuf;
-	guint8 *payload_data;
+	GstBufferList *list;
+	GstBufferListIterator *it;
+	GstBuffer *outbuf, *header, *frames;
 	guint frame_count;
 	guint payload_length;
 	struct rtp_payload *payload;
@@ -188,25 +189,33 @@ static GstFlowReturn gst_rtp_sbc_pay_flush_buffers(GstRtpSBCPay *sbcpay)
 	if (payload_length == 0) /* Nothing to send */
 		return GST_FLOW_OK;
 
-	outbuf = gst_rtp_buffer_new_allocate(payload_length +
-			RTP_SBC_PAYLOAD_HEADER_SIZE, 0, 0);
+	outbuf = gst_rtp_buffer_new_allocate(0, 0, 0);
 
 	gst_rtp_buffer_set_payload_type(outbuf,
 			GST_BASE_RTP_PAYLOAD_PT(sbcpay));
 
-	payload_data = gst_rtp_buffer_get_payload(outbuf);
-	payload = (struct rtp_payload *) payload_data;
+	header = gst_buffer_new_and_alloc(RTP_SBC_PAYLOAD_HEADER_SIZE);
+	payload = (struct rtp_payload *) GST_BUFFER_DATA(header);
 	memset(payload, 0, sizeof(struct rtp_payload));
 	payload->frame_count = frame_count;
 
-	gst_adapter_copy(sbcpay->adapter, payload_data +
-			RTP_SBC_PAYLOAD_HEADER_SIZE, 0, payload_length);
-	gst_adapter_flush(sbcpay->adapter, payload_length);
+	/* A sub-buffer of the encoder output when the frames are in one
+	 * buffer, so they reach the sink without being copied */
+	frames = gst_adapter_take_buffer(sbcpay->adapter, payload_length);
 
 	GST_BUFFER_TIMESTAMP(outbuf) = sbcpay->timestamp;
 	GST_DEBUG_OBJECT(sbcpay, "Pushing %d bytes", payload_length);
 
-	return gst_basertppayload_push(GST_BASE_RTP_PAYLOAD(sbcpay), outbuf);
+	list = gst_buffer_list_new();
+	it = gst_buffer_list_iterate(list);
+	gst_buffer_list_iterator_add_group(it);
+	gst_buffer_list_iterator_add(it, outbuf);
+	gst_buffer_list_iterator_add(it, header);
+	gst_buffer_list_iterator_add(it, frames);
+	gst_buffer_list_iterator_free(it);
+
+	return gst_basertppayload_push_list(GST_BASE_RTP_PAYLOAD(sbcpay),
+									list);
 }
 
 static GstFlowReturn gst_rtp_sbc_pay_handle_buffer(GstBaseRTPPayload *payload,
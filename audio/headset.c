@@ -37,6 +37,7 @@
 #include <getopt.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <assert.h>
 
 #include <bluetooth/bluetooth.h>
@@ -65,6 +66,16 @@
 
 #define BUF_SIZE 1024
 
+/* Limits of the per connection output queue */
+#define MAX_OUTPUT_SIZE 4096
+#define MAX_OUTPUT_IOV 16
+
+/* Queued responses with the same key supersede each other */
+#define RSP_KEY_NONE 0
+#define RSP_KEY_RING 1
+#define RSP_KEY_CLIP 2
+#define RSP_KEY_CIEV 16		/* Plus the indicator index */
+
 #define HEADSET_GAIN_SPEAKER 'S'
 #define HEADSET_GAIN_MICROPHONE 'M'
 
@@ -132,9 +143,10 @@ struct pending_connect {
 };
 
 struct headset_slc {
-	char buf[BUF_SIZE];
-	int data_start;
-	int data_length;
+	char buf[BUF_SIZE];		/* Ring buffer of received data */
+	unsigned int data_start;
+	unsigned int data_length;
+	unsigned int scanned;		/* Bytes known not to contain '\r' */
 
 	gboolean cli_active;
 	gboolean cme_enabled;
@@ -161,6 +173,11 @@ struct headset {
 	GIOChannel *sco;
 	guint sco_id;
 
+	GSList *out_queue;	/* Elements of type struct headset_rsp * */
+	size_t out_size;	/* Bytes in out_queue */
+	size_t out_offset;	/* Bytes of the first element written */
+	guint out_id;
+
 	gboolean auto_dc;
 
 	guint dc_timer;
@@ -177,11 +194,20 @@ struct headset {
 	GSList *nrec_cbs;
 };
 
+struct headset_rsp {
+	int key;
+	size_t len;
+	char data[0];
+};
+
 struct event {
 	const char *cmd;
 	int (*callback) (struct audio_device *device, const char *buf);
 };
 
+/* Longest extended command name after "AT+" in event_callbacks */
+#define MAX_CMD_NAME 16
+
 static GSList *headset_callbacks = NULL;
 
 static void error_connect_failed(DBusConnection *conn, DBusMessage *msg,
@@ -286,11 +312,167 @@ static const char *state2str(headset_state_t state)
 	return NULL;
 }
 
+static int rsp_get_key(const char *rsp)
+{
+	if (strcmp(rsp, "\r\nRING\r\n") == 0)
+		return RSP_KEY_RING;
+
+	if (strncmp(rsp, "\r\n+CLIP:", 8) == 0)
+		return RSP_KEY_CLIP;
+
+	if (strncmp(rsp, "\r\n+CIEV: ", 9) == 0)
+		return RSP_KEY_CIEV + atoi(rsp + 9);
+
+	return RSP_KEY_NONE;
+}
+
+static void headset_clear_output(struct headset *hs)
+{
+	if (hs->out_id) {
+		g_source_remove(hs->out_id);
+		hs->out_id = 0;
+	}
+
+	g_slist_free_full(hs->out_queue, g_free);
+	hs->out_queue = NULL;
+	hs->out_size = 0;
+	hs->out_offset = 0;
+}
+
+/*
+ * Writes as much of the queued responses as the socket takes without
+ * blocking, several of them with a single call.
+ */
+static int headset_flush(struct headset *hs)
+{
+	struct iovec iov[MAX_OUTPUT_IOV];
+	struct msghdr msg;
+	ssize_t written;
+	GSList *l;
+	int fd, n;
+
+	for (l = hs->out_queue, n = 0; l && n < MAX_OUTPUT_IOV;
+						l = l->next, n++) {
+		struct headset_rsp *rsp = l->data;
+		size_t offset = n == 0 ? hs->out_offset : 0;
+
+		iov[n].iov_base = rsp->data + offset;
+		iov[n].iov_len = rsp->len - offset;
+	}
+
+	if (n == 0)
+		return 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = n;
+
+	fd = g_io_channel_unix_get_fd(hs->rfcomm);
+
+	written = sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (written < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return 0;
+		return -errno;
+	}
+
+	hs->out_size -= written;
+
+	while (written > 0) {
+		struct headset_rsp *rsp = hs->out_queue->data;
+		size_t left = rsp->len - hs->out_offset;
+
+		if ((size_t) written < left) {
+			hs->out_offset += written;
+			break;
+		}
+
+		written -= left;
+		hs->out_offset = 0;
+		hs->out_queue = g_slist_remove(hs->out_queue, rsp);
+		g_free(rsp);
+	}
+
+	return 0;
+}
+
+static gboolean rfcomm_out_cb(GIOChannel *chan, GIOCondition cond,
+							struct headset *hs)
+{
+	int err;
+
+	if (cond & G_IO_NVAL)
+		return FALSE;
+
+	/* Disconnection is handled by the read watch */
+	if (cond & (G_IO_ERR | G_IO_HUP))
+		goto done;
+
+	err = headset_flush(hs);
+	if (err < 0) {
+		error("headset_send: %s (%d)", strerror(-err), -err);
+		goto done;
+	}
+
+	if (hs->out_queue != NULL)
+		return TRUE;
+
+done:
+	hs->out_id = 0;
+	return FALSE;
+}
+
+/*
+ * Queues a response for the next time the socket is writable. An
+ * unsent RING, +CLIP or +CIEV for the same indicator is dropped in
+ * favour of the new one, so a slow link only ever gets the latest
+ * state and indicators still arrive in the order they changed.
+ */
+static int headset_queue_rsp(struct headset *hs, const char *data,
+								size_t len)
+{
+	struct headset_rsp *rsp;
+	int key = rsp_get_key(data);
+	GSList *l;
+
+	for (l = hs->out_queue; l && key != RSP_KEY_NONE; l = l->next) {
+		rsp = l->data;
+
+		/* The head may already be partially written */
+		if (rsp->key != key || (l == hs->out_queue && hs->out_offset))
+			continue;
+
+		hs->out_size -= rsp->len;
+		hs->out_queue = g_slist_remove(hs->out_queue, rsp);
+		g_free(rsp);
+		break;
+	}
+
+	if (hs->out_size + len > MAX_OUTPUT_SIZE) {
+		error("headset_send: output queue full, dropping response");
+		return -ENOBUFS;
+	}
+
+	rsp = g_malloc(sizeof(*rsp) + len);
+	rsp->key = key;
+	rsp->len = len;
+	memcpy(rsp->data, data, len);
+
+	hs->out_queue = g_slist_append(hs->out_queue, rsp);
+	hs->out_size += len;
+
+	if (!hs->out_id)
+		hs->out_id = g_io_add_watch(hs->rfcomm,
+					G_IO_OUT | G_IO_ERR | G_IO_HUP,
+					(GIOFunc) rfcomm_out_cb, hs);
+
+	return 0;
+}
+
 static int headset_send_valist(struct headset *hs, char *format, va_list ap)
 {
 	char rsp[BUF_SIZE];
-	ssize_t total_written, count;
-	int fd;
+	int count;
 
 	count = vsnprintf(rsp, sizeof(rsp), format, ap);
 
@@ -302,21 +484,8 @@ static int headset_send_valist(struct headset *hs, char *format, va_list ap)
 		return -EIO;
 	}
 
-	total_written = 0;
-	fd = g_io_channel_unix_get_fd(hs->rfcomm);
-
-	while (total_written < count) {
-		ssize_t written;
-
-		written = write(fd, rsp + total_written,
-				count - total_written);
-		if (written < 0)
-			return -errno;
-
-		total_written += written;
-	}
-
-	return 0;
+	return headset_queue_rsp(hs, rsp, MIN((size_t) count,
+							sizeof(rsp) - 1));
 }
 
 static int __attribute__((format(printf, 2, 3)))
@@ -1596,53 +1765,86 @@ static int apple_command(struct audio_device *device, const char *buf)
 	return telephony_generic_rsp(device, CME_ERROR_NONE);
 }
 
+/* Extended commands by their name after "AT+", sorted for bsearch() */
 static struct event event_callbacks[] = {
-	{ "ATA", answer_call },
-	{ "ATD", dial_number },
-	{ "AT+VG", signal_gain_setting },
-	{ "AT+BRSF", supported_features },
-	{ "AT+CIND", report_indicators },
-	{ "AT+CMER", event_reporting },
-	{ "AT+CHLD", call_hold },
-	{ "AT+CHUP", terminate_call },
-	{ "AT+CKPD", key_press },
-	{ "AT+CLIP", cli_notification },
-	{ "AT+BTRH", response_and_hold },
-	{ "AT+BLDN", last_dialed_number },
-	{ "AT+VTS", dtmf_tone },
-	{ "AT+CNUM", subscriber_number },
-	{ "AT+CLCC", list_current_calls },
-	{ "AT+CMEE", extended_errors },
-	{ "AT+CCWA", call_waiting_notify },
-	{ "AT+COPS", operator_selection },
-	{ "AT+NREC", nr_and_ec },
-	{ "AT+BVRA", voice_dial },
-	{ "AT+XAPL", apple_command },
-	{ "AT+IPHONEACCEV", apple_command },
+	{ "BLDN", last_dialed_number },
+	{ "BRSF", supported_features },
+	{ "BTRH", response_and_hold },
+	{ "BVRA", voice_dial },
 #ifdef __TIZEN_PATCH__
-	{ "AT+CPBS", select_phonebook_memory },
-	{ "AT+CPBR", read_phonebook_entries},
-	{ "AT+CPBF", find_phonebook_entires },
-	{ "AT+CPMS", preffered_message_storage },
-	{ "AT+CSCS", select_character_set },
-	{ "AT+CSQ", get_signal_quality },
-	{ "AT+CBC", get_battery_charge_status },
+	{ "CBC", get_battery_charge_status },
 #endif
-	{ 0 }
+	{ "CCWA", call_waiting_notify },
+	{ "CHLD", call_hold },
+	{ "CHUP", terminate_call },
+	{ "CIND", report_indicators },
+	{ "CKPD", key_press },
+	{ "CLCC", list_current_calls },
+	{ "CLIP", cli_notification },
+	{ "CMEE", extended_errors },
+	{ "CMER", event_reporting },
+	{ "CNUM", subscriber_number },
+	{ "COPS", operator_selection },
+#ifdef __TIZEN_PATCH__
+	{ "CPBF", find_phonebook_entires },
+	{ "CPBR", read_phonebook_entries },
+	{ "CPBS", select_phonebook_memory },
+	{ "CPMS", preffered_message_storage },
+	{ "CSCS", select_character_set },
+	{ "CSQ", get_signal_quality },
+#endif
+	{ "IPHONEACCEV", apple_command },
+	{ "NREC", nr_and_ec },
+	{ "VGM", signal_gain_setting },
+	{ "VGS", signal_gain_setting },
+	{ "VTS", dtmf_tone },
+	{ "XAPL", apple_command },
 };
 
+static int event_cmp(const void *a, const void *b)
+{
+	const struct event *ev = b;
+
+	return strcmp(a, ev->cmd);
+}
+
 static int handle_event(struct audio_device *device, const char *buf)
 {
+	char name[MAX_CMD_NAME + 1];
 	struct event *ev;
+	size_t len;
 
 	DBG("Received %s", buf);
 
-	for (ev = event_callbacks; ev->cmd; ev++) {
-		if (!strncmp(buf, ev->cmd, strlen(ev->cmd)))
-			return ev->callback(device, buf);
+	if (strncmp(buf, "AT", 2) != 0)
+		return -EINVAL;
+
+	/* Basic commands are a single letter followed by their argument */
+	switch (buf[2]) {
+	case 'A':
+		return answer_call(device, buf);
+	case 'D':
+		return dial_number(device, buf);
+	case '+':
+		break;
+	default:
+		return -EINVAL;
 	}
 
-	return -EINVAL;
+	/* The name of an extended command ends at '=', '?' or the end */
+	len = strcspn(buf + 3, "=?");
+	if (len == 0 || len > MAX_CMD_NAME)
+		return -EINVAL;
+
+	memcpy(name, buf + 3, len);
+	name[len] = '\0';
+
+	ev = bsearch(name, event_callbacks, G_N_ELEMENTS(event_callbacks),
+					sizeof(struct event), event_cmp);
+	if (ev == NULL)
+		return -EINVAL;
+
+	return ev->callback(device, buf);
 }
 
 static void close_sco(struct audio_device *device)
@@ -1663,15 +1865,43 @@ static void close_sco(struct audio_device *device)
 	}
 }
 
+/*
+ * Looks for the '\r' ending the command at the start of the ring,
+ * resuming after the data already scanned. Returns its index in the
+ * ring and leaves its offset from data_start in scanned, or returns
+ * -1 when the command is still incomplete.
+ */
+static int slc_find_cr(struct headset_slc *slc)
+{
+	while (slc->scanned < slc->data_length) {
+		unsigned int pos, len;
+		char *cr;
+
+		pos = (slc->data_start + slc->scanned) % sizeof(slc->buf);
+		len = MIN(slc->data_length - slc->scanned,
+						sizeof(slc->buf) - pos);
+
+		cr = memchr(&slc->buf[pos], '\r', len);
+		if (cr != NULL) {
+			slc->scanned += cr - &slc->buf[pos];
+			return cr - slc->buf;
+		}
+
+		slc->scanned += len;
+	}
+
+	return -1;
+}
+
 static gboolean rfcomm_io_cb(GIOChannel *chan, GIOCondition cond,
 				struct audio_device *device)
 {
 	struct headset *hs;
 	struct headset_slc *slc;
-	unsigned char buf[BUF_SIZE];
+	struct iovec iov[2];
+	unsigned int end, free_space;
 	ssize_t bytes_read;
-	size_t free_space;
-	int fd;
+	int fd, cr;
 
 	if (cond & G_IO_NVAL)
 		return FALSE;
@@ -1684,61 +1914,69 @@ static gboolean rfcomm_io_cb(GIOChannel *chan, GIOCondition cond,
 		goto failed;
 	}
 
-	fd = g_io_channel_unix_get_fd(chan);
-
-	bytes_read = read(fd, buf, sizeof(buf) - 1);
-	if (bytes_read < 0)
-		return TRUE;
-
-	free_space = sizeof(slc->buf) - slc->data_start -
-			slc->data_length - 1;
-
-	if (free_space < (size_t) bytes_read) {
+	free_space = sizeof(slc->buf) - slc->data_length;
+	if (free_space == 0) {
 		/* Very likely that the HS is sending us garbage so
 		 * just ignore the data and disconnect */
 		error("Too much data to fit incoming buffer");
 		goto failed;
 	}
 
-	memcpy(&slc->buf[slc->data_start], buf, bytes_read);
-	slc->data_length += bytes_read;
+	/* Read straight into the free part of the ring */
+	end = (slc->data_start + slc->data_length) % sizeof(slc->buf);
+	iov[0].iov_base = &slc->buf[end];
+	iov[0].iov_len = MIN(free_space, sizeof(slc->buf) - end);
+	iov[1].iov_base = slc->buf;
+	iov[1].iov_len = free_space - iov[0].iov_len;
 
-	/* Make sure the data is null terminated so we can use string
-	 * functions */
-	slc->buf[slc->data_start + slc->data_length] = '\0';
+	fd = g_io_channel_unix_get_fd(chan);
 
-	while (slc->data_length > 0) {
-		char *cr;
+	bytes_read = readv(fd, iov, iov[1].iov_len > 0 ? 2 : 1);
+	if (bytes_read < 0)
+		return TRUE;
+
+	slc->data_length += bytes_read;
+
+	while ((cr = slc_find_cr(slc)) >= 0) {
+		char line[BUF_SIZE];
+		unsigned int cmd_len = slc->scanned + 1;
+		char *cmd;
 		int err;
-		off_t cmd_len;
 
-		cr = strchr(&slc->buf[slc->data_start], '\r');
-		if (!cr)
-			break;
+		/* Commands are handled in place unless they wrap around */
+		if ((unsigned int) cr >= slc->data_start) {
+			cmd = &slc->buf[slc->data_start];
+		} else {
+			unsigned int head = sizeof(slc->buf) - slc->data_start;
 
-		cmd_len = 1 + (off_t) cr - (off_t) &slc->buf[slc->data_start];
-		*cr = '\0';
+			memcpy(line, &slc->buf[slc->data_start], head);
+			memcpy(line + head, slc->buf, cr);
+			cmd = line;
+		}
+
+		cmd[slc->scanned] = '\0';
 
-		if (cmd_len > 1)
-			err = handle_event(device, &slc->buf[slc->data_start]);
+		if (slc->scanned > 0)
+			err = handle_event(device, cmd);
 		else
 			/* Silently skip empty commands */
 			err = 0;
 
 		if (err == -EINVAL) {
 			error("Badly formated or unrecognized command: %s",
-					&slc->buf[slc->data_start]);
+									cmd);
 			err = telephony_generic_rsp(device,
 						CME_ERROR_NOT_SUPPORTED);
 			if (err < 0)
 				goto failed;
 		} else if (err < 0)
-			error("Error handling command %s: %s (%d)",
-						&slc->buf[slc->data_start],
+			error("Error handling command %s: %s (%d)", cmd,
 						strerror(-err), -err);
 
-		slc->data_start += cmd_len;
+		slc->data_start = (slc->data_start + cmd_len) %
+							sizeof(slc->buf);
 		slc->data_length -= cmd_len;
+		slc->scanned = 0;
 
 		if (!slc->data_length)
 			slc->data_start = 0;
@@ -2598,6 +2836,12 @@ static int headset_close_rfcomm(struct audio_device *dev)
 	struct headset *hs = dev->headset;
 	GIOChannel *rfcomm = hs->tmp_rfcomm ? hs->tmp_rfcomm : hs->rfcomm;
 
+	/* Last chance for queued responses, e.g. the final ERROR */
+	if (hs->rfcomm && hs->out_queue)
+		headset_flush(hs);
+
+	headset_clear_output(hs);
+
 	if (rfcomm) {
 		g_io_channel_shutdown(rfcomm, TRUE, NULL);
 		g_io_channel_unref(rfcomm);
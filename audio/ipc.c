@@ -80,19 +80,24 @@ int bt_audio_service_close(int sk)
 	return close(sk);
 }
 
-int bt_audio_service_get_data_fd(int sk)
+int bt_audio_service_get_data_fds(int sk, int *fds, int count)
 {
-	char cmsg_b[CMSG_SPACE(sizeof(int))], m;
-	int err, ret;
+	char cmsg_b[CMSG_SPACE(sizeof(int) * 2)], m;
+	int err, ret, n;
 	struct iovec iov = { &m, sizeof(m) };
 	struct msghdr msgh;
 	struct cmsghdr *cmsg;
 
+	if (count < 1 || count > 2) {
+		errno = EINVAL;
+		return -1;
+	}
+
 	memset(&msgh, 0, sizeof(msgh));
 	msgh.msg_iov = &iov;
 	msgh.msg_iovlen = 1;
 	msgh.msg_control = &cmsg_b;
-	msgh.msg_controllen = CMSG_LEN(sizeof(int));
+	msgh.msg_controllen = CMSG_LEN(sizeof(int) * count);
 
 	ret = recvmsg(sk, &msgh, 0);
 	if (ret < 0) {
@@ -108,8 +113,11 @@ int bt_audio_service_get_data_fd(int sk)
 			cmsg = CMSG_NXTHDR(&msgh, cmsg)) {
 		if (cmsg->cmsg_level == SOL_SOCKET
 				&& cmsg->cmsg_type == SCM_RIGHTS) {
-			memcpy(&ret, CMSG_DATA(cmsg), sizeof(int));
-			return ret;
+			n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (n > count)
+				n = count;
+			memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * n);
+			return n;
 		}
 	}
 
@@ -117,6 +125,56 @@ int bt_audio_service_get_data_fd(int sk)
 	return -1;
 }
 
+int bt_audio_service_get_data_fd(int sk)
+{
+	int fd;
+
+	if (bt_audio_service_get_data_fds(sk, &fd, 1) < 1)
+		return -1;
+
+	return fd;
+}
+
+uint32_t bt_pcm_ring_avail(struct bt_pcm_ring *ring)
+{
+	uint32_t head, tail;
+
+	head = *(volatile uint32_t *) &ring->head;
+	tail = *(volatile uint32_t *) &ring->tail;
+
+	return head - tail;
+}
+
+uint32_t bt_pcm_ring_write(struct bt_pcm_ring *ring, const void *buf,
+							uint32_t len)
+{
+	uint32_t head, space, offset, chunk;
+
+	head = ring->head;
+
+	space = ring->size - bt_pcm_ring_avail(ring);
+	if (len > space)
+		len = space;
+
+	/* Make sure the consumer is done with the space before reusing it */
+	__sync_synchronize();
+
+	offset = head & (ring->size - 1);
+	chunk = ring->size - offset;
+	if (chunk > len)
+		chunk = len;
+
+	memcpy(ring->data + offset, buf, chunk);
+	memcpy(ring->data, (const uint8_t *) buf + chunk, len - chunk);
+
+	/* Publish the data before moving head */
+	__sync_synchronize();
+
+	*(volatile uint32_t *) &ring->head = head + len;
+
+	return len;
+}
+
 const char *bt_audio_strtype(uint8_t type)
 {
 	if (type >= ARRAY_SIZE(strtypes))
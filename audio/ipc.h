@@ -113,6 +113,8 @@ typedef struct {
 #define BT_CAPABILITIES_ACCESS_MODE_READWRITE	3
 
 #define BT_FLAG_AUTOCONNECT	1
+#define BT_FLAG_PCM_RING	2
+#define BT_FLAG_BROADCAST	4
 
 struct bt_get_capabilities_req {
 	bt_audio_msg_header_t	h;
@@ -265,7 +267,8 @@ struct bt_start_stream_rsp {
 } __attribute__ ((packed));
 
 /* This message is followed by one byte of data containing the stream data fd
-   as ancillary data */
+   as ancillary data. When BT_FLAG_PCM_RING was requested the ancillary data
+   carries the PCM ring fd and its eventfd instead */
 struct bt_new_stream_ind {
 	bt_audio_msg_header_t	h;
 } __attribute__ ((packed));
@@ -336,6 +339,31 @@ struct bt_delay_report_ind {
 	uint16_t		delay;
 } __attribute__ ((packed));
 
+/* PCM ring shared with bluetoothd when BT_FLAG_PCM_RING is requested. The
+ * client writes interleaved 16 bit host endian frames at head and bluetoothd,
+ * which encodes and paces the stream, consumes them at tail. Only the client
+ * moves head and only bluetoothd moves tail; both run freely and are taken
+ * modulo size, which is a power of two. The eventfd is signalled each time
+ * bluetoothd consumed data from the ring.
+ *
+ * A ring has exactly one writer: every client gets its own ring and the
+ * rings feeding the same encoder are mixed. With BT_FLAG_BROADCAST all
+ * streams negotiated with the same SBC configuration share one encoder,
+ * and every packet is sent to each of them. */
+#define BT_PCM_RING_MAGIC		0x50434d52
+
+struct bt_pcm_ring {
+	uint32_t		magic;
+	uint32_t		size;		/* Size of data in bytes */
+	uint32_t		rate;		/* Sampling rate */
+	uint8_t			channels;
+	uint8_t			reserved[3];
+	uint32_t		head;		/* Written by the client */
+	uint32_t		tail;		/* Written by bluetoothd */
+	uint32_t		underruns;	/* Written by bluetoothd */
+	uint8_t			data[0];
+};
+
 /* Function declaration */
 
 /* Opens a connection to the audio service: return a socket descriptor */
@@ -348,6 +376,18 @@ int bt_audio_service_close(int sk);
 BT_STREAMFD_IND message is returned */
 int bt_audio_service_get_data_fd(int sk);
 
+/* Receives up to count stream file descriptors: returns the number of
+descriptors stored in fds */
+int bt_audio_service_get_data_fds(int sk, int *fds, int count);
+
+/* Bytes queued in the PCM ring */
+uint32_t bt_pcm_ring_avail(struct bt_pcm_ring *ring);
+
+/* Copies up to len bytes into the PCM ring: returns the number of bytes
+written */
+uint32_t bt_pcm_ring_write(struct bt_pcm_ring *ring, const void *buf,
+							uint32_t len);
+
 /* Human readable message type string */
 const char *bt_audio_strtype(uint8_t type);
 
@@ -69,6 +69,7 @@
 #include "manager.h"
 #include "sdpd.h"
 #include "telephony.h"
+#include "sco-bridge.h"
 #include "unix.h"
 
 typedef enum {
@@ -102,6 +103,7 @@ struct audio_adapter {
 
 static gboolean auto_connect = TRUE;
 static int max_connected_headsets = 1;
+static gboolean sco_bridge = FALSE;
 static DBusConnection *connection = NULL;
 static GKeyFile *config = NULL;
 static GSList *adapters = NULL;
@@ -1241,6 +1243,12 @@ int audio_manager_init(DBusConnection *conn, GKeyFile *conf,
 	} else
 		max_connected_headsets = i;
 
+	b = g_key_file_get_boolean(config, "General", "SCOBridge", &err);
+	if (err)
+		g_clear_error(&err);
+	else
+		sco_bridge = b;
+
 proceed:
 	if (enabled.socket)
 		unix_init();
@@ -1262,6 +1270,9 @@ proceed:
 
 	btd_register_device_driver(&audio_driver);
 
+	if (sco_bridge && enabled.headset && enabled.gateway)
+		sco_bridge_init();
+
 	*enable_sco = (enabled.gateway || enabled.headset);
 
 	return 0;
@@ -1281,6 +1292,9 @@ void audio_manager_exit(void)
 		config = NULL;
 	}
 
+	if (sco_bridge)
+		sco_bridge_exit();
+
 	if (enabled.socket)
 		unix_exit();
 
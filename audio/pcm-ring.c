@@ -0,0 +1,817 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/sdp.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#include "log.h"
+#include "ipc.h"
+#include "sbc.h"
+#include "rtp.h"
+#include "device.h"
+#include "avdtp.h"
+#include "a2dp.h"
+#include "a2dp-codecs.h"
+#include "pcm-ring.h"
+
+#define PCM_RING_SIZE		65536
+
+#define NSEC_PER_SEC		1000000000ULL
+
+/* Packets overdue by more than this are skipped rather than burst out */
+#define PCM_MAX_LAG		(NSEC_PER_SEC / 10)
+
+/* Packets allowed to queue up on a single link before it gets skipped */
+#define PCM_MAX_BACKLOG		4
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC		0x0001U
+#endif
+
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS		1033
+#define F_SEAL_SEAL		0x0001
+#define F_SEAL_SHRINK		0x0002
+#endif
+
+/* An encoder instance mixing the rings of all its clients. Without
+ * BT_FLAG_BROADCAST it serves one stream; broadcast encoders serve every
+ * stream sharing the same SBC configuration. */
+struct pcm_stream {
+	gboolean broadcast;
+	struct sbc_codec_cap config;
+	sbc_t sbc;
+	uint32_t rate;
+	uint8_t channels;
+	size_t codesize;
+	size_t frame_length;
+	uint16_t mtu;
+	unsigned int frame_count;
+	unsigned int samples;
+	uint16_t seq_num;
+	uint32_t timestamp;
+	int timer_fd;
+	guint timer_id;
+	uint64_t start;
+	uint64_t sent;
+	int16_t *mix;
+	int16_t *pcm;
+	uint8_t *buf;
+	GSList *links;
+	GSList *queues;
+};
+
+/* Transport of a single remote sink */
+struct pcm_link {
+	struct avdtp_stream *stream;
+	int fd;
+	uint16_t mtu;
+	int sndbuf;
+	unsigned int ref;
+	unsigned int drops;
+};
+
+/* Shared memory ring as seen by bluetoothd, one per client since the
+ * ring only supports a single writer */
+struct pcm_queue {
+	struct bt_pcm_ring *shm;
+	size_t shm_size;
+	uint32_t size;
+	uint32_t tail;
+	int fd;
+	int event_fd;
+};
+
+struct pcm_ring {
+	struct pcm_stream *pcm;
+	struct pcm_link *link;
+	struct pcm_queue *queue;
+};
+
+static GSList *streams = NULL;
+
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+/* Split in whole seconds so long running streams don't overflow */
+static uint64_t frames_to_ns(uint64_t frames, uint32_t rate)
+{
+	return frames / rate * NSEC_PER_SEC +
+				frames % rate * NSEC_PER_SEC / rate;
+}
+
+static struct pcm_link *find_link(struct pcm_stream *pcm,
+						struct avdtp_stream *stream)
+{
+	GSList *l;
+
+	for (l = pcm->links; l != NULL; l = l->next) {
+		struct pcm_link *link = l->data;
+
+		if (link->stream == stream)
+			return link;
+	}
+
+	return NULL;
+}
+
+static struct pcm_stream *find_stream(struct avdtp_stream *stream,
+					const struct sbc_codec_cap *config,
+					gboolean broadcast)
+{
+	GSList *l;
+
+	for (l = streams; l != NULL; l = l->next) {
+		struct pcm_stream *pcm = l->data;
+
+		if (pcm->broadcast != broadcast)
+			continue;
+
+		if (broadcast && memcmp(&pcm->config, config,
+						sizeof(*config)) == 0)
+			return pcm;
+
+		if (!broadcast && find_link(pcm, stream))
+			return pcm;
+	}
+
+	return NULL;
+}
+
+static gboolean pcm_stream_setup(struct pcm_stream *pcm)
+{
+	struct sbc_codec_cap *cap = &pcm->config;
+
+	sbc_init(&pcm->sbc, 0);
+
+	switch (cap->frequency) {
+	case SBC_SAMPLING_FREQ_16000:
+		pcm->sbc.frequency = SBC_FREQ_16000;
+		pcm->rate = 16000;
+		break;
+	case SBC_SAMPLING_FREQ_32000:
+		pcm->sbc.frequency = SBC_FREQ_32000;
+		pcm->rate = 32000;
+		break;
+	case SBC_SAMPLING_FREQ_44100:
+		pcm->sbc.frequency = SBC_FREQ_44100;
+		pcm->rate = 44100;
+		break;
+	case SBC_SAMPLING_FREQ_48000:
+		pcm->sbc.frequency = SBC_FREQ_48000;
+		pcm->rate = 48000;
+		break;
+	default:
+		goto failed;
+	}
+
+	switch (cap->channel_mode) {
+	case SBC_CHANNEL_MODE_MONO:
+		pcm->sbc.mode = SBC_MODE_MONO;
+		pcm->channels = 1;
+		break;
+	case SBC_CHANNEL_MODE_DUAL_CHANNEL:
+		pcm->sbc.mode = SBC_MODE_DUAL_CHANNEL;
+		pcm->channels = 2;
+		break;
+	case SBC_CHANNEL_MODE_STEREO:
+		pcm->sbc.mode = SBC_MODE_STEREO;
+		pcm->channels = 2;
+		break;
+	case SBC_CHANNEL_MODE_JOINT_STEREO:
+		pcm->sbc.mode = SBC_MODE_JOINT_STEREO;
+		pcm->channels = 2;
+		break;
+	default:
+		goto failed;
+	}
+
+	pcm->sbc.allocation = cap->allocation_method == SBC_ALLOCATION_SNR ?
+						SBC_AM_SNR : SBC_AM_LOUDNESS;
+
+	pcm->sbc.subbands = cap->subbands == SBC_SUBBANDS_4 ?
+							SBC_SB_4 : SBC_SB_8;
+
+	switch (cap->block_length) {
+	case SBC_BLOCK_LENGTH_4:
+		pcm->sbc.blocks = SBC_BLK_4;
+		break;
+	case SBC_BLOCK_LENGTH_8:
+		pcm->sbc.blocks = SBC_BLK_8;
+		break;
+	case SBC_BLOCK_LENGTH_12:
+		pcm->sbc.blocks = SBC_BLK_12;
+		break;
+	default:
+		pcm->sbc.blocks = SBC_BLK_16;
+		break;
+	}
+
+	pcm->sbc.bitpool = cap->max_bitpool;
+
+	pcm->codesize = sbc_get_codesize(&pcm->sbc);
+	pcm->frame_length = sbc_get_frame_length(&pcm->sbc);
+
+	DBG("rate %u channels %u bitpool %u", pcm->rate, pcm->channels,
+							pcm->sbc.bitpool);
+
+	return TRUE;
+
+failed:
+	sbc_finish(&pcm->sbc);
+	return FALSE;
+}
+
+static int pcm_stream_set_timer(struct pcm_stream *pcm)
+{
+	struct itimerspec ts;
+	uint64_t period;
+
+	period = frames_to_ns(pcm->samples, pcm->rate);
+
+	memset(&ts, 0, sizeof(ts));
+	ts.it_value.tv_sec = period / NSEC_PER_SEC;
+	ts.it_value.tv_nsec = period % NSEC_PER_SEC;
+	ts.it_interval = ts.it_value;
+
+	if (timerfd_settime(pcm->timer_fd, 0, &ts, NULL) < 0)
+		return -errno;
+
+	return 0;
+}
+
+/* Packets are sized for the smallest MTU of all links so the very same
+ * packet can be written to each of them */
+static gboolean pcm_stream_set_mtu(struct pcm_stream *pcm, uint16_t mtu)
+{
+	unsigned int frame_count;
+	size_t len;
+
+	if (pcm->mtu != 0 && pcm->mtu <= mtu)
+		return TRUE;
+
+	frame_count = (mtu - sizeof(struct rtp_header) -
+			sizeof(struct rtp_payload)) / pcm->frame_length;
+	if (frame_count > 15)
+		frame_count = 15;
+
+	if (frame_count == 0)
+		return FALSE;
+
+	pcm->mtu = mtu;
+	pcm->frame_count = frame_count;
+	pcm->samples = frame_count * pcm->codesize / (2 * pcm->channels);
+
+	len = pcm->codesize * frame_count;
+	pcm->mix = g_realloc(pcm->mix, len);
+	pcm->pcm = g_realloc(pcm->pcm, len);
+	pcm->buf = g_realloc(pcm->buf, mtu);
+
+	DBG("%u frames per packet", frame_count);
+
+	if (pcm->timer_fd >= 0 && pcm_stream_set_timer(pcm) < 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static void pcm_queue_signal(struct pcm_queue *queue)
+{
+	uint64_t value = 1;
+
+	if (write(queue->event_fd, &value, sizeof(value)) < 0 &&
+							errno != EAGAIN)
+		error("eventfd write: %s (%d)", strerror(errno), errno);
+}
+
+/* Only the head published by the client is read back from the shared
+ * header, tail and size are kept private so a misbehaving client can't make
+ * us read outside of the ring */
+static uint32_t pcm_queue_read(struct pcm_queue *queue, void *buf,
+					uint32_t len, uint32_t frame_size)
+{
+	struct bt_pcm_ring *shm = queue->shm;
+	uint32_t head, avail, offset, chunk;
+
+	head = *(volatile uint32_t *) &shm->head;
+	avail = head - queue->tail;
+
+	if (avail > queue->size) {
+		error("PCM ring overrun, dropping %u bytes", avail);
+		queue->tail = head;
+		*(volatile uint32_t *) &shm->tail = queue->tail;
+		return 0;
+	}
+
+	if (len > avail)
+		len = avail;
+
+	len -= len % frame_size;
+	if (len == 0)
+		return 0;
+
+	/* Don't read data older than the head we just looked at */
+	__sync_synchronize();
+
+	offset = queue->tail & (queue->size - 1);
+	chunk = queue->size - offset;
+	if (chunk > len)
+		chunk = len;
+
+	memcpy(buf, shm->data + offset, chunk);
+	memcpy((uint8_t *) buf + chunk, shm->data, len - chunk);
+
+	/* Release the space only once it has been copied out */
+	__sync_synchronize();
+
+	queue->tail += len;
+	*(volatile uint32_t *) &shm->tail = queue->tail;
+
+	return len;
+}
+
+/* Sums one packet worth of samples from every ring into pcm->mix. Rings
+ * running short are padded with silence; returns FALSE when none of them
+ * had anything queued. */
+static gboolean pcm_stream_mix(struct pcm_stream *pcm)
+{
+	uint32_t len = pcm->codesize * pcm->frame_count;
+	unsigned int i, count = len / sizeof(int16_t);
+	gboolean mixed = FALSE;
+	GSList *l;
+
+	for (l = pcm->queues; l != NULL; l = l->next) {
+		struct pcm_queue *queue = l->data;
+		int16_t *dst = mixed ? pcm->pcm : pcm->mix;
+		uint32_t n;
+
+		n = pcm_queue_read(queue, dst, len, 2 * pcm->channels);
+		if (n == 0)
+			continue;
+
+		if (n < len) {
+			memset((uint8_t *) dst + n, 0, len - n);
+			queue->shm->underruns++;
+		}
+
+		pcm_queue_signal(queue);
+
+		if (!mixed) {
+			mixed = TRUE;
+			continue;
+		}
+
+		for (i = 0; i < count; i++) {
+			int32_t sample = pcm->mix[i] + pcm->pcm[i];
+
+			if (sample > INT16_MAX)
+				sample = INT16_MAX;
+			else if (sample < INT16_MIN)
+				sample = INT16_MIN;
+
+			pcm->mix[i] = sample;
+		}
+	}
+
+	return mixed;
+}
+
+/* A sink that falls behind only loses its own packets, the others keep
+ * receiving theirs */
+static void pcm_link_send(struct pcm_link *link, const void *buf, size_t len)
+{
+	int space;
+
+	/* Bluetooth sockets report the free send space for TIOCOUTQ */
+	if (link->sndbuf > 0 && ioctl(link->fd, TIOCOUTQ, &space) == 0 &&
+			link->sndbuf - space >= (int) len * PCM_MAX_BACKLOG)
+		goto drop;
+
+	if (send(link->fd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+		return;
+
+	if (errno != EAGAIN) {
+		error("send: %s (%d)", strerror(errno), errno);
+		return;
+	}
+
+drop:
+	link->drops++;
+	DBG("Link %p backlogged, %u packets dropped", link, link->drops);
+}
+
+static void pcm_stream_send(struct pcm_stream *pcm)
+{
+	struct rtp_header *header = (void *) pcm->buf;
+	struct rtp_payload *payload;
+	size_t offset = sizeof(*header) + sizeof(*payload);
+	unsigned int i;
+	GSList *l;
+
+	payload = (void *) (pcm->buf + sizeof(*header));
+
+	memset(pcm->buf, 0, offset);
+	header->v = 2;
+	header->pt = 1;
+	header->sequence_number = htons(pcm->seq_num++);
+	header->timestamp = htonl(pcm->timestamp);
+	header->ssrc = htonl(1);
+	payload->frame_count = pcm->frame_count;
+
+	pcm->timestamp += pcm->samples;
+
+	for (i = 0; i < pcm->frame_count; i++) {
+		ssize_t ret, written = 0;
+
+		ret = sbc_encode(&pcm->sbc,
+				(uint8_t *) pcm->mix + i * pcm->codesize,
+				pcm->codesize, pcm->buf + offset,
+				pcm->mtu - offset, &written);
+		if (ret < 0) {
+			error("SBC encoding error %zd", ret);
+			return;
+		}
+
+		offset += written;
+	}
+
+	for (l = pcm->links; l != NULL; l = l->next)
+		pcm_link_send(l->data, pcm->buf, offset);
+}
+
+static gboolean pcm_stream_tick(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct pcm_stream *pcm = user_data;
+	uint64_t expirations, now, elapsed, due;
+
+	if (cond & (G_IO_ERR | G_IO_HUP | G_IO_NVAL)) {
+		pcm->timer_id = 0;
+		return FALSE;
+	}
+
+	if (read(pcm->timer_fd, &expirations, sizeof(expirations)) < 0)
+		return TRUE;
+
+	now = monotonic_ns();
+	if (pcm->start == 0)
+		pcm->start = now;
+
+	while (TRUE) {
+		elapsed = now - pcm->start;
+		due = frames_to_ns(pcm->sent, pcm->rate);
+
+		if (due > elapsed)
+			break;
+
+		if (elapsed - due > PCM_MAX_LAG)
+			pcm->start = now - due;
+
+		if (!pcm_stream_mix(pcm)) {
+			/* Nothing queued by any client, hold the clock */
+			pcm->start = 0;
+			pcm->sent = 0;
+			break;
+		}
+
+		pcm_stream_send(pcm);
+		pcm->sent += pcm->samples;
+	}
+
+	return TRUE;
+}
+
+static void pcm_stream_free(struct pcm_stream *pcm)
+{
+	streams = g_slist_remove(streams, pcm);
+
+	if (pcm->timer_id > 0)
+		g_source_remove(pcm->timer_id);
+
+	if (pcm->timer_fd >= 0)
+		close(pcm->timer_fd);
+
+	sbc_finish(&pcm->sbc);
+
+	g_free(pcm->mix);
+	g_free(pcm->pcm);
+	g_free(pcm->buf);
+	g_free(pcm);
+}
+
+static struct pcm_stream *pcm_stream_new(const struct sbc_codec_cap *config,
+						gboolean broadcast,
+						uint16_t mtu)
+{
+	struct pcm_stream *pcm;
+	GIOChannel *io;
+
+	pcm = g_new0(struct pcm_stream, 1);
+	pcm->broadcast = broadcast;
+	pcm->config = *config;
+	pcm->timer_fd = -1;
+
+	if (!pcm_stream_setup(pcm)) {
+		error("Unsupported stream configuration");
+		g_free(pcm);
+		return NULL;
+	}
+
+	streams = g_slist_append(streams, pcm);
+
+	if (!pcm_stream_set_mtu(pcm, mtu)) {
+		error("MTU %u too small for stream configuration", mtu);
+		goto failed;
+	}
+
+	pcm->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+						TFD_NONBLOCK | TFD_CLOEXEC);
+	if (pcm->timer_fd < 0) {
+		error("timerfd_create: %s (%d)", strerror(errno), errno);
+		goto failed;
+	}
+
+	if (pcm_stream_set_timer(pcm) < 0) {
+		error("timerfd_settime: %s (%d)", strerror(errno), errno);
+		goto failed;
+	}
+
+	io = g_io_channel_unix_new(pcm->timer_fd);
+	pcm->timer_id = g_io_add_watch(io,
+				G_IO_IN | G_IO_ERR | G_IO_HUP | G_IO_NVAL,
+				pcm_stream_tick, pcm);
+	g_io_channel_unref(io);
+
+	return pcm;
+
+failed:
+	pcm_stream_free(pcm);
+	return NULL;
+}
+
+static struct pcm_link *pcm_link_get(struct pcm_stream *pcm,
+					struct avdtp_stream *stream,
+					int fd, uint16_t mtu)
+{
+	struct pcm_link *link;
+	socklen_t len;
+
+	link = find_link(pcm, stream);
+	if (link != NULL) {
+		link->ref++;
+		return link;
+	}
+
+	if (!pcm_stream_set_mtu(pcm, mtu))
+		return NULL;
+
+	link = g_new0(struct pcm_link, 1);
+	link->stream = stream;
+	link->fd = fd;
+	link->mtu = mtu;
+	link->ref = 1;
+
+	len = sizeof(link->sndbuf);
+	if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &link->sndbuf, &len) < 0)
+		link->sndbuf = 0;
+
+	pcm->links = g_slist_append(pcm->links, link);
+
+	return link;
+}
+
+static void pcm_link_unref(struct pcm_stream *pcm, struct pcm_link *link)
+{
+	if (--link->ref > 0)
+		return;
+
+	pcm->links = g_slist_remove(pcm->links, link);
+
+	if (link->drops > 0)
+		DBG("Link %p dropped %u packets", link, link->drops);
+
+	g_free(link);
+}
+
+static int ring_fd_create(size_t size)
+{
+	static unsigned int id = 0;
+	int fd = -1, err;
+
+#ifdef __NR_memfd_create
+	fd = syscall(__NR_memfd_create, "bluez-pcm-ring",
+					MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+	if (fd < 0) {
+		char name[64];
+
+		snprintf(name, sizeof(name), "/bluez-pcm-ring-%d-%u",
+							getpid(), id++);
+
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+							S_IRUSR | S_IWUSR);
+		if (fd < 0)
+			return -errno;
+
+		shm_unlink(name);
+	}
+
+	if (ftruncate(fd, size) < 0) {
+		err = -errno;
+		close(fd);
+		return err;
+	}
+
+	/* Clients get a writable fd, make sure they can't shrink the ring
+	 * under us */
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL);
+
+	return fd;
+}
+
+static void pcm_queue_free(struct pcm_stream *pcm, struct pcm_queue *queue)
+{
+	pcm->queues = g_slist_remove(pcm->queues, queue);
+
+	if (queue->shm != MAP_FAILED)
+		munmap(queue->shm, queue->shm_size);
+
+	if (queue->fd >= 0)
+		close(queue->fd);
+
+	if (queue->event_fd >= 0)
+		close(queue->event_fd);
+
+	g_free(queue);
+}
+
+static struct pcm_queue *pcm_queue_new(struct pcm_stream *pcm)
+{
+	struct pcm_queue *queue;
+	int err;
+
+	queue = g_new0(struct pcm_queue, 1);
+	queue->size = PCM_RING_SIZE;
+	queue->shm_size = sizeof(struct bt_pcm_ring) + queue->size;
+	queue->shm = MAP_FAILED;
+	queue->event_fd = -1;
+
+	pcm->queues = g_slist_append(pcm->queues, queue);
+
+	queue->fd = ring_fd_create(queue->shm_size);
+	if (queue->fd < 0) {
+		err = -queue->fd;
+		goto failed;
+	}
+
+	queue->shm = mmap(NULL, queue->shm_size, PROT_READ | PROT_WRITE,
+						MAP_SHARED, queue->fd, 0);
+	if (queue->shm == MAP_FAILED) {
+		err = errno;
+		goto failed;
+	}
+
+	queue->shm->magic = BT_PCM_RING_MAGIC;
+	queue->shm->size = queue->size;
+	queue->shm->rate = pcm->rate;
+	queue->shm->channels = pcm->channels;
+
+	queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (queue->event_fd < 0) {
+		err = errno;
+		goto failed;
+	}
+
+	return queue;
+
+failed:
+	error("Unable to create PCM ring: %s (%d)", strerror(err), err);
+	pcm_queue_free(pcm, queue);
+	return NULL;
+}
+
+struct pcm_ring *pcm_ring_new(struct avdtp_stream *stream, int fd,
+					uint16_t mtu, gboolean broadcast)
+{
+	struct avdtp_service_capability *service;
+	struct sbc_codec_cap *config;
+	struct pcm_stream *pcm;
+	struct pcm_ring *ring;
+
+	service = avdtp_stream_get_codec(stream);
+	if (service == NULL)
+		return NULL;
+
+	config = (struct sbc_codec_cap *) service->data;
+	if (config->cap.media_codec_type != A2DP_CODEC_SBC ||
+			service->length < sizeof(*config))
+		return NULL;
+
+	pcm = find_stream(stream, config, broadcast);
+	if (pcm == NULL)
+		pcm = pcm_stream_new(config, broadcast, mtu);
+
+	if (pcm == NULL)
+		return NULL;
+
+	ring = g_new0(struct pcm_ring, 1);
+	ring->pcm = pcm;
+
+	ring->link = pcm_link_get(pcm, stream, fd, mtu);
+	if (ring->link == NULL)
+		goto failed;
+
+	ring->queue = pcm_queue_new(pcm);
+	if (ring->queue == NULL)
+		goto failed;
+
+	DBG("PCM ring %p attached to stream %p (%u links, %u rings)", ring,
+			stream, g_slist_length(pcm->links),
+			g_slist_length(pcm->queues));
+
+	return ring;
+
+failed:
+	pcm_ring_free(ring);
+	return NULL;
+}
+
+void pcm_ring_free(struct pcm_ring *ring)
+{
+	struct pcm_stream *pcm = ring->pcm;
+
+	if (ring->queue)
+		pcm_queue_free(pcm, ring->queue);
+
+	if (ring->link)
+		pcm_link_unref(pcm, ring->link);
+
+	g_free(ring);
+
+	if (pcm->links == NULL)
+		pcm_stream_free(pcm);
+}
+
+int pcm_ring_get_fd(struct pcm_ring *ring)
+{
+	return ring->queue->fd;
+}
+
+int pcm_ring_get_event_fd(struct pcm_ring *ring)
+{
+	return ring->queue->event_fd;
+}
@@ -28,7 +28,11 @@
 
 #include <stdint.h>
 #include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <time.h>
 #include <sys/time.h>
 #include <pthread.h>
@@ -46,10 +50,6 @@
 
 /* #define ENABLE_DEBUG */
 
-#define UINT_SECS_MAX (UINT_MAX / 1000000 - 1)
-
-#define MIN_PERIOD_TIME 1
-
 #define BUFFER_SIZE 2048
 
 #ifdef ENABLE_DEBUG
@@ -81,16 +81,34 @@
 #define MAX_BITPOOL 64
 #define MIN_BITPOOL 2
 
-/* adapted from glibc sys/time.h timersub() macro */
-#define priv_timespecsub(a, b, result)					\
-	do {								\
-		(result)->tv_sec = (a)->tv_sec - (b)->tv_sec;		\
-		(result)->tv_nsec = (a)->tv_nsec - (b)->tv_nsec;	\
-		if ((result)->tv_nsec < 0) {				\
-			--(result)->tv_sec;				\
-			(result)->tv_nsec += 1000000000;		\
-		}							\
-	} while (0)
+/*
+ * Adaptive bitpool thresholds. The socket backlog is measured in
+ * link MTUs and includes the kernel's per packet overhead.
+ */
+#define BITPOOL_HIGH_BACKLOG 6
+#define BITPOOL_LOW_BACKLOG 2
+#define BITPOOL_DOWN_STEP 2
+#define BITPOOL_FAIL_STEP 8
+#define BITPOOL_UP_PACKETS 32
+
+#define NSEC_PER_SEC 1000000000ULL
+
+#define RTP_HEADERS_SIZE (sizeof(struct rtp_header) + \
+					sizeof(struct rtp_payload))
+
+/* Audio buffered before capture starts, in ms, reported as sink delay */
+#define DEFAULT_CAPTURE_DELAY 100
+
+/*
+ * Playback keeps the RTP headers here and only the SBC frames in the
+ * queue slot, capture receives whole packets into the slot.
+ */
+struct a2dp_packet {
+	struct rtp_header header;
+	struct rtp_payload payload;
+	unsigned int len;			/* RTP packet length */
+	unsigned int samples;			/* Frames carried by the packet */
+};
 
 struct bluetooth_a2dp {
 	sbc_capabilities_t sbc_capabilities;
@@ -98,12 +116,39 @@ struct bluetooth_a2dp {
 	int sbc_initialized;			/* Keep track if the encoder is initialized */
 	unsigned int codesize;			/* SBC codesize */
 	int samples;				/* Number of encoded samples */
-	uint8_t buffer[BUFFER_SIZE];		/* Codec transfer buffer */
-	unsigned int count;			/* Codec transfer buffer counter */
+	uint8_t *frames;			/* Where the encoder writes to */
+	unsigned int count;			/* Length of packet being encoded */
 
 	int nsamples;				/* Cumulative number of codec samples */
 	uint16_t seq_num;			/* Cumulative packet sequence */
 	int frame_count;			/* Current frames in buffer*/
+
+	uint8_t min_bitpool;			/* Negotiated bitpool range */
+	uint8_t max_bitpool;
+	volatile uint8_t next_bitpool;		/* Bitpool for the next packet */
+	int sndbuf;				/* Socket send buffer size */
+	unsigned int backlog;			/* Bytes queued in the socket */
+	unsigned int backlog_frames;		/* Same in audio frames */
+	unsigned int send_failures;		/* Packets dropped by send */
+	unsigned int stable;			/* Packets sent without backlog */
+
+	pthread_mutex_t lock;			/* Protects the packet queue */
+	pthread_cond_t drained;			/* Signaled when queue is empty */
+	struct a2dp_packet *queue;		/* Packets waiting for their time */
+	uint8_t *queue_data;			/* Slots of link_mtu, plus scratch */
+	unsigned int queue_size;
+	unsigned int queue_head;
+	unsigned int queue_len;
+	uint64_t start;				/* Media clock origin in ns */
+	uint64_t sent;				/* Frames sent since start */
+
+	unsigned int queue_offset;		/* Read position in head packet */
+	unsigned int queued_frames;		/* Received and not yet read */
+	unsigned int held;			/* Received before prefill ended */
+	int primed;				/* Jitter buffer prefilled */
+	uint16_t next_seq;			/* Expected RTP sequence */
+	unsigned int lost;			/* Packets missing in sequence */
+	unsigned int overruns;			/* Packets dropped, queue full */
 };
 
 struct bluetooth_alsa_config {
@@ -123,6 +168,8 @@ struct bluetooth_alsa_config {
 	int has_block_length;
 	uint8_t bitpool;		/* A2DP only */
 	int has_bitpool;
+	int adaptive;			/* A2DP only */
+	uint16_t delay;			/* A2DP capture only */
 	int autoconnect;
 };
 
@@ -139,9 +186,9 @@ struct bluetooth_data {
 	struct bluetooth_a2dp a2dp;			/* A2DP data */
 
 	pthread_t hw_thread;				/* Makes virtual hw pointer move */
-	int pipefd[2];					/* Inter thread communication */
+	int timer_fd;					/* Paces the hw thread */
+	int event_fd;					/* Wakes up the application */
 	int stopped;
-	sig_atomic_t reset;				/* Request XRUN handling */
 };
 
 static int audioservice_send(int sk, const bt_audio_msg_header_t *msg);
@@ -162,101 +209,354 @@ static int bluetooth_stop(snd_pcm_ioplug_t *io)
 	return 0;
 }
 
+static uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static uint64_t frames_to_ns(uint64_t frames, unsigned int rate)
+{
+	return frames / rate * NSEC_PER_SEC +
+				frames % rate * NSEC_PER_SEC / rate;
+}
+
+static uint64_t ns_to_frames(uint64_t ns, unsigned int rate)
+{
+	return ns / NSEC_PER_SEC * rate +
+				ns % NSEC_PER_SEC * rate / NSEC_PER_SEC;
+}
+
+static void timer_set(int fd, uint64_t value, uint64_t interval, int flags)
+{
+	struct itimerspec its;
+
+	its.it_value.tv_sec = value / NSEC_PER_SEC;
+	its.it_value.tv_nsec = value % NSEC_PER_SEC;
+	its.it_interval.tv_sec = interval / NSEC_PER_SEC;
+	its.it_interval.tv_nsec = interval % NSEC_PER_SEC;
+
+	if (timerfd_settime(fd, flags, &its, NULL) < 0)
+		SNDERR("timerfd_settime: %s (%d)", strerror(errno), errno);
+}
+
+static void avdtp_write(struct bluetooth_data *data,
+					struct a2dp_packet *pkt, uint8_t *buf);
+
+/*
+ * Sends every queued packet whose media time has come and arms the
+ * timer for the next one. With nothing to send the media clock is
+ * held, so a late application resumes the stream instead of having
+ * it rushed out to catch up.
+ */
+static void a2dp_pacing_tick(struct bluetooth_data *data)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	unsigned int rate = data->io.rate;
+	uint64_t now, elapsed, next;
+	int moved = 0;
+
+	now = monotonic_ns();
+	elapsed = ns_to_frames(now - a2dp->start, rate);
+
+	pthread_mutex_lock(&a2dp->lock);
+
+	while (!data->stopped && a2dp->queue_len > 0 &&
+						a2dp->sent <= elapsed) {
+		unsigned int head = a2dp->queue_head;
+		struct a2dp_packet *pkt = &a2dp->queue[head];
+
+		/* The slot is not reused before the head moves on */
+		pthread_mutex_unlock(&a2dp->lock);
+		avdtp_write(data, pkt, a2dp->queue_data +
+						head * data->link_mtu);
+		pthread_mutex_lock(&a2dp->lock);
+
+		a2dp->queue_head = (head + 1) % a2dp->queue_size;
+		a2dp->queue_len--;
+		a2dp->sent += pkt->samples;
+
+		data->hw_ptr += pkt->samples;
+		data->hw_ptr %= data->io.buffer_size;
+		moved = 1;
+	}
+
+	if (a2dp->queue_len == 0)
+		pthread_cond_broadcast(&a2dp->drained);
+
+	if ((data->stopped || a2dp->queue_len == 0) && a2dp->sent <= elapsed) {
+		a2dp->start = now - frames_to_ns(a2dp->sent, rate);
+		next = now + frames_to_ns(a2dp->codesize /
+					(data->io.channels * 2), rate);
+	} else
+		next = a2dp->start + frames_to_ns(a2dp->sent, rate);
+
+	pthread_mutex_unlock(&a2dp->lock);
+
+	timer_set(data->timer_fd, next, 0, TFD_TIMER_ABSTIME);
+
+	if (moved && eventfd_write(data->event_fd, 1) < 0)
+		pthread_testcancel();
+}
+
+static void sco_pacing_tick(struct bluetooth_data *data,
+						uint64_t expirations)
+{
+	if (data->stopped)
+		return;
+
+	data->hw_ptr += expirations * data->io.period_size;
+	data->hw_ptr %= data->io.buffer_size;
+
+	/* Notify user that hardware pointer has moved */
+	if (eventfd_write(data->event_fd, 1) < 0)
+		pthread_testcancel();
+}
+
 static void *playback_hw_thread(void *param)
 {
 	struct bluetooth_data *data = param;
-	unsigned int prev_periods;
-	double period_time;
-	struct timespec start;
-	struct pollfd fds[2];
-	int poll_timeout;
+	struct pollfd fds[3];
 
 	data->server.events = POLLIN;
 	/* note: only errors for data->stream.events */
 
-	fds[0] = data->server;
-	fds[1] = data->stream;
+	fds[0].fd = data->timer_fd;
+	fds[0].events = POLLIN;
+	fds[1] = data->server;
+	fds[2] = data->stream;
 
-	prev_periods = 0;
-	period_time = 1000000.0 * data->io.period_size / data->io.rate;
-	if (period_time > (int) (MIN_PERIOD_TIME * 1000))
-		poll_timeout = (int) (period_time / 1000.0f);
-	else
-		poll_timeout = MIN_PERIOD_TIME;
+	if (data->transport == BT_CAPABILITIES_TRANSPORT_A2DP) {
+		data->a2dp.start = monotonic_ns();
+		timer_set(data->timer_fd, data->a2dp.start, 0,
+							TFD_TIMER_ABSTIME);
+	} else {
+		uint64_t period = frames_to_ns(data->io.period_size,
+							data->io.rate);
 
-	clock_gettime(CLOCK_MONOTONIC, &start);
+		timer_set(data->timer_fd, period, period, 0);
+	}
 
 	while (1) {
-		unsigned int dtime, periods;
-		struct timespec cur, delta;
+		uint64_t expirations;
 		int ret;
 
-		if (data->stopped)
-			goto iter_sleep;
+		ret = poll(fds, 3, -1);
+		if (ret < 0) {
+			if (errno != EINTR) {
+				SNDERR("poll error: %s (%d)", strerror(errno),
+								errno);
+				break;
+			}
+			continue;
+		}
+
+		if (fds[1].revents || fds[2].revents) {
+			ret = (fds[1].revents) ? 1 : 2;
+			SNDERR("poll fd %d revents %d", ret, fds[ret].revents);
+			if (fds[ret].revents & (POLLERR | POLLHUP | POLLNVAL))
+				break;
 
-		if (data->reset) {
-			DBG("Handle XRUN in hw-thread.");
-			data->reset = 0;
-			clock_gettime(CLOCK_MONOTONIC, &start);
-			prev_periods = 0;
+			/* Nobody reads the daemon here, keep errors only */
+			fds[1].events = 0;
 		}
 
-		clock_gettime(CLOCK_MONOTONIC, &cur);
+		if (!(fds[0].revents & POLLIN))
+			continue;
 
-		priv_timespecsub(&cur, &start, &delta);
+		if (read(data->timer_fd, &expirations,
+					sizeof(expirations)) < 0)
+			continue;
+
+		if (data->transport == BT_CAPABILITIES_TRANSPORT_A2DP)
+			a2dp_pacing_tick(data);
+		else
+			sco_pacing_tick(data, expirations);
 
-		dtime = delta.tv_sec * 1000000 + delta.tv_nsec / 1000;
-		periods = 1.0 * dtime / period_time;
+		/* Offer opportunity to be canceled by main thread */
+		pthread_testcancel();
+	}
 
-		if (periods > prev_periods) {
-			char c = 'w';
-			int frags = periods - prev_periods, n;
+	data->hw_thread = 0;
 
-			data->hw_ptr += frags * data->io.period_size;
-			data->hw_ptr %= data->io.buffer_size;
+	pthread_mutex_lock(&data->a2dp.lock);
+	pthread_cond_broadcast(&data->a2dp.drained);
+	pthread_mutex_unlock(&data->a2dp.lock);
 
-			for (n = 0; n < frags; n++) {
-				/* Notify user that hardware pointer
-				 * has moved * */
-				if (write(data->pipefd[1], &c, 1) < 0)
-					pthread_testcancel();
-			}
+	pthread_exit(NULL);
+}
 
-			/* Reset point of reference to avoid too big values
-			 * that wont fit an unsigned int */
-			if ((unsigned int) delta.tv_sec < UINT_SECS_MAX)
-				prev_periods = periods;
-			else {
-				prev_periods = 0;
-				clock_gettime(CLOCK_MONOTONIC, &start);
-			}
+/*
+ * Queues one received RTP packet. The frames are only made visible
+ * to the application once the configured delay worth of audio has
+ * been buffered, which absorbs the jitter of the radio link.
+ */
+static void a2dp_capture_recv(struct bluetooth_data *data)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	struct rtp_header *header;
+	struct rtp_payload *payload;
+	unsigned int tail, samples, jitter;
+	ssize_t len;
+	uint8_t *buf;
+	int moved = 0;
+
+	pthread_mutex_lock(&a2dp->lock);
+
+	/* The last slot is scratch space for packets we drop */
+	tail = a2dp->queue_size;
+	if (a2dp->queue_len < a2dp->queue_size)
+		tail = (a2dp->queue_head + a2dp->queue_len) %
+							a2dp->queue_size;
+
+	buf = a2dp->queue_data + tail * data->link_mtu;
+
+	pthread_mutex_unlock(&a2dp->lock);
+
+	/* The tail slot is not touched by the reader until queued */
+	len = recv(data->stream.fd, buf, data->link_mtu, MSG_DONTWAIT);
+	if (len < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			SNDERR("recv failed: %s (%d)", strerror(errno), errno);
+		return;
+	}
+
+	if (data->stopped)
+		return;
+
+	header = (void *) buf;
+	payload = (void *) (buf + sizeof(*header));
+
+	if ((size_t) len <= sizeof(*header) + sizeof(*payload) ||
+					header->v != 2 || header->cc != 0 ||
+					payload->is_fragmented) {
+		DBG("Invalid RTP packet (%zd bytes)", len);
+		return;
+	}
+
+	if (a2dp->primed && ntohs(header->sequence_number) != a2dp->next_seq)
+		a2dp->lost += (uint16_t) (ntohs(header->sequence_number) -
+							a2dp->next_seq);
+
+	a2dp->next_seq = ntohs(header->sequence_number) + 1;
+
+	samples = payload->frame_count * a2dp->codesize /
+						(data->io.channels * 2);
+
+	pthread_mutex_lock(&a2dp->lock);
+
+	if (tail == a2dp->queue_size || a2dp->queued_frames + samples >
+						data->io.buffer_size) {
+		pthread_mutex_unlock(&a2dp->lock);
+		DBG("capture queue full, dropping packet");
+		a2dp->overruns++;
+		return;
+	}
+
+	a2dp->queue[tail].len = len;
+	a2dp->queue[tail].samples = samples;
+	a2dp->queue_len++;
+	a2dp->queued_frames += samples;
+
+	if (a2dp->primed) {
+		data->hw_ptr += samples;
+		moved = 1;
+	} else {
+		jitter = data->alsa_config.delay * data->io.rate / 1000;
+		jitter = MIN(jitter, data->io.buffer_size -
+						data->io.period_size);
+
+		a2dp->held += samples;
+		if (a2dp->held >= jitter) {
+			data->hw_ptr += a2dp->held;
+			a2dp->held = 0;
+			a2dp->primed = 1;
+			moved = 1;
 		}
+	}
+
+	data->hw_ptr %= data->io.buffer_size;
+
+	pthread_mutex_unlock(&a2dp->lock);
 
-iter_sleep:
-		/* sleep up to one period interval */
-		ret = poll(fds, 2, poll_timeout);
+	if (moved && eventfd_write(data->event_fd, 1) < 0)
+		pthread_testcancel();
+}
+
+static void *capture_hw_thread(void *param)
+{
+	struct bluetooth_data *data = param;
+	struct pollfd fds[2];
 
+	fds[0].fd = data->stream.fd;
+	fds[0].events = POLLIN;
+	fds[1] = data->server;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		int ret;
+
+		ret = poll(fds, 2, -1);
 		if (ret < 0) {
 			if (errno != EINTR) {
 				SNDERR("poll error: %s (%d)", strerror(errno),
 								errno);
 				break;
 			}
-		} else if (ret > 0) {
-			ret = (fds[0].revents) ? 0 : 1;
-			SNDERR("poll fd %d revents %d", ret, fds[ret].revents);
-			if (fds[ret].revents & (POLLERR | POLLHUP | POLLNVAL))
+			continue;
+		}
+
+		if (fds[1].revents) {
+			SNDERR("poll fd 1 revents %d", fds[1].revents);
+			if (fds[1].revents & (POLLERR | POLLHUP | POLLNVAL))
 				break;
+
+			/* Nobody reads the daemon here, keep errors only */
+			fds[1].events = 0;
 		}
 
+		if (fds[0].revents & POLLIN)
+			a2dp_capture_recv(data);
+		else if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+			break;
+
 		/* Offer opportunity to be canceled by main thread */
 		pthread_testcancel();
 	}
 
 	data->hw_thread = 0;
+
+	pthread_mutex_lock(&data->a2dp.lock);
+	pthread_cond_broadcast(&data->a2dp.drained);
+	pthread_mutex_unlock(&data->a2dp.lock);
+
+	/* Let a polling application notice the disconnection */
+	if (eventfd_write(data->event_fd, 1) < 0)
+		SNDERR("eventfd_write: %s (%d)", strerror(errno), errno);
+
 	pthread_exit(NULL);
 }
 
+static int bluetooth_a2dp_capture_start(snd_pcm_ioplug_t *io)
+{
+	struct bluetooth_data *data = io->private_data;
+	int err;
+
+	DBG("%p", io);
+
+	data->stopped = 0;
+
+	if (data->hw_thread)
+		return 0;
+
+	err = pthread_create(&data->hw_thread, 0, capture_hw_thread, data);
+
+	return -err;
+}
+
 static int bluetooth_playback_start(snd_pcm_ioplug_t *io)
 {
 	struct bluetooth_data *data = io->private_data;
@@ -310,11 +610,17 @@ static void bluetooth_exit(struct bluetooth_data *data)
 	if (a2dp->sbc_initialized)
 		sbc_finish(&a2dp->sbc);
 
-	if (data->pipefd[0] > 0)
-		close(data->pipefd[0]);
+	if (data->timer_fd >= 0)
+		close(data->timer_fd);
 
-	if (data->pipefd[1] > 0)
-		close(data->pipefd[1]);
+	if (data->event_fd >= 0)
+		close(data->event_fd);
+
+	free(a2dp->queue);
+	free(a2dp->queue_data);
+
+	pthread_cond_destroy(&a2dp->drained);
+	pthread_mutex_destroy(&a2dp->lock);
 
 	free(data);
 }
@@ -330,10 +636,77 @@ static int bluetooth_close(snd_pcm_ioplug_t *io)
 	return 0;
 }
 
+/*
+ * Sizes the packet queue so that a whole ALSA buffer fits in it even
+ * if every packet carries a single SBC frame.
+ */
+static int bluetooth_a2dp_queue_init(struct bluetooth_data *data)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	unsigned int frames, size;
+
+	frames = a2dp->codesize / (data->io.channels * 2);
+	size = data->io.buffer_size / frames + 2;
+
+	free(a2dp->queue);
+	free(a2dp->queue_data);
+
+	a2dp->queue = calloc(size, sizeof(struct a2dp_packet));
+	a2dp->queue_data = malloc((size + 1) * data->link_mtu);
+	if (!a2dp->queue || !a2dp->queue_data) {
+		free(a2dp->queue);
+		free(a2dp->queue_data);
+		a2dp->queue = NULL;
+		a2dp->queue_data = NULL;
+		a2dp->queue_size = 0;
+		return -ENOMEM;
+	}
+
+	a2dp->queue_size = size;
+	a2dp->queue_head = 0;
+	a2dp->queue_len = 0;
+	a2dp->sent = 0;
+
+	a2dp->queue_offset = RTP_HEADERS_SIZE;
+	a2dp->queued_frames = 0;
+	a2dp->held = 0;
+	a2dp->primed = 0;
+
+	/* Drop whatever was left of the previous run */
+	a2dp->frames = a2dp->queue_data;
+	a2dp->count = RTP_HEADERS_SIZE;
+	a2dp->frame_count = 0;
+	a2dp->samples = 0;
+	data->count = 0;
+
+	return 0;
+}
+
+/* Tells the source how much audio we buffer before playing it */
+static void bluetooth_a2dp_delay_report(struct bluetooth_data *data)
+{
+	char buf[BT_SUGGESTED_BUFFER_SIZE];
+	struct bt_delay_report_req *req = (void *) buf;
+	bt_audio_msg_header_t *rsp = (void *) buf;
+
+	memset(req, 0, BT_SUGGESTED_BUFFER_SIZE);
+	req->h.type = BT_REQUEST;
+	req->h.name = BT_DELAY_REPORT;
+	req->h.length = sizeof(*req);
+	/* AVDTP delays are in 1/10 ms */
+	req->delay = data->alsa_config.delay * 10;
+
+	if (audioservice_send(data->server.fd, &req->h) < 0)
+		return;
+
+	/* Not every source supports delay reporting, that is fine */
+	rsp->length = sizeof(*rsp);
+	audioservice_expect(data->server.fd, rsp, BT_DELAY_REPORT);
+}
+
 static int bluetooth_prepare(snd_pcm_ioplug_t *io)
 {
 	struct bluetooth_data *data = io->private_data;
-	char c = 'w';
 	char buf[BT_SUGGESTED_BUFFER_SIZE];
 	struct bt_start_stream_req *req = (void *) buf;
 	struct bt_start_stream_rsp *rsp = (void *) buf;
@@ -345,8 +718,6 @@ static int bluetooth_prepare(snd_pcm_ioplug_t *io)
 	DBG("Preparing with io->period_size=%lu io->buffer_size=%lu",
 					io->period_size, io->buffer_size);
 
-	data->reset = 0;
-
 	/* As we're gonna receive messages on the server socket, we have to stop the
 	   hw thread that is polling on it, if any */
 	if (data->hw_thread) {
@@ -359,6 +730,9 @@ static int bluetooth_prepare(snd_pcm_ioplug_t *io)
 		/* If not null for playback, xmms doesn't display time
 		 * correctly */
 		data->hw_ptr = 0;
+	else if (data->transport == BT_CAPABILITIES_TRANSPORT_A2DP)
+		/* Moved by the capture thread as packets arrive */
+		data->hw_ptr = 0;
 	else
 		/* ALSA library is really picky on the fact hw_ptr is not null.
 		 * If it is, capture won't start */
@@ -401,6 +775,29 @@ static int bluetooth_prepare(snd_pcm_ioplug_t *io)
 		if (setsockopt(data->stream.fd, SOL_SOCKET, opt_name, &t,
 							sizeof(t)) < 0)
 			return -errno;
+
+		if (io->stream == SND_PCM_STREAM_PLAYBACK) {
+			struct bluetooth_a2dp *a2dp = &data->a2dp;
+			socklen_t len = sizeof(a2dp->sndbuf);
+
+			if (getsockopt(data->stream.fd, SOL_SOCKET, SO_SNDBUF,
+						&a2dp->sndbuf, &len) < 0)
+				a2dp->sndbuf = 0;
+
+			a2dp->backlog = 0;
+			a2dp->backlog_frames = 0;
+			a2dp->stable = 0;
+
+			err = bluetooth_a2dp_queue_init(data);
+			if (err < 0)
+				return err;
+		} else {
+			err = bluetooth_a2dp_queue_init(data);
+			if (err < 0)
+				return err;
+
+			bluetooth_a2dp_delay_report(data);
+		}
 	} else {
 		opt_name = (io->stream == SND_PCM_STREAM_PLAYBACK) ?
 						SCO_TXBUFS : SCO_RXBUFS;
@@ -420,7 +817,7 @@ static int bluetooth_prepare(snd_pcm_ioplug_t *io)
 	}
 
 	/* wake up any client polling at us */
-	if (write(data->pipefd[1], &c, 1) < 0) {
+	if (eventfd_write(data->event_fd, 1) < 0) {
 		err = -errno;
 		return err;
 	}
@@ -682,9 +1079,12 @@ static void bluetooth_a2dp_setup(struct bluetooth_a2dp *a2dp)
 		break;
 	}
 
+	a2dp->min_bitpool = active_capabilities.min_bitpool;
+	a2dp->max_bitpool = active_capabilities.max_bitpool;
 	a2dp->sbc.bitpool = active_capabilities.max_bitpool;
+	a2dp->next_bitpool = a2dp->sbc.bitpool;
 	a2dp->codesize = sbc_get_codesize(&a2dp->sbc);
-	a2dp->count = sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+	a2dp->count = RTP_HEADERS_SIZE;
 }
 
 static int bluetooth_a2dp_hw_params(snd_pcm_ioplug_t *io,
@@ -801,12 +1201,12 @@ static int bluetooth_playback_poll_descriptors(snd_pcm_ioplug_t *io,
 
 	DBG("");
 
-	assert(data->pipefd[0] >= 0);
+	assert(data->event_fd >= 0);
 
 	if (space < 2)
 		return 0;
 
-	pfd[0].fd = data->pipefd[0];
+	pfd[0].fd = data->event_fd;
 	pfd[0].events = POLLIN;
 	pfd[0].revents = 0;
 	pfd[1].fd = data->stream.fd;
@@ -820,7 +1220,7 @@ static int bluetooth_playback_poll_revents(snd_pcm_ioplug_t *io,
 					struct pollfd *pfds, unsigned int nfds,
 					unsigned short *revents)
 {
-	static char buf[1];
+	eventfd_t val;
 
 	DBG("");
 
@@ -831,7 +1231,7 @@ static int bluetooth_playback_poll_revents(snd_pcm_ioplug_t *io,
 	assert(pfds[1].fd >= 0);
 
 	if (io->state != SND_PCM_STATE_PREPARED)
-		if (read(pfds[0].fd, buf, 1) < 0)
+		if (eventfd_read(pfds[0].fd, &val) < 0 && errno != EAGAIN)
 			SYSERR("read error: %s (%d)", strerror(errno), errno);
 
 	if (pfds[1].revents & (POLLERR | POLLHUP | POLLNVAL))
@@ -843,6 +1243,31 @@ static int bluetooth_playback_poll_revents(snd_pcm_ioplug_t *io,
 }
 
 
+static int bluetooth_a2dp_capture_poll_revents(snd_pcm_ioplug_t *io,
+					struct pollfd *pfds, unsigned int nfds,
+					unsigned short *revents)
+{
+	struct bluetooth_data *data = io->private_data;
+	eventfd_t val;
+
+	DBG("");
+
+	assert(pfds);
+	assert(nfds == 2);
+	assert(revents);
+
+	if (eventfd_read(pfds[0].fd, &val) < 0 && errno != EAGAIN)
+		SYSERR("read error: %s (%d)", strerror(errno), errno);
+
+	if ((pfds[1].revents & (POLLERR | POLLHUP | POLLNVAL)) ||
+			(io->state == SND_PCM_STATE_RUNNING && !data->hw_thread))
+		io->state = SND_PCM_STATE_DISCONNECTED;
+
+	*revents = (pfds[0].revents & POLLIN) ? POLLIN : 0;
+
+	return 0;
+}
+
 static snd_pcm_sframes_t bluetooth_hsp_read(snd_pcm_ioplug_t *io,
 				const snd_pcm_channel_area_t *areas,
 				snd_pcm_uframes_t offset,
@@ -959,46 +1384,248 @@ done:
 	return ret;
 }
 
+/*
+ * SBC frames are decoded straight into the application area. Only a
+ * frame that does not fit in the requested size goes through
+ * data->buffer, and its remainder is handed out by the next call.
+ */
 static snd_pcm_sframes_t bluetooth_a2dp_read(snd_pcm_ioplug_t *io,
 				const snd_pcm_channel_area_t *areas,
 				snd_pcm_uframes_t offset, snd_pcm_uframes_t size)
 {
-	snd_pcm_uframes_t ret = 0;
-	return ret;
+	struct bluetooth_data *data = io->private_data;
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	unsigned int frame_size, bytes_left, len;
+	struct a2dp_packet *pkt;
+	uint8_t *buff, *input;
+	ssize_t decoded;
+	size_t written;
+
+	DBG("areas->step=%u areas->first=%u offset=%lu size=%lu",
+				areas->step, areas->first, offset, size);
+
+	frame_size = areas->step / 8;
+	bytes_left = size * frame_size;
+	buff = (uint8_t *) areas->addr +
+				(areas->first + areas->step * offset) / 8;
+
+	/* Left over from a frame split by the last read */
+	if (data->count > 0) {
+		len = MIN(data->count, bytes_left);
+
+		memcpy(buff, data->buffer, len);
+		memmove(data->buffer, data->buffer + len, data->count - len);
+		data->count -= len;
+
+		buff += len;
+		bytes_left -= len;
+	}
+
+	pthread_mutex_lock(&a2dp->lock);
+
+	while (bytes_left > 0 && a2dp->queue_len > 0) {
+		pkt = &a2dp->queue[a2dp->queue_head];
+		input = a2dp->queue_data + a2dp->queue_head * data->link_mtu;
+
+		pthread_mutex_unlock(&a2dp->lock);
+
+		if (bytes_left >= a2dp->codesize)
+			decoded = sbc_decode(&a2dp->sbc,
+					input + a2dp->queue_offset,
+					pkt->len - a2dp->queue_offset,
+					buff, bytes_left, &written);
+		else {
+			decoded = sbc_decode(&a2dp->sbc,
+					input + a2dp->queue_offset,
+					pkt->len - a2dp->queue_offset,
+					data->buffer, sizeof(data->buffer),
+					&written);
+			if (decoded > 0) {
+				len = MIN(written, bytes_left);
+				memcpy(buff, data->buffer, len);
+				memmove(data->buffer, data->buffer + len,
+								written - len);
+				data->count = written - len;
+				written = len;
+			}
+		}
+
+		pthread_mutex_lock(&a2dp->lock);
+
+		if (decoded <= 0) {
+			/* Skip what is left of a corrupted packet */
+			DBG("Decoding error %zd", decoded);
+			a2dp->queue_offset = pkt->len;
+			written = 0;
+		} else
+			a2dp->queue_offset += decoded;
+
+		buff += written;
+		bytes_left -= written;
+
+		if (a2dp->queue_offset < pkt->len)
+			continue;
+
+		a2dp->queued_frames -= pkt->samples;
+		a2dp->queue_head = (a2dp->queue_head + 1) % a2dp->queue_size;
+		a2dp->queue_len--;
+		a2dp->queue_offset = RTP_HEADERS_SIZE;
+	}
+
+	pthread_mutex_unlock(&a2dp->lock);
+
+	/* Frames lost to a decoding error are returned as silence */
+	if (bytes_left > 0 && a2dp->queue_len == 0 && data->count == 0)
+		memset(buff, 0, bytes_left);
+
+	DBG("returning %lu", size);
+
+	return size;
 }
 
-static int avdtp_write(struct bluetooth_data *data)
+/*
+ * Lowers the bitpool as soon as packets pile up in the socket or get
+ * dropped, and raises it one step at a time once the backlog stayed
+ * low for a while. The encoder picks up the new value at the start of
+ * its next packet, so every packet carries frames of a single size.
+ */
+static void bluetooth_a2dp_adapt(struct bluetooth_data *data,
+					struct a2dp_packet *pkt, int err)
 {
-	int err;
-	struct rtp_header *header;
-	struct rtp_payload *payload;
 	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	int bitpool = a2dp->next_bitpool;
+	int space;
+
+	if (a2dp->sndbuf <= 0)
+		return;
+
+	/* Bluetooth sockets report the free space of the send buffer */
+	if (ioctl(data->stream.fd, TIOCOUTQ, &space) < 0)
+		return;
+
+	a2dp->backlog = space < a2dp->sndbuf ? a2dp->sndbuf - space : 0;
+	a2dp->backlog_frames = a2dp->backlog * pkt->samples / pkt->len;
+
+	if (!data->alsa_config.adaptive ||
+				a2dp->min_bitpool >= a2dp->max_bitpool)
+		return;
+
+	if (err < 0 || a2dp->backlog > BITPOOL_HIGH_BACKLOG * data->link_mtu) {
+		a2dp->stable = 0;
+		bitpool -= err < 0 ? BITPOOL_FAIL_STEP : BITPOOL_DOWN_STEP;
+		bitpool = MAX(bitpool, a2dp->min_bitpool);
+	} else if (a2dp->backlog <= BITPOOL_LOW_BACKLOG * data->link_mtu) {
+		if (++a2dp->stable < BITPOOL_UP_PACKETS)
+			return;
+
+		a2dp->stable = 0;
+		bitpool = MIN(bitpool + 1, a2dp->max_bitpool);
+	} else {
+		a2dp->stable = 0;
+		return;
+	}
+
+	if (bitpool == a2dp->next_bitpool)
+		return;
 
-	header = (void *) a2dp->buffer;
-	payload = (void *) (a2dp->buffer + sizeof(*header));
+	DBG("bitpool %d -> %d, backlog %u bytes", a2dp->next_bitpool,
+						bitpool, a2dp->backlog);
 
-	memset(a2dp->buffer, 0, sizeof(*header) + sizeof(*payload));
+	a2dp->next_bitpool = bitpool;
+}
 
-	payload->frame_count = a2dp->frame_count;
-	header->v = 2;
-	header->pt = 1;
-	header->sequence_number = htons(a2dp->seq_num);
-	header->timestamp = htonl(a2dp->nsamples);
-	header->ssrc = htonl(1);
+static void avdtp_write(struct bluetooth_data *data,
+					struct a2dp_packet *pkt, uint8_t *buf)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	struct iovec iov[3];
+	struct msghdr msg;
+	int err;
 
-	err = send(data->stream.fd, a2dp->buffer, a2dp->count, MSG_DONTWAIT);
+	iov[0].iov_base = &pkt->header;
+	iov[0].iov_len = sizeof(pkt->header);
+	iov[1].iov_base = &pkt->payload;
+	iov[1].iov_len = sizeof(pkt->payload);
+	iov[2].iov_base = buf;
+	iov[2].iov_len = pkt->len - RTP_HEADERS_SIZE;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 3;
+
+	err = sendmsg(data->stream.fd, &msg, MSG_DONTWAIT);
 	if (err < 0) {
 		err = -errno;
+		a2dp->send_failures++;
 		DBG("send failed: %s (%d)", strerror(-err), -err);
 	}
 
-	/* Reset buffer of data to send */
-	a2dp->count = sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+	bluetooth_a2dp_adapt(data, pkt, err);
+}
+
+/*
+ * Points the encoder at the queue slot the next packet will occupy.
+ * The slot stays put while the pacing thread pops packets, since head
+ * and length move together. With the queue full the scratch slot is
+ * used and the packet gets dropped.
+ */
+static void avdtp_packet_start(struct bluetooth_data *data)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	unsigned int tail = a2dp->queue_size;
+
+	pthread_mutex_lock(&a2dp->lock);
+
+	if (a2dp->queue_len < a2dp->queue_size)
+		tail = (a2dp->queue_head + a2dp->queue_len) %
+							a2dp->queue_size;
+
+	pthread_mutex_unlock(&a2dp->lock);
+
+	a2dp->frames = a2dp->queue_data + tail * data->link_mtu;
+	a2dp->count = RTP_HEADERS_SIZE;
 	a2dp->frame_count = 0;
 	a2dp->samples = 0;
+}
+
+/* Hands the packet being encoded over to the pacing thread */
+static void avdtp_queue(struct bluetooth_data *data)
+{
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+	struct a2dp_packet *pkt;
+	unsigned int tail;
+
+	pthread_mutex_lock(&a2dp->lock);
+
+	tail = (a2dp->frames - a2dp->queue_data) / data->link_mtu;
+
+	if (tail < a2dp->queue_size) {
+		pkt = &a2dp->queue[tail];
+
+		memset(&pkt->header, 0, sizeof(pkt->header));
+		memset(&pkt->payload, 0, sizeof(pkt->payload));
+
+		pkt->payload.frame_count = a2dp->frame_count;
+		pkt->header.v = 2;
+		pkt->header.pt = 1;
+		pkt->header.sequence_number = htons(a2dp->seq_num);
+		pkt->header.timestamp = htonl(a2dp->nsamples);
+		pkt->header.ssrc = htonl(1);
+
+		pkt->len = a2dp->count;
+		pkt->samples = a2dp->samples;
+		a2dp->queue_len++;
+	} else {
+		DBG("packet queue full, dropping packet %d", a2dp->seq_num);
+		a2dp->send_failures++;
+	}
+
+	pthread_mutex_unlock(&a2dp->lock);
+
 	a2dp->seq_num++;
+	a2dp->sbc.bitpool = a2dp->next_bitpool;
 
-	return err;
+	avdtp_packet_start(data);
 }
 
 static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
@@ -1024,15 +1651,6 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 	buff = (uint8_t *) areas->addr +
 				(areas->first + areas->step * (offset)) / 8;
 
-	/* Check for underrun */
-	if (io->hw_ptr > io->appl_ptr) {
-		ret = bluetooth_playback_stop(io);
-		if (ret == 0)
-			ret = -EPIPE;
-		data->reset = 1;
-		return ret;
-	}
-
 	/* Check if we should autostart */
 	if (io->state == SND_PCM_STATE_PREPARED) {
 		snd_pcm_sw_params_t *swparams;
@@ -1064,9 +1682,8 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 
 		/* Enough data to encode (sbc wants 1k blocks) */
 		encoded = sbc_encode(&a2dp->sbc, data->buffer, a2dp->codesize,
-					a2dp->buffer + a2dp->count,
-					sizeof(a2dp->buffer) - a2dp->count,
-								&written);
+				a2dp->frames + a2dp->count - RTP_HEADERS_SIZE,
+				data->link_mtu - a2dp->count, &written);
 		if (encoded <= 0) {
 			DBG("Encoding error %d", encoded);
 			goto done;
@@ -1080,8 +1697,8 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 
 		/* No space left for another frame then send */
 		if (a2dp->count + written >= data->link_mtu) {
-			avdtp_write(data);
-			DBG("sending packet %d, count %d, link_mtu %u",
+			avdtp_queue(data);
+			DBG("queued packet %d, count %d, link_mtu %u",
 					a2dp->seq_num, a2dp->count,
 							data->link_mtu);
 		}
@@ -1100,9 +1717,8 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 	while (bytes_left >= a2dp->codesize) {
 		/* Enough data to encode (sbc wants 1k blocks) */
 		encoded = sbc_encode(&a2dp->sbc, buff, a2dp->codesize,
-					a2dp->buffer + a2dp->count,
-					sizeof(a2dp->buffer) - a2dp->count,
-								&written);
+				a2dp->frames + a2dp->count - RTP_HEADERS_SIZE,
+				data->link_mtu - a2dp->count, &written);
 		if (encoded <= 0) {
 			DBG("Encoding error %d", encoded);
 			goto done;
@@ -1121,8 +1737,8 @@ static snd_pcm_sframes_t bluetooth_a2dp_write(snd_pcm_ioplug_t *io,
 
 		/* No space left for another frame then send */
 		if (a2dp->count + written >= data->link_mtu) {
-			avdtp_write(data);
-			DBG("sending packet %d, count %d, link_mtu %u",
+			avdtp_queue(data);
+			DBG("queued packet %d, count %d, link_mtu %u",
 						a2dp->seq_num, a2dp->count,
 							data->link_mtu);
 		}
@@ -1142,6 +1758,46 @@ done:
 	return size - bytes_left / frame_size;
 }
 
+static int bluetooth_a2dp_drain(snd_pcm_ioplug_t *io)
+{
+	struct bluetooth_data *data = io->private_data;
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+
+	DBG("%p", io);
+
+	/* Flush the last packet, a partial SBC frame is dropped */
+	if (a2dp->frame_count > 0)
+		avdtp_queue(data);
+
+	pthread_mutex_lock(&a2dp->lock);
+
+	while (a2dp->queue_len > 0 && data->hw_thread && !data->stopped)
+		pthread_cond_wait(&a2dp->drained, &a2dp->lock);
+
+	pthread_mutex_unlock(&a2dp->lock);
+
+	return 0;
+}
+
+/*
+ * Frames written by the application but not yet sent, plus what is
+ * still waiting in the socket for the controller.
+ */
+static int bluetooth_a2dp_delay(snd_pcm_ioplug_t *io,
+					snd_pcm_sframes_t *delayp)
+{
+	struct bluetooth_data *data = io->private_data;
+
+	DBG("");
+
+	/* This updates io->hw_ptr value using pointer() function */
+	snd_pcm_hwsync(io->pcm);
+
+	*delayp = io->appl_ptr - io->hw_ptr + data->a2dp.backlog_frames;
+
+	return 0;
+}
+
 static int bluetooth_playback_delay(snd_pcm_ioplug_t *io,
 					snd_pcm_sframes_t *delayp)
 {
@@ -1162,6 +1818,27 @@ static int bluetooth_playback_delay(snd_pcm_ioplug_t *io,
 	return 0;
 }
 
+static void bluetooth_a2dp_dump(snd_pcm_ioplug_t *io, snd_output_t *out)
+{
+	struct bluetooth_data *data = io->private_data;
+	struct bluetooth_a2dp *a2dp = &data->a2dp;
+
+	snd_output_printf(out, "%s\n", io->name);
+	if (io->stream == SND_PCM_STREAM_PLAYBACK)
+		snd_output_printf(out, "Bitpool %u (%u-%u%s), backlog %u "
+			"bytes, %u send failures\n", a2dp->sbc.bitpool,
+			a2dp->min_bitpool, a2dp->max_bitpool,
+			data->alsa_config.adaptive ? ", adaptive" : "",
+			a2dp->backlog, a2dp->send_failures);
+	else
+		snd_output_printf(out, "Delay %u ms, %u frames queued, "
+			"%u packets lost, %u overruns\n",
+			data->alsa_config.delay, a2dp->queued_frames,
+			a2dp->lost, a2dp->overruns);
+	snd_output_printf(out, "Its setup is:\n");
+	snd_pcm_dump_setup(io->pcm, out);
+}
+
 static snd_pcm_ioplug_callback_t bluetooth_hsp_playback = {
 	.start			= bluetooth_playback_start,
 	.stop			= bluetooth_playback_stop,
@@ -1196,22 +1873,26 @@ static snd_pcm_ioplug_callback_t bluetooth_a2dp_playback = {
 	.hw_params		= bluetooth_a2dp_hw_params,
 	.prepare		= bluetooth_prepare,
 	.transfer		= bluetooth_a2dp_write,
+	.drain			= bluetooth_a2dp_drain,
 	.poll_descriptors_count	= bluetooth_playback_poll_descriptors_count,
 	.poll_descriptors	= bluetooth_playback_poll_descriptors,
 	.poll_revents		= bluetooth_playback_poll_revents,
-	.delay			= bluetooth_playback_delay,
+	.delay			= bluetooth_a2dp_delay,
+	.dump			= bluetooth_a2dp_dump,
 };
 
 static snd_pcm_ioplug_callback_t bluetooth_a2dp_capture = {
-	.start			= bluetooth_start,
-	.stop			= bluetooth_stop,
+	.start			= bluetooth_a2dp_capture_start,
+	.stop			= bluetooth_playback_stop,
 	.pointer		= bluetooth_pointer,
 	.close			= bluetooth_close,
 	.hw_params		= bluetooth_a2dp_hw_params,
 	.prepare		= bluetooth_prepare,
 	.transfer		= bluetooth_a2dp_read,
-	.poll_descriptors	= bluetooth_poll_descriptors,
-	.poll_revents		= bluetooth_poll_revents,
+	.poll_descriptors_count	= bluetooth_playback_poll_descriptors_count,
+	.poll_descriptors	= bluetooth_playback_poll_descriptors,
+	.poll_revents		= bluetooth_a2dp_capture_poll_revents,
+	.dump			= bluetooth_a2dp_dump,
 };
 
 #define ARRAY_NELEMS(a) (sizeof((a)) / sizeof((a)[0]))
@@ -1388,6 +2069,8 @@ static int bluetooth_parse_config(snd_config_t *conf,
 
 	/* Set defaults */
 	bt_config->autoconnect = 1;
+	bt_config->adaptive = 1;
+	bt_config->delay = DEFAULT_CAPTURE_DELAY;
 
 	snd_config_for_each(i, next, conf) {
 		snd_config_t *n = snd_config_iterator_entry(i);
@@ -1412,6 +2095,19 @@ static int bluetooth_parse_config(snd_config_t *conf,
 			continue;
 		}
 
+		if (strcmp(id, "adaptive") == 0) {
+			int b;
+
+			b = snd_config_get_bool(n);
+			if (b < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+
+			bt_config->adaptive = b;
+			continue;
+		}
+
 		if (strcmp(id, "device") == 0 || strcmp(id, "bdaddr") == 0) {
 			if (snd_config_get_string(n, &value) < 0) {
 				SNDERR("Invalid type for %s", id);
@@ -1515,6 +2211,16 @@ static int bluetooth_parse_config(snd_config_t *conf,
 			continue;
 		}
 
+		if (strcmp(id, "delay") == 0) {
+			if (snd_config_get_string(n, &value) < 0) {
+				SNDERR("Invalid type for %s", id);
+				return -EINVAL;
+			}
+
+			bt_config->delay = atoi(value);
+			continue;
+		}
+
 		if (strcmp(id, "bitpool") == 0) {
 			if (snd_config_get_string(n, &value) < 0) {
 				SNDERR("Invalid type for %s", id);
@@ -1619,18 +2325,24 @@ static int audioservice_expect(int sk, bt_audio_msg_header_t *rsp,
 }
 
 static int bluetooth_parse_capabilities(struct bluetooth_data *data,
-					struct bt_get_capabilities_rsp *rsp)
+					struct bt_get_capabilities_rsp *rsp,
+					snd_pcm_stream_t stream)
 {
 	int bytes_left = rsp->h.length - sizeof(*rsp);
 	codec_capabilities_t *codec = (void *) rsp->data;
+	uint8_t type;
 
 	data->transport = codec->transport;
 
 	if (codec->transport != BT_CAPABILITIES_TRANSPORT_A2DP)
 		return 0;
 
+	/* Capturing means receiving from a remote source */
+	type = stream == SND_PCM_STREAM_PLAYBACK ? BT_A2DP_SBC_SINK :
+							BT_A2DP_SBC_SOURCE;
+
 	while (bytes_left > 0) {
-		if ((codec->type == BT_A2DP_SBC_SINK) &&
+		if ((codec->type == type) &&
 				!(codec->lock & BT_WRITE_LOCK))
 			break;
 
@@ -1658,6 +2370,12 @@ static int bluetooth_init(struct bluetooth_data *data,
 
 	memset(data, 0, sizeof(struct bluetooth_data));
 
+	pthread_mutex_init(&data->a2dp.lock, NULL);
+	pthread_cond_init(&data->a2dp.drained, NULL);
+
+	data->timer_fd = -1;
+	data->event_fd = -1;
+
 	err = bluetooth_parse_config(conf, alsa_conf);
 	if (err < 0)
 		return err;
@@ -1674,18 +2392,15 @@ static int bluetooth_init(struct bluetooth_data *data,
 	data->server.fd = sk;
 	data->server.events = POLLIN;
 
-	data->pipefd[0] = -1;
-	data->pipefd[1] = -1;
-
-	if (pipe(data->pipefd) < 0) {
+	data->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (data->event_fd < 0) {
 		err = -errno;
 		goto failed;
 	}
-	if (fcntl(data->pipefd[0], F_SETFL, O_NONBLOCK) < 0) {
-		err = -errno;
-		goto failed;
-	}
-	if (fcntl(data->pipefd[1], F_SETFL, O_NONBLOCK) < 0) {
+
+	data->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+						TFD_NONBLOCK | TFD_CLOEXEC);
+	if (data->timer_fd < 0) {
 		err = -errno;
 		goto failed;
 	}
@@ -1713,7 +2428,7 @@ static int bluetooth_init(struct bluetooth_data *data,
 	if (err < 0)
 		goto failed;
 
-	bluetooth_parse_capabilities(data, rsp);
+	bluetooth_parse_capabilities(data, rsp, stream);
 
 	return 0;
 
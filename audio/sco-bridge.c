@@ -0,0 +1,472 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/sco.h>
+
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#include "log.h"
+#include "device.h"
+#include "headset.h"
+#include "gateway.h"
+#include "sco-bridge.h"
+
+/* Largest payload of a single SCO packet */
+#define SCO_MAX_PACKET		255
+
+/* Packets read or written per system call */
+#define SCO_BATCH		8
+
+/* Packets held back before a direction starts sending, so that the
+ * slot timing of the two links doesn't starve the outgoing one */
+#define SCO_PREFILL		2
+
+/* Packets buffered per direction before the oldest audio is dropped */
+#define SCO_MAX_LATENCY		8
+
+#define SCO_BUF_SIZE		((SCO_MAX_LATENCY + SCO_BATCH) * \
+							SCO_MAX_PACKET)
+
+/* One direction of the bridge. Audio is kept as a byte stream and sent in
+ * packets of the outgoing link's MTU, since the two links may have been
+ * set up with different packet sizes. */
+struct sco_pipe {
+	int in;
+	int out;
+	uint16_t in_mtu;
+	uint16_t out_mtu;
+	gboolean started;
+	size_t len;
+	unsigned int drops;
+	uint8_t buf[SCO_BUF_SIZE];
+};
+
+struct sco_bridge {
+	pthread_t thread;
+	int ag_fd;
+	int hf_fd;
+	int event_fd;
+	struct sco_pipe up;	/* From the hands-free to the gateway */
+	struct sco_pipe down;	/* From the gateway to the hands-free */
+};
+
+/* A pair of devices whose SCO links are bridged */
+struct bridge_link {
+	struct audio_device *ag;
+	struct audio_device *hf;
+	struct sco_bridge *bridge;
+};
+
+static GSList *playing_ag = NULL;
+static GSList *playing_hf = NULL;
+static GSList *links = NULL;
+
+static unsigned int hs_cb_id = 0;
+static unsigned int gw_cb_id = 0;
+
+static uint16_t sco_get_mtu(int fd)
+{
+	struct sco_options so;
+	socklen_t len = sizeof(so);
+
+	if (getsockopt(fd, SOL_SCO, SCO_OPTIONS, &so, &len) < 0 ||
+								so.mtu == 0)
+		return 48;
+
+	return MIN(so.mtu, SCO_MAX_PACKET);
+}
+
+static int pipe_read(struct sco_pipe *p)
+{
+	uint8_t pkt[SCO_BATCH][SCO_MAX_PACKET];
+	struct mmsghdr msgs[SCO_BATCH];
+	struct iovec iov[SCO_BATCH];
+	size_t max;
+	int i, n;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < SCO_BATCH; i++) {
+		iov[i].iov_base = pkt[i];
+		iov[i].iov_len = p->in_mtu;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	n = recvmmsg(p->in, msgs, SCO_BATCH, MSG_DONTWAIT, NULL);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -errno;
+
+	max = (size_t) SCO_MAX_LATENCY * p->out_mtu;
+
+	for (i = 0; i < n; i++) {
+		size_t len = msgs[i].msg_len;
+
+		memcpy(p->buf + p->len, pkt[i], len);
+		p->len += len;
+
+		/* The outgoing link isn't keeping up, drop the oldest audio
+		 * in whole packets to keep the latency bounded */
+		if (p->len > max) {
+			size_t drop = p->len - max;
+
+			drop += p->out_mtu - 1;
+			drop -= drop % p->out_mtu;
+			drop = MIN(drop, p->len);
+
+			memmove(p->buf, p->buf + drop, p->len - drop);
+			p->len -= drop;
+			p->drops++;
+		}
+	}
+
+	if (!p->started && p->len >= (size_t) SCO_PREFILL * p->out_mtu)
+		p->started = TRUE;
+
+	return n;
+}
+
+static int pipe_write(struct sco_pipe *p)
+{
+	struct mmsghdr msgs[SCO_BATCH];
+	struct iovec iov[SCO_BATCH];
+	size_t sent;
+	int i, n;
+
+	if (!p->started)
+		return 0;
+
+	n = MIN(p->len / p->out_mtu, SCO_BATCH);
+	if (n == 0)
+		return 0;
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for (i = 0; i < n; i++) {
+		iov[i].iov_base = p->buf + i * p->out_mtu;
+		iov[i].iov_len = p->out_mtu;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	n = sendmmsg(p->out, msgs, n, MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (n < 0)
+		return (errno == EAGAIN || errno == EINTR) ? 0 : -errno;
+
+	sent = (size_t) n * p->out_mtu;
+	memmove(p->buf, p->buf + sent, p->len - sent);
+	p->len -= sent;
+
+	return n;
+}
+
+static gboolean pipe_pending(struct sco_pipe *p)
+{
+	return p->started && p->len >= p->out_mtu;
+}
+
+static void pipe_init(struct sco_pipe *p, int in, int out)
+{
+	p->in = in;
+	p->out = out;
+	p->in_mtu = sco_get_mtu(in);
+	p->out_mtu = sco_get_mtu(out);
+}
+
+static void *bridge_thread(void *user_data)
+{
+	struct sco_bridge *bridge = user_data;
+	struct pollfd fds[3];
+
+	fds[0].fd = bridge->ag_fd;
+	fds[1].fd = bridge->hf_fd;
+	fds[2].fd = bridge->event_fd;
+	fds[2].events = POLLIN;
+
+	while (1) {
+		int err = 0;
+
+		fds[0].events = POLLIN;
+		fds[1].events = POLLIN;
+
+		/* Only wait for writability while a link is backed up */
+		if (pipe_pending(&bridge->up))
+			fds[0].events |= POLLOUT;
+		if (pipe_pending(&bridge->down))
+			fds[1].events |= POLLOUT;
+
+		if (poll(fds, 3, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			err = -errno;
+			break;
+		}
+
+		if (fds[2].revents)
+			break;
+
+		if ((fds[0].revents | fds[1].revents) &
+					(POLLERR | POLLHUP | POLLNVAL))
+			break;
+
+		if (fds[0].revents & POLLIN)
+			err = pipe_read(&bridge->down);
+		if (err >= 0 && fds[1].revents & POLLIN)
+			err = pipe_read(&bridge->up);
+
+		if (err >= 0 && pipe_pending(&bridge->down))
+			err = pipe_write(&bridge->down);
+		if (err >= 0 && pipe_pending(&bridge->up))
+			err = pipe_write(&bridge->up);
+
+		if (err < 0) {
+			error("SCO bridge: %s (%d)", strerror(-err), -err);
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+struct sco_bridge *sco_bridge_new(int ag_fd, int hf_fd)
+{
+	struct sco_bridge *bridge;
+	int err;
+
+	bridge = g_new0(struct sco_bridge, 1);
+
+	/* The devices keep ownership of their sockets, the bridge works on
+	 * its own descriptors so a device closing its link can't hand a
+	 * reused fd number to the forwarding thread */
+	bridge->ag_fd = dup(ag_fd);
+	bridge->hf_fd = dup(hf_fd);
+	bridge->event_fd = eventfd(0, EFD_CLOEXEC);
+
+	if (bridge->ag_fd < 0 || bridge->hf_fd < 0 || bridge->event_fd < 0) {
+		err = errno;
+		goto failed;
+	}
+
+	pipe_init(&bridge->down, bridge->ag_fd, bridge->hf_fd);
+	pipe_init(&bridge->up, bridge->hf_fd, bridge->ag_fd);
+
+	err = pthread_create(&bridge->thread, NULL, bridge_thread, bridge);
+	if (err != 0)
+		goto failed;
+
+	DBG("bridging SCO, gateway mtu %u, hands-free mtu %u",
+					bridge->down.in_mtu, bridge->up.in_mtu);
+
+	return bridge;
+
+failed:
+	error("Unable to set up SCO bridge: %s (%d)", strerror(err), err);
+
+	if (bridge->ag_fd >= 0)
+		close(bridge->ag_fd);
+	if (bridge->hf_fd >= 0)
+		close(bridge->hf_fd);
+	if (bridge->event_fd >= 0)
+		close(bridge->event_fd);
+
+	g_free(bridge);
+
+	return NULL;
+}
+
+void sco_bridge_free(struct sco_bridge *bridge)
+{
+	uint64_t stop = 1;
+
+	if (write(bridge->event_fd, &stop, sizeof(stop)) < 0)
+		error("SCO bridge: %s (%d)", strerror(errno), errno);
+
+	pthread_join(bridge->thread, NULL);
+
+	if (bridge->down.drops || bridge->up.drops)
+		DBG("SCO bridge dropped %u/%u bursts (down/up)",
+				bridge->down.drops, bridge->up.drops);
+
+	close(bridge->ag_fd);
+	close(bridge->hf_fd);
+	close(bridge->event_fd);
+
+	g_free(bridge);
+}
+
+static void link_free(struct bridge_link *link)
+{
+	sco_bridge_free(link->bridge);
+	g_free(link);
+}
+
+static struct bridge_link *find_link(struct audio_device *dev)
+{
+	GSList *l;
+
+	for (l = links; l; l = l->next) {
+		struct bridge_link *link = l->data;
+
+		if (link->ag == dev || link->hf == dev)
+			return link;
+	}
+
+	return NULL;
+}
+
+static struct audio_device *find_unbridged(GSList *list)
+{
+	for (; list; list = list->next) {
+		struct audio_device *dev = list->data;
+
+		if (find_link(dev) == NULL)
+			return dev;
+	}
+
+	return NULL;
+}
+
+static void bridge_devices(struct audio_device *ag, struct audio_device *hf)
+{
+	struct bridge_link *link;
+	struct sco_bridge *bridge;
+	int ag_fd, hf_fd;
+
+	/* With PCM routing the audio never reaches the sockets */
+	if (!headset_get_sco_hci(hf))
+		return;
+
+	ag_fd = gateway_get_sco_fd(ag);
+	hf_fd = headset_get_sco_fd(hf);
+	if (ag_fd < 0 || hf_fd < 0)
+		return;
+
+	bridge = sco_bridge_new(ag_fd, hf_fd);
+	if (bridge == NULL)
+		return;
+
+	DBG("%s <-> %s", ag->path, hf->path);
+
+	link = g_new0(struct bridge_link, 1);
+	link->ag = ag;
+	link->hf = hf;
+	link->bridge = bridge;
+
+	links = g_slist_append(links, link);
+}
+
+static void unbridge_device(struct audio_device *dev)
+{
+	struct bridge_link *link = find_link(dev);
+
+	if (link == NULL)
+		return;
+
+	DBG("%s <-> %s", link->ag->path, link->hf->path);
+
+	links = g_slist_remove(links, link);
+	link_free(link);
+}
+
+static void headset_state_changed(struct audio_device *dev,
+					headset_state_t old_state,
+					headset_state_t new_state,
+					void *user_data)
+{
+	struct audio_device *ag;
+
+	if (new_state == HEADSET_STATE_PLAYING) {
+		playing_hf = g_slist_append(playing_hf, dev);
+
+		ag = find_unbridged(playing_ag);
+		if (ag)
+			bridge_devices(ag, dev);
+	} else if (old_state == HEADSET_STATE_PLAYING) {
+		playing_hf = g_slist_remove(playing_hf, dev);
+		unbridge_device(dev);
+	}
+}
+
+static void gateway_state_changed(struct audio_device *dev,
+					gateway_state_t old_state,
+					gateway_state_t new_state,
+					void *user_data)
+{
+	struct audio_device *hf;
+
+	if (new_state == GATEWAY_STATE_PLAYING) {
+		playing_ag = g_slist_append(playing_ag, dev);
+
+		hf = find_unbridged(playing_hf);
+		if (hf)
+			bridge_devices(dev, hf);
+	} else if (old_state == GATEWAY_STATE_PLAYING) {
+		playing_ag = g_slist_remove(playing_ag, dev);
+		unbridge_device(dev);
+	}
+}
+
+void sco_bridge_init(void)
+{
+	hs_cb_id = headset_add_state_cb(headset_state_changed, NULL);
+	gw_cb_id = gateway_add_state_cb(gateway_state_changed, NULL);
+}
+
+void sco_bridge_exit(void)
+{
+	if (hs_cb_id) {
+		headset_remove_state_cb(hs_cb_id);
+		hs_cb_id = 0;
+	}
+
+	if (gw_cb_id) {
+		gateway_remove_state_cb(gw_cb_id);
+		gw_cb_id = 0;
+	}
+
+	g_slist_free_full(links, (GDestroyNotify) link_free);
+	links = NULL;
+
+	g_slist_free(playing_ag);
+	playing_ag = NULL;
+	g_slist_free(playing_hf);
+	playing_hf = NULL;
+}
@@ -286,6 +286,9 @@ static gboolean stream_setup_retry(gpointer user_data)
 	return FALSE;
 }
 
+static void discovery_complete(struct avdtp *session, GSList *seps,
+				struct avdtp_error *err, void *user_data);
+
 static void stream_setup_complete(struct avdtp *session, struct a2dp_sep *sep,
 					struct avdtp_stream *stream,
 					struct avdtp_error *err, void *user_data)
@@ -312,6 +315,14 @@ static void stream_setup_complete(struct avdtp *session, struct a2dp_sep *sep,
 		return;
 	}
 
+	/* Endpoints restored from storage got rejected so discover them
+	 * again before giving up */
+	if (avdtp_discovery_stale(session) &&
+			avdtp_discover(session, discovery_complete, sink) == 0) {
+		DBG("Stored endpoints rejected, rediscovering");
+		return;
+	}
+
 	avdtp_unref(sink->session);
 	sink->session = NULL;
 	if (avdtp_error_category(err) == AVDTP_ERRNO
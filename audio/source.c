@@ -239,6 +239,9 @@ static gboolean stream_setup_retry(gpointer user_data)
 	return FALSE;
 }
 
+static void discovery_complete(struct avdtp *session, GSList *seps,
+				struct avdtp_error *err, void *user_data);
+
 static void stream_setup_complete(struct avdtp *session, struct a2dp_sep *sep,
 					struct avdtp_stream *stream,
 					struct avdtp_error *err, void *user_data)
@@ -265,6 +268,14 @@ static void stream_setup_complete(struct avdtp *session, struct a2dp_sep *sep,
 		return;
 	}
 
+	/* Endpoints restored from storage got rejected so discover them
+	 * again before giving up */
+	if (avdtp_discovery_stale(session) &&
+			avdtp_discover(session, discovery_complete, source) == 0) {
+		DBG("Stored endpoints rejected, rediscovering");
+		return;
+	}
+
 	avdtp_unref(source->session);
 	source->session = NULL;
 	if (avdtp_error_category(err) == AVDTP_ERRNO
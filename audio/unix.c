@@ -51,6 +51,7 @@
 #include "sink.h"
 #include "source.h"
 #include "gateway.h"
+#include "pcm-ring.h"
 #include "unix.h"
 
 #define check_nul(str) (str[sizeof(str) - 1] == '\0')
@@ -69,6 +70,7 @@ struct a2dp_data {
 	struct avdtp *session;
 	struct avdtp_stream *stream;
 	struct a2dp_sep *sep;
+	uint16_t omtu;
 };
 
 struct headset_data {
@@ -88,6 +90,8 @@ struct unix_client {
 	int sock;
 	int lock;
 	int data_fd; /* To be deleted once two phase configuration is fully implemented */
+	uint8_t flags;
+	struct pcm_ring *ring;
 	unsigned int req_id;
 	unsigned int cb_id;
 	gboolean (*cancel) (struct audio_device *dev, unsigned int id);
@@ -109,6 +113,9 @@ static void client_free(void *data)
 	if (client->sock >= 0)
 		close(client->sock);
 
+	if (client->ring)
+		pcm_ring_free(client->ring);
+
 	g_slist_free_full(client->caps, g_free);
 
 	g_free(client->interface);
@@ -134,33 +141,77 @@ static int set_nonblocking(int fd)
 	return 0;
 }
 
-/* Pass file descriptor through local domain sockets (AF_LOCAL, formerly
+/* Pass file descriptors through local domain sockets (AF_LOCAL, formerly
  * AF_UNIX) and the sendmsg() system call with the cmsg_type field of a "struct
- * cmsghdr" set to SCM_RIGHTS and the data being an integer value equal to the
- * handle of the file descriptor to be passed. */
-static int unix_sendmsg_fd(int sock, int fd)
+ * cmsghdr" set to SCM_RIGHTS and the data being an array of integer values
+ * equal to the handles of the file descriptors to be passed. */
+static int unix_sendmsg_fds(int sock, const int *fds, int count)
 {
-	char cmsg_b[CMSG_SPACE(sizeof(int))], m = 'm';
+	char cmsg_b[CMSG_SPACE(sizeof(int) * 2)], m = 'm';
 	struct cmsghdr *cmsg;
 	struct iovec iov = { &m, sizeof(m) };
 	struct msghdr msgh;
 
+	if (count < 1 || count > 2)
+		return -EINVAL;
+
 	memset(&msgh, 0, sizeof(msgh));
 	msgh.msg_iov = &iov;
 	msgh.msg_iovlen = 1;
 	msgh.msg_control = &cmsg_b;
-	msgh.msg_controllen = CMSG_LEN(sizeof(int));
+	msgh.msg_controllen = CMSG_LEN(sizeof(int) * count);
 
 	cmsg = CMSG_FIRSTHDR(&msgh);
 	cmsg->cmsg_level = SOL_SOCKET;
 	cmsg->cmsg_type = SCM_RIGHTS;
-	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
 	/* Initialize the payload */
-	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
 
 	return sendmsg(sock, &msgh, MSG_NOSIGNAL);
 }
 
+static int unix_sendmsg_fd(int sock, int fd)
+{
+	return unix_sendmsg_fds(sock, &fd, 1);
+}
+
+static void client_release_ring(struct unix_client *client)
+{
+	if (!client->ring)
+		return;
+
+	pcm_ring_free(client->ring);
+	client->ring = NULL;
+}
+
+/* In PCM ring mode the transport stays with us and the client gets the
+ * shared ring plus its eventfd instead */
+static int unix_send_stream_fd(struct unix_client *client)
+{
+	struct a2dp_data *a2dp = &client->d.a2dp;
+	int fds[2];
+
+	if (!(client->flags & BT_FLAG_PCM_RING))
+		return unix_sendmsg_fd(client->sock, client->data_fd);
+
+	if (!client->ring)
+		client->ring = pcm_ring_new(a2dp->stream, client->data_fd,
+					a2dp->omtu,
+					client->flags & BT_FLAG_BROADCAST ?
+								TRUE : FALSE);
+
+	if (!client->ring) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fds[0] = pcm_ring_get_fd(client->ring);
+	fds[1] = pcm_ring_get_event_fd(client->ring);
+
+	return unix_sendmsg_fds(client->sock, fds, 2);
+}
+
 static void unix_ipc_sendmsg(struct unix_client *client,
 					const bt_audio_msg_header_t *msg)
 {
@@ -231,6 +282,7 @@ static void stream_state_changed(struct avdtp_stream *stream,
 
 	switch (new_state) {
 	case AVDTP_STATE_IDLE:
+		client_release_ring(client);
 		if (a2dp->sep) {
 			a2dp_sep_unlock(a2dp->sep, a2dp->session);
 			a2dp->sep = NULL;
@@ -754,6 +806,7 @@ static void a2dp_config_complete(struct avdtp *session, struct a2dp_sep *sep,
 
 	/* FIXME: Use imtu when fd_opt is CFG_FD_OPT_READ */
 	rsp->link_mtu = omtu;
+	a2dp->omtu = omtu;
 
 	unix_ipc_sendmsg(client, &rsp->h);
 
@@ -800,8 +853,8 @@ static void a2dp_resume_complete(struct avdtp *session,
 
 	unix_ipc_sendmsg(client, &ind->h);
 
-	if (unix_sendmsg_fd(client->sock, client->data_fd) < 0) {
-		error("unix_sendmsg_fd: %s(%d)", strerror(errno), errno);
+	if (unix_send_stream_fd(client) < 0) {
+		error("unix_send_stream_fd: %s(%d)", strerror(errno), errno);
 		goto failed;
 	}
 
@@ -1173,6 +1226,8 @@ static void start_suspend(struct audio_device *dev, struct unix_client *client)
 			goto failed;
 		}
 
+		client_release_ring(client);
+
 		id = a2dp_suspend(a2dp->session, a2dp->sep,
 					a2dp_suspend_complete, client);
 		client->cancel = a2dp_cancel;
@@ -1260,6 +1315,8 @@ static void start_close(struct audio_device *dev, struct unix_client *client,
 	case TYPE_SINK:
 		a2dp = &client->d.a2dp;
 
+		client_release_ring(client);
+
 		if (client->cb_id > 0) {
 			avdtp_stream_remove_cb(a2dp->session, a2dp->stream,
 								client->cb_id);
@@ -1350,12 +1407,19 @@ static void handle_getcapabilities_req(struct unix_client *client,
 		goto failed;
 	}
 
+	if ((req->flags & BT_FLAG_PCM_RING) && client->type != TYPE_SINK) {
+		error("PCM ring is only available for A2DP sinks");
+		err = EINVAL;
+		goto failed;
+	}
+
 	if (g_strcmp0(interface, client->interface) != 0) {
 		g_free(client->interface);
 		client->interface = g_strdup(interface);
 	}
 
 	client->seid = req->seid;
+	client->flags = req->flags;
 
 	start_discovery(dev, client);
 
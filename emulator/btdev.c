@@ -30,15 +30,51 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "mainloop.h"
 #include "bt.h"
 #include "btdev.h"
 
 #define le16_to_cpu(val) (val)
 #define cpu_to_le16(val) (val)
 
+#define LINK_ACL	0x01
+#define LINK_LE		0x80
+
+#define MAX_HANDLE	0x0eff
+
+/* ACL packet held by the sending controller until it is transmitted
+ * and then in flight until it reaches the remote controller */
+struct btdev_pkt {
+	struct btdev_pkt *next;
+	uint64_t complete;
+	uint64_t arrival;
+	uint16_t len;
+	uint8_t data[0];
+};
+
+struct btdev_conn {
+	struct btdev *dev;
+	struct btdev_conn *peer;
+	uint16_t handle;
+	uint8_t link_type;
+	struct btdev_pkt *tx_head;
+	struct btdev_pkt *tx_tail;
+	struct btdev_pkt *tx_unreported;
+	uint64_t tx_busy;
+	int timeout_id;
+};
+
 struct btdev {
-	struct btdev *conn;
+	struct btdev *next;
+	struct btdev *hash_next;
+	struct btdev *adv_next;
+	struct btdev *scan_next;
+
+	struct btdev_conn **conns;
+	uint16_t conn_size;
+	uint16_t acl_pending;
 
 	btdev_send_func send_handler;
 	void *send_data;
@@ -73,54 +109,108 @@ struct btdev {
 	uint8_t  le_supported;
 	uint8_t  le_simultaneous;
 	uint8_t  le_event_mask[8];
+	uint8_t  le_random_addr[6];
+	uint16_t le_adv_interval;
+	uint8_t  le_adv_type;
+	uint8_t  le_adv_direct_addr[6];
+	uint8_t  le_adv_data_len;
+	uint8_t  le_adv_data[31];
+	uint8_t  le_scan_rsp_len;
+	uint8_t  le_scan_rsp[31];
+	uint8_t  le_adv_enable;
+	int      le_adv_timeout;
+	uint8_t  le_scan_type;
+	uint8_t  le_scan_enable;
+	uint8_t  le_filter_dup;
+	uint8_t  le_conn_pending;
+	uint8_t  le_conn_addr[6];
+	uint16_t le_conn_interval;
+	uint16_t le_conn_latency;
+	uint16_t le_conn_supv_timeout;
 };
 
-#define MAX_BTDEV_ENTRIES 16
+#define BTDEV_HASH_SIZE 256
+
+static struct btdev *btdev_list = NULL;
+static struct btdev *btdev_hash[BTDEV_HASH_SIZE];
+
+/* Devices with advertising and with scanning enabled */
+static struct btdev *adv_list = NULL;
+static struct btdev *scan_list = NULL;
 
-static struct btdev *btdev_list[MAX_BTDEV_ENTRIES] = { };
+/* Simulated link properties, zero for instant delivery */
+static unsigned int link_latency = 0;
+static unsigned int link_bandwidth = 0;
 
-static inline int add_btdev(struct btdev *btdev)
+static inline unsigned int bdaddr_hash(const uint8_t *bdaddr)
 {
-	int i, index = -1;
+	unsigned int i, hash = 0;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] == NULL) {
-			index = i;
-			btdev_list[index] = btdev;
-			break;
-		}
-	}
+	for (i = 0; i < 6; i++)
+		hash = hash * 31 + bdaddr[i];
 
-	return index;
+	return hash % BTDEV_HASH_SIZE;
 }
 
-static inline int del_btdev(struct btdev *btdev)
+static inline void add_btdev(struct btdev *btdev)
 {
-	int i, index = -1;
+	unsigned int hash = bdaddr_hash(btdev->bdaddr);
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] == btdev) {
-			index = i;
-			btdev_list[index] = NULL;
+	btdev->next = btdev_list;
+	btdev_list = btdev;
+
+	btdev->hash_next = btdev_hash[hash];
+	btdev_hash[hash] = btdev;
+}
+
+static inline void del_btdev(struct btdev *btdev)
+{
+	struct btdev **ptr;
+
+	for (ptr = &btdev_list; *ptr; ptr = &(*ptr)->next) {
+		if (*ptr == btdev) {
+			*ptr = btdev->next;
 			break;
 		}
 	}
 
-	return index;
+	for (ptr = &btdev_hash[bdaddr_hash(btdev->bdaddr)]; *ptr;
+						ptr = &(*ptr)->hash_next) {
+		if (*ptr == btdev) {
+			*ptr = btdev->hash_next;
+			break;
+		}
+	}
 }
 
 static inline struct btdev *find_btdev_by_bdaddr(const uint8_t *bdaddr)
 {
-	int i;
+	struct btdev *btdev;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (btdev_list[i] && !memcmp(btdev_list[i]->bdaddr, bdaddr, 6))
-			return btdev_list[i];
+	for (btdev = btdev_hash[bdaddr_hash(bdaddr)]; btdev;
+						btdev = btdev->hash_next) {
+		if (!memcmp(btdev->bdaddr, bdaddr, 6))
+			return btdev;
 	}
 
 	return NULL;
 }
 
+static uint64_t get_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+void btdev_set_link_params(unsigned int latency, unsigned int bandwidth)
+{
+	link_latency = latency;
+	link_bandwidth = bandwidth;
+}
+
 static void hexdump(const unsigned char *buf, uint16_t len)
 {
 	static const char hexdigits[] = "0123456789abcdef";
@@ -214,19 +304,17 @@ struct btdev *btdev_create(uint16_t id)
 
 	get_bdaddr(id, btdev->bdaddr);
 
-	add_btdev(btdev);
+	if (find_btdev_by_bdaddr(btdev->bdaddr)) {
+		free(btdev);
+		return NULL;
+	}
 
-	return btdev;
-}
+	btdev->le_adv_interval = 0x0800;
+	btdev->le_adv_timeout = -1;
 
-void btdev_destroy(struct btdev *btdev)
-{
-	if (!btdev)
-		return;
-
-	del_btdev(btdev);
+	add_btdev(btdev);
 
-	free(btdev);
+	return btdev;
 }
 
 void btdev_set_send_handler(struct btdev *btdev, btdev_send_func handler,
@@ -317,41 +405,244 @@ static void cmd_status(struct btdev *btdev, uint8_t status, uint16_t opcode)
 	send_event(btdev, BT_HCI_EVT_CMD_STATUS, &cs, sizeof(cs));
 }
 
-static void num_completed_packets(struct btdev *btdev)
+static void num_completed_packets(struct btdev *btdev, uint16_t handle,
+							uint16_t count)
 {
-	if (btdev->conn) {
-		struct bt_hci_evt_num_completed_packets ncp;
+	struct bt_hci_evt_num_completed_packets ncp;
 
-		ncp.num_handles = 1;
-		ncp.handle = cpu_to_le16(42);
-		ncp.count = cpu_to_le16(1);
+	ncp.num_handles = 1;
+	ncp.handle = cpu_to_le16(handle);
+	ncp.count = cpu_to_le16(count);
 
-		send_event(btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS,
-							&ncp, sizeof(ncp));
+	send_event(btdev, BT_HCI_EVT_NUM_COMPLETED_PACKETS, &ncp, sizeof(ncp));
+}
+
+static void send_acl(struct btdev_conn *conn, const void *data, uint16_t len)
+{
+	struct bt_hci_acl_hdr *hdr;
+	uint8_t *pkt_data;
+	uint16_t flags;
+
+	pkt_data = malloc(len);
+	if (!pkt_data)
+		return;
+
+	memcpy(pkt_data, data, len);
+
+	/* Keep the boundary and broadcast flags, but use the handle the
+	 * receiving controller knows the connection by */
+	hdr = (void *) (pkt_data + 1);
+	flags = le16_to_cpu(hdr->handle) & 0xf000;
+	hdr->handle = cpu_to_le16(conn->handle | flags);
+
+	send_packet(conn->dev, pkt_data, len);
+
+	free(pkt_data);
+}
+
+static void link_schedule(struct btdev_conn *conn)
+{
+	uint64_t next = UINT64_MAX, now;
+
+	if (conn->tx_unreported)
+		next = conn->tx_unreported->complete;
+
+	if (conn->tx_head && conn->tx_head->arrival < next)
+		next = conn->tx_head->arrival;
+
+	if (next == UINT64_MAX)
+		return;
+
+	now = get_usec();
+
+	mainloop_modify_timeout_ms(conn->timeout_id,
+				next > now ? (next - now + 999) / 1000 : 1);
+}
+
+static void link_timeout(int id, void *user_data)
+{
+	struct btdev_conn *conn = user_data;
+	uint64_t now = get_usec();
+	uint16_t count = 0;
+
+	while (conn->tx_unreported && conn->tx_unreported->complete <= now) {
+		conn->tx_unreported = conn->tx_unreported->next;
+		count++;
+	}
+
+	if (count > 0) {
+		conn->dev->acl_pending -= count;
+		num_completed_packets(conn->dev, conn->handle, count);
 	}
+
+	while (conn->tx_head && conn->tx_head->arrival <= now) {
+		struct btdev_pkt *pkt = conn->tx_head;
+
+		conn->tx_head = pkt->next;
+		if (!conn->tx_head)
+			conn->tx_tail = NULL;
+
+		send_acl(conn->peer, pkt->data, pkt->len);
+
+		free(pkt);
+	}
+
+	link_schedule(conn);
+}
+
+static struct btdev_conn *conn_new(struct btdev *btdev, uint8_t link_type)
+{
+	struct btdev_conn *conn;
+	uint16_t i;
+
+	for (i = 0; i < btdev->conn_size; i++) {
+		if (!btdev->conns[i])
+			break;
+	}
+
+	if (i == btdev->conn_size) {
+		struct btdev_conn **conns;
+		uint16_t size = btdev->conn_size ? btdev->conn_size * 2 : 8;
+
+		if (size > MAX_HANDLE)
+			size = MAX_HANDLE;
+
+		if (i >= size)
+			return NULL;
+
+		conns = realloc(btdev->conns, size * sizeof(*conns));
+		if (!conns)
+			return NULL;
+
+		memset(conns + btdev->conn_size, 0,
+				(size - btdev->conn_size) * sizeof(*conns));
+
+		btdev->conns = conns;
+		btdev->conn_size = size;
+	}
+
+	conn = malloc(sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	memset(conn, 0, sizeof(*conn));
+	conn->dev = btdev;
+	conn->handle = i + 1;
+	conn->link_type = link_type;
+	conn->timeout_id = -1;
+
+	if (link_latency || link_bandwidth) {
+		conn->timeout_id = mainloop_add_timeout_ms(0, link_timeout,
+								conn, NULL);
+		if (conn->timeout_id < 0) {
+			free(conn);
+			return NULL;
+		}
+	}
+
+	btdev->conns[i] = conn;
+
+	return conn;
+}
+
+static void conn_free(struct btdev_conn *conn)
+{
+	struct btdev *btdev = conn->dev;
+	struct btdev_pkt *pkt;
+
+	/* Buffers of packets not yet completed are returned to the host
+	 * implicitly by the disconnection */
+	for (pkt = conn->tx_unreported; pkt; pkt = pkt->next)
+		btdev->acl_pending--;
+
+	while (conn->tx_head) {
+		pkt = conn->tx_head;
+		conn->tx_head = pkt->next;
+		free(pkt);
+	}
+
+	if (conn->timeout_id >= 0)
+		mainloop_remove_timeout(conn->timeout_id);
+
+	btdev->conns[conn->handle - 1] = NULL;
+
+	free(conn);
+}
+
+static struct btdev_conn *conn_link(struct btdev *btdev,
+					struct btdev *remote, uint8_t link_type)
+{
+	struct btdev_conn *conn, *peer;
+
+	conn = conn_new(btdev, link_type);
+	if (!conn)
+		return NULL;
+
+	peer = conn_new(remote, link_type);
+	if (!peer) {
+		conn_free(conn);
+		return NULL;
+	}
+
+	conn->peer = peer;
+	peer->peer = conn;
+
+	return conn;
+}
+
+static void conn_unlink(struct btdev_conn *conn)
+{
+	conn_free(conn->peer);
+	conn_free(conn);
+}
+
+static struct btdev_conn *find_conn(struct btdev *btdev, uint16_t handle)
+{
+	if (handle < 1 || handle > btdev->conn_size)
+		return NULL;
+
+	return btdev->conns[handle - 1];
+}
+
+static struct btdev_conn *find_conn_by_bdaddr(struct btdev *btdev,
+				const uint8_t *bdaddr, uint8_t link_type)
+{
+	uint16_t i;
+
+	for (i = 0; i < btdev->conn_size; i++) {
+		struct btdev_conn *conn = btdev->conns[i];
+
+		if (!conn || conn->link_type != link_type)
+			continue;
+
+		if (!memcmp(conn->peer->dev->bdaddr, bdaddr, 6))
+			return conn;
+	}
+
+	return NULL;
 }
 
 static void inquiry_complete(struct btdev *btdev, uint8_t status)
 {
 	struct bt_hci_evt_inquiry_complete ic;
-	int i;
+	struct btdev *remote;
 
-	for (i = 0; i < MAX_BTDEV_ENTRIES; i++) {
-		if (!btdev_list[i] || btdev_list[i] == btdev)
+	for (remote = btdev_list; remote; remote = remote->next) {
+		if (remote == btdev)
 			continue;
 
-		if (!(btdev_list[i]->scan_enable & 0x02))
+		if (!(remote->scan_enable & 0x02))
 			continue;
 
 		if (btdev->inquiry_mode == 0x02 &&
-					btdev_list[i]->ext_inquiry_rsp[0]) {
+					remote->ext_inquiry_rsp[0]) {
 			struct bt_hci_evt_ext_inquiry_result ir;
 
 			ir.num_resp = 0x01;
-			memcpy(ir.bdaddr, btdev_list[i]->bdaddr, 6);
-			memcpy(ir.dev_class, btdev_list[i]->dev_class, 3);
+			memcpy(ir.bdaddr, remote->bdaddr, 6);
+			memcpy(ir.dev_class, remote->dev_class, 3);
 			ir.rssi = -60;
-			memcpy(ir.data, btdev_list[i]->ext_inquiry_rsp, 240);
+			memcpy(ir.data, remote->ext_inquiry_rsp, 240);
 
 			send_event(btdev, BT_HCI_EVT_EXT_INQUIRY_RESULT,
 							&ir, sizeof(ir));
@@ -362,8 +653,8 @@ static void inquiry_complete(struct btdev *btdev, uint8_t status)
 			struct bt_hci_evt_inquiry_result_with_rssi ir;
 
 			ir.num_resp = 0x01;
-			memcpy(ir.bdaddr, btdev_list[i]->bdaddr, 6);
-			memcpy(ir.dev_class, btdev_list[i]->dev_class, 3);
+			memcpy(ir.bdaddr, remote->bdaddr, 6);
+			memcpy(ir.dev_class, remote->dev_class, 3);
 			ir.rssi = -60;
 
 			send_event(btdev, BT_HCI_EVT_INQUIRY_RESULT_WITH_RSSI,
@@ -372,13 +663,13 @@ static void inquiry_complete(struct btdev *btdev, uint8_t status)
 			struct bt_hci_evt_inquiry_result ir;
 
 			ir.num_resp = 0x01;
-			memcpy(ir.bdaddr, btdev_list[i]->bdaddr, 6);
-			memcpy(ir.dev_class, btdev_list[i]->dev_class, 3);
+			memcpy(ir.bdaddr, remote->bdaddr, 6);
+			memcpy(ir.dev_class, remote->dev_class, 3);
 
 			send_event(btdev, BT_HCI_EVT_INQUIRY_RESULT,
 							&ir, sizeof(ir));
 		}
-        }
+	}
 
 	ic.status = status;
 
@@ -392,22 +683,31 @@ static void conn_complete(struct btdev *btdev,
 
 	if (!status) {
 		struct btdev *remote = find_btdev_by_bdaddr(bdaddr);
+		struct btdev_conn *conn = NULL;
 
-		btdev->conn = remote;
-		remote->conn = btdev;
+		if (remote)
+			conn = conn_link(btdev, remote, LINK_ACL);
 
-		cc.status = status;
-		memcpy(cc.bdaddr, btdev->bdaddr, 6);
-		cc.encr_mode = 0x00;
+		if (conn) {
+			cc.status = status;
+			memcpy(cc.bdaddr, btdev->bdaddr, 6);
+			cc.encr_mode = 0x00;
 
-		cc.handle = cpu_to_le16(42);
-		cc.link_type = 0x01;
+			cc.handle = cpu_to_le16(conn->peer->handle);
+			cc.link_type = 0x01;
 
-		send_event(remote, BT_HCI_EVT_CONN_COMPLETE, &cc, sizeof(cc));
+			send_event(remote, BT_HCI_EVT_CONN_COMPLETE,
+							&cc, sizeof(cc));
 
-		cc.handle = cpu_to_le16(42);
-		cc.link_type = 0x01;
-	} else {
+			cc.handle = cpu_to_le16(conn->handle);
+			cc.link_type = 0x01;
+		} else if (remote) {
+			status = BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+		} else
+			status = BT_HCI_ERR_UNKNOWN_CONN_ID;
+	}
+
+	if (status) {
 		cc.handle = cpu_to_le16(0x0000);
 		cc.link_type = 0x01;
 	}
@@ -423,6 +723,11 @@ static void conn_request(struct btdev *btdev, const uint8_t *bdaddr)
 {
 	struct btdev *remote = find_btdev_by_bdaddr(bdaddr);
 
+	if (find_conn_by_bdaddr(btdev, bdaddr, LINK_ACL)) {
+		conn_complete(btdev, bdaddr, BT_HCI_ERR_CONN_ALREADY_EXISTS);
+		return;
+	}
+
 	if (remote) {
 		if (remote->scan_enable & 0x01) {
 			struct bt_hci_evt_conn_request cr;
@@ -439,33 +744,323 @@ static void conn_request(struct btdev *btdev, const uint8_t *bdaddr)
 		conn_complete(btdev, bdaddr, BT_HCI_ERR_UNKNOWN_CONN_ID);
 }
 
+static void conn_reject(struct btdev *btdev, const uint8_t *bdaddr,
+							uint8_t reason)
+{
+	struct btdev *remote = find_btdev_by_bdaddr(bdaddr);
+
+	/* The rejection is reported to the device that paged */
+	if (remote)
+		conn_complete(remote, btdev->bdaddr, reason);
+}
+
 static void disconnect_complete(struct btdev *btdev, uint16_t handle,
 							uint8_t reason)
 {
 	struct bt_hci_evt_disconnect_complete dc;
-	struct btdev *remote;
+	struct btdev_conn *conn;
 
-	if (!btdev) {
-		dc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
-		dc.handle = cpu_to_le16(handle);
-		dc.reason = 0x00;
+	conn = find_conn(btdev, handle);
+	if (!conn)
+		return;
+
+	dc.status = BT_HCI_ERR_SUCCESS;
+	dc.handle = cpu_to_le16(conn->handle);
+	dc.reason = BT_HCI_ERR_LOCAL_HOST_TERM;
 
-		send_event(btdev, BT_HCI_EVT_DISCONNECT_COMPLETE,
+	send_event(btdev, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
+
+	dc.handle = cpu_to_le16(conn->peer->handle);
+	dc.reason = reason;
+
+	send_event(conn->peer->dev, BT_HCI_EVT_DISCONNECT_COMPLETE,
 							&dc, sizeof(dc));
+
+	conn_unlink(conn);
+}
+
+static void le_meta_event(struct btdev *btdev, const void *data, uint8_t len)
+{
+	send_event(btdev, BT_HCI_EVT_LE_META_EVENT, data, len);
+}
+
+static void le_adv_report(struct btdev *btdev, struct btdev *remote,
+				uint8_t type, const uint8_t *data, uint8_t len)
+{
+	struct bt_hci_evt_le_adv_report ar;
+
+	ar.subevent = BT_HCI_EVT_LE_ADV_REPORT;
+	ar.num_reports = 0x01;
+	ar.event_type = type;
+	ar.addr_type = 0x00;
+	memcpy(ar.addr, remote->bdaddr, 6);
+	ar.data_len = len;
+
+	if (len > 0)
+		memcpy(ar.data, data, len);
+
+	ar.data[len] = (uint8_t) -60;	/* RSSI */
+
+	le_meta_event(btdev, &ar, sizeof(ar) - sizeof(ar.data) + len + 1);
+}
+
+static void le_adv_deliver(struct btdev *btdev, struct btdev *remote)
+{
+	if (btdev == remote)
+		return;
+
+	/* Directed advertising is only seen by its target */
+	if (remote->le_adv_type == 0x01) {
+		if (!memcmp(remote->le_adv_direct_addr, btdev->bdaddr, 6))
+			le_adv_report(btdev, remote, 0x01, NULL, 0);
 		return;
 	}
 
-	dc.status = BT_HCI_ERR_SUCCESS;
-	dc.handle = cpu_to_le16(handle);
-	dc.reason = reason;
+	le_adv_report(btdev, remote, remote->le_adv_type,
+				remote->le_adv_data, remote->le_adv_data_len);
 
-	remote = btdev->conn;
+	if (btdev->le_scan_type == 0x01 && (remote->le_adv_type == 0x00 ||
+						remote->le_adv_type == 0x02))
+		le_adv_report(btdev, remote, 0x04, remote->le_scan_rsp,
+						remote->le_scan_rsp_len);
+}
 
-	btdev->conn = NULL;
-	remote->conn = NULL;
+static void le_adv_broadcast(struct btdev *btdev, uint8_t periodic)
+{
+	struct btdev *scanner;
 
-	send_event(btdev, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
-	send_event(remote, BT_HCI_EVT_DISCONNECT_COMPLETE, &dc, sizeof(dc));
+	for (scanner = scan_list; scanner; scanner = scanner->scan_next) {
+		/* Duplicate filtering hides repeated advertising */
+		if (periodic && scanner->le_filter_dup)
+			continue;
+
+		le_adv_deliver(scanner, btdev);
+	}
+}
+
+static unsigned int le_adv_interval_ms(struct btdev *btdev)
+{
+	unsigned int msec = btdev->le_adv_interval * 5 / 8;
+
+	return msec > 0 ? msec : 1;
+}
+
+static void le_adv_callback(int id, void *user_data)
+{
+	struct btdev *btdev = user_data;
+
+	le_adv_broadcast(btdev, 0x01);
+
+	mainloop_modify_timeout_ms(id, le_adv_interval_ms(btdev));
+}
+
+static int le_adv_connectable(struct btdev *btdev, struct btdev *initiator)
+{
+	if (!btdev->le_adv_enable)
+		return 0;
+
+	switch (btdev->le_adv_type) {
+	case 0x00:
+		return 1;
+	case 0x01:
+		return !memcmp(btdev->le_adv_direct_addr,
+						initiator->bdaddr, 6);
+	}
+
+	return 0;
+}
+
+static void le_adv_stop(struct btdev *btdev)
+{
+	struct btdev **ptr;
+
+	if (!btdev->le_adv_enable)
+		return;
+
+	btdev->le_adv_enable = 0x00;
+
+	for (ptr = &adv_list; *ptr; ptr = &(*ptr)->adv_next) {
+		if (*ptr == btdev) {
+			*ptr = btdev->adv_next;
+			break;
+		}
+	}
+
+	if (btdev->le_adv_timeout >= 0) {
+		mainloop_remove_timeout(btdev->le_adv_timeout);
+		btdev->le_adv_timeout = -1;
+	}
+}
+
+static void le_conn_complete(struct btdev *btdev, struct btdev *remote)
+{
+	struct bt_hci_evt_le_conn_complete cc;
+	struct btdev_conn *conn;
+
+	btdev->le_conn_pending = 0x00;
+
+	memset(&cc, 0, sizeof(cc));
+	cc.subevent = BT_HCI_EVT_LE_CONN_COMPLETE;
+
+	conn = conn_link(btdev, remote, LINK_LE);
+	if (!conn) {
+		cc.status = BT_HCI_ERR_MEM_CAPACITY_EXCEEDED;
+		memcpy(cc.peer_addr, remote->bdaddr, 6);
+		le_meta_event(btdev, &cc, sizeof(cc));
+		return;
+	}
+
+	/* Advertising ends with the connection it was accepting */
+	le_adv_stop(remote);
+
+	cc.status = BT_HCI_ERR_SUCCESS;
+	cc.peer_addr_type = 0x00;
+	cc.interval = cpu_to_le16(btdev->le_conn_interval);
+	cc.latency = cpu_to_le16(btdev->le_conn_latency);
+	cc.supv_timeout = cpu_to_le16(btdev->le_conn_supv_timeout);
+
+	cc.handle = cpu_to_le16(conn->handle);
+	cc.role = 0x00;
+	memcpy(cc.peer_addr, remote->bdaddr, 6);
+
+	le_meta_event(btdev, &cc, sizeof(cc));
+
+	cc.handle = cpu_to_le16(conn->peer->handle);
+	cc.role = 0x01;
+	memcpy(cc.peer_addr, btdev->bdaddr, 6);
+
+	le_meta_event(remote, &cc, sizeof(cc));
+}
+
+static void le_adv_start(struct btdev *btdev)
+{
+	struct btdev *initiator;
+
+	if (btdev->le_adv_enable)
+		return;
+
+	btdev->le_adv_timeout = mainloop_add_timeout_ms(
+					le_adv_interval_ms(btdev),
+					le_adv_callback, btdev, NULL);
+
+	btdev->le_adv_enable = 0x01;
+	btdev->adv_next = adv_list;
+	adv_list = btdev;
+
+	le_adv_broadcast(btdev, 0x00);
+
+	/* Complete a connection that was waiting for this device */
+	for (initiator = btdev_list; initiator; initiator = initiator->next) {
+		if (!initiator->le_conn_pending)
+			continue;
+
+		if (memcmp(initiator->le_conn_addr, btdev->bdaddr, 6))
+			continue;
+
+		if (!le_adv_connectable(btdev, initiator))
+			continue;
+
+		le_conn_complete(initiator, btdev);
+		break;
+	}
+}
+
+static void le_scan_start(struct btdev *btdev)
+{
+	struct btdev *remote;
+
+	if (btdev->le_scan_enable)
+		return;
+
+	btdev->le_scan_enable = 0x01;
+	btdev->scan_next = scan_list;
+	scan_list = btdev;
+
+	for (remote = adv_list; remote; remote = remote->adv_next)
+		le_adv_deliver(btdev, remote);
+}
+
+static void le_scan_stop(struct btdev *btdev)
+{
+	struct btdev **ptr;
+
+	if (!btdev->le_scan_enable)
+		return;
+
+	btdev->le_scan_enable = 0x00;
+
+	for (ptr = &scan_list; *ptr; ptr = &(*ptr)->scan_next) {
+		if (*ptr == btdev) {
+			*ptr = btdev->scan_next;
+			break;
+		}
+	}
+}
+
+static void le_create_conn(struct btdev *btdev,
+				const struct bt_hci_cmd_le_create_conn *cmd)
+{
+	struct btdev *remote;
+
+	memcpy(btdev->le_conn_addr, cmd->peer_addr, 6);
+	btdev->le_conn_interval = le16_to_cpu(cmd->min_interval);
+	btdev->le_conn_latency = le16_to_cpu(cmd->latency);
+	btdev->le_conn_supv_timeout = le16_to_cpu(cmd->supv_timeout);
+	btdev->le_conn_pending = 0x01;
+
+	/* Otherwise it completes once the device starts advertising */
+	remote = find_btdev_by_bdaddr(cmd->peer_addr);
+	if (remote && le_adv_connectable(remote, btdev))
+		le_conn_complete(btdev, remote);
+}
+
+static void le_create_conn_cancel(struct btdev *btdev)
+{
+	struct bt_hci_evt_le_conn_complete cc;
+
+	btdev->le_conn_pending = 0x00;
+
+	memset(&cc, 0, sizeof(cc));
+	cc.subevent = BT_HCI_EVT_LE_CONN_COMPLETE;
+	cc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
+	memcpy(cc.peer_addr, btdev->le_conn_addr, 6);
+
+	le_meta_event(btdev, &cc, sizeof(cc));
+}
+
+void btdev_destroy(struct btdev *btdev)
+{
+	uint16_t i;
+
+	if (!btdev)
+		return;
+
+	le_adv_stop(btdev);
+	le_scan_stop(btdev);
+
+	/* For the remote devices the links just time out */
+	for (i = 0; i < btdev->conn_size; i++) {
+		struct btdev_conn *conn = btdev->conns[i];
+		struct bt_hci_evt_disconnect_complete dc;
+
+		if (!conn)
+			continue;
+
+		dc.status = BT_HCI_ERR_SUCCESS;
+		dc.handle = cpu_to_le16(conn->peer->handle);
+		dc.reason = BT_HCI_ERR_CONN_TIMEOUT;
+
+		send_event(conn->peer->dev, BT_HCI_EVT_DISCONNECT_COMPLETE,
+							&dc, sizeof(dc));
+
+		conn_unlink(conn);
+	}
+
+	free(btdev->conns);
+
+	del_btdev(btdev);
+
+	free(btdev);
 }
 
 static void name_request_complete(struct btdev *btdev,
@@ -493,11 +1088,12 @@ static void name_request_complete(struct btdev *btdev,
 static void remote_features_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_evt_remote_features_complete rfc;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
-	if (btdev->conn) {
+	if (conn) {
 		rfc.status = BT_HCI_ERR_SUCCESS;
 		rfc.handle = cpu_to_le16(handle);
-		memcpy(rfc.features, btdev->conn->features, 8);
+		memcpy(rfc.features, conn->peer->dev->features, 8);
 	} else {
 		rfc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		rfc.handle = cpu_to_le16(handle);
@@ -512,8 +1108,9 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 								uint8_t page)
 {
 	struct bt_hci_evt_remote_ext_features_complete refc;
+	struct btdev_conn *conn = find_conn(btdev, handle);
 
-	if (btdev->conn && page < 0x02) {
+	if (conn && page < 0x02) {
 		refc.handle = cpu_to_le16(handle);
 		refc.page = page;
 		refc.max_page = 0x01;
@@ -521,7 +1118,7 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 		switch (page) {
 		case 0x00:
 			refc.status = BT_HCI_ERR_SUCCESS;
-			memcpy(refc.features, btdev->conn->features, 8);
+			memcpy(refc.features, conn->peer->dev->features, 8);
 			break;
 		case 0x01:
 			refc.status = BT_HCI_ERR_SUCCESS;
@@ -547,13 +1144,16 @@ static void remote_ext_features_complete(struct btdev *btdev, uint16_t handle,
 static void remote_version_complete(struct btdev *btdev, uint16_t handle)
 {
 	struct bt_hci_evt_remote_version_complete rvc;
+	struct btdev_conn *conn = find_conn(btdev, handle);
+
+	if (conn) {
+		struct btdev *remote = conn->peer->dev;
 
-	if (btdev->conn) {
 		rvc.status = BT_HCI_ERR_SUCCESS;
 		rvc.handle = cpu_to_le16(handle);
-		rvc.lmp_ver = btdev->conn->version;
-		rvc.manufacturer = cpu_to_le16(btdev->conn->manufacturer);
-		rvc.lmp_subver = cpu_to_le16(btdev->conn->revision);
+		rvc.lmp_ver = remote->version;
+		rvc.manufacturer = cpu_to_le16(remote->manufacturer);
+		rvc.lmp_subver = cpu_to_le16(remote->revision);
 	} else {
 		rvc.status = BT_HCI_ERR_UNKNOWN_CONN_ID;
 		rvc.handle = cpu_to_le16(handle);
@@ -595,6 +1195,14 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	const struct bt_hci_cmd_write_simple_pairing_mode *wspm;
 	const struct bt_hci_cmd_write_le_host_supported *wlhs;
 	const struct bt_hci_cmd_le_set_event_mask *lsem;
+	const struct bt_hci_cmd_le_set_random_address *lsra;
+	const struct bt_hci_cmd_le_set_adv_parameters *lsap;
+	const struct bt_hci_cmd_le_set_adv_data *lsad;
+	const struct bt_hci_cmd_le_set_scan_rsp_data *lssrd;
+	const struct bt_hci_cmd_le_set_adv_enable *lsae;
+	const struct bt_hci_cmd_le_set_scan_parameters *lssp;
+	const struct bt_hci_cmd_le_set_scan_enable *lsse;
+	const struct bt_hci_cmd_le_create_conn *lcc;
 	struct bt_hci_rsp_read_default_link_policy rdlp;
 	struct bt_hci_rsp_read_stored_link_key rslk;
 	struct bt_hci_rsp_write_stored_link_key wslk;
@@ -623,6 +1231,8 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	struct bt_hci_rsp_le_read_buffer_size lrbs;
 	struct bt_hci_rsp_le_read_local_features lrlf;
 	struct bt_hci_rsp_le_read_supported_states lrss;
+	struct bt_hci_rsp_le_read_adv_tx_power lratp;
+	struct bt_hci_rsp_le_read_white_list_size lrwls;
 	uint16_t opcode;
 	uint8_t status, page;
 
@@ -650,6 +1260,10 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 
 	case BT_HCI_CMD_DISCONNECT:
 		dc = data + sizeof(*hdr);
+		if (!find_conn(btdev, le16_to_cpu(dc->handle))) {
+			cmd_status(btdev, BT_HCI_ERR_UNKNOWN_CONN_ID, opcode);
+			break;
+		}
 		cmd_status(btdev, BT_HCI_ERR_SUCCESS, opcode);
 		disconnect_complete(btdev, le16_to_cpu(dc->handle), dc->reason);
 		break;
@@ -669,7 +1283,7 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	case BT_HCI_CMD_REJECT_CONN_REQUEST:
 		rcr = data + sizeof(*hdr);
 		cmd_status(btdev, BT_HCI_ERR_SUCCESS, opcode);
-		conn_complete(btdev, rcr->bdaddr, BT_HCI_ERR_UNKNOWN_CONN_ID);
+		conn_reject(btdev, rcr->bdaddr, rcr->reason);
 		break;
 
 	case BT_HCI_CMD_REMOTE_NAME_REQUEST:
@@ -1024,14 +1638,110 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 		cmd_complete(btdev, opcode, &lrlf, sizeof(lrlf));
 		break;
 
+	case BT_HCI_CMD_LE_SET_RANDOM_ADDRESS:
+		lsra = data + sizeof(*hdr);
+		memcpy(btdev->le_random_addr, lsra->addr, 6);
+		status = BT_HCI_ERR_SUCCESS;
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		break;
+
+	case BT_HCI_CMD_LE_SET_ADV_PARAMETERS:
+		lsap = data + sizeof(*hdr);
+		if (btdev->le_adv_enable) {
+			status = BT_HCI_ERR_COMMAND_DISALLOWED;
+			cmd_complete(btdev, opcode, &status, sizeof(status));
+			break;
+		}
+		btdev->le_adv_interval = le16_to_cpu(lsap->min_interval);
+		btdev->le_adv_type = lsap->type;
+		memcpy(btdev->le_adv_direct_addr, lsap->direct_addr, 6);
+		status = BT_HCI_ERR_SUCCESS;
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		break;
+
+	case BT_HCI_CMD_LE_READ_ADV_TX_POWER:
+		lratp.status = BT_HCI_ERR_SUCCESS;
+		lratp.level = 0;
+		cmd_complete(btdev, opcode, &lratp, sizeof(lratp));
+		break;
+
+	case BT_HCI_CMD_LE_SET_ADV_DATA:
+		lsad = data + sizeof(*hdr);
+		btdev->le_adv_data_len = lsad->len < 31 ? lsad->len : 31;
+		memcpy(btdev->le_adv_data, lsad->data, 31);
+		status = BT_HCI_ERR_SUCCESS;
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		if (btdev->le_adv_enable)
+			le_adv_broadcast(btdev, 0x00);
+		break;
+
+	case BT_HCI_CMD_LE_SET_SCAN_RSP_DATA:
+		lssrd = data + sizeof(*hdr);
+		btdev->le_scan_rsp_len = lssrd->len < 31 ? lssrd->len : 31;
+		memcpy(btdev->le_scan_rsp, lssrd->data, 31);
+		status = BT_HCI_ERR_SUCCESS;
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		break;
+
+	case BT_HCI_CMD_LE_SET_ADV_ENABLE:
+		lsae = data + sizeof(*hdr);
+		status = BT_HCI_ERR_SUCCESS;
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		if (lsae->enable)
+			le_adv_start(btdev);
+		else
+			le_adv_stop(btdev);
+		break;
+
 	case BT_HCI_CMD_LE_SET_SCAN_PARAMETERS:
+		lssp = data + sizeof(*hdr);
+		if (btdev->le_scan_enable) {
+			status = BT_HCI_ERR_COMMAND_DISALLOWED;
+			cmd_complete(btdev, opcode, &status, sizeof(status));
+			break;
+		}
+		btdev->le_scan_type = lssp->type;
 		status = BT_HCI_ERR_SUCCESS;
 		cmd_complete(btdev, opcode, &status, sizeof(status));
 		break;
 
 	case BT_HCI_CMD_LE_SET_SCAN_ENABLE:
+		lsse = data + sizeof(*hdr);
+		btdev->le_filter_dup = lsse->filter_dup;
 		status = BT_HCI_ERR_SUCCESS;
 		cmd_complete(btdev, opcode, &status, sizeof(status));
+		if (lsse->enable)
+			le_scan_start(btdev);
+		else
+			le_scan_stop(btdev);
+		break;
+
+	case BT_HCI_CMD_LE_CREATE_CONN:
+		lcc = data + sizeof(*hdr);
+		if (btdev->le_conn_pending) {
+			cmd_status(btdev, BT_HCI_ERR_COMMAND_DISALLOWED,
+								opcode);
+			break;
+		}
+		cmd_status(btdev, BT_HCI_ERR_SUCCESS, opcode);
+		le_create_conn(btdev, lcc);
+		break;
+
+	case BT_HCI_CMD_LE_CREATE_CONN_CANCEL:
+		if (!btdev->le_conn_pending) {
+			status = BT_HCI_ERR_COMMAND_DISALLOWED;
+			cmd_complete(btdev, opcode, &status, sizeof(status));
+			break;
+		}
+		status = BT_HCI_ERR_SUCCESS;
+		cmd_complete(btdev, opcode, &status, sizeof(status));
+		le_create_conn_cancel(btdev);
+		break;
+
+	case BT_HCI_CMD_LE_READ_WHITE_LIST_SIZE:
+		lrwls.status = BT_HCI_ERR_SUCCESS;
+		lrwls.size = 0;
+		cmd_complete(btdev, opcode, &lrwls, sizeof(lrwls));
 		break;
 
 	case BT_HCI_CMD_LE_READ_SUPPORTED_STATES:
@@ -1048,6 +1758,71 @@ static void process_cmd(struct btdev *btdev, const void *data, uint16_t len)
 	}
 }
 
+static void process_acl(struct btdev *btdev, const void *data, uint16_t len)
+{
+	const struct bt_hci_acl_hdr *hdr = data + 1;
+	struct btdev_conn *conn;
+	struct btdev_pkt *pkt;
+	uint16_t handle;
+	uint64_t now;
+
+	if (len < 1 + sizeof(*hdr))
+		return;
+
+	handle = le16_to_cpu(hdr->handle) & 0x0fff;
+
+	conn = find_conn(btdev, handle);
+	if (!conn) {
+		printf("ACL data for unknown handle 0x%4.4x\n", handle);
+		return;
+	}
+
+	if (conn->timeout_id < 0) {
+		send_acl(conn->peer, data, len);
+		num_completed_packets(btdev, conn->handle, 1);
+		return;
+	}
+
+	/* The host has to wait for Number Of Completed Packets */
+	if (btdev->acl_pending >= btdev->acl_max_pkt) {
+		printf("ACL buffer overflow on handle 0x%4.4x\n", handle);
+		return;
+	}
+
+	pkt = malloc(sizeof(*pkt) + len);
+	if (!pkt)
+		return;
+
+	pkt->next = NULL;
+	pkt->len = len;
+	memcpy(pkt->data, data, len);
+
+	/* Packets of one link go out back to back at its bandwidth */
+	now = get_usec();
+	if (conn->tx_busy < now)
+		conn->tx_busy = now;
+
+	if (link_bandwidth)
+		conn->tx_busy += len * 1000000ull / link_bandwidth;
+
+	pkt->complete = conn->tx_busy;
+	pkt->arrival = pkt->complete + link_latency * 1000ull;
+
+	if (conn->tx_tail)
+		conn->tx_tail->next = pkt;
+	else
+		conn->tx_head = pkt;
+
+	conn->tx_tail = pkt;
+
+	if (!conn->tx_unreported)
+		conn->tx_unreported = pkt;
+
+	btdev->acl_pending++;
+
+	link_schedule(conn);
+}
+
 void btdev_receive_h4(struct btdev *btdev, const void *data, uint16_t len)
 {
 	uint8_t pkt_type;
@@ -1065,9 +1840,7 @@ void btdev_receive_h4(struct btdev *btdev, const void *data, uint16_t len)
 		process_cmd(btdev, data + 1, len - 1);
 		break;
 	case BT_H4_ACL_PKT:
-		if (btdev->conn)
-			send_packet(btdev->conn, data, len);
-		num_completed_packets(btdev);
+		process_acl(btdev, data, len);
 		break;
 	default:
 		printf("Unsupported packet 0x%2.2x\n", pkt_type);
@@ -29,6 +29,8 @@ typedef void (*btdev_send_func) (const void *data, uint16_t len,
 
 struct btdev;
 
+void btdev_set_link_params(unsigned int latency, unsigned int bandwidth);
+
 struct btdev *btdev_create(uint16_t id);
 void btdev_destroy(struct btdev *btdev);
 
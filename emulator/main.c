@@ -27,10 +27,13 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
 
 #include "mainloop.h"
 #include "server.h"
 #include "vhci.h"
+#include "btdev.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -42,14 +45,62 @@ static void signal_callback(int signum, void *user_data)
 	}
 }
 
+static void usage(void)
+{
+	printf("btvirt - Bluetooth emulator\n"
+		"Usage:\n");
+	printf("\tbtvirt [options]\n");
+	printf("options:\n"
+		"\t-l, --latency <msec>     Delay of ACL data between devices\n"
+		"\t-b, --bandwidth <bytes>  ACL bytes per second of each link\n"
+		"\t-e, --events <n>         Events handled per loop iteration\n"
+		"\t-h, --help               Show help options\n");
+}
+
+static const struct option main_options[] = {
+	{ "latency",	required_argument, NULL, 'l'	},
+	{ "bandwidth",	required_argument, NULL, 'b'	},
+	{ "events",	required_argument, NULL, 'e'	},
+	{ "help",	no_argument,	   NULL, 'h'	},
+	{ }
+};
+
 int main(int argc, char *argv[])
 {
 	struct vhci *vhci;
 	struct server *server;
+	unsigned int latency = 0, bandwidth = 0;
 	sigset_t mask;
 
 	mainloop_init();
 
+	for (;;) {
+		int opt;
+
+		opt = getopt_long(argc, argv, "l:b:e:h", main_options, NULL);
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'l':
+			latency = atoi(optarg);
+			break;
+		case 'b':
+			bandwidth = atoi(optarg);
+			break;
+		case 'e':
+			mainloop_set_batch_size(atoi(optarg));
+			break;
+		case 'h':
+			usage();
+			return 0;
+		default:
+			return 1;
+		}
+	}
+
+	btdev_set_link_params(latency, bandwidth);
+
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
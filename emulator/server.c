@@ -46,6 +46,7 @@
 
 struct server {
 	uint16_t id;
+	uint16_t next_id;
 	int fd;
 };
 
@@ -114,6 +115,7 @@ again:
 
 	while (count > 0) {
 		hci_command_hdr *cmd_hdr;
+		hci_acl_hdr *acl_hdr;
 
 		if (!client->pkt_data) {
 			client->pkt_type = ptr[0];
@@ -130,6 +132,17 @@ again:
 				client->pkt_data = malloc(client->pkt_expect);
 				client->pkt_len = 0;
 				break;
+			case HCI_ACLDATA_PKT:
+				if (count < HCI_ACL_HDR_SIZE + 1) {
+					client->pkt_offset += len;
+					return;
+				}
+				acl_hdr = (hci_acl_hdr *) (ptr + 1);
+				client->pkt_expect = HCI_ACL_HDR_SIZE +
+						btohs(acl_hdr->dlen) + 1;
+				client->pkt_data = malloc(client->pkt_expect);
+				client->pkt_len = 0;
+				break;
 			default:
 				printf("packet error\n");
 				return;
@@ -203,7 +216,8 @@ static void server_accept_callback(int fd, uint32_t events, void *user_data)
 		return;
 	}
 
-	client->btdev = btdev_create(server->id);
+	/* Every client is a separate device with its own address */
+	client->btdev = btdev_create(server->id + server->next_id++);
 	if (!client->btdev) {
 		close(client->fd);
 		free(client);
@@ -70,7 +70,6 @@ static uint128_t bluetooth_base_uuid = {
 static sdp_data_t *sdp_copy_seq(sdp_data_t *data);
 static int sdp_attr_add_new_with_length(sdp_record_t *rec,
 	uint16_t attr, uint8_t dtd, const void *value, uint32_t len);
-static int sdp_gen_buffer(sdp_buf_t *buf, sdp_data_t *d);
 
 /* Message structure. */
 struct tupla {
@@ -633,7 +632,7 @@ void sdp_set_seq_len(uint8_t *ptr, uint32_t length)
 	}
 }
 
-static int sdp_get_data_type(sdp_buf_t *buf, uint8_t dtd)
+static int sdp_get_data_type(uint8_t dtd)
 {
 	int data_type = 0;
 
@@ -660,9 +659,6 @@ static int sdp_get_data_type(sdp_buf_t *buf, uint8_t dtd)
 		break;
 	}
 
-	if (!buf->data)
-		buf->buf_size += data_type;
-
 	return data_type;
 }
 
@@ -672,7 +668,7 @@ static int sdp_set_data_type(sdp_buf_t *buf, uint8_t dtd)
 	uint8_t *p = buf->data + buf->data_size;
 
 	*p = dtd;
-	data_type = sdp_get_data_type(buf, dtd);
+	data_type = sdp_get_data_type(dtd);
 	buf->data_size += data_type;
 
 	return data_type;
@@ -689,25 +685,13 @@ void sdp_set_attrid(sdp_buf_t *buf, uint16_t attr)
 	buf->data_size += sizeof(uint16_t);
 }
 
-static int get_data_size(sdp_buf_t *buf, sdp_data_t *sdpdata)
-{
-	sdp_data_t *d;
-	int n = 0;
-
-	for (d = sdpdata->val.dataseq; d; d = d->next) {
-		if (buf->data)
-			n += sdp_gen_pdu(buf, d);
-		else
-			n += sdp_gen_buffer(buf, d);
-	}
-
-	return n;
-}
+static uint32_t sdp_get_pdu_size(const sdp_data_t *d);
 
-static int sdp_get_data_size(sdp_buf_t *buf, sdp_data_t *d)
+static uint32_t sdp_get_data_size(const sdp_data_t *d)
 {
 	uint32_t data_size = 0;
 	uint8_t dtd = d->dtd;
+	const sdp_data_t *seq;
 
 	switch (dtd) {
 	case SDP_DATA_NIL:
@@ -754,12 +738,11 @@ static int sdp_get_data_size(sdp_buf_t *buf, sdp_data_t *d)
 	case SDP_SEQ8:
 	case SDP_SEQ16:
 	case SDP_SEQ32:
-		data_size = get_data_size(buf, d);
-		break;
 	case SDP_ALT8:
 	case SDP_ALT16:
 	case SDP_ALT32:
-		data_size = get_data_size(buf, d);
+		for (seq = d->val.dataseq; seq; seq = seq->next)
+			data_size += sdp_get_pdu_size(seq);
 		break;
 	case SDP_UUID16:
 		data_size = sizeof(uint16_t);
@@ -774,34 +757,28 @@ static int sdp_get_data_size(sdp_buf_t *buf, sdp_data_t *d)
 		break;
 	}
 
-	if (!buf->data)
-		buf->buf_size += data_size;
-
 	return data_size;
 }
 
-static int sdp_gen_buffer(sdp_buf_t *buf, sdp_data_t *d)
+/*
+ * Exact number of bytes sdp_gen_pdu() will emit for this element,
+ * computed in a single walk over the tree so that callers can size
+ * the destination buffer up front.
+ */
+static uint32_t sdp_get_pdu_size(const sdp_data_t *d)
 {
-	int orig = buf->buf_size;
-
-	if (buf->buf_size == 0 && d->dtd == 0) {
-		/* create initial sequence */
-		buf->buf_size += sizeof(uint8_t);
-
-		/* reserve space for sequence size */
-		buf->buf_size += sizeof(uint8_t);
-	}
-
-	/* attribute length */
-	buf->buf_size += sizeof(uint8_t) + sizeof(uint16_t);
+	return sdp_get_data_type(d->dtd) + sdp_get_data_size(d);
+}
 
-	sdp_get_data_type(buf, d->dtd);
-	sdp_get_data_size(buf, d);
+static int gen_seq_pdu(sdp_buf_t *buf, sdp_data_t *d)
+{
+	sdp_data_t *seq;
+	int n = 0;
 
-	if (buf->buf_size > UCHAR_MAX && d->dtd == SDP_SEQ8)
-		buf->buf_size += sizeof(uint8_t);
+	for (seq = d->val.dataseq; seq; seq = seq->next)
+		n += sdp_gen_pdu(buf, seq);
 
-	return buf->buf_size - orig;
+	return n;
 }
 
 int sdp_gen_pdu(sdp_buf_t *buf, sdp_data_t *d)
@@ -816,7 +793,10 @@ int sdp_gen_pdu(sdp_buf_t *buf, sdp_data_t *d)
 	uint8_t *seqp = buf->data + buf->data_size;
 
 	pdu_size = sdp_set_data_type(buf, dtd);
-	data_size = sdp_get_data_size(buf, d);
+
+	/* Sequences are sized while their elements are generated */
+	if (dtd < SDP_SEQ8 || dtd > SDP_ALT32)
+		data_size = sdp_get_data_size(d);
 
 	switch (dtd) {
 	case SDP_DATA_NIL:
@@ -873,12 +853,14 @@ int sdp_gen_pdu(sdp_buf_t *buf, sdp_data_t *d)
 	case SDP_SEQ16:
 	case SDP_SEQ32:
 		is_seq = 1;
+		data_size = gen_seq_pdu(buf, d);
 		sdp_set_seq_len(seqp, data_size);
 		break;
 	case SDP_ALT8:
 	case SDP_ALT16:
 	case SDP_ALT32:
 		is_alt = 1;
+		data_size = gen_seq_pdu(buf, d);
 		sdp_set_seq_len(seqp, data_size);
 		break;
 	case SDP_UUID16:
@@ -910,20 +892,49 @@ int sdp_gen_pdu(sdp_buf_t *buf, sdp_data_t *d)
 	return pdu_size;
 }
 
-static void sdp_attr_pdu(void *value, void *udata)
+static uint32_t sdp_get_attr_size(const sdp_data_t *d)
 {
-	sdp_append_to_pdu((sdp_buf_t *)udata, (sdp_data_t *)value);
+	/* attribute id followed by the attribute value */
+	return sizeof(uint8_t) + sizeof(uint16_t) + sdp_get_pdu_size(d);
 }
 
-static void sdp_attr_size(void *value, void *udata)
+static void sdp_gen_attr_pdu(sdp_buf_t *buf, sdp_data_t *d)
 {
-	sdp_gen_buffer((sdp_buf_t *)udata, (sdp_data_t *)value);
+	uint8_t *p = buf->data + buf->data_size;
+
+	*p++ = SDP_UINT16;
+	bt_put_unaligned(htons(d->attrId), (uint16_t *) p);
+	buf->data_size += sizeof(uint8_t) + sizeof(uint16_t);
+
+	sdp_gen_pdu(buf, d);
 }
 
+/*
+ * The record is sized once up front and every attribute is then
+ * generated in place, so no intermediate buffers are needed and the
+ * outer sequence header never has to be widened after the fact.
+ */
 int sdp_gen_record_pdu(const sdp_record_t *rec, sdp_buf_t *buf)
 {
+	sdp_list_t *l;
+	uint32_t size = 0;
+	uint8_t dtd;
+
 	memset(buf, 0, sizeof(sdp_buf_t));
-	sdp_list_foreach(rec->attrlist, sdp_attr_size, buf);
+
+	for (l = rec->attrlist; l; l = l->next)
+		size += sdp_get_attr_size(l->data);
+
+	/* Same sequence type sdp_append_to_buf() would end up with */
+	if (size + sizeof(uint8_t) + sizeof(uint8_t) <= UCHAR_MAX)
+		dtd = SDP_SEQ8;
+	else if (size <= USHRT_MAX)
+		dtd = SDP_SEQ16;
+	else
+		dtd = SDP_SEQ32;
+
+	if (rec->attrlist)
+		buf->buf_size = sdp_get_data_type(dtd) + size;
 
 	buf->data = malloc(buf->buf_size);
 	if (!buf->data)
@@ -931,7 +942,15 @@ int sdp_gen_record_pdu(const sdp_record_t *rec, sdp_buf_t *buf)
 	buf->data_size = 0;
 	memset(buf->data, 0, buf->buf_size);
 
-	sdp_list_foreach(rec->attrlist, sdp_attr_pdu, buf);
+	if (!rec->attrlist)
+		return 0;
+
+	sdp_set_data_type(buf, dtd);
+
+	for (l = rec->attrlist; l; l = l->next)
+		sdp_gen_attr_pdu(buf, l->data);
+
+	sdp_set_seq_len(buf->data, size);
 
 	return 0;
 }
@@ -2800,13 +2819,12 @@ void sdp_append_to_pdu(sdp_buf_t *pdu, sdp_data_t *d)
 	sdp_buf_t append;
 
 	memset(&append, 0, sizeof(sdp_buf_t));
-	sdp_gen_buffer(&append, d);
+	append.buf_size = sdp_get_attr_size(d);
 	append.data = malloc(append.buf_size);
 	if (!append.data)
 		return;
 
-	sdp_set_attrid(&append, d->attrId);
-	sdp_gen_pdu(&append, d);
+	sdp_gen_attr_pdu(&append, d);
 	sdp_append_to_buf(pdu, append.data, append.data_size);
 	free(append.data);
 }
@@ -3230,7 +3248,7 @@ static int gen_dataseq_pdu(uint8_t *dst, const sdp_list_t *seq, uint8_t dtd)
 	}
 
 	memset(&buf, 0, sizeof(sdp_buf_t));
-	sdp_gen_buffer(&buf, dataseq);
+	buf.buf_size = sdp_get_pdu_size(dataseq);
 	buf.data = malloc(buf.buf_size);
 
 	if (!buf.data) {
@@ -26,12 +26,17 @@
 #include <config.h>
 #endif
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <time.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <arpa/inet.h>
 
@@ -71,27 +76,300 @@ static const uint8_t btsnoop_id[] = { 0x62, 0x74, 0x73, 0x6e,
 				      0x6f, 0x6f, 0x70, 0x00 };
 
 static const uint32_t btsnoop_version = 1;
-static const uint32_t btsnoop_type = 1001;
+
+#define BTSNOOP_TYPE_UART	1002
+
+/* Microseconds from 0 AD to the Unix epoch */
+#define BTSNOOP_EPOCH_DELTA	(0x00E03AB44A676000ll - \
+						946684800ll * 1000000ll)
+
+/* Large enough for the biggest record plus an unwritten direct I/O block */
+#define BTSNOOP_BUF_SIZE	(128 * 1024)
+
+/* Alignment of buffer, file offsets and lengths for O_DIRECT */
+#define BTSNOOP_BLOCK_SIZE	4096
+
+#define BTSNOOP_DEFAULT_FILES	4
+#define BTSNOOP_DEFAULT_FLUSH	1000
 
 static int btsnoop_fd = -1;
 static uint16_t btsnoop_index = 0xffff;
+static uint32_t btsnoop_drops = 0;
+
+static char *btsnoop_path = NULL;
+static unsigned long btsnoop_flags = 0;
+static uint32_t btsnoop_type = BTSNOOP_TYPE_HCI;
 
-void btsnoop_open(const char *path)
+/* Records not yet written out. With O_DIRECT the buffer also holds the
+ * tail of the last partially written block, which starts at buf_offset
+ * in the file. */
+static uint8_t *btsnoop_buf = NULL;
+static size_t buf_len = 0;
+static off_t buf_offset = 0;
+
+static unsigned int flush_interval = BTSNOOP_DEFAULT_FLUSH;
+static struct timespec last_flush;
+
+static uint64_t file_size = 0;
+static time_t file_start = 0;
+
+static uint64_t rotate_size = 0;
+static unsigned int rotate_time = 0;
+static unsigned int rotate_files = BTSNOOP_DEFAULT_FILES;
+
+void btsnoop_set_flush_interval(unsigned int msec)
 {
-	if (btsnoop_fd >= 0)
+	flush_interval = msec;
+}
+
+void btsnoop_set_rotation(uint64_t size, unsigned int seconds,
+							unsigned int files)
+{
+	rotate_size = size;
+	rotate_time = seconds;
+
+	if (files > 0)
+		rotate_files = files;
+}
+
+static int write_buf(void)
+{
+	ssize_t written;
+	size_t len, full;
+
+	if (!(btsnoop_flags & BTSNOOP_FLAG_DIRECT_IO)) {
+		uint8_t *ptr = btsnoop_buf;
+
+		len = buf_len;
+
+		while (len > 0) {
+			written = write(btsnoop_fd, ptr, len);
+			if (written < 0) {
+				if (errno == EINTR)
+					continue;
+				return -errno;
+			}
+
+			ptr += written;
+			len -= written;
+		}
+
+		buf_len = 0;
+		return 0;
+	}
+
+	/* Direct I/O only takes whole blocks. The last block is written
+	 * zero padded and kept in the buffer, to be written again at the
+	 * same offset once more records are appended. */
+	len = (buf_len + BTSNOOP_BLOCK_SIZE - 1) & ~(BTSNOOP_BLOCK_SIZE - 1);
+	memset(btsnoop_buf + buf_len, 0, len - buf_len);
+
+	written = pwrite(btsnoop_fd, btsnoop_buf, len, buf_offset);
+	if (written < 0)
+		return -errno;
+
+	full = buf_len & ~(BTSNOOP_BLOCK_SIZE - 1);
+	memmove(btsnoop_buf, btsnoop_buf + full, buf_len - full);
+	buf_len -= full;
+	buf_offset += full;
+
+	return 0;
+}
+
+void btsnoop_flush(void)
+{
+	if (btsnoop_fd < 0 || buf_len == 0)
 		return;
 
-	btsnoop_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC,
+	if (write_buf() < 0)
+		buf_len = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &last_flush);
+}
+
+void btsnoop_add_drops(uint32_t count)
+{
+	btsnoop_drops += count;
+}
+
+static void append(const void *data, size_t len)
+{
+	if (buf_len + len > BTSNOOP_BUF_SIZE)
+		btsnoop_flush();
+
+	memcpy(btsnoop_buf + buf_len, data, len);
+	buf_len += len;
+	file_size += len;
+}
+
+static int create_file(void)
+{
+	struct btsnoop_hdr hdr;
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+	if (btsnoop_flags & BTSNOOP_FLAG_DIRECT_IO) {
+		btsnoop_fd = open(btsnoop_path, flags | O_DIRECT,
 				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		if (btsnoop_fd >= 0)
+			goto opened;
+
+		/* Not every file system supports it, e.g. tmpfs */
+		fprintf(stderr, "Direct I/O on %s failed, using buffered\n",
+								btsnoop_path);
+		btsnoop_flags &= ~BTSNOOP_FLAG_DIRECT_IO;
+	}
+
+	btsnoop_fd = open(btsnoop_path, flags,
+				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (btsnoop_fd < 0)
+		return -errno;
+
+opened:
+	buf_len = 0;
+	buf_offset = 0;
+	file_size = 0;
+	file_start = 0;
+
+	memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
+	hdr.version = htonl(btsnoop_version);
+	hdr.type = htonl(btsnoop_type);
+
+	append(&hdr, BTSNOOP_HDR_SIZE);
+
+	return 0;
+}
+
+static void close_file(void)
+{
+	btsnoop_flush();
+
+	/* Drop the padding of the last direct I/O block */
+	if (btsnoop_flags & BTSNOOP_FLAG_DIRECT_IO) {
+		if (ftruncate(btsnoop_fd, buf_offset + buf_len) < 0)
+			perror("Failed to truncate btsnoop file");
+	}
+
+	close(btsnoop_fd);
+	btsnoop_fd = -1;
 }
 
-void btsnoop_write(struct timeval *tv, uint16_t index, uint32_t flags,
+static char *rotated_name(unsigned int n)
+{
+	char *name;
+
+	if (n == 0)
+		return strdup(btsnoop_path);
+
+	if (asprintf(&name, "%s.%u", btsnoop_path, n) < 0)
+		return NULL;
+
+	return name;
+}
+
+/* The current file becomes <path>.1, <path>.1 becomes <path>.2 and so on,
+ * the oldest of the configured number of files is overwritten */
+static void rotate(void)
+{
+	unsigned int n;
+
+	close_file();
+
+	for (n = rotate_files - 1; n > 0; n--) {
+		char *from = rotated_name(n - 1);
+		char *to = rotated_name(n);
+
+		if (from && to)
+			rename(from, to);
+
+		free(from);
+		free(to);
+	}
+
+	if (create_file() < 0)
+		perror("Failed to rotate btsnoop file");
+}
+
+void btsnoop_open(const char *path, unsigned long flags)
+{
+	if (btsnoop_fd >= 0)
+		return;
+
+	if (posix_memalign((void **) &btsnoop_buf, BTSNOOP_BLOCK_SIZE,
+						BTSNOOP_BUF_SIZE) != 0)
+		return;
+
+	btsnoop_path = strdup(path);
+	btsnoop_flags = flags;
+
+	if (flags & BTSNOOP_FLAG_ALL_INDEXES)
+		btsnoop_type = BTSNOOP_TYPE_MONITOR;
+	else
+		btsnoop_type = BTSNOOP_TYPE_HCI;
+
+	if (create_file() < 0) {
+		free(btsnoop_path);
+		btsnoop_path = NULL;
+		free(btsnoop_buf);
+		btsnoop_buf = NULL;
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &last_flush);
+}
+
+static bool get_flags(uint16_t index, uint16_t opcode, uint32_t *flags)
+{
+	if (btsnoop_type == BTSNOOP_TYPE_MONITOR) {
+		*flags = (index << 16) | opcode;
+		return true;
+	}
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		*flags = 0x02;
+		break;
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		*flags = 0x03;
+		break;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+		*flags = 0x00;
+		break;
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+		*flags = 0x01;
+		break;
+	default:
+		return false;
+	}
+
+	/* The HCI format carries a single controller, the first one seen */
+	if (btsnoop_index == 0xffff)
+		btsnoop_index = index;
+
+	return index == btsnoop_index;
+}
+
+static bool flush_due(void)
+{
+	struct timespec now;
+	uint64_t elapsed;
+
+	if (flush_interval == 0)
+		return true;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	elapsed = (now.tv_sec - last_flush.tv_sec) * 1000ll +
+			(now.tv_nsec - last_flush.tv_nsec) / 1000000ll;
+
+	return elapsed >= flush_interval;
+}
+
+void btsnoop_write_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size)
 {
-	struct btsnoop_hdr hdr;
 	struct btsnoop_pkt pkt;
+	uint32_t flags;
 	uint64_t ts;
-	ssize_t written;
 
 	if (!tv)
 		return;
@@ -99,38 +377,38 @@ void btsnoop_write(struct timeval *tv, uint16_t index, uint32_t flags,
 	if (btsnoop_fd < 0)
 		return;
 
-	if (btsnoop_index == 0xffff) {
-		memcpy(hdr.id, btsnoop_id, sizeof(btsnoop_id));
-		hdr.version = htonl(btsnoop_version);
-		hdr.type = htonl(btsnoop_type);
+	if (!get_flags(index, opcode, &flags))
+		return;
+
+	if (file_start == 0)
+		file_start = tv->tv_sec;
 
-		written = write(btsnoop_fd, &hdr, BTSNOOP_HDR_SIZE);
-		if (written < 0)
+	if (file_size > BTSNOOP_HDR_SIZE &&
+		((rotate_size && file_size + BTSNOOP_PKT_SIZE + size >
+								rotate_size) ||
+		(rotate_time && tv->tv_sec - file_start >= rotate_time))) {
+		rotate();
+		if (btsnoop_fd < 0)
 			return;
 
-		btsnoop_index = index;
+		file_start = tv->tv_sec;
 	}
 
-	if (index != btsnoop_index)
-		return;
-
 	ts = (tv->tv_sec - 946684800ll) * 1000000ll + tv->tv_usec;
 
 	pkt.size  = htonl(size);
 	pkt.len   = htonl(size);
 	pkt.flags = htonl(flags);
-	pkt.drops = htonl(0);
+	pkt.drops = htonl(btsnoop_drops);
 	pkt.ts    = hton64(ts + 0x00E03AB44A676000ll);
 
-	written = write(btsnoop_fd, &pkt, BTSNOOP_PKT_SIZE);
-	if (written < 0)
-		return;
+	append(&pkt, BTSNOOP_PKT_SIZE);
 
-	if (data && size > 0) {
-		written = write(btsnoop_fd, data, size);
-		if (written < 0)
-			return;
-	}
+	if (data && size > 0)
+		append(data, size);
+
+	if (flush_due())
+		btsnoop_flush();
 }
 
 void btsnoop_close(void)
@@ -138,8 +416,173 @@ void btsnoop_close(void)
 	if (btsnoop_fd < 0)
 		return;
 
-	close(btsnoop_fd);
-	btsnoop_fd = -1;
+	close_file();
+
+	free(btsnoop_path);
+	btsnoop_path = NULL;
+	free(btsnoop_buf);
+	btsnoop_buf = NULL;
 
 	btsnoop_index = 0xffff;
+	btsnoop_drops = 0;
+}
+
+static bool uart_opcode(uint32_t flags, const uint8_t **data, uint32_t *len,
+							uint16_t *opcode)
+{
+	bool in = flags & 0x01;
+
+	if (*len < 1)
+		return false;
+
+	switch (**data) {
+	case 0x01:
+		*opcode = BTSNOOP_OPCODE_COMMAND_PKT;
+		break;
+	case 0x02:
+		*opcode = in ? BTSNOOP_OPCODE_ACL_RX_PKT :
+						BTSNOOP_OPCODE_ACL_TX_PKT;
+		break;
+	case 0x03:
+		*opcode = in ? BTSNOOP_OPCODE_SCO_RX_PKT :
+						BTSNOOP_OPCODE_SCO_TX_PKT;
+		break;
+	case 0x04:
+		*opcode = BTSNOOP_OPCODE_EVENT_PKT;
+		break;
+	default:
+		return false;
+	}
+
+	(*data)++;
+	(*len)--;
+
+	return true;
+}
+
+static bool record_opcode(uint32_t type, uint32_t flags, uint16_t *index,
+							uint16_t *opcode)
+{
+	switch (type) {
+	case BTSNOOP_TYPE_MONITOR:
+		*index = flags >> 16;
+		*opcode = flags & 0xffff;
+		return true;
+	case BTSNOOP_TYPE_HCI:
+		*index = 0;
+
+		switch (flags & 0x03) {
+		case 0x00:
+			*opcode = BTSNOOP_OPCODE_ACL_TX_PKT;
+			break;
+		case 0x01:
+			*opcode = BTSNOOP_OPCODE_ACL_RX_PKT;
+			break;
+		case 0x02:
+			*opcode = BTSNOOP_OPCODE_COMMAND_PKT;
+			break;
+		default:
+			*opcode = BTSNOOP_OPCODE_EVENT_PKT;
+			break;
+		}
+		return true;
+	}
+
+	return false;
+}
+
+/* Records too short for their fixed size payload, or too long for the
+ * 16 bit size of the callback, only come from damaged files */
+static bool record_size_valid(uint16_t opcode, uint32_t len)
+{
+	if (len > UINT16_MAX)
+		return false;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_NEW_INDEX:
+		/* Type, bus, address and name */
+		return len >= 16;
+	}
+
+	return true;
+}
+
+int btsnoop_read(const char *path, btsnoop_read_func func, void *user_data)
+{
+	const struct btsnoop_hdr *hdr;
+	const uint8_t *map, *ptr, *end;
+	struct stat st;
+	uint32_t type;
+	int fd, count = 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) BTSNOOP_HDR_SIZE) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -errno;
+
+	madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+
+	hdr = (const struct btsnoop_hdr *) map;
+	type = ntohl(hdr->type);
+
+	if (memcmp(hdr->id, btsnoop_id, sizeof(btsnoop_id)) ||
+				ntohl(hdr->version) != btsnoop_version ||
+				(type != BTSNOOP_TYPE_HCI &&
+					type != BTSNOOP_TYPE_UART &&
+					type != BTSNOOP_TYPE_MONITOR)) {
+		munmap((void *) map, st.st_size);
+		return -EPROTONOSUPPORT;
+	}
+
+	ptr = map + BTSNOOP_HDR_SIZE;
+	end = map + st.st_size;
+
+	while (end - ptr >= (ssize_t) BTSNOOP_PKT_SIZE) {
+		const struct btsnoop_pkt *pkt = (const void *) ptr;
+		const uint8_t *data = pkt->data;
+		uint32_t len = ntohl(pkt->len);
+		uint32_t flags = ntohl(pkt->flags);
+		uint64_t ts = ntoh64(pkt->ts);
+		uint16_t index, opcode;
+		struct timeval tv;
+
+		/* Truncated record, or the padding of a direct I/O capture
+		 * that is still being written */
+		if (ts == 0 || len > (size_t) (end - data))
+			break;
+
+		ptr = data + len;
+
+		if (type == BTSNOOP_TYPE_UART) {
+			index = 0;
+			if (!uart_opcode(flags, &data, &len, &opcode))
+				continue;
+		} else if (!record_opcode(type, flags, &index, &opcode))
+			continue;
+
+		if (!record_size_valid(opcode, len))
+			continue;
+
+		ts -= BTSNOOP_EPOCH_DELTA;
+		tv.tv_sec = ts / 1000000;
+		tv.tv_usec = ts % 1000000;
+
+		func(&tv, index, opcode, ntohl(pkt->drops), data, len,
+								user_data);
+		count++;
+	}
+
+	munmap((void *) map, st.st_size);
+
+	return count;
 }
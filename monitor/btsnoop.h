@@ -22,9 +22,38 @@
  *
  */
 
+#include <stdint.h>
 #include <sys/time.h>
 
-void btsnoop_open(const char *path);
-void btsnoop_write(struct timeval *tv, uint16_t index, uint32_t flags,
+#define BTSNOOP_TYPE_HCI		1001
+#define BTSNOOP_TYPE_MONITOR		2001
+
+#define BTSNOOP_OPCODE_NEW_INDEX	0
+#define BTSNOOP_OPCODE_DEL_INDEX	1
+#define BTSNOOP_OPCODE_COMMAND_PKT	2
+#define BTSNOOP_OPCODE_EVENT_PKT	3
+#define BTSNOOP_OPCODE_ACL_TX_PKT	4
+#define BTSNOOP_OPCODE_ACL_RX_PKT	5
+#define BTSNOOP_OPCODE_SCO_TX_PKT	6
+#define BTSNOOP_OPCODE_SCO_RX_PKT	7
+
+#define BTSNOOP_FLAG_ALL_INDEXES	(1 << 0)
+#define BTSNOOP_FLAG_DIRECT_IO		(1 << 1)
+
+void btsnoop_set_flush_interval(unsigned int msec);
+void btsnoop_set_rotation(uint64_t size, unsigned int seconds,
+							unsigned int files);
+
+void btsnoop_open(const char *path, unsigned long flags);
+void btsnoop_write_hci(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size);
+void btsnoop_add_drops(uint32_t count);
+void btsnoop_flush(void);
 void btsnoop_close(void);
+
+typedef void (*btsnoop_read_func) (struct timeval *tv, uint16_t index,
+					uint16_t opcode, uint32_t drops,
+					const void *data, uint16_t size,
+					void *user_data);
+
+int btsnoop_read(const char *path, btsnoop_read_func func, void *user_data);
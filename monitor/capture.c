@@ -0,0 +1,379 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2012  Intel Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "mainloop.h"
+#include "packet.h"
+#include "btsnoop.h"
+#include "capture.h"
+
+/* Records buffered per source, a power of two */
+#define CAPTURE_RING_SIZE	256
+
+/* How long a record waits for the other sources to catch up before it is
+ * decoded, so that records of different sources come out in time order */
+#define CAPTURE_MERGE_DELAY	20000
+
+/* Each source is read by its own thread into a single producer, single
+ * consumer ring. The main thread merges the rings by timestamp and does
+ * all decoding and writing. */
+struct capture_source {
+	struct capture_source *next;
+	int fd;
+	capture_recv_func recv;
+	capture_destroy_func destroy;
+	void *user_data;
+	pthread_t thread;
+	unsigned int head;	/* Advanced by the main thread */
+	unsigned int tail;	/* Advanced by the capture thread */
+	unsigned int drops;	/* Written by the capture thread */
+	unsigned int reported;
+	bool finished;
+	bool joined;
+	struct capture_record ring[CAPTURE_RING_SIZE];
+};
+
+static struct capture_source *sources = NULL;
+
+static int wakeup_fd = -1;
+static int stop_fd = -1;
+static int timer_id = -1;
+
+static void wakeup(void)
+{
+	uint64_t val = 1;
+
+	if (write(wakeup_fd, &val, sizeof(val)) < 0)
+		perror("Failed to wake up decoder");
+}
+
+static void *capture_thread(void *user_data)
+{
+	struct capture_source *source = user_data;
+	struct capture_record scratch;
+	struct pollfd fds[2];
+
+	fds[0].fd = source->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = stop_fd;
+	fds[1].events = POLLIN;
+
+	while (1) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+
+		if (fds[1].revents)
+			break;
+
+		if (fds[0].revents & (POLLERR | POLLHUP | POLLNVAL))
+			break;
+
+		while (1) {
+			struct capture_record *rec;
+			unsigned int tail, head;
+			int err;
+
+			tail = source->tail;
+			head = __atomic_load_n(&source->head, __ATOMIC_ACQUIRE);
+
+			/* Still has to be read to make progress, but the
+			 * decoder is behind and it gets counted as dropped */
+			if (tail - head == CAPTURE_RING_SIZE)
+				rec = &scratch;
+			else
+				rec = &source->ring[tail % CAPTURE_RING_SIZE];
+
+			memset(&rec->tv, 0, sizeof(rec->tv));
+
+			err = source->recv(source->fd, rec, source->user_data);
+			if (err == -EAGAIN || err == -EINTR)
+				break;
+
+			if (err < 0)
+				goto done;
+
+			if (err == 0)
+				continue;
+
+			if (rec == &scratch) {
+				__atomic_add_fetch(&source->drops, 1,
+							__ATOMIC_RELAXED);
+				continue;
+			}
+
+			if (rec->tv.tv_sec == 0 && rec->tv.tv_usec == 0)
+				gettimeofday(&rec->tv, NULL);
+
+			__atomic_store_n(&source->tail, tail + 1,
+							__ATOMIC_SEQ_CST);
+
+			/* Only an empty ring needs the decoder woken up, it
+			 * drains everything it finds once awake */
+			if (__atomic_load_n(&source->head,
+						__ATOMIC_SEQ_CST) == tail)
+				wakeup();
+		}
+	}
+
+done:
+	__atomic_store_n(&source->finished, true, __ATOMIC_SEQ_CST);
+	wakeup();
+
+	return NULL;
+}
+
+static bool record_before(const struct capture_record *a,
+					const struct capture_record *b)
+{
+	if (a->tv.tv_sec != b->tv.tv_sec)
+		return a->tv.tv_sec < b->tv.tv_sec;
+
+	return a->tv.tv_usec < b->tv.tv_usec;
+}
+
+static void deliver(struct capture_source *source)
+{
+	struct capture_record *rec;
+	unsigned int drops;
+
+	drops = __atomic_load_n(&source->drops, __ATOMIC_RELAXED);
+	if (drops != source->reported) {
+		btsnoop_add_drops(drops - source->reported);
+		source->reported = drops;
+	}
+
+	rec = &source->ring[source->head % CAPTURE_RING_SIZE];
+
+	packet_monitor(&rec->tv, rec->index, rec->opcode,
+						rec->data, rec->size);
+
+	__atomic_store_n(&source->head, source->head + 1, __ATOMIC_SEQ_CST);
+}
+
+static void arm_timer(long usec)
+{
+	mainloop_modify_timeout_ms(timer_id, (usec + 999) / 1000);
+}
+
+static void remove_finished(void)
+{
+	struct capture_source **ptr = &sources;
+
+	while (*ptr) {
+		struct capture_source *source = *ptr;
+
+		if (!__atomic_load_n(&source->finished, __ATOMIC_SEQ_CST) ||
+				source->head != __atomic_load_n(&source->tail,
+							__ATOMIC_SEQ_CST)) {
+			ptr = &source->next;
+			continue;
+		}
+
+		*ptr = source->next;
+
+		if (!source->joined)
+			pthread_join(source->thread, NULL);
+
+		if (source->destroy)
+			source->destroy(source->user_data);
+
+		free(source);
+	}
+}
+
+/* With flush set everything buffered is decoded, otherwise records that
+ * might still be overtaken by another source are held back */
+static void drain(bool flush)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+
+	while (1) {
+		struct capture_source *source, *best = NULL;
+		const struct capture_record *rec;
+		bool complete = true;
+		long age;
+
+		for (source = sources; source; source = source->next) {
+			unsigned int tail;
+
+			tail = __atomic_load_n(&source->tail, __ATOMIC_SEQ_CST);
+
+			if (source->head == tail) {
+				if (!__atomic_load_n(&source->finished,
+							__ATOMIC_SEQ_CST))
+					complete = false;
+				continue;
+			}
+
+			if (!best || record_before(
+				&source->ring[source->head % CAPTURE_RING_SIZE],
+				&best->ring[best->head % CAPTURE_RING_SIZE]))
+				best = source;
+		}
+
+		if (!best)
+			break;
+
+		rec = &best->ring[best->head % CAPTURE_RING_SIZE];
+
+		age = (now.tv_sec - rec->tv.tv_sec) * 1000000l +
+					(now.tv_usec - rec->tv.tv_usec);
+
+		if (!flush && !complete && age < CAPTURE_MERGE_DELAY) {
+			arm_timer(CAPTURE_MERGE_DELAY - age);
+			break;
+		}
+
+		deliver(best);
+	}
+
+	remove_finished();
+}
+
+static void wakeup_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t val;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		mainloop_remove_fd(fd);
+		return;
+	}
+
+	if (read(fd, &val, sizeof(val)) < 0)
+		return;
+
+	drain(false);
+}
+
+static void timer_callback(int id, void *user_data)
+{
+	drain(false);
+}
+
+int capture_init(void)
+{
+	wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	stop_fd = eventfd(0, EFD_CLOEXEC);
+
+	if (wakeup_fd < 0 || stop_fd < 0)
+		goto failed;
+
+	if (mainloop_add_fd(wakeup_fd, EPOLLIN, wakeup_callback,
+							NULL, NULL) < 0)
+		goto failed;
+
+	timer_id = mainloop_add_timeout_ms(0, timer_callback, NULL, NULL);
+	if (timer_id < 0) {
+		mainloop_remove_fd(wakeup_fd);
+		goto failed;
+	}
+
+	return 0;
+
+failed:
+	perror("Failed to set up capture");
+
+	if (wakeup_fd >= 0)
+		close(wakeup_fd);
+	if (stop_fd >= 0)
+		close(stop_fd);
+
+	wakeup_fd = stop_fd = timer_id = -1;
+
+	return -1;
+}
+
+int capture_add(int fd, capture_recv_func recv, void *user_data,
+					capture_destroy_func destroy)
+{
+	struct capture_source *source;
+	int err;
+
+	if (fd < 0 || !recv || wakeup_fd < 0)
+		return -EINVAL;
+
+	source = calloc(1, sizeof(*source));
+	if (!source)
+		return -ENOMEM;
+
+	source->fd = fd;
+	source->recv = recv;
+	source->destroy = destroy;
+	source->user_data = user_data;
+
+	err = pthread_create(&source->thread, NULL, capture_thread, source);
+	if (err != 0) {
+		free(source);
+		return -err;
+	}
+
+	source->next = sources;
+	sources = source;
+
+	return 0;
+}
+
+void capture_exit(void)
+{
+	struct capture_source *source;
+	uint64_t val = 1;
+
+	if (stop_fd < 0)
+		return;
+
+	if (write(stop_fd, &val, sizeof(val)) < 0)
+		perror("Failed to stop capture");
+
+	/* Once all threads are gone decode whatever they left behind */
+	for (source = sources; source; source = source->next) {
+		pthread_join(source->thread, NULL);
+		source->joined = true;
+		source->finished = true;
+	}
+
+	drain(true);
+
+	close(stop_fd);
+	close(wakeup_fd);
+
+	stop_fd = wakeup_fd = timer_id = -1;
+}
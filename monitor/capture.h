@@ -0,0 +1,48 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2012  Intel Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#define CAPTURE_MAX_SIZE	1028	/* HCI_MAX_FRAME_SIZE */
+
+struct capture_record {
+	struct timeval tv;
+	uint16_t index;
+	uint16_t opcode;
+	uint16_t size;
+	uint8_t data[CAPTURE_MAX_SIZE];
+};
+
+/* Called on the capture thread to receive one packet without blocking.
+ * Returns 1 when rec was filled in, 0 for a packet to be skipped and a
+ * negative error otherwise, -EAGAIN once the socket is drained. */
+typedef int (*capture_recv_func) (int fd, struct capture_record *rec,
+							void *user_data);
+typedef void (*capture_destroy_func) (void *user_data);
+
+int capture_init(void);
+int capture_add(int fd, capture_recv_func recv, void *user_data,
+					capture_destroy_func destroy);
+void capture_exit(void);
@@ -39,6 +39,7 @@
 
 #include "mainloop.h"
 #include "packet.h"
+#include "capture.h"
 #include "control.h"
 
 struct control_data {
@@ -578,6 +579,54 @@ static void data_callback(int fd, uint32_t events, void *user_data)
 	}
 }
 
+static int monitor_recv(int fd, struct capture_record *rec, void *user_data)
+{
+	unsigned char control[32];
+	struct mgmt_hdr hdr;
+	struct msghdr msg;
+	struct iovec iov[2];
+	struct cmsghdr *cmsg;
+	uint16_t pktlen;
+	ssize_t len;
+
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = MGMT_HDR_SIZE;
+	iov[1].iov_base = rec->data;
+	iov[1].iov_len = sizeof(rec->data);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	len = recvmsg(fd, &msg, MSG_DONTWAIT);
+	if (len < 0)
+		return -errno;
+
+	if (len < MGMT_HDR_SIZE)
+		return 0;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+					cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET)
+			continue;
+
+		if (cmsg->cmsg_type == SCM_TIMESTAMP)
+			memcpy(&rec->tv, CMSG_DATA(cmsg), sizeof(rec->tv));
+	}
+
+	pktlen = btohs(hdr.len);
+	if (pktlen > len - MGMT_HDR_SIZE)
+		pktlen = len - MGMT_HDR_SIZE;
+
+	rec->opcode = btohs(hdr.opcode);
+	rec->index  = btohs(hdr.index);
+	rec->size   = pktlen;
+
+	return 1;
+}
+
 static int open_socket(uint16_t channel)
 {
 	struct sockaddr_hci addr;
@@ -631,6 +680,17 @@ static int open_channel(uint16_t channel)
 		return -1;
 	}
 
+	/* Monitor traffic is received on its own thread and decoded in
+	 * timestamp order with the other capture sources */
+	if (channel == HCI_CHANNEL_MONITOR) {
+		if (capture_add(data->fd, monitor_recv, data, free_data) < 0) {
+			free_data(data);
+			return -1;
+		}
+
+		return 0;
+	}
+
 	mainloop_add_fd(data->fd, EPOLLIN, data_callback, data, free_data);
 
 	return 0;
@@ -0,0 +1,220 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2012  Intel Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+
+#include "btsnoop.h"
+#include "filter.h"
+
+#define MAX_FILTER_INDEX	64
+#define MAX_FILTER_VALUES	16
+
+struct value_set {
+	unsigned int count;
+	uint16_t values[MAX_FILTER_VALUES];
+};
+
+/* Terms of the same kind are alternatives, different kinds must all
+ * match. An empty set of a kind matches everything. */
+static uint64_t index_mask = 0;
+static uint16_t opcode_mask = 0;
+
+/* Command opcodes, event codes and connection handles together form one
+ * kind, a packet passes if any of its fields is listed */
+static struct value_set opcodes;
+static struct value_set events;
+static struct value_set handles;
+
+static const struct {
+	const char *str;
+	uint16_t mask;
+} type_table[] = {
+	{ "cmd", 1 << BTSNOOP_OPCODE_COMMAND_PKT			},
+	{ "evt", 1 << BTSNOOP_OPCODE_EVENT_PKT				},
+	{ "acl", 1 << BTSNOOP_OPCODE_ACL_TX_PKT |
+				1 << BTSNOOP_OPCODE_ACL_RX_PKT		},
+	{ "sco", 1 << BTSNOOP_OPCODE_SCO_TX_PKT |
+				1 << BTSNOOP_OPCODE_SCO_RX_PKT		},
+	{ }
+};
+
+static bool set_add(struct value_set *set, const char *str, long max)
+{
+	char *end;
+	long val;
+
+	val = strtol(str, &end, 0);
+	if (end == str || *end != '\0' || val < 0 || val > max)
+		return false;
+
+	if (set->count == MAX_FILTER_VALUES)
+		return false;
+
+	set->values[set->count++] = val;
+
+	return true;
+}
+
+static bool set_contains(const struct value_set *set, uint16_t value)
+{
+	unsigned int i;
+
+	for (i = 0; i < set->count; i++) {
+		if (set->values[i] == value)
+			return true;
+	}
+
+	return false;
+}
+
+static bool parse_term(const char *term)
+{
+	char *end;
+	long val;
+	int i;
+
+	if (!strncmp(term, "opcode=", 7))
+		return set_add(&opcodes, term + 7, 0xffff);
+
+	if (!strncmp(term, "event=", 6))
+		return set_add(&events, term + 6, 0xff);
+
+	if (!strncmp(term, "handle=", 7))
+		return set_add(&handles, term + 7, 0x0fff);
+
+	for (i = 0; type_table[i].str; i++) {
+		if (!strcmp(term, type_table[i].str)) {
+			opcode_mask |= type_table[i].mask;
+			return true;
+		}
+	}
+
+	if (strncmp(term, "hci", 3))
+		return false;
+
+	val = strtol(term + 3, &end, 10);
+	if (end == term + 3 || *end != '\0' || val < 0 ||
+						val >= MAX_FILTER_INDEX)
+		return false;
+
+	index_mask |= 1ull << val;
+
+	return true;
+}
+
+/* A comma or space separated list of hci<N>, cmd, evt, acl, sco,
+ * opcode=<opcode>, event=<code> and handle=<handle> */
+bool filter_parse(const char *expr)
+{
+	char *str, *term, *ptr = NULL;
+	bool result = true;
+
+	str = strdup(expr);
+	if (!str)
+		return false;
+
+	for (term = strtok_r(str, ", ", &ptr); term;
+					term = strtok_r(NULL, ", ", &ptr)) {
+		if (!parse_term(term)) {
+			fprintf(stderr, "Invalid filter term: %s\n", term);
+			result = false;
+			break;
+		}
+	}
+
+	free(str);
+
+	return result;
+}
+
+/* Only looks at the HCI packet headers, nothing is decoded */
+static bool match_fields(uint16_t opcode, const uint8_t *data, uint16_t size)
+{
+	const hci_event_hdr *evt;
+
+	switch (opcode) {
+	case BTSNOOP_OPCODE_COMMAND_PKT:
+		if (size < HCI_COMMAND_HDR_SIZE)
+			return false;
+
+		return set_contains(&opcodes, bt_get_le16(data));
+	case BTSNOOP_OPCODE_EVENT_PKT:
+		if (size < HCI_EVENT_HDR_SIZE)
+			return false;
+
+		evt = (const void *) data;
+
+		if (set_contains(&events, evt->evt))
+			return true;
+
+		/* Command Complete and Command Status carry the opcode */
+		if (evt->evt == EVT_CMD_COMPLETE && size >= 5)
+			return set_contains(&opcodes, bt_get_le16(data + 3));
+
+		if (evt->evt == EVT_CMD_STATUS && size >= 6)
+			return set_contains(&opcodes, bt_get_le16(data + 4));
+
+		return false;
+	case BTSNOOP_OPCODE_ACL_TX_PKT:
+	case BTSNOOP_OPCODE_ACL_RX_PKT:
+	case BTSNOOP_OPCODE_SCO_TX_PKT:
+	case BTSNOOP_OPCODE_SCO_RX_PKT:
+		if (size < 2)
+			return false;
+
+		return set_contains(&handles, bt_get_le16(data) & 0x0fff);
+	}
+
+	return false;
+}
+
+bool filter_match(uint16_t index, uint16_t opcode,
+					const void *data, uint16_t size)
+{
+	if (index_mask && (index >= MAX_FILTER_INDEX ||
+					!(index_mask & (1ull << index))))
+		return false;
+
+	/* Index add and remove records only depend on the index */
+	if (opcode == BTSNOOP_OPCODE_NEW_INDEX ||
+					opcode == BTSNOOP_OPCODE_DEL_INDEX)
+		return true;
+
+	if (opcode_mask && (opcode > 15 || !(opcode_mask & (1 << opcode))))
+		return false;
+
+	if (opcodes.count || events.count || handles.count)
+		return match_fields(opcode, data, size);
+
+	return true;
+}
@@ -40,6 +40,8 @@
 
 #include "mainloop.h"
 #include "packet.h"
+#include "btsnoop.h"
+#include "capture.h"
 #include "hcidump.h"
 
 struct hcidump_data {
@@ -105,73 +107,73 @@ static int open_hci_dev(uint16_t index)
 	return fd;
 }
 
-static void device_callback(int fd, uint32_t events, void *user_data)
+static int device_recv(int fd, struct capture_record *rec, void *user_data)
 {
 	struct hcidump_data *data = user_data;
-	unsigned char buf[HCI_MAX_FRAME_SIZE];
 	unsigned char control[64];
 	struct msghdr msg;
-	struct iovec iov;
-
-	if (events & (EPOLLERR | EPOLLHUP)) {
-		mainloop_remove_fd(fd);
-		return;
-	}
+	struct iovec iov[2];
+	struct cmsghdr *cmsg;
+	uint8_t type;
+	int *dir = NULL;
+	ssize_t len;
 
-	iov.iov_base = buf;
-	iov.iov_len = sizeof(buf);
+	iov[0].iov_base = &type;
+	iov[0].iov_len = 1;
+	iov[1].iov_base = rec->data;
+	iov[1].iov_len = sizeof(rec->data);
 
 	memset(&msg, 0, sizeof(msg));
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
 	msg.msg_control = control;
 	msg.msg_controllen = sizeof(control);
 
-	while (1) {
-		struct cmsghdr *cmsg;
-		struct timeval *tv = NULL;
-		int *dir = NULL;
-		ssize_t len;
-
-		len = recvmsg(fd, &msg, MSG_DONTWAIT);
-		if (len < 0)
-			break;
-
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
-					cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			if (cmsg->cmsg_level != SOL_HCI)
-				continue;
-
-			switch (cmsg->cmsg_type) {
-			case HCI_DATA_DIR:
-				dir = (int *) CMSG_DATA(cmsg);
-				break;
-			case HCI_CMSG_TSTAMP:
-				tv = (struct timeval *) CMSG_DATA(cmsg);
-				break;
-			}
-		}
+	len = recvmsg(fd, &msg, MSG_DONTWAIT);
+	if (len < 0)
+		return -errno;
 
-		if (!dir || len < 1)
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+				cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_HCI)
 			continue;
 
-		switch (buf[0]) {
-		case HCI_COMMAND_PKT:
-			packet_hci_command(tv, data->index, buf + 1, len - 1);
-			break;
-		case HCI_EVENT_PKT:
-			packet_hci_event(tv, data->index, buf + 1, len - 1);
-			break;
-		case HCI_ACLDATA_PKT:
-			packet_hci_acldata(tv, data->index, !!(*dir),
-							buf + 1, len - 1);
+		switch (cmsg->cmsg_type) {
+		case HCI_DATA_DIR:
+			dir = (int *) CMSG_DATA(cmsg);
 			break;
-		case HCI_SCODATA_PKT:
-			packet_hci_scodata(tv, data->index, !!(*dir),
-							buf + 1, len - 1);
+		case HCI_CMSG_TSTAMP:
+			memcpy(&rec->tv, CMSG_DATA(cmsg), sizeof(rec->tv));
 			break;
 		}
 	}
+
+	if (!dir || len < 1)
+		return 0;
+
+	switch (type) {
+	case HCI_COMMAND_PKT:
+		rec->opcode = BTSNOOP_OPCODE_COMMAND_PKT;
+		break;
+	case HCI_EVENT_PKT:
+		rec->opcode = BTSNOOP_OPCODE_EVENT_PKT;
+		break;
+	case HCI_ACLDATA_PKT:
+		rec->opcode = *dir ? BTSNOOP_OPCODE_ACL_RX_PKT :
+						BTSNOOP_OPCODE_ACL_TX_PKT;
+		break;
+	case HCI_SCODATA_PKT:
+		rec->opcode = *dir ? BTSNOOP_OPCODE_SCO_RX_PKT :
+						BTSNOOP_OPCODE_SCO_TX_PKT;
+		break;
+	default:
+		return 0;
+	}
+
+	rec->index = data->index;
+	rec->size = len - 1;
+
+	return 1;
 }
 
 static void open_device(uint16_t index)
@@ -191,7 +193,8 @@ static void open_device(uint16_t index)
 		return;
 	}
 
-	mainloop_add_fd(data->fd, EPOLLIN, device_callback, data, free_data);
+	if (capture_add(data->fd, device_recv, data, free_data) < 0)
+		free_data(data);
 }
 
 static void device_info(int fd, uint16_t index, uint8_t *type, uint8_t *bus,
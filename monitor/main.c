@@ -28,6 +28,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 #include <getopt.h>
 
 #include "mainloop.h"
@@ -35,6 +39,9 @@
 #include "control.h"
 #include "hcidump.h"
 #include "btsnoop.h"
+#include "filter.h"
+#include "stats.h"
+#include "capture.h"
 
 static void signal_callback(int signum, void *user_data)
 {
@@ -43,21 +50,129 @@ static void signal_callback(int signum, void *user_data)
 	case SIGTERM:
 		mainloop_quit();
 		break;
+	case SIGUSR1:
+		stats_print();
+		break;
 	}
 }
 
+static unsigned int stats_interval = 0;
+
+static void stats_callback(int id, void *user_data)
+{
+	stats_print();
+
+	mainloop_modify_timeout(id, stats_interval);
+}
+
+static unsigned int flush_timeout = 1;
+
+static void flush_callback(int id, void *user_data)
+{
+	btsnoop_flush();
+	fflush(stdout);
+
+	mainloop_modify_timeout(id, flush_timeout);
+}
+
+struct read_stats {
+	uint64_t bytes;
+};
+
+static void read_callback(struct timeval *tv, uint16_t index,
+					uint16_t opcode, uint32_t drops,
+					const void *data, uint16_t size,
+					void *user_data)
+{
+	struct read_stats *stats = user_data;
+
+	stats->bytes += size;
+
+	packet_monitor(tv, index, opcode, data, size);
+}
+
+static int read_file(const char *path, bool throughput)
+{
+	struct read_stats stats;
+	struct timespec start, stop;
+	double elapsed;
+	int count;
+
+	/* Formatting still happens, only the terminal is taken out */
+	if (throughput && !freopen("/dev/null", "w", stdout)) {
+		perror("Failed to redirect output");
+		return EXIT_FAILURE;
+	}
+
+	memset(&stats, 0, sizeof(stats));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	count = btsnoop_read(path, read_callback, &stats);
+	if (count < 0) {
+		fprintf(stderr, "Failed to read %s: %s\n", path,
+							strerror(-count));
+		return EXIT_FAILURE;
+	}
+
+	fflush(stdout);
+
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	if (!throughput)
+		return EXIT_SUCCESS;
+
+	elapsed = (stop.tv_sec - start.tv_sec) +
+				(stop.tv_nsec - start.tv_nsec) / 1e9;
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+
+	fprintf(stderr, "%d records, %llu bytes in %.3f s "
+			"(%.0f records/s, %.1f MB/s)\n", count,
+			(unsigned long long) stats.bytes, elapsed,
+			count / elapsed, stats.bytes / elapsed / 1000000);
+
+	return EXIT_SUCCESS;
+}
+
 static void usage(void)
 {
 	printf("btmon - Bluetooth monitor\n"
 		"Usage:\n");
 	printf("\tbtmon [options]\n");
 	printf("options:\n"
-		"\t-b, --btsnoop <file>  Save dump in btsnoop format\n"
-		"\t-h, --help            Show help options\n");
+		"\t-r, --read <file>      Read traces in btsnoop format\n"
+		"\t-f, --filter <expr>    Only show matching packets, e.g.\n"
+		"\t                       \"hci0,acl,evt,opcode=0x0c03\"\n"
+		"\t-j, --json             Print one JSON object per packet\n"
+		"\t-s, --stats <s>        Print connection and command\n"
+		"\t                       statistics instead of packets,\n"
+		"\t                       every s seconds and on SIGUSR1\n"
+		"\t-t, --throughput       Decode without output and report\n"
+		"\t                       read throughput\n"
+		"\t-b, --btsnoop <file>   Save dump in btsnoop format\n"
+		"\t-a, --all-indexes      Save all controllers into one dump\n"
+		"\t-F, --flush <msec>     Write out dump at most every msec\n"
+		"\t-S, --rotate-size <kB> Start a new dump file after kB\n"
+		"\t-T, --rotate-time <s>  Start a new dump file after seconds\n"
+		"\t-N, --rotate-files <n> Number of dump files to keep\n"
+		"\t-D, --direct           Write dump with direct I/O\n"
+		"\t-h, --help             Show help options\n");
 }
 
 static const struct option main_options[] = {
+	{ "read",	required_argument, NULL, 'r'	},
+	{ "filter",	required_argument, NULL, 'f'	},
+	{ "json",	no_argument,	   NULL, 'j'	},
+	{ "stats",	required_argument, NULL, 's'	},
+	{ "throughput",	no_argument,	   NULL, 't'	},
 	{ "btsnoop",	required_argument, NULL, 'b'	},
+	{ "all-indexes", no_argument,	   NULL, 'a'	},
+	{ "flush",	required_argument, NULL, 'F'	},
+	{ "rotate-size", required_argument, NULL, 'S'	},
+	{ "rotate-time", required_argument, NULL, 'T'	},
+	{ "rotate-files", required_argument, NULL, 'N'	},
+	{ "direct",	no_argument,	   NULL, 'D'	},
 	{ "version",	no_argument,	   NULL, 'v'	},
 	{ "help",	no_argument,	   NULL, 'h'	},
 	{ }
@@ -66,20 +181,67 @@ static const struct option main_options[] = {
 int main(int argc, char *argv[])
 {
 	unsigned long filter_mask = 0;
+	const char *reader_path = NULL;
+	bool throughput = false;
+	int output = PACKET_OUTPUT_TEXT;
+	bool stats = false;
+	const char *btsnoop_path = NULL;
+	unsigned long btsnoop_flags = 0;
+	uint64_t rotate_size = 0;
+	unsigned int rotate_time = 0, rotate_files = 0;
 	sigset_t mask;
+	int ret;
 
 	mainloop_init();
 
 	for (;;) {
 		int opt;
 
-		opt = getopt_long(argc, argv, "bvh", main_options, NULL);
+		opt = getopt_long(argc, argv, "r:f:js:tb:aF:S:T:N:Dvh",
+						main_options, NULL);
 		if (opt < 0)
 			break;
 
 		switch (opt) {
+		case 'r':
+			reader_path = optarg;
+			break;
+		case 'f':
+			if (!filter_parse(optarg))
+				return EXIT_FAILURE;
+			break;
+		case 'j':
+			output = PACKET_OUTPUT_JSON;
+			break;
+		case 's':
+			stats = true;
+			stats_interval = atoi(optarg);
+			break;
+		case 't':
+			throughput = true;
+			break;
 		case 'b':
-			btsnoop_open(optarg);
+			btsnoop_path = optarg;
+			break;
+		case 'a':
+			btsnoop_flags |= BTSNOOP_FLAG_ALL_INDEXES;
+			break;
+		case 'F':
+			btsnoop_set_flush_interval(atoi(optarg));
+			if (atoi(optarg) > 1000)
+				flush_timeout = atoi(optarg) / 1000;
+			break;
+		case 'S':
+			rotate_size = strtoull(optarg, NULL, 10) * 1024;
+			break;
+		case 'T':
+			rotate_time = atoi(optarg);
+			break;
+		case 'N':
+			rotate_files = atoi(optarg);
+			break;
+		case 'D':
+			btsnoop_flags |= BTSNOOP_FLAG_DIRECT_IO;
 			break;
 		case 'v':
 			printf("%s\n", VERSION);
@@ -92,9 +254,43 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (stats) {
+		stats_enable();
+		output = PACKET_OUTPUT_NONE;
+	}
+
+	packet_set_output(output);
+
+	if (btsnoop_path) {
+		btsnoop_set_rotation(rotate_size, rotate_time, rotate_files);
+		btsnoop_open(btsnoop_path, btsnoop_flags);
+	}
+
+	/* Output is written out by packet, or by the flush timer when it
+	 * doesn't go to a terminal */
+	if (!isatty(STDOUT_FILENO))
+		setvbuf(stdout, NULL, _IOFBF, 65536);
+
+	if (reader_path) {
+		filter_mask |= PACKET_FILTER_SHOW_INDEX;
+		filter_mask |= PACKET_FILTER_SHOW_DATE;
+		filter_mask |= PACKET_FILTER_SHOW_TIME;
+		filter_mask |= PACKET_FILTER_SHOW_ACL_DATA;
+
+		packet_set_filter(filter_mask);
+
+		ret = read_file(reader_path, throughput);
+
+		stats_print();
+		btsnoop_close();
+
+		return ret;
+	}
+
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGINT);
 	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
 
 	mainloop_set_signal(&mask, signal_callback, NULL, NULL);
 
@@ -106,10 +302,26 @@ int main(int argc, char *argv[])
 
 	printf("Bluetooth monitor ver %s\n", VERSION);
 
+	mainloop_add_timeout(flush_timeout, flush_callback, NULL, NULL);
+
+	if (stats_interval > 0)
+		mainloop_add_timeout(stats_interval, stats_callback,
+								NULL, NULL);
+
+	if (capture_init() < 0)
+		return EXIT_FAILURE;
+
 	if (control_tracing() < 0) {
 		if (hcidump_tracing() < 0)
 			return EXIT_FAILURE;
 	}
 
-	return mainloop_run();
+	ret = mainloop_run();
+
+	capture_exit();
+
+	stats_print();
+	btsnoop_close();
+
+	return ret;
 }
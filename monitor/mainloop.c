@@ -28,6 +28,8 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,10 +40,11 @@
 
 #include "mainloop.h"
 
-#define MAX_EPOLL_EVENTS 10
+#define DEFAULT_EPOLL_EVENTS 10
 
 static int epoll_fd;
 static int epoll_terminate;
+static unsigned int epoll_batch = DEFAULT_EPOLL_EVENTS;
 
 struct mainloop_data {
 	int fd;
@@ -51,17 +54,46 @@ struct mainloop_data {
 	void *user_data;
 };
 
-#define MAX_MAINLOOP_ENTRIES 128
+/* Indexed by file descriptor, grows on demand */
+static struct mainloop_data **mainloop_list = NULL;
+static unsigned int mainloop_size = 0;
 
-static struct mainloop_data *mainloop_list[MAX_MAINLOOP_ENTRIES];
+/*
+ * All timeouts share a single timerfd. They are kept in a hierarchical
+ * timing wheel with millisecond ticks: level 0 holds the next 64 ticks,
+ * each further level covers 64 times the range of the one below and is
+ * cascaded down when the lower level wraps around. Adding, modifying
+ * and removing a timeout are constant time.
+ */
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+
+#define WHEEL_RANGE(level)	(1ull << (WHEEL_BITS * (level)))
+
+#define TICK_NONE	UINT64_MAX
 
 struct timeout_data {
-	int fd;
+	int id;
+	uint64_t expire;
+	struct timeout_data *next;
+	struct timeout_data **pprev;
 	mainloop_timeout_func callback;
 	mainloop_destroy_func destroy;
 	void *user_data;
 };
 
+static struct timeout_data *wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static uint64_t wheel_tick;	/* Next tick to be processed */
+static uint64_t wheel_armed;	/* Never later than the next due tick */
+static int wheel_fd = -1;
+
+/* Indexed by timeout identifier minus one, grows on demand */
+static struct timeout_data **timeout_list = NULL;
+static unsigned int timeout_size = 0;
+static unsigned int timeout_hint = 0;
+
 struct signal_data {
 	int fd;
 	sigset_t mask;
@@ -72,14 +104,209 @@ struct signal_data {
 
 static struct signal_data *signal_data;
 
+static uint64_t get_ticks(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static void wheel_link(struct timeout_data **head, struct timeout_data *data)
+{
+	data->next = *head;
+	if (data->next)
+		data->next->pprev = &data->next;
+
+	data->pprev = head;
+	*head = data;
+}
+
+static void wheel_unlink(struct timeout_data *data)
+{
+	if (!data->pprev)
+		return;
+
+	*data->pprev = data->next;
+	if (data->next)
+		data->next->pprev = data->pprev;
+
+	data->next = NULL;
+	data->pprev = NULL;
+}
+
+static void wheel_insert(struct timeout_data *data)
+{
+	uint64_t expire = data->expire;
+	unsigned int level;
+
+	if (expire < wheel_tick)
+		expire = wheel_tick;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (expire - wheel_tick < WHEEL_RANGE(level + 1))
+			break;
+	}
+
+	/* Too far out, parked in the last slot of the top level and
+	 * inserted again once that slot is cascaded */
+	if (expire - wheel_tick >= WHEEL_RANGE(WHEEL_LEVELS))
+		expire = wheel_tick + WHEEL_RANGE(WHEEL_LEVELS) - 1;
+
+	wheel_link(&wheel[level][(expire >> (WHEEL_BITS * level)) &
+							WHEEL_MASK], data);
+}
+
+/* First tick at which a slot needs to be fired or cascaded */
+static uint64_t wheel_next(void)
+{
+	uint64_t next = TICK_NONE;
+	unsigned int level;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		unsigned int shift = WHEEL_BITS * level;
+		uint64_t index;
+		unsigned int i;
+
+		index = (wheel_tick + WHEEL_RANGE(level) - 1) >> shift;
+
+		for (i = 0; i < WHEEL_SIZE; i++, index++) {
+			if (!wheel[level][index & WHEEL_MASK])
+				continue;
+
+			if ((index << shift) < next)
+				next = index << shift;
+			break;
+		}
+	}
+
+	return next;
+}
+
+static void wheel_arm(void)
+{
+	struct itimerspec itimer;
+	uint64_t next;
+
+	next = wheel_next();
+	if (next == wheel_armed)
+		return;
+
+	wheel_armed = next;
+
+	memset(&itimer, 0, sizeof(itimer));
+
+	if (next != TICK_NONE) {
+		itimer.it_value.tv_sec = next / 1000;
+		itimer.it_value.tv_nsec = (next % 1000) * 1000000;
+	}
+
+	timerfd_settime(wheel_fd, TFD_TIMER_ABSTIME, &itimer, NULL);
+}
+
+static void wheel_cascade(unsigned int level, unsigned int slot)
+{
+	struct timeout_data *data = wheel[level][slot];
+
+	wheel[level][slot] = NULL;
+
+	while (data) {
+		struct timeout_data *next = data->next;
+
+		data->next = NULL;
+		data->pprev = NULL;
+		wheel_insert(data);
+
+		data = next;
+	}
+}
+
+static void wheel_process(uint64_t now)
+{
+	while (1) {
+		struct timeout_data *expired;
+		unsigned int level;
+		uint64_t tick;
+
+		tick = wheel_next();
+		if (tick > now)
+			break;
+
+		wheel_tick = tick;
+
+		for (level = WHEEL_LEVELS - 1; level > 0; level--) {
+			unsigned int shift = WHEEL_BITS * level;
+
+			if (tick & (WHEEL_RANGE(level) - 1))
+				continue;
+
+			wheel_cascade(level, (tick >> shift) & WHEEL_MASK);
+		}
+
+		/* Detach the slot so that timeouts added by the callbacks
+		 * never end up in the list being fired */
+		expired = wheel[0][tick & WHEEL_MASK];
+		wheel[0][tick & WHEEL_MASK] = NULL;
+		if (expired)
+			expired->pprev = &expired;
+
+		wheel_tick = tick + 1;
+
+		while (expired) {
+			struct timeout_data *data = expired;
+
+			wheel_unlink(data);
+
+			if (data->callback)
+				data->callback(data->id, data->user_data);
+		}
+	}
+
+	if (wheel_tick <= now)
+		wheel_tick = now + 1;
+}
+
+static void wheel_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t expired;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+		return;
+
+	if (read(fd, &expired, sizeof(expired)) < 0 && errno != EAGAIN)
+		return;
+
+	wheel_armed = 0;
+
+	wheel_process(get_ticks());
+	wheel_arm();
+}
+
 void mainloop_init(void)
 {
-	unsigned int i;
+	unsigned int level, slot;
 
 	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++)
-		mainloop_list[i] = NULL;
+	mainloop_list = NULL;
+	mainloop_size = 0;
+
+	timeout_list = NULL;
+	timeout_size = 0;
+	timeout_hint = 0;
+
+	for (level = 0; level < WHEEL_LEVELS; level++) {
+		for (slot = 0; slot < WHEEL_SIZE; slot++)
+			wheel[level][slot] = NULL;
+	}
+
+	wheel_tick = get_ticks();
+	wheel_armed = TICK_NONE;
+
+	wheel_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (wheel_fd >= 0)
+		mainloop_add_fd(wheel_fd, EPOLLIN, wheel_callback, NULL, NULL);
 
 	epoll_terminate = 0;
 }
@@ -89,6 +316,11 @@ void mainloop_quit(void)
 	epoll_terminate = 1;
 }
 
+void mainloop_set_batch_size(unsigned int size)
+{
+	epoll_batch = size > 0 ? size : DEFAULT_EPOLL_EVENTS;
+}
+
 static void signal_callback(int fd, uint32_t events, void *user_data)
 {
 	struct signal_data *data = user_data;
@@ -110,7 +342,8 @@ static void signal_callback(int fd, uint32_t events, void *user_data)
 
 int mainloop_run(void)
 {
-	unsigned int i;
+	struct epoll_event *events = NULL;
+	unsigned int i, max_events = 0;
 
 	if (signal_data) {
 		if (sigprocmask(SIG_BLOCK, &signal_data->mask, NULL) < 0)
@@ -129,21 +362,43 @@ int mainloop_run(void)
 	}
 
 	while (!epoll_terminate) {
-		struct epoll_event events[MAX_EPOLL_EVENTS];
 		int n, nfds;
 
-		nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		if (max_events != epoll_batch) {
+			struct epoll_event *tmp;
+
+			tmp = realloc(events, epoll_batch * sizeof(*events));
+			if (tmp) {
+				events = tmp;
+				max_events = epoll_batch;
+			} else if (!events)
+				break;
+		}
+
+		nfds = epoll_wait(epoll_fd, events, max_events, -1);
 		if (nfds < 0)
 			continue;
 
 		for (n = 0; n < nfds; n++) {
-			struct mainloop_data *data = events[n].data.ptr;
+			struct mainloop_data *data;
+			int fd = events[n].data.fd;
+
+			/* An earlier callback of this batch may have
+			 * removed the descriptor already */
+			if ((unsigned int) fd >= mainloop_size)
+				continue;
+
+			data = mainloop_list[fd];
+			if (!data)
+				continue;
 
 			data->callback(data->fd, events[n].events,
 							data->user_data);
 		}
 	}
 
+	free(events);
+
 	if (signal_data) {
 		mainloop_remove_fd(signal_data->fd);
 		close(signal_data->fd);
@@ -152,7 +407,7 @@ int mainloop_run(void)
 			signal_data->destroy(signal_data->user_data);
 	}
 
-	for (i = 0; i < MAX_MAINLOOP_ENTRIES; i++) {
+	for (i = 0; i < mainloop_size; i++) {
 		struct mainloop_data *data = mainloop_list[i];
 
 		mainloop_list[i] = NULL;
@@ -167,6 +422,24 @@ int mainloop_run(void)
 		}
 	}
 
+	free(mainloop_list);
+	mainloop_list = NULL;
+	mainloop_size = 0;
+
+	for (i = 0; i < timeout_size; i++) {
+		if (timeout_list[i])
+			mainloop_remove_timeout(i + 1);
+	}
+
+	free(timeout_list);
+	timeout_list = NULL;
+	timeout_size = 0;
+
+	if (wheel_fd >= 0) {
+		close(wheel_fd);
+		wheel_fd = -1;
+	}
+
 	close(epoll_fd);
 	epoll_fd = 0;
 
@@ -180,9 +453,27 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1 || !callback)
+	if (fd < 0 || !callback)
 		return -EINVAL;
 
+	if ((unsigned int) fd >= mainloop_size) {
+		struct mainloop_data **list;
+		unsigned int size = mainloop_size ? mainloop_size : 128;
+
+		while (size <= (unsigned int) fd)
+			size *= 2;
+
+		list = realloc(mainloop_list, size * sizeof(*list));
+		if (!list)
+			return -ENOMEM;
+
+		memset(list + mainloop_size, 0,
+				(size - mainloop_size) * sizeof(*list));
+
+		mainloop_list = list;
+		mainloop_size = size;
+	}
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
@@ -196,7 +487,7 @@ int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 
 	memset(&ev, 0, sizeof(ev));
 	ev.events = events;
-	ev.data.ptr = data;
+	ev.data.fd = fd;
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->fd, &ev);
 	if (err < 0) {
@@ -215,7 +506,7 @@ int mainloop_modify_fd(int fd, uint32_t events)
 	struct epoll_event ev;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0 || (unsigned int) fd >= mainloop_size)
 		return -EINVAL;
 
 	data = mainloop_list[fd];
@@ -227,7 +518,7 @@ int mainloop_modify_fd(int fd, uint32_t events)
 
 	memset(&ev, 0, sizeof(ev));
 	ev.events = events;
-	ev.data.ptr = data;
+	ev.data.fd = fd;
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, data->fd, &ev);
 	if (err < 0)
@@ -243,7 +534,7 @@ int mainloop_remove_fd(int fd)
 	struct mainloop_data *data;
 	int err;
 
-	if (fd < 0 || fd > MAX_MAINLOOP_ENTRIES - 1)
+	if (fd < 0 || (unsigned int) fd >= mainloop_size)
 		return -EINVAL;
 
 	data = mainloop_list[fd];
@@ -262,104 +553,130 @@ int mainloop_remove_fd(int fd)
 	return err;
 }
 
-static void timeout_destroy(void *user_data)
+static struct timeout_data *timeout_lookup(int id)
 {
-	struct timeout_data *data = user_data;
-
-	close(data->fd);
-	data->fd = -1;
+	if (id < 1 || (unsigned int) id > timeout_size)
+		return NULL;
 
-	if (data->destroy)
-		data->destroy(data->user_data);
+	return timeout_list[id - 1];
 }
 
-static void timeout_callback(int fd, uint32_t events, void *user_data)
+static void timeout_set(struct timeout_data *data, unsigned int msec)
 {
-	struct timeout_data *data = user_data;
-	uint64_t expired;
-	ssize_t result;
-
-	if (events & (EPOLLERR | EPOLLHUP))
-		return;
+	uint64_t now = get_ticks();
 
-	result = read(data->fd, &expired, sizeof(expired));
-	if (result != sizeof(expired))
-		return;
+	wheel_unlink(data);
 
-	if (data->callback)
-		data->callback(data->fd, data->user_data);
-}
+	/* Nothing is due before now, so catch up after an idle period
+	 * to keep new timeouts in the lowest possible level */
+	if (wheel_armed > now && wheel_tick < now)
+		wheel_tick = now;
 
-static inline int timeout_set(int fd, unsigned int seconds)
-{
-	struct itimerspec itimer;
-
-	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = seconds;
-	itimer.it_value.tv_nsec = 0;
+	data->expire = now + msec;
+	wheel_insert(data);
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+	wheel_arm();
 }
 
-int mainloop_add_timeout(unsigned int seconds, mainloop_timeout_func callback,
+int mainloop_add_timeout_ms(unsigned int msec,
+				mainloop_timeout_func callback,
 				void *user_data, mainloop_destroy_func destroy)
 {
 	struct timeout_data *data;
+	unsigned int i;
 
-	if (!callback)
+	if (!callback || wheel_fd < 0)
 		return -EINVAL;
 
+	for (i = 0; i < timeout_size; i++) {
+		unsigned int index = (timeout_hint + i) % timeout_size;
+
+		if (!timeout_list[index])
+			break;
+	}
+
+	if (i < timeout_size)
+		i = (timeout_hint + i) % timeout_size;
+	else {
+		struct timeout_data **list;
+		unsigned int size = timeout_size ? timeout_size * 2 : 16;
+
+		list = realloc(timeout_list, size * sizeof(*list));
+		if (!list)
+			return -ENOMEM;
+
+		memset(list + timeout_size, 0,
+				(size - timeout_size) * sizeof(*list));
+
+		timeout_list = list;
+		timeout_size = size;
+	}
+
 	data = malloc(sizeof(*data));
 	if (!data)
 		return -ENOMEM;
 
 	memset(data, 0, sizeof(*data));
+	data->id = i + 1;
 	data->callback = callback;
 	data->destroy = destroy;
 	data->user_data = user_data;
 
-	data->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
-	if (data->fd < 0) {
-		free(data);
-		return -EIO;
-	}
-
-	if (seconds > 0) {
-		if (timeout_set(data->fd, seconds) < 0) {
-			close(data->fd);
-			free(data);
-			return -EIO;
-		}
-	}
+	timeout_list[i] = data;
+	timeout_hint = i + 1;
 
-	if (mainloop_add_fd(data->fd, EPOLLIN | EPOLLONESHOT,
-				timeout_callback, data, timeout_destroy) < 0) {
-		close(data->fd);
-		free(data);
-		return -EIO;
-	}
+	if (msec > 0)
+		timeout_set(data, msec);
 
-	return data->fd;
+	return data->id;
 }
 
-int mainloop_modify_timeout(int id, unsigned int seconds)
+int mainloop_modify_timeout_ms(int id, unsigned int msec)
 {
-	if (seconds > 0) {
-		if (timeout_set(id, seconds) < 0)
-			return -EIO;
-	}
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
 
-	if (mainloop_modify_fd(id, EPOLLIN | EPOLLONESHOT) < 0)
-		return -EIO;
+	if (msec > 0)
+		timeout_set(data, msec);
 
 	return 0;
 }
 
+int mainloop_add_timeout(unsigned int seconds, mainloop_timeout_func callback,
+				void *user_data, mainloop_destroy_func destroy)
+{
+	return mainloop_add_timeout_ms(seconds * 1000, callback,
+							user_data, destroy);
+}
+
+int mainloop_modify_timeout(int id, unsigned int seconds)
+{
+	return mainloop_modify_timeout_ms(id, seconds * 1000);
+}
+
 int mainloop_remove_timeout(int id)
 {
-	return mainloop_remove_fd(id);
+	struct timeout_data *data;
+
+	data = timeout_lookup(id);
+	if (!data)
+		return -ENXIO;
+
+	timeout_list[id - 1] = NULL;
+	if ((unsigned int) id - 1 < timeout_hint)
+		timeout_hint = id - 1;
+
+	wheel_unlink(data);
+
+	if (data->destroy)
+		data->destroy(data->user_data);
+
+	free(data);
+
+	return 0;
 }
 
 int mainloop_set_signal(sigset_t *mask, mainloop_signal_func callback,
@@ -35,6 +35,8 @@ void mainloop_init(void);
 void mainloop_quit(void);
 int mainloop_run(void);
 
+void mainloop_set_batch_size(unsigned int size);
+
 int mainloop_add_fd(int fd, uint32_t events, mainloop_event_func callback,
 				void *user_data, mainloop_destroy_func destroy);
 int mainloop_modify_fd(int fd, uint32_t events);
@@ -42,7 +44,11 @@ int mainloop_remove_fd(int fd);
 
 int mainloop_add_timeout(unsigned int seconds, mainloop_timeout_func callback,
 				void *user_data, mainloop_destroy_func destroy);
-int mainloop_modify_timeout(int fd, unsigned int seconds);
+int mainloop_modify_timeout(int id, unsigned int seconds);
+int mainloop_add_timeout_ms(unsigned int msec,
+				mainloop_timeout_func callback,
+				void *user_data, mainloop_destroy_func destroy);
+int mainloop_modify_timeout_ms(int id, unsigned int msec);
 int mainloop_remove_timeout(int id);
 
 int mainloop_set_signal(sigset_t *mask, mainloop_signal_func callback,
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,41 +43,192 @@
 
 #include "control.h"
 #include "btsnoop.h"
+#include "filter.h"
+#include "stats.h"
 #include "packet.h"
 
+#define OUTPUT_BUF_SIZE 8192
+
 static unsigned long filter_mask = 0;
+static int output_mode = PACKET_OUTPUT_TEXT;
+
+/* Everything a packet prints is collected here and handed to stdio in one
+ * piece once the packet is done */
+static char output[OUTPUT_BUF_SIZE];
+static size_t output_len = 0;
 
 void packet_set_filter(unsigned long filter)
 {
 	filter_mask = filter;
 }
 
+void packet_set_output(int mode)
+{
+	output_mode = mode;
+}
+
+static void output_flush(void)
+{
+	if (output_len == 0)
+		return;
+
+	fwrite(output, 1, output_len, stdout);
+	output_len = 0;
+}
+
+static void output_str(const char *str, size_t len)
+{
+	if (output_len + len > sizeof(output)) {
+		output_flush();
+
+		if (len > sizeof(output)) {
+			fwrite(str, 1, len, stdout);
+			return;
+		}
+	}
+
+	memcpy(output + output_len, str, len);
+	output_len += len;
+}
+
+static void __attribute__((format(printf, 1, 2)))
+					print_text(const char *format, ...)
+{
+	size_t avail = sizeof(output) - output_len;
+	va_list ap;
+	int len;
+
+	va_start(ap, format);
+	len = vsnprintf(output + output_len, avail, format, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+
+	if ((size_t) len >= avail) {
+		output_flush();
+
+		va_start(ap, format);
+		len = vsnprintf(output, sizeof(output), format, ap);
+		va_end(ap);
+
+		if (len < 0)
+			return;
+
+		if ((size_t) len >= sizeof(output))
+			len = sizeof(output) - 1;
+	}
+
+	output_len += len;
+}
+
+static void print_hex(const unsigned char *buf, uint16_t len)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	char str[64];
+	uint16_t i, n = 0;
+
+	for (i = 0; i < len; i++) {
+		str[n++] = hexdigits[buf[i] >> 4];
+		str[n++] = hexdigits[buf[i] & 0xf];
+
+		if (n == sizeof(str)) {
+			output_str(str, n);
+			n = 0;
+		}
+	}
+
+	output_str(str, n);
+}
+
+static void json_begin(struct timeval *tv, uint16_t index, const char *type)
+{
+	print_text("{\"time\":%lu.%06lu,\"index\":%u,\"type\":\"%s\"",
+				tv ? (unsigned long) tv->tv_sec : 0,
+				tv ? (unsigned long) tv->tv_usec : 0,
+				index, type);
+}
+
+static void json_data(const void *data, uint16_t size)
+{
+	output_str(",\"data\":\"", 9);
+	print_hex(data, size);
+	output_str("\"", 1);
+}
+
+/* Names can come from capture files, so everything outside printable
+ * ASCII is escaped to keep each line valid JSON */
+static void json_string(const char *key, const char *str)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+	char esc[6] = { '\\', 'u', '0', '0' };
+	size_t i, start = 0;
+
+	print_text(",\"%s\":\"", key);
+
+	for (i = 0; str[i]; i++) {
+		unsigned char c = str[i];
+
+		if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\')
+			continue;
+
+		output_str(str + start, i - start);
+		start = i + 1;
+
+		if (c == '"' || c == '\\') {
+			esc[1] = c;
+			output_str(esc, 2);
+			continue;
+		}
+
+		esc[1] = 'u';
+		esc[4] = hexdigits[c >> 4];
+		esc[5] = hexdigits[c & 0xf];
+		output_str(esc, 6);
+	}
+
+	output_str(str + start, i - start);
+	output_str("\"", 1);
+}
+
+static void json_end(void)
+{
+	output_str("}\n", 2);
+	output_flush();
+}
+
 static void print_channel_header(struct timeval *tv, uint16_t index,
 							uint16_t channel)
 {
+	static time_t last_sec = -1;
+	static struct tm tm;
+
 	if (filter_mask & PACKET_FILTER_SHOW_INDEX) {
 		switch (channel) {
 		case HCI_CHANNEL_CONTROL:
-			printf("{hci%d} ", index);
+			print_text("{hci%d} ", index);
 			break;
 		case HCI_CHANNEL_MONITOR:
-			printf("[hci%d] ", index);
+			print_text("[hci%d] ", index);
 			break;
 		}
 	}
 
 	if (tv) {
 		time_t t = tv->tv_sec;
-		struct tm tm;
 
-		localtime_r(&t, &tm);
+		/* Packets mostly arrive many per second */
+		if (t != last_sec) {
+			localtime_r(&t, &tm);
+			last_sec = t;
+		}
 
 		if (filter_mask & PACKET_FILTER_SHOW_DATE)
-			printf("%04d-%02d-%02d ", tm.tm_year + 1900,
+			print_text("%04d-%02d-%02d ", tm.tm_year + 1900,
 						tm.tm_mon + 1, tm.tm_mday);
 
 		if (filter_mask & PACKET_FILTER_SHOW_TIME)
-			printf("%02d:%02d:%02d.%06lu ", tm.tm_hour,
+			print_text("%02d:%02d:%02d.%06lu ", tm.tm_hour,
 					tm.tm_min, tm.tm_sec, tv->tv_usec);
 	}
 }
@@ -86,49 +238,62 @@ static void print_header(struct timeval *tv, uint16_t index)
 	print_channel_header(tv, index, HCI_CHANNEL_MONITOR);
 }
 
-void packet_hexdump(const unsigned char *buf, uint16_t len)
+static void hexdump(const unsigned char *buf, uint16_t len)
 {
 	static const char hexdigits[] = "0123456789abcdef";
-	char str[68];
+	char str[78];
 	uint16_t i;
 
 	if (!len)
 		return;
 
+	/* Fixed layout: 12 spaces of indent, 16 bytes in hex, two spaces,
+	 * the same 16 bytes as text */
+	memset(str, ' ', sizeof(str));
+	str[sizeof(str) - 1] = '\n';
+
 	for (i = 0; i < len; i++) {
-		str[((i % 16) * 3) + 0] = hexdigits[buf[i] >> 4];
-		str[((i % 16) * 3) + 1] = hexdigits[buf[i] & 0xf];
-		str[((i % 16) * 3) + 2] = ' ';
-		str[(i % 16) + 49] = isprint(buf[i]) ? buf[i] : '.';
-
-		if ((i + 1) % 16 == 0) {
-			str[47] = ' ';
-			str[48] = ' ';
-			str[65] = '\0';
-			printf("%-12c%s\n", ' ', str);
-			str[0] = ' ';
-		}
+		str[12 + ((i % 16) * 3) + 0] = hexdigits[buf[i] >> 4];
+		str[12 + ((i % 16) * 3) + 1] = hexdigits[buf[i] & 0xf];
+		str[61 + (i % 16)] = isprint(buf[i]) ? buf[i] : '.';
+
+		if ((i + 1) % 16 == 0)
+			output_str(str, sizeof(str));
 	}
 
 	if (i % 16 > 0) {
 		uint16_t j;
 		for (j = (i % 16); j < 16; j++) {
-			str[(j * 3) + 0] = ' ';
-			str[(j * 3) + 1] = ' ';
-			str[(j * 3) + 2] = ' ';
-			str[j + 49] = ' ';
+			str[12 + (j * 3) + 0] = ' ';
+			str[12 + (j * 3) + 1] = ' ';
+			str[61 + j] = ' ';
 		}
-		str[47] = ' ';
-		str[48] = ' ';
-		str[65] = '\0';
-		printf("%-12c%s\n", ' ', str);
+		output_str(str, sizeof(str));
 	}
 }
 
+void packet_hexdump(const unsigned char *buf, uint16_t len)
+{
+	hexdump(buf, len);
+	output_flush();
+}
+
 void packet_control(struct timeval *tv, uint16_t index, uint16_t opcode,
 					const void *data, uint16_t size)
 {
+	if (output_mode == PACKET_OUTPUT_NONE)
+		return;
+
+	if (output_mode == PACKET_OUTPUT_JSON) {
+		json_begin(tv, index, "control");
+		print_text(",\"opcode\":%u", opcode);
+		json_data(data, size);
+		json_end();
+		return;
+	}
+
 	print_channel_header(tv, index, HCI_CHANNEL_CONTROL);
+	output_flush();
 
 	control_message(opcode, data, size);
 }
@@ -165,6 +330,26 @@ void packet_monitor(struct timeval *tv, uint16_t index, uint16_t opcode,
 
 	switch (opcode) {
 	case MONITOR_NEW_INDEX:
+		if (size < MONITOR_NEW_INDEX_SIZE) {
+			if (!filter_match(index, BTSNOOP_OPCODE_NEW_INDEX,
+								NULL, 0))
+				break;
+
+			if (output_mode == PACKET_OUTPUT_NONE)
+				break;
+
+			if (output_mode == PACKET_OUTPUT_JSON) {
+				json_begin(tv, index, "malformed_new_index");
+				json_end();
+				break;
+			}
+
+			print_header(tv, index);
+			print_text("* Malformed New Index packet\n");
+			output_flush();
+			break;
+		}
+
 		ni = data;
 
 		if (index < MAX_INDEX)
@@ -200,8 +385,19 @@ void packet_monitor(struct timeval *tv, uint16_t index, uint16_t opcode,
 		packet_hci_scodata(tv, index, true, data, size);
 		break;
 	default:
+		if (output_mode == PACKET_OUTPUT_NONE)
+			break;
+
+		if (output_mode == PACKET_OUTPUT_JSON) {
+			json_begin(tv, index, "unknown");
+			print_text(",\"code\":%u", opcode);
+			json_data(data, size);
+			json_end();
+			break;
+		}
+
 		print_header(tv, index);
-		printf("* Unknown packet (code %d len %d)\n", opcode, size);
+		print_text("* Unknown packet (code %d len %d)\n", opcode, size);
 		packet_hexdump(data, size);
 		break;
 	}
@@ -444,16 +640,24 @@ static const struct {
 	{ }
 };
 
+static int opcode_cmp(const void *key, const void *entry)
+{
+	uint16_t opcode = *((const uint16_t *) key);
+	const typeof(opcode2str_table[0]) *e = entry;
+
+	return (int) opcode - (int) e->opcode;
+}
+
+/* The table is sorted by opcode, leaving out the terminating entry */
 static const char *opcode2str(uint16_t opcode)
 {
-	int i;
+	size_t count = sizeof(opcode2str_table) / sizeof(opcode2str_table[0]);
+	const typeof(opcode2str_table[0]) *e;
 
-	for (i = 0; opcode2str_table[i].str; i++) {
-		if (opcode2str_table[i].opcode == opcode)
-			return opcode2str_table[i].str;
-	}
+	e = bsearch(&opcode, opcode2str_table, count - 1,
+				sizeof(opcode2str_table[0]), opcode_cmp);
 
-	return "Unknown";
+	return e ? e->str : "Unknown";
 }
 
 static const struct {
@@ -537,56 +741,143 @@ static const struct {
 
 static const char *event2str(uint8_t event)
 {
-	int i;
+	static const char *event_names[256];
+	static bool initialized = false;
 
-	for (i = 0; event2str_table[i].str; i++) {
-		if (event2str_table[i].event == event)
-			return event2str_table[i].str;
+	if (!initialized) {
+		int i;
+
+		for (i = 0; i < 256; i++)
+			event_names[i] = "Unknown";
+
+		for (i = 0; event2str_table[i].str; i++)
+			event_names[event2str_table[i].event] =
+						event2str_table[i].str;
+
+		initialized = true;
 	}
 
-	return "Unknown";
+	return event_names[event];
 }
 
 void packet_new_index(struct timeval *tv, uint16_t index, const char *label,
 				uint8_t type, uint8_t bus, const char *name)
 {
+	struct monitor_new_index ni;
+	char str[sizeof(ni.name) + 1];
+
+	if (!filter_match(index, BTSNOOP_OPCODE_NEW_INDEX, NULL, 0))
+		return;
+
+	memset(&ni, 0, sizeof(ni));
+	ni.type = type;
+	ni.bus = bus;
+	str2ba(label, &ni.bdaddr);
+	memcpy(ni.name, name, strnlen(name, sizeof(ni.name)));
+
+	/* Names filling the whole field are not terminated */
+	memcpy(str, ni.name, sizeof(ni.name));
+	str[sizeof(ni.name)] = '\0';
+
+	btsnoop_write_hci(tv, index, BTSNOOP_OPCODE_NEW_INDEX,
+						&ni, MONITOR_NEW_INDEX_SIZE);
+
+	if (output_mode == PACKET_OUTPUT_NONE)
+		return;
+
+	if (output_mode == PACKET_OUTPUT_JSON) {
+		json_begin(tv, index, "new_index");
+		json_string("address", label);
+		json_string("bus", hci_bustostr(bus));
+		json_string("controller", hci_typetostr(type));
+		json_string("name", str);
+		json_end();
+		return;
+	}
+
 	print_header(tv, index);
 
-	printf("= New Index: %s (%s,%s,%s)\n", label,
-				hci_typetostr(type), hci_bustostr(bus), name);
+	print_text("= New Index: %s (%s,%s,%s)\n", label,
+				hci_typetostr(type), hci_bustostr(bus), str);
+	output_flush();
 }
 
 void packet_del_index(struct timeval *tv, uint16_t index, const char *label)
 {
+	if (!filter_match(index, BTSNOOP_OPCODE_DEL_INDEX, NULL, 0))
+		return;
+
+	btsnoop_write_hci(tv, index, BTSNOOP_OPCODE_DEL_INDEX, NULL,
+						MONITOR_DEL_INDEX_SIZE);
+
+	if (output_mode == PACKET_OUTPUT_NONE)
+		return;
+
+	if (output_mode == PACKET_OUTPUT_JSON) {
+		json_begin(tv, index, "del_index");
+		json_string("address", label);
+		json_end();
+		return;
+	}
+
 	print_header(tv, index);
 
-	printf("= Delete Index: %s\n", label);
+	print_text("= Delete Index: %s\n", label);
+	output_flush();
 }
 
 void packet_hci_command(struct timeval *tv, uint16_t index,
 					const void *data, uint16_t size)
 {
 	const hci_command_hdr *hdr = data;
-	uint16_t opcode = btohs(hdr->opcode);
-	uint16_t ogf = cmd_opcode_ogf(opcode);
-	uint16_t ocf = cmd_opcode_ocf(opcode);
+	uint16_t opcode, ogf, ocf;
 
-	btsnoop_write(tv, index, 0x02, data, size);
+	if (!filter_match(index, BTSNOOP_OPCODE_COMMAND_PKT, data, size))
+		return;
 
-	print_header(tv, index);
+	btsnoop_write_hci(tv, index, BTSNOOP_OPCODE_COMMAND_PKT, data, size);
+	stats_hci_command(tv, index, data, size);
+
+	if (output_mode == PACKET_OUTPUT_NONE)
+		return;
 
 	if (size < HCI_COMMAND_HDR_SIZE) {
-		printf("* Malformed HCI Command packet\n");
+		if (output_mode == PACKET_OUTPUT_JSON) {
+			json_begin(tv, index, "malformed_cmd");
+			json_end();
+			return;
+		}
+
+		print_header(tv, index);
+		print_text("* Malformed HCI Command packet\n");
+		output_flush();
 		return;
 	}
 
-	printf("< HCI Command: %s (0x%2.2x|0x%4.4x) plen %d\n",
-				opcode2str(opcode), ogf, ocf, hdr->plen);
+	opcode = btohs(hdr->opcode);
+	ogf = cmd_opcode_ogf(opcode);
+	ocf = cmd_opcode_ocf(opcode);
 
 	data += HCI_COMMAND_HDR_SIZE;
 	size -= HCI_COMMAND_HDR_SIZE;
 
-	packet_hexdump(data, size);
+	if (output_mode == PACKET_OUTPUT_JSON) {
+		json_begin(tv, index, "cmd");
+		print_text(",\"opcode\":%u", opcode);
+		json_string("name", opcode2str(opcode));
+		print_text(",\"plen\":%u", hdr->plen);
+		json_data(data, size);
+		json_end();
+		return;
+	}
+
+	print_header(tv, index);
+
+	print_text("< HCI Command: %s (0x%2.2x|0x%4.4x) plen %d\n",
+				opcode2str(opcode), ogf, ocf, hdr->plen);
+
+	hexdump(data, size);
+	output_flush();
 }
 
 void packet_hci_event(struct timeval *tv, uint16_t index,
@@ -594,71 +885,166 @@ void packet_hci_event(struct timeval *tv, uint16_t index,
 {
 	const hci_event_hdr *hdr = data;
 
-	btsnoop_write(tv, index, 0x03, data, size);
+	if (!filter_match(index, BTSNOOP_OPCODE_EVENT_PKT, data, size))
+		return;
 
-	print_header(tv, index);
+	btsnoop_write_hci(tv, index, BTSNOOP_OPCODE_EVENT_PKT, data, size);
+	stats_hci_event(tv, index, data, size);
+
+	if (output_mode == PACKET_OUTPUT_NONE)
+		return;
 
 	if (size < HCI_EVENT_HDR_SIZE) {
-		printf("* Malformed HCI Event packet\n");
+		if (output_mode == PACKET_OUTPUT_JSON) {
+			json_begin(tv, index, "malformed_evt");
+			json_end();
+			return;
+		}
+
+		print_header(tv, index);
+		print_text("* Malformed HCI Event packet\n");
+		output_flush();
 		return;
 	}
 
-	printf("> HCI Event: %s (0x%2.2x) plen %d\n",
-				event2str(hdr->evt), hdr->evt, hdr->plen);
-
 	data += HCI_EVENT_HDR_SIZE;
 	size -= HCI_EVENT_HDR_SIZE;
 
-	packet_hexdump(data, size);
+	if (output_mode == PACKET_OUTPUT_JSON) {
+		json_begin(tv, index, "evt");
+		print_text(",\"event\":%u", hdr->evt);
+		json_string("name", event2str(hdr->evt));
+		print_text(",\"plen\":%u", hdr->plen);
+		json_data(data, size);
+		json_end();
+		return;
+	}
+
+	print_header(tv, index);
+
+	print_text("> HCI Event: %s (0x%2.2x) plen %d\n",
+				event2str(hdr->evt), hdr->evt, hdr->plen);
+
+	hexdump(data, size);
+	output_flush();
 }
 
 void packet_hci_acldata(struct timeval *tv, uint16_t index, bool in,
 					const void *data, uint16_t size)
 {
 	const hci_acl_hdr *hdr = data;
-	uint16_t handle = btohs(hdr->handle);
-	uint16_t dlen = btohs(hdr->dlen);
-	uint8_t flags = acl_flags(handle);
+	uint16_t handle, dlen;
+	uint8_t flags;
 
-	btsnoop_write(tv, index, in ? 0x01 : 0x00, data, size);
+	if (!filter_match(index, in ? BTSNOOP_OPCODE_ACL_RX_PKT :
+				BTSNOOP_OPCODE_ACL_TX_PKT, data, size))
+		return;
 
-	print_header(tv, index);
+	btsnoop_write_hci(tv, index, in ? BTSNOOP_OPCODE_ACL_RX_PKT :
+					BTSNOOP_OPCODE_ACL_TX_PKT, data, size);
+	stats_hci_acldata(tv, index, in, data, size);
+
+	if (output_mode == PACKET_OUTPUT_NONE)
+		return;
 
 	if (size < HCI_ACL_HDR_SIZE) {
-		printf("* Malformed ACL Data %s packet\n", in ? "RX" : "TX");
+		if (output_mode == PACKET_OUTPUT_JSON) {
+			json_begin(tv, index, "malformed_acl");
+			json_end();
+			return;
+		}
+
+		print_header(tv, index);
+		print_text("* Malformed ACL Data %s packet\n",
+							in ? "RX" : "TX");
+		output_flush();
 		return;
 	}
 
-	printf("%c ACL Data: handle %d flags 0x%2.2x dlen %d\n",
-			in ? '>' : '<', acl_handle(handle), flags, dlen);
+	handle = btohs(hdr->handle);
+	dlen = btohs(hdr->dlen);
+	flags = acl_flags(handle);
 
 	data += HCI_ACL_HDR_SIZE;
 	size -= HCI_ACL_HDR_SIZE;
 
+	if (output_mode == PACKET_OUTPUT_JSON) {
+		json_begin(tv, index, "acl");
+		print_text(",\"dir\":\"%s\",\"handle\":%u,\"flags\":%u,"
+				"\"dlen\":%u", in ? "rx" : "tx",
+				acl_handle(handle), flags, dlen);
+		if (filter_mask & PACKET_FILTER_SHOW_ACL_DATA)
+			json_data(data, size);
+		json_end();
+		return;
+	}
+
+	print_header(tv, index);
+
+	print_text("%c ACL Data: handle %d flags 0x%2.2x dlen %d\n",
+			in ? '>' : '<', acl_handle(handle), flags, dlen);
+
 	if (filter_mask & PACKET_FILTER_SHOW_ACL_DATA)
-		packet_hexdump(data, size);
+		hexdump(data, size);
+
+	output_flush();
 }
 
 void packet_hci_scodata(struct timeval *tv, uint16_t index, bool in,
 					const void *data, uint16_t size)
 {
 	const hci_sco_hdr *hdr = data;
-	uint16_t handle = btohs(hdr->handle);
-	uint8_t flags = acl_flags(handle);
+	uint16_t handle;
+	uint8_t flags;
 
-	print_header(tv, index);
+	if (!filter_match(index, in ? BTSNOOP_OPCODE_SCO_RX_PKT :
+				BTSNOOP_OPCODE_SCO_TX_PKT, data, size))
+		return;
+
+	btsnoop_write_hci(tv, index, in ? BTSNOOP_OPCODE_SCO_RX_PKT :
+					BTSNOOP_OPCODE_SCO_TX_PKT, data, size);
+
+	if (output_mode == PACKET_OUTPUT_NONE)
+		return;
 
 	if (size < HCI_SCO_HDR_SIZE) {
-		printf("* Malformed SCO Data %s packet\n", in ? "RX" : "TX");
+		if (output_mode == PACKET_OUTPUT_JSON) {
+			json_begin(tv, index, "malformed_sco");
+			json_end();
+			return;
+		}
+
+		print_header(tv, index);
+		print_text("* Malformed SCO Data %s packet\n",
+							in ? "RX" : "TX");
+		output_flush();
 		return;
 	}
 
-	printf("%c SCO Data: handle %d flags 0x%2.2x dlen %d\n",
-			in ? '>' : '<', acl_handle(handle), flags, hdr->dlen);
+	handle = btohs(hdr->handle);
+	flags = acl_flags(handle);
 
 	data += HCI_SCO_HDR_SIZE;
 	size -= HCI_SCO_HDR_SIZE;
 
+	if (output_mode == PACKET_OUTPUT_JSON) {
+		json_begin(tv, index, "sco");
+		print_text(",\"dir\":\"%s\",\"handle\":%u,\"flags\":%u,"
+				"\"dlen\":%u", in ? "rx" : "tx",
+				acl_handle(handle), flags, hdr->dlen);
+		if (filter_mask & PACKET_FILTER_SHOW_SCO_DATA)
+			json_data(data, size);
+		json_end();
+		return;
+	}
+
+	print_header(tv, index);
+
+	print_text("%c SCO Data: handle %d flags 0x%2.2x dlen %d\n",
+			in ? '>' : '<', acl_handle(handle), flags, hdr->dlen);
+
 	if (filter_mask & PACKET_FILTER_SHOW_SCO_DATA)
-		packet_hexdump(data, size);
+		hexdump(data, size);
+
+	output_flush();
 }
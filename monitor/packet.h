@@ -31,7 +31,12 @@
 #define PACKET_FILTER_SHOW_ACL_DATA	(1 << 3)
 #define PACKET_FILTER_SHOW_SCO_DATA	(1 << 4)
 
+#define PACKET_OUTPUT_TEXT		0
+#define PACKET_OUTPUT_JSON		1
+#define PACKET_OUTPUT_NONE		2
+
 void packet_set_filter(unsigned long filter);
+void packet_set_output(int mode);
 
 void packet_hexdump(const unsigned char *buf, uint16_t len);
 
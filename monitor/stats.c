@@ -0,0 +1,495 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2011-2012  Intel Corporation
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/hci.h>
+
+#include "stats.h"
+
+/* Latencies are counted in power of two buckets of microseconds, the last
+ * bucket takes everything from about 8 seconds on */
+#define HIST_BUCKETS		24
+
+/* ACL packets whose completion is still tracked per connection */
+#define MAX_PENDING		64
+
+#define HASH_SIZE		256
+
+struct histogram {
+	uint32_t count;
+	uint64_t sum;
+	uint32_t max;
+	uint32_t buckets[HIST_BUCKETS];
+};
+
+struct conn_stats {
+	struct conn_stats *next;
+	uint16_t index;
+	uint16_t handle;
+	bool closed;
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	uint32_t tx_packets;
+	uint32_t rx_packets;
+	struct timeval pending[MAX_PENDING];
+	unsigned int pending_head;
+	unsigned int pending_count;
+	uint32_t untracked;
+	struct histogram credit;
+};
+
+struct cmd_stats {
+	struct cmd_stats *next;
+	uint16_t index;
+	uint16_t opcode;
+	bool outstanding;
+	struct timeval sent;
+	struct histogram latency;
+};
+
+static bool enabled = false;
+
+static struct conn_stats *conn_table[HASH_SIZE];
+static struct cmd_stats *cmd_table[HASH_SIZE];
+
+static unsigned int hash(uint16_t index, uint16_t value)
+{
+	return (index * 31 + value * 131 + (value >> 8)) % HASH_SIZE;
+}
+
+static uint32_t elapsed_usec(const struct timeval *from,
+						const struct timeval *to)
+{
+	int64_t usec;
+
+	usec = (to->tv_sec - from->tv_sec) * 1000000ll +
+					(to->tv_usec - from->tv_usec);
+
+	return usec < 0 ? 0 : (usec > UINT32_MAX ? UINT32_MAX : usec);
+}
+
+static void hist_add(struct histogram *hist, uint32_t usec)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < HIST_BUCKETS - 1 && (1u << bucket) <= usec)
+		bucket++;
+
+	hist->buckets[bucket]++;
+	hist->count++;
+	hist->sum += usec;
+
+	if (usec > hist->max)
+		hist->max = usec;
+}
+
+/* Upper bound of the bucket holding the given fraction of samples */
+static uint32_t hist_percentile(const struct histogram *hist,
+						unsigned int percent)
+{
+	uint64_t target = ((uint64_t) hist->count * percent + 99) / 100;
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->buckets[i];
+		if (seen >= target)
+			break;
+	}
+
+	if (i >= HIST_BUCKETS - 1 || (1u << i) > hist->max)
+		return hist->max;
+
+	return 1u << i;
+}
+
+static void hist_print(const char *label, const struct histogram *hist)
+{
+	if (hist->count == 0)
+		return;
+
+	printf("%-36s %8u %9llu %9u %9u %9u\n", label, hist->count,
+				(unsigned long long) (hist->sum / hist->count),
+				hist_percentile(hist, 50),
+				hist_percentile(hist, 99), hist->max);
+}
+
+static struct conn_stats *conn_lookup(uint16_t index, uint16_t handle,
+								bool create)
+{
+	struct conn_stats **head = &conn_table[hash(index, handle)];
+	struct conn_stats *conn;
+
+	for (conn = *head; conn; conn = conn->next) {
+		if (conn->index == index && conn->handle == handle &&
+								!conn->closed)
+			return conn;
+	}
+
+	if (!create)
+		return NULL;
+
+	conn = calloc(1, sizeof(*conn));
+	if (!conn)
+		return NULL;
+
+	conn->index = index;
+	conn->handle = handle;
+
+	conn->next = *head;
+	*head = conn;
+
+	return conn;
+}
+
+static struct cmd_stats *cmd_lookup(uint16_t index, uint16_t opcode,
+								bool create)
+{
+	struct cmd_stats **head = &cmd_table[hash(index, opcode)];
+	struct cmd_stats *cmd;
+
+	for (cmd = *head; cmd; cmd = cmd->next) {
+		if (cmd->index == index && cmd->opcode == opcode)
+			return cmd;
+	}
+
+	if (!create)
+		return NULL;
+
+	cmd = calloc(1, sizeof(*cmd));
+	if (!cmd)
+		return NULL;
+
+	cmd->index = index;
+	cmd->opcode = opcode;
+
+	cmd->next = *head;
+	*head = cmd;
+
+	return cmd;
+}
+
+void stats_enable(void)
+{
+	enabled = true;
+}
+
+void stats_hci_command(struct timeval *tv, uint16_t index,
+					const void *data, uint16_t size)
+{
+	struct cmd_stats *cmd;
+
+	if (!enabled || !tv || size < HCI_COMMAND_HDR_SIZE)
+		return;
+
+	cmd = cmd_lookup(index, bt_get_le16(data), true);
+	if (!cmd)
+		return;
+
+	cmd->outstanding = true;
+	cmd->sent = *tv;
+}
+
+static void command_done(struct timeval *tv, uint16_t index, uint16_t opcode)
+{
+	struct cmd_stats *cmd;
+
+	cmd = cmd_lookup(index, opcode, false);
+	if (!cmd || !cmd->outstanding)
+		return;
+
+	cmd->outstanding = false;
+	hist_add(&cmd->latency, elapsed_usec(&cmd->sent, tv));
+}
+
+static void packets_completed(struct timeval *tv, uint16_t index,
+					uint16_t handle, uint16_t count)
+{
+	struct conn_stats *conn;
+
+	conn = conn_lookup(index, handle, false);
+	if (!conn)
+		return;
+
+	for (; count > 0; count--) {
+		if (conn->pending_count == 0) {
+			conn->untracked++;
+			continue;
+		}
+
+		hist_add(&conn->credit, elapsed_usec(
+				&conn->pending[conn->pending_head], tv));
+
+		conn->pending_head = (conn->pending_head + 1) % MAX_PENDING;
+		conn->pending_count--;
+	}
+}
+
+void stats_hci_event(struct timeval *tv, uint16_t index,
+					const void *data, uint16_t size)
+{
+	const hci_event_hdr *hdr = data;
+	const uint8_t *params = data + HCI_EVENT_HDR_SIZE;
+	struct conn_stats *conn;
+	unsigned int i, num;
+
+	if (!enabled || !tv || size < HCI_EVENT_HDR_SIZE)
+		return;
+
+	size -= HCI_EVENT_HDR_SIZE;
+
+	switch (hdr->evt) {
+	case EVT_CMD_COMPLETE:
+		if (size >= 3)
+			command_done(tv, index, bt_get_le16(params + 1));
+		break;
+	case EVT_CMD_STATUS:
+		if (size >= 4)
+			command_done(tv, index, bt_get_le16(params + 2));
+		break;
+	case EVT_NUM_COMP_PKTS:
+		if (size < 1)
+			break;
+
+		num = params[0];
+		if (size < 1 + num * 4)
+			break;
+
+		for (i = 0, params++; i < num; i++, params += 4)
+			packets_completed(tv, index,
+						bt_get_le16(params) & 0x0fff,
+						bt_get_le16(params + 2));
+		break;
+	case EVT_DISCONN_COMPLETE:
+		if (size < 3 || params[0] != 0x00)
+			break;
+
+		/* Kept for the next report, a new connection reusing the
+		 * handle starts from scratch */
+		conn = conn_lookup(index, bt_get_le16(params + 1) & 0x0fff,
+									false);
+		if (conn)
+			conn->closed = true;
+		break;
+	}
+}
+
+void stats_hci_acldata(struct timeval *tv, uint16_t index, bool in,
+					const void *data, uint16_t size)
+{
+	struct conn_stats *conn;
+	unsigned int tail;
+
+	if (!enabled || !tv || size < HCI_ACL_HDR_SIZE)
+		return;
+
+	conn = conn_lookup(index, bt_get_le16(data) & 0x0fff, true);
+	if (!conn)
+		return;
+
+	size -= HCI_ACL_HDR_SIZE;
+
+	if (in) {
+		conn->rx_packets++;
+		conn->rx_bytes += size;
+		return;
+	}
+
+	conn->tx_packets++;
+	conn->tx_bytes += size;
+
+	/* More outstanding packets than tracked means the controller
+	 * isn't returning credits, forget the oldest send times */
+	if (conn->pending_count == MAX_PENDING) {
+		conn->pending_head = (conn->pending_head + 1) % MAX_PENDING;
+		conn->pending_count--;
+		conn->untracked++;
+	}
+
+	tail = (conn->pending_head + conn->pending_count) % MAX_PENDING;
+	conn->pending[tail] = *tv;
+	conn->pending_count++;
+}
+
+static int conn_cmp(const void *a, const void *b)
+{
+	const struct conn_stats *c1 = *((struct conn_stats * const *) a);
+	const struct conn_stats *c2 = *((struct conn_stats * const *) b);
+
+	if (c1->index != c2->index)
+		return c1->index - c2->index;
+
+	return c1->handle - c2->handle;
+}
+
+static int cmd_cmp(const void *a, const void *b)
+{
+	const struct cmd_stats *c1 = *((struct cmd_stats * const *) a);
+	const struct cmd_stats *c2 = *((struct cmd_stats * const *) b);
+
+	if (c1->index != c2->index)
+		return c1->index - c2->index;
+
+	return c1->opcode - c2->opcode;
+}
+
+static void print_connections(void)
+{
+	struct conn_stats **list, *conn;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < HASH_SIZE; i++)
+		for (conn = conn_table[i]; conn; conn = conn->next)
+			n++;
+
+	if (n == 0)
+		return;
+
+	list = malloc(n * sizeof(*list));
+	if (!list)
+		return;
+
+	for (i = 0, n = 0; i < HASH_SIZE; i++)
+		for (conn = conn_table[i]; conn; conn = conn->next)
+			list[n++] = conn;
+
+	qsort(list, n, sizeof(*list), conn_cmp);
+
+	printf("%-12s %10s %12s %10s %12s %8s %8s\n", "Connection",
+				"TX pkts", "TX bytes", "RX pkts", "RX bytes",
+				"Pending", "Lost");
+
+	for (i = 0; i < n; i++) {
+		char label[16];
+
+		conn = list[i];
+
+		snprintf(label, sizeof(label), "hci%u/%u%s", conn->index,
+					conn->handle, conn->closed ? "*" : "");
+
+		printf("%-12s %10u %12llu %10u %12llu %8u %8u\n", label,
+				conn->tx_packets,
+				(unsigned long long) conn->tx_bytes,
+				conn->rx_packets,
+				(unsigned long long) conn->rx_bytes,
+				conn->pending_count, conn->untracked);
+	}
+
+	printf("\n%-36s %8s %9s %9s %9s %9s\n", "Credit turnaround (usec)",
+				"Count", "Avg", "P50", "P99", "Max");
+
+	for (i = 0; i < n; i++) {
+		char label[16];
+
+		conn = list[i];
+
+		snprintf(label, sizeof(label), "hci%u/%u", conn->index,
+								conn->handle);
+		hist_print(label, &conn->credit);
+	}
+
+	free(list);
+}
+
+static void print_commands(void)
+{
+	struct cmd_stats **list, *cmd;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < HASH_SIZE; i++)
+		for (cmd = cmd_table[i]; cmd; cmd = cmd->next)
+			n++;
+
+	if (n == 0)
+		return;
+
+	list = malloc(n * sizeof(*list));
+	if (!list)
+		return;
+
+	for (i = 0, n = 0; i < HASH_SIZE; i++)
+		for (cmd = cmd_table[i]; cmd; cmd = cmd->next)
+			list[n++] = cmd;
+
+	qsort(list, n, sizeof(*list), cmd_cmp);
+
+	printf("\n%-36s %8s %9s %9s %9s %9s\n", "Command latency (usec)",
+				"Count", "Avg", "P50", "P99", "Max");
+
+	for (i = 0; i < n; i++) {
+		char label[16];
+
+		cmd = list[i];
+
+		snprintf(label, sizeof(label), "hci%u/0x%4.4x", cmd->index,
+								cmd->opcode);
+		hist_print(label, &cmd->latency);
+	}
+
+	free(list);
+}
+
+/* Closed connections are reported once more and then dropped */
+static void purge_closed(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < HASH_SIZE; i++) {
+		struct conn_stats **ptr = &conn_table[i];
+
+		while (*ptr) {
+			struct conn_stats *conn = *ptr;
+
+			if (conn->closed) {
+				*ptr = conn->next;
+				free(conn);
+			} else
+				ptr = &conn->next;
+		}
+	}
+}
+
+void stats_print(void)
+{
+	if (!enabled)
+		return;
+
+	printf("\n");
+
+	print_connections();
+	print_commands();
+
+	printf("\n");
+	fflush(stdout);
+
+	purge_closed();
+}
@@ -56,8 +56,9 @@ struct record_data {
 
 struct context_data {
 	sdp_record_t *record;
-	sdp_data_t attr_data;
-	struct sdp_xml_data *stack_head;
+	sdp_data_t **stack;
+	unsigned int depth;
+	unsigned int size;
 	uint16_t attr_id;
 };
 
@@ -77,6 +78,16 @@ struct service_adapter {
 
 static struct service_adapter *serv_adapter_any = NULL;
 
+/*
+ * Clients register the very same XML on every reconnect, so keep the
+ * generated PDU of recently parsed records around, keyed by a hash of
+ * the XML text, and skip the XML parser when it is seen again.
+ */
+#define XML_CACHE_SIZE 32
+
+static GHashTable *xml_cache = NULL;
+static GQueue *xml_cache_keys = NULL;
+
 static int compute_seq_size(sdp_data_t *data)
 {
 	int unit_size = data->unitSize;
@@ -88,11 +99,33 @@ static int compute_seq_size(sdp_data_t *data)
 	return unit_size;
 }
 
+static void push_data(struct context_data *ctx_data, sdp_data_t *data)
+{
+	if (ctx_data->depth == ctx_data->size) {
+		ctx_data->size = ctx_data->size ? ctx_data->size * 2 : 8;
+		ctx_data->stack = g_renew(sdp_data_t *, ctx_data->stack,
+							ctx_data->size);
+	}
+
+	ctx_data->stack[ctx_data->depth++] = data;
+}
+
+static void clear_stack(struct context_data *ctx_data)
+{
+	while (ctx_data->depth > 0) {
+		sdp_data_t *data = ctx_data->stack[--ctx_data->depth];
+
+		if (data)
+			sdp_data_free(data);
+	}
+}
+
 static void element_start(GMarkupParseContext *context,
 		const gchar *element_name, const gchar **attribute_names,
 		const gchar **attribute_values, gpointer user_data, GError **err)
 {
 	struct context_data *ctx_data = user_data;
+	sdp_data_t *data;
 
 	if (!strcmp(element_name, "record"))
 		return;
@@ -109,128 +142,123 @@ static void element_start(GMarkupParseContext *context,
 		return;
 	}
 
-	if (ctx_data->stack_head) {
-		struct sdp_xml_data *newelem = sdp_xml_data_alloc();
-		newelem->next = ctx_data->stack_head;
-		ctx_data->stack_head = newelem;
-	} else {
-		ctx_data->stack_head = sdp_xml_data_alloc();
-		ctx_data->stack_head->next = NULL;
-	}
-
 	if (!strcmp(element_name, "sequence"))
-		ctx_data->stack_head->data = sdp_data_alloc(SDP_SEQ8, NULL);
+		data = sdp_data_alloc(SDP_SEQ8, NULL);
 	else if (!strcmp(element_name, "alternate"))
-		ctx_data->stack_head->data = sdp_data_alloc(SDP_ALT8, NULL);
+		data = sdp_data_alloc(SDP_ALT8, NULL);
 	else {
+		const char *value = "";
+		char encoding = SDP_XML_ENCODING_NORMAL;
 		int i;
-		/* Parse value, name, encoding */
+
+		/* Parse value and encoding straight from the attributes */
 		for (i = 0; attribute_names[i]; i++) {
-			if (!strcmp(attribute_names[i], "value")) {
-				int curlen = strlen(ctx_data->stack_head->text);
-				int attrlen = strlen(attribute_values[i]);
-
-				/* Ensure we're big enough */
-				while ((curlen + 1 + attrlen) > ctx_data->stack_head->size) {
-					sdp_xml_data_expand(ctx_data->stack_head);
-				}
-
-				memcpy(ctx_data->stack_head->text + curlen,
-						attribute_values[i], attrlen);
-				ctx_data->stack_head->text[curlen + attrlen] = '\0';
-			}
+			if (!strcmp(attribute_names[i], "value"))
+				value = attribute_values[i];
 
 			if (!strcmp(attribute_names[i], "encoding")) {
 				if (!strcmp(attribute_values[i], "hex"))
-					ctx_data->stack_head->type = 1;
-			}
-
-			if (!strcmp(attribute_names[i], "name")) {
-				ctx_data->stack_head->name = strdup(attribute_values[i]);
+					encoding = SDP_XML_ENCODING_HEX;
 			}
 		}
 
-		ctx_data->stack_head->data = sdp_xml_parse_datatype(element_name,
-				ctx_data->stack_head, ctx_data->record);
-
-		if (ctx_data->stack_head->data == NULL)
+		data = sdp_xml_parse_datatype(element_name, value, encoding,
+							ctx_data->record);
+		if (data == NULL)
 			error("Can't parse element %s", element_name);
 	}
+
+	push_data(ctx_data, data);
 }
 
 static void element_end(GMarkupParseContext *context,
 		const gchar *element_name, gpointer user_data, GError **err)
 {
 	struct context_data *ctx_data = user_data;
-	struct sdp_xml_data *elem;
+	sdp_data_t *data, *parent;
 
 	if (!strcmp(element_name, "record"))
 		return;
 
 	if (!strcmp(element_name, "attribute")) {
-		if (ctx_data->stack_head && ctx_data->stack_head->data) {
+		data = NULL;
+		if (ctx_data->depth > 0)
+			data = ctx_data->stack[ctx_data->depth - 1];
+
+		if (data) {
 			int ret = sdp_attr_add(ctx_data->record, ctx_data->attr_id,
-							ctx_data->stack_head->data);
-			if (ret == -1)
+									data);
+			if (ret == -1) {
 				DBG("Could not add attribute 0x%04x",
 							ctx_data->attr_id);
+				sdp_data_free(data);
+			}
 
-			ctx_data->stack_head->data = NULL;
-			sdp_xml_data_free(ctx_data->stack_head);
-			ctx_data->stack_head = NULL;
+			ctx_data->stack[ctx_data->depth - 1] = NULL;
 		} else {
 			DBG("No data for attribute 0x%04x", ctx_data->attr_id);
 		}
+
+		clear_stack(ctx_data);
 		return;
 	}
 
-	if (!strcmp(element_name, "sequence")) {
-		ctx_data->stack_head->data->unitSize = compute_seq_size(ctx_data->stack_head->data);
+	if (ctx_data->depth == 0)
+		return;
+
+	data = ctx_data->stack[ctx_data->depth - 1];
 
-		if (ctx_data->stack_head->data->unitSize > USHRT_MAX) {
-			ctx_data->stack_head->data->unitSize += sizeof(uint32_t);
-			ctx_data->stack_head->data->dtd = SDP_SEQ32;
-		} else if (ctx_data->stack_head->data->unitSize > UCHAR_MAX) {
-			ctx_data->stack_head->data->unitSize += sizeof(uint16_t);
-			ctx_data->stack_head->data->dtd = SDP_SEQ16;
+	if (data && !strcmp(element_name, "sequence")) {
+		data->unitSize = compute_seq_size(data);
+
+		if (data->unitSize > USHRT_MAX) {
+			data->unitSize += sizeof(uint32_t);
+			data->dtd = SDP_SEQ32;
+		} else if (data->unitSize > UCHAR_MAX) {
+			data->unitSize += sizeof(uint16_t);
+			data->dtd = SDP_SEQ16;
 		} else {
-			ctx_data->stack_head->data->unitSize += sizeof(uint8_t);
+			data->unitSize += sizeof(uint8_t);
 		}
-	} else if (!strcmp(element_name, "alternate")) {
-		ctx_data->stack_head->data->unitSize = compute_seq_size(ctx_data->stack_head->data);
-
-		if (ctx_data->stack_head->data->unitSize > USHRT_MAX) {
-			ctx_data->stack_head->data->unitSize += sizeof(uint32_t);
-			ctx_data->stack_head->data->dtd = SDP_ALT32;
-		} else if (ctx_data->stack_head->data->unitSize > UCHAR_MAX) {
-			ctx_data->stack_head->data->unitSize += sizeof(uint16_t);
-			ctx_data->stack_head->data->dtd = SDP_ALT16;
+	} else if (data && !strcmp(element_name, "alternate")) {
+		data->unitSize = compute_seq_size(data);
+
+		if (data->unitSize > USHRT_MAX) {
+			data->unitSize += sizeof(uint32_t);
+			data->dtd = SDP_ALT32;
+		} else if (data->unitSize > UCHAR_MAX) {
+			data->unitSize += sizeof(uint16_t);
+			data->dtd = SDP_ALT16;
 		} else {
-			ctx_data->stack_head->data->unitSize += sizeof(uint8_t);
+			data->unitSize += sizeof(uint8_t);
 		}
 	}
 
-	if (ctx_data->stack_head->next && ctx_data->stack_head->data &&
-					ctx_data->stack_head->next->data) {
-		switch (ctx_data->stack_head->next->data->dtd) {
+	/* The outermost element stays until the attribute is closed */
+	if (ctx_data->depth == 1)
+		return;
+
+	parent = ctx_data->stack[ctx_data->depth - 2];
+
+	if (data && parent) {
+		switch (parent->dtd) {
 		case SDP_SEQ8:
 		case SDP_SEQ16:
 		case SDP_SEQ32:
 		case SDP_ALT8:
 		case SDP_ALT16:
 		case SDP_ALT32:
-			ctx_data->stack_head->next->data->val.dataseq =
-				sdp_seq_append(ctx_data->stack_head->next->data->val.dataseq,
-								ctx_data->stack_head->data);
-			ctx_data->stack_head->data = NULL;
+			parent->val.dataseq = sdp_seq_append(parent->val.dataseq,
+									data);
+			data = NULL;
 			break;
 		}
+	}
 
-		elem = ctx_data->stack_head;
-		ctx_data->stack_head = ctx_data->stack_head->next;
+	if (data)
+		sdp_data_free(data);
 
-		sdp_xml_data_free(elem);
-	}
+	ctx_data->depth--;
 }
 
 static GMarkupParser parser = {
@@ -240,35 +268,84 @@ static GMarkupParser parser = {
 static sdp_record_t *sdp_xml_parse_record(const char *data, int size)
 {
 	GMarkupParseContext *ctx;
-	struct context_data *ctx_data;
+	struct context_data ctx_data;
 	sdp_record_t *record;
-
-	ctx_data = malloc(sizeof(*ctx_data));
-	if (!ctx_data)
-		return NULL;
+	gboolean ret;
 
 	record = sdp_record_alloc();
-	if (!record) {
-		free(ctx_data);
+	if (!record)
 		return NULL;
-	}
 
-	memset(ctx_data, 0, sizeof(*ctx_data));
-	ctx_data->record = record;
+	memset(&ctx_data, 0, sizeof(ctx_data));
+	ctx_data.record = record;
+
+	ctx = g_markup_parse_context_new(&parser, 0, &ctx_data, NULL);
+
+	ret = g_markup_parse_context_parse(ctx, data, size, NULL);
+
+	g_markup_parse_context_free(ctx);
 
-	ctx = g_markup_parse_context_new(&parser, 0, ctx_data, NULL);
+	clear_stack(&ctx_data);
+	g_free(ctx_data.stack);
 
-	if (g_markup_parse_context_parse(ctx, data, size, NULL) == FALSE) {
+	if (ret == FALSE) {
 		error("XML parsing error");
-		g_markup_parse_context_free(ctx);
 		sdp_record_free(record);
-		free(ctx_data);
 		return NULL;
 	}
 
-	g_markup_parse_context_free(ctx);
+	return record;
+}
+
+static void free_cached_pdu(gpointer data)
+{
+	sdp_buf_t *pdu = data;
+
+	free(pdu->data);
+	g_free(pdu);
+}
+
+static sdp_record_t *parse_xml_record(const char *data, int size)
+{
+	sdp_record_t *record;
+	sdp_buf_t *pdu;
+	gchar *hash;
+	int scanned;
+
+	hash = g_compute_checksum_for_data(G_CHECKSUM_SHA256,
+						(const guchar *) data, size);
+
+	pdu = g_hash_table_lookup(xml_cache, hash);
+	if (pdu) {
+		g_free(hash);
+
+		/* Let the server assign the handle, as for parsed XML */
+		record = sdp_extract_pdu(pdu->data, pdu->data_size, &scanned);
+		if (record)
+			record->handle = 0xffffffff;
+
+		return record;
+	}
+
+	record = sdp_xml_parse_record(data, size);
+	if (!record) {
+		g_free(hash);
+		return NULL;
+	}
+
+	pdu = g_new0(sdp_buf_t, 1);
+	if (sdp_gen_record_pdu(record, pdu) < 0) {
+		g_free(pdu);
+		g_free(hash);
+		return record;
+	}
+
+	if (g_hash_table_size(xml_cache) >= XML_CACHE_SIZE)
+		g_hash_table_remove(xml_cache,
+					g_queue_pop_head(xml_cache_keys));
 
-	free(ctx_data);
+	g_hash_table_insert(xml_cache, hash, pdu);
+	g_queue_push_tail(xml_cache_keys, hash);
 
 	return record;
 }
@@ -346,7 +423,7 @@ static int add_xml_record(DBusConnection *conn, const char *sender,
 	sdp_record_t *sdp_record;
 	bdaddr_t src;
 
-	sdp_record = sdp_xml_parse_record(record, strlen(record));
+	sdp_record = parse_xml_record(record, strlen(record));
 	if (!sdp_record) {
 		error("Parsing of XML service record failed");
 		return -EIO;
@@ -433,7 +510,7 @@ static DBusMessage *update_xml_record(DBusConnection *conn,
 	if (!user_record)
 		return btd_error_not_available(msg);
 
-	sdp_record = sdp_xml_parse_record(record, len);
+	sdp_record = parse_xml_record(record, len);
 	if (!sdp_record) {
 		error("Parsing of XML service record failed");
 		return btd_error_failed(msg,
@@ -797,6 +874,10 @@ static int service_init(void)
 	if (connection == NULL)
 		return -EIO;
 
+	xml_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+						g_free, free_cached_pdu);
+	xml_cache_keys = g_queue_new();
+
 	any_path = btd_adapter_any_request_path();
 	if (any_path != NULL) {
 		if (register_interface(any_path, NULL) < 0) {
@@ -807,6 +888,8 @@ static int service_init(void)
 
 	err = btd_register_adapter_driver(&service_driver);
 	if (err < 0) {
+		g_queue_free(xml_cache_keys);
+		g_hash_table_destroy(xml_cache);
 		dbus_connection_unref(connection);
 		return err;
 	}
@@ -825,6 +908,9 @@ static void service_exit(void)
 		any_path = NULL;
 	}
 
+	g_queue_free(xml_cache_keys);
+	g_hash_table_destroy(xml_cache);
+
 	dbus_connection_unref(connection);
 }
 
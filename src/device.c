@@ -1163,6 +1163,7 @@ static void device_remove_stored(struct btd_device *device)
 	/* key: address only */
 	delete_entry(&src, "profiles", key);
 	delete_entry(&src, "trusts", key);
+	delete_entry(&src, "avdtp", key);
 
 	if (device_is_bonded(device)) {
 		delete_entry(&src, "linkkeys", key);
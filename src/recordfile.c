@@ -0,0 +1,484 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "recordfile.h"
+
+/*
+ * On-disk layout, all integers little endian:
+ *
+ *   header:  "BZRF" | version (1) | reserved (3) | entry count (4)
+ *   index:   count * { bdaddr (6) | reserved (2) | handle (4) |
+ *                      offset (4) | length (4) }
+ *   data:    raw SDP record PDUs referenced by the index
+ *
+ * The index is kept sorted by (bdaddr, handle) so that lookups are a
+ * binary search on the mapped file and only the matching PDUs are ever
+ * touched by the caller.
+ */
+
+#define RECORDFILE_MAGIC	"BZRF"
+#define RECORDFILE_VERSION	0x01
+
+#define HEADER_SIZE		12
+#define ENTRY_SIZE		20
+
+struct recordfile_map {
+	uint8_t *map;
+	size_t size;
+	uint32_t count;
+};
+
+static inline void put_le32(uint32_t val, uint8_t *ptr)
+{
+	bt_put_unaligned(htobl(val), (uint32_t *) ptr);
+}
+
+static int map_file(int fd, struct recordfile_map *m)
+{
+	struct stat st;
+
+	memset(m, 0, sizeof(*m));
+
+	if (fstat(fd, &st) < 0)
+		return -errno;
+
+	/* Freshly created files are empty and hold no records */
+	if (st.st_size == 0)
+		return 0;
+
+	if (st.st_size < HEADER_SIZE)
+		return -EILSEQ;
+
+	m->size = st.st_size;
+
+	m->map = mmap(NULL, m->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (!m->map || m->map == MAP_FAILED) {
+		m->map = NULL;
+		return -errno;
+	}
+
+	if (memcmp(m->map, RECORDFILE_MAGIC, 4) ||
+					m->map[4] != RECORDFILE_VERSION)
+		goto fail;
+
+	m->count = bt_get_le32(m->map + 8);
+	if (m->count > (m->size - HEADER_SIZE) / ENTRY_SIZE)
+		goto fail;
+
+	return 0;
+
+fail:
+	munmap(m->map, m->size);
+	m->map = NULL;
+
+	return -EILSEQ;
+}
+
+static void unmap_file(struct recordfile_map *m)
+{
+	if (m->map)
+		munmap(m->map, m->size);
+}
+
+static int get_entry(struct recordfile_map *m, uint32_t idx,
+					struct recordfile_entry *entry)
+{
+	const uint8_t *ptr = m->map + HEADER_SIZE + idx * ENTRY_SIZE;
+	uint32_t offset, len;
+
+	offset = bt_get_le32(ptr + 12);
+	len = bt_get_le32(ptr + 16);
+
+	if (offset > m->size || len > m->size - offset)
+		return -EILSEQ;
+
+	memcpy(&entry->dst, ptr, sizeof(bdaddr_t));
+	entry->handle = bt_get_le32(ptr + 8);
+	entry->data = m->map + offset;
+	entry->len = len;
+
+	return 0;
+}
+
+static int entry_cmp(const bdaddr_t *dst, uint32_t handle,
+					const struct recordfile_entry *entry)
+{
+	int ret;
+
+	ret = bacmp(dst, &entry->dst);
+	if (ret)
+		return ret;
+
+	if (handle == entry->handle)
+		return 0;
+
+	return handle < entry->handle ? -1 : 1;
+}
+
+static int sort_entries(const void *a, const void *b)
+{
+	const struct recordfile_entry *entry = a;
+
+	return entry_cmp(&entry->dst, entry->handle, b);
+}
+
+/* Index of the first entry not smaller than (dst, handle) */
+static uint32_t lower_bound(struct recordfile_map *m, const bdaddr_t *dst,
+							uint32_t handle)
+{
+	uint32_t low = 0, high = m->count;
+
+	while (low < high) {
+		uint32_t mid = low + (high - low) / 2;
+		const uint8_t *ptr = m->map + HEADER_SIZE + mid * ENTRY_SIZE;
+		struct recordfile_entry entry;
+
+		memcpy(&entry.dst, ptr, sizeof(bdaddr_t));
+		entry.handle = bt_get_le32(ptr + 8);
+
+		if (entry_cmp(dst, handle, &entry) > 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static int open_locked(const char *pathname, int flags, int operation)
+{
+	struct stat st, fst;
+	int fd;
+
+	/*
+	 * Writers replace the file through rename(), so after acquiring
+	 * the lock make sure it still belongs to the current file.
+	 */
+	while (1) {
+		fd = open(pathname, flags, S_IRUSR | S_IWUSR |
+						S_IRGRP | S_IROTH);
+		if (fd < 0)
+			return -errno;
+
+		if (flock(fd, operation) < 0) {
+			int err = -errno;
+			close(fd);
+			return err;
+		}
+
+		if (fstat(fd, &fst) < 0 || stat(pathname, &st) < 0) {
+			int err = -errno;
+			flock(fd, LOCK_UN);
+			close(fd);
+			return err;
+		}
+
+		if (fst.st_dev == st.st_dev && fst.st_ino == st.st_ino)
+			return fd;
+
+		flock(fd, LOCK_UN);
+		close(fd);
+	}
+}
+
+static void close_locked(int fd)
+{
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+/* Entries must already be sorted by (dst, handle) */
+static int write_entries(const char *pathname,
+			struct recordfile_entry *entries, unsigned int count)
+{
+	char tmpname[PATH_MAX + 1];
+	uint8_t *buf, *ptr;
+	size_t size, offset;
+	unsigned int i;
+	ssize_t len;
+	int fd, err = 0;
+
+	size = HEADER_SIZE + count * ENTRY_SIZE;
+	for (i = 0; i < count; i++)
+		size += entries[i].len;
+
+	buf = malloc(size);
+	if (!buf)
+		return -ENOMEM;
+
+	memcpy(buf, RECORDFILE_MAGIC, 4);
+	buf[4] = RECORDFILE_VERSION;
+	memset(buf + 5, 0, 3);
+	put_le32(count, buf + 8);
+
+	ptr = buf + HEADER_SIZE;
+	offset = HEADER_SIZE + count * ENTRY_SIZE;
+
+	for (i = 0; i < count; i++, ptr += ENTRY_SIZE) {
+		memcpy(ptr, &entries[i].dst, sizeof(bdaddr_t));
+		memset(ptr + 6, 0, 2);
+		put_le32(entries[i].handle, ptr + 8);
+		put_le32(offset, ptr + 12);
+		put_le32(entries[i].len, ptr + 16);
+
+		memcpy(buf + offset, entries[i].data, entries[i].len);
+		offset += entries[i].len;
+	}
+
+	snprintf(tmpname, sizeof(tmpname), "%s.new", pathname);
+
+	fd = open(tmpname, O_WRONLY | O_CREAT | O_TRUNC,
+				S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if (fd < 0) {
+		err = -errno;
+		goto done;
+	}
+
+	for (offset = 0; offset < size; offset += len) {
+		len = write(fd, buf + offset, size - offset);
+		if (len < 0) {
+			if (errno == EINTR) {
+				len = 0;
+				continue;
+			}
+			err = -errno;
+			break;
+		}
+	}
+
+	if (!err && fdatasync(fd) < 0)
+		err = -errno;
+
+	close(fd);
+
+	if (!err && rename(tmpname, pathname) < 0)
+		err = -errno;
+
+	if (err < 0)
+		unlink(tmpname);
+
+done:
+	free(buf);
+
+	return err;
+}
+
+int recordfile_write(const char *pathname, struct recordfile_entry *entries,
+							unsigned int count)
+{
+	int fd, err;
+
+	fd = open_locked(pathname, O_RDWR | O_CREAT, LOCK_EX);
+	if (fd < 0)
+		return fd;
+
+	qsort(entries, count, sizeof(*entries), sort_entries);
+
+	err = write_entries(pathname, entries, count);
+
+	close_locked(fd);
+
+	return err;
+}
+
+static int update_entries(const char *pathname, const bdaddr_t *dst,
+				uint32_t handle, int all,
+				const uint8_t *data, size_t len)
+{
+	struct recordfile_map m;
+	struct recordfile_entry *entries, entry;
+	unsigned int i, count = 0;
+	int changed = 0;
+	int fd, err;
+
+	fd = open_locked(pathname, O_RDWR | O_CREAT, LOCK_EX);
+	if (fd < 0)
+		return fd;
+
+	err = map_file(fd, &m);
+	if (err < 0)
+		goto unlock;
+
+	entries = malloc((m.count + 1) * sizeof(*entries));
+	if (!entries) {
+		err = -ENOMEM;
+		goto unmap;
+	}
+
+	for (i = 0; i < m.count; i++) {
+		err = get_entry(&m, i, &entry);
+		if (err < 0)
+			goto free;
+
+		if (!bacmp(dst, &entry.dst) &&
+					(all || handle == entry.handle)) {
+			/* Rewriting an identical record is a no-op */
+			if (data && entry.len == len &&
+					!memcmp(entry.data, data, len))
+				goto free;
+
+			changed = 1;
+			continue;
+		}
+
+		entries[count++] = entry;
+	}
+
+	if (data) {
+		bacpy(&entries[count].dst, dst);
+		entries[count].handle = handle;
+		entries[count].data = data;
+		entries[count].len = len;
+		count++;
+
+		qsort(entries, count, sizeof(*entries), sort_entries);
+		changed = 1;
+	}
+
+	if (changed)
+		err = write_entries(pathname, entries, count);
+
+free:
+	free(entries);
+
+unmap:
+	unmap_file(&m);
+
+unlock:
+	close_locked(fd);
+
+	return err;
+}
+
+int recordfile_put(const char *pathname, const bdaddr_t *dst, uint32_t handle,
+					const uint8_t *data, size_t len)
+{
+	return update_entries(pathname, dst, handle, 0, data, len);
+}
+
+int recordfile_del(const char *pathname, const bdaddr_t *dst, uint32_t handle)
+{
+	return update_entries(pathname, dst, handle, 0, NULL, 0);
+}
+
+int recordfile_del_all(const char *pathname, const bdaddr_t *dst)
+{
+	return update_entries(pathname, dst, 0, 1, NULL, 0);
+}
+
+int recordfile_get(const char *pathname, const bdaddr_t *dst, uint32_t handle,
+					recordfile_cb func, void *user_data)
+{
+	struct recordfile_map m;
+	struct recordfile_entry entry;
+	uint32_t idx;
+	int fd, err;
+
+	fd = open_locked(pathname, O_RDONLY, LOCK_SH);
+	if (fd < 0)
+		return fd;
+
+	err = map_file(fd, &m);
+	if (err < 0)
+		goto unlock;
+
+	idx = lower_bound(&m, dst, handle);
+	if (idx == m.count) {
+		err = -ENOENT;
+		goto unmap;
+	}
+
+	err = get_entry(&m, idx, &entry);
+	if (err < 0)
+		goto unmap;
+
+	if (entry_cmp(dst, handle, &entry)) {
+		err = -ENOENT;
+		goto unmap;
+	}
+
+	func(&entry.dst, entry.handle, entry.data, entry.len, user_data);
+
+unmap:
+	unmap_file(&m);
+
+unlock:
+	close_locked(fd);
+
+	return err;
+}
+
+int recordfile_foreach(const char *pathname, const bdaddr_t *dst,
+					recordfile_cb func, void *user_data)
+{
+	struct recordfile_map m;
+	struct recordfile_entry entry;
+	uint32_t idx;
+	int fd, err;
+
+	fd = open_locked(pathname, O_RDONLY, LOCK_SH);
+	if (fd < 0)
+		return fd;
+
+	err = map_file(fd, &m);
+	if (err < 0)
+		goto unlock;
+
+	idx = dst ? lower_bound(&m, dst, 0) : 0;
+
+	for (; idx < m.count; idx++) {
+		err = get_entry(&m, idx, &entry);
+		if (err < 0)
+			break;
+
+		if (dst && bacmp(dst, &entry.dst))
+			break;
+
+		func(&entry.dst, entry.handle, entry.data, entry.len,
+								user_data);
+	}
+
+	unmap_file(&m);
+
+unlock:
+	close_locked(fd);
+
+	return err;
+}
@@ -0,0 +1,48 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __RECORDFILE_H
+#define __RECORDFILE_H
+
+struct recordfile_entry {
+	bdaddr_t dst;
+	uint32_t handle;
+	const uint8_t *data;
+	size_t len;
+};
+
+typedef void (*recordfile_cb) (const bdaddr_t *dst, uint32_t handle,
+				const uint8_t *data, size_t len, void *user_data);
+
+int recordfile_write(const char *pathname, struct recordfile_entry *entries,
+							unsigned int count);
+int recordfile_put(const char *pathname, const bdaddr_t *dst, uint32_t handle,
+					const uint8_t *data, size_t len);
+int recordfile_del(const char *pathname, const bdaddr_t *dst, uint32_t handle);
+int recordfile_del_all(const char *pathname, const bdaddr_t *dst);
+int recordfile_get(const char *pathname, const bdaddr_t *dst, uint32_t handle,
+					recordfile_cb func, void *user_data);
+int recordfile_foreach(const char *pathname, const bdaddr_t *dst,
+					recordfile_cb func, void *user_data);
+
+#endif /* __RECORDFILE_H */
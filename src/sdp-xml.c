@@ -696,58 +696,9 @@ sdp_data_t *sdp_xml_parse_nil(const char *data)
 	return sdp_data_alloc(SDP_DATA_NIL, 0);
 }
 
-#define DEFAULT_XML_DATA_SIZE 1024
-
-struct sdp_xml_data *sdp_xml_data_alloc(void)
-{
-	struct sdp_xml_data *elem;
-
-	elem = malloc(sizeof(struct sdp_xml_data));
-	if (!elem)
-		return NULL;
-
-	memset(elem, 0, sizeof(struct sdp_xml_data));
-
-	/* Null terminate the text */
-	elem->size = DEFAULT_XML_DATA_SIZE;
-	elem->text = malloc(DEFAULT_XML_DATA_SIZE);
-	elem->text[0] = '\0';
-
-	return elem;
-}
-
-void sdp_xml_data_free(struct sdp_xml_data *elem)
-{
-	if (elem->data)
-		sdp_data_free(elem->data);
-
-	free(elem->name);
-	free(elem->text);
-	free(elem);
-}
-
-struct sdp_xml_data *sdp_xml_data_expand(struct sdp_xml_data *elem)
+sdp_data_t *sdp_xml_parse_datatype(const char *el, const char *data,
+					char encoding, sdp_record_t *record)
 {
-	char *newbuf;
-
-	newbuf = malloc(elem->size * 2);
-	if (!newbuf)
-		return NULL;
-
-	memcpy(newbuf, elem->text, elem->size);
-	elem->size *= 2;
-	free(elem->text);
-
-	elem->text = newbuf;
-
-	return elem;
-}
-
-sdp_data_t *sdp_xml_parse_datatype(const char *el, struct sdp_xml_data *elem,
-							sdp_record_t *record)
-{
-	const char *data = elem->text;
-
 	if (!strcmp(el, "boolean"))
 		return sdp_xml_parse_int(data, SDP_BOOL);
 	else if (!strcmp(el, "uint8"))
@@ -775,7 +726,7 @@ sdp_data_t *sdp_xml_parse_datatype(const char *el, struct sdp_xml_data *elem,
 	else if (!strcmp(el, "url"))
 		return sdp_xml_parse_url(data);
 	else if (!strcmp(el, "text"))
-		return sdp_xml_parse_text(data, elem->type);
+		return sdp_xml_parse_text(data, encoding);
 	else if (!strcmp(el, "nil"))
 		return sdp_xml_parse_nil(data);
 
@@ -39,21 +39,7 @@ sdp_data_t *sdp_xml_parse_url(const char *data);
 sdp_data_t *sdp_xml_parse_int(const char *data, uint8_t dtd);
 sdp_data_t *sdp_xml_parse_uuid(const char *data, sdp_record_t *record);
 
-struct sdp_xml_data {
-	char *text;			/* Pointer to the current buffer */
-	int size;			/* Size of the current buffer */
-	sdp_data_t *data;		/* The current item being built */
-	struct sdp_xml_data *next;	/* Next item on the stack */
-	char type;			/* 0 = Text or Hexadecimal */
-	char *name;			/* Name, optional in the dtd */
-	/* TODO: What is it used for? */
-};
-
-struct sdp_xml_data *sdp_xml_data_alloc(void);
-void sdp_xml_data_free(struct sdp_xml_data *elem);
-struct sdp_xml_data *sdp_xml_data_expand(struct sdp_xml_data *elem);
-
-sdp_data_t *sdp_xml_parse_datatype(const char *el, struct sdp_xml_data *elem,
-							sdp_record_t *record);
+sdp_data_t *sdp_xml_parse_datatype(const char *el, const char *data,
+					char encoding, sdp_record_t *record);
 
 #endif /* __SDP_XML_H */
@@ -461,7 +461,7 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 
 	/* under both the conditions below, the rsp buffer is not built yet */
 	if (cstate || cStateId > 0) {
-		short lastIndex = 0;
+		uint16_t lastIndex = 0;
 
 		if (cstate) {
 			/*
@@ -469,13 +469,29 @@ static int service_search_req(sdp_req_t *req, sdp_buf_t *buf)
 			 * the cached rsp
 			 */
 			sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
-			if (pCache) {
+			if (pCache && pCache->data_size >= 2 * sizeof(uint16_t)) {
 				pCacheBuffer = pCache->data;
 				/* get the rsp_count from the cached buffer */
 				rsp_count = ntohs(bt_get_unaligned((uint16_t *)pCacheBuffer));
 
+				/*
+				 * The cache is shared by all request types,
+				 * make sure this entry holds enough handles
+				 */
+				if (pCache->data_size < 2 * sizeof(uint16_t) +
+						rsp_count * sizeof(uint32_t)) {
+					status = SDP_INVALID_CSTATE;
+					SDPDBG("Cached response too short for handles");
+					goto done;
+				}
+
 				/* get index of the last sdp_record_t sent */
 				lastIndex = cstate->cStateValue.lastIndexSent;
+				if (lastIndex >= rsp_count) {
+					status = SDP_INVALID_CSTATE;
+					SDPDBG("Continuation state beyond cached response");
+					goto done;
+				}
 			} else {
 				status = SDP_INVALID_CSTATE;
 				goto done;
@@ -713,7 +729,11 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 
 		SDPDBG("Obtained cached rsp : %p", pCache);
 
-		if (pCache) {
+		if (pCache && cstate->cStateValue.maxBytesSent >=
+							pCache->data_size) {
+			status = SDP_INVALID_CSTATE;
+			SDPDBG("Continuation state beyond cached response");
+		} else if (pCache) {
 			short sent = MIN(max_rsp_size, pCache->data_size - cstate->cStateValue.maxBytesSent);
 			pResponse = pCache->data;
 			memcpy(buf->data, pResponse + cstate->cStateValue.maxBytesSent, sent);
@@ -728,7 +748,7 @@ static int service_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 				cstate_size = sdp_set_cstate_pdu(buf, cstate);
 		} else {
 			status = SDP_INVALID_CSTATE;
-			error("NULL cache buffer and non-NULL continuation state");
+			SDPDBG("NULL cache buffer and non-NULL continuation state");
 		}
 	} else {
 		sdp_record_t *rec = sdp_record_find(handle);
@@ -907,7 +927,11 @@ static int service_search_attr_req(sdp_req_t *req, sdp_buf_t *buf)
 	} else {
 		/* continuation State exists -> get from cache */
 		sdp_buf_t *pCache = sdp_get_cached_rsp(cstate);
-		if (pCache) {
+		if (pCache && cstate->cStateValue.maxBytesSent >=
+							pCache->data_size) {
+			status = SDP_INVALID_CSTATE;
+			SDPDBG("Continuation state beyond cached response");
+		} else if (pCache) {
 			uint16_t sent = MIN(max, pCache->data_size - cstate->cStateValue.maxBytesSent);
 			pResponse = pCache->data;
 			memcpy(buf->data, pResponse + cstate->cStateValue.maxBytesSent, sent);
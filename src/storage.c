@@ -44,6 +44,7 @@
 #include <bluetooth/uuid.h>
 
 #include "textfile.h"
+#include "recordfile.h"
 #include "glib-helper.h"
 #include "storage.h"
 
@@ -795,33 +796,104 @@ int delete_entry(bdaddr_t *src, const char *storage, const char *key)
 	return textfile_del(filename, key);
 }
 
+struct record_convert {
+	GSList *pdus;
+	struct recordfile_entry *entries;
+	unsigned int count;
+	unsigned int size;
+};
+
+static void convert_record_entry(char *key, char *value, void *user_data)
+{
+	struct record_convert *conv = user_data;
+	struct recordfile_entry *entry;
+	uint8_t *pdu;
+	size_t len;
+	char *end;
+
+	if (strlen(key) != 26 || key[17] != '#')
+		return;
+
+	len = strlen(value) / 2;
+	pdu = g_malloc0(len);
+
+	if (decode_bytes(value, pdu, len) < 0) {
+		g_free(pdu);
+		return;
+	}
+
+	if (conv->count == conv->size) {
+		conv->size = conv->size ? conv->size * 2 : 32;
+		conv->entries = g_renew(struct recordfile_entry,
+						conv->entries, conv->size);
+	}
+
+	entry = &conv->entries[conv->count];
+
+	key[17] = '\0';
+	str2ba(key, &entry->dst);
+	entry->handle = strtoul(key + 18, &end, 16);
+	entry->data = pdu;
+	entry->len = len;
+
+	conv->pdus = g_slist_prepend(conv->pdus, pdu);
+
+	if (*end == '\0')
+		conv->count++;
+}
+
+/*
+ * Remote records used to be stored hex encoded in the "sdp" textfile.
+ * Convert them once into the indexed binary store, which is then the
+ * only place records are read from and written to.
+ */
+static void create_record_filename(char *filename, const char *src)
+{
+	char oldname[PATH_MAX + 1];
+	struct record_convert conv;
+
+	create_name(filename, PATH_MAX, STORAGEDIR, src, "sdprecords");
+
+	if (access(filename, F_OK) == 0)
+		return;
+
+	create_name(oldname, PATH_MAX, STORAGEDIR, src, "sdp");
+
+	memset(&conv, 0, sizeof(conv));
+
+	if (textfile_foreach(oldname, convert_record_entry, &conv) < 0 &&
+							conv.count == 0)
+		return;
+
+	create_dirs(filename, S_IRUSR | S_IWUSR | S_IXUSR |
+					S_IRGRP | S_IXGRP | S_IROTH | S_IXOTH);
+
+	recordfile_write(filename, conv.entries, conv.count);
+
+	g_slist_free_full(conv.pdus, g_free);
+	g_free(conv.entries);
+}
+
 int store_record(const gchar *src, const gchar *dst, sdp_record_t *rec)
 {
-	char filename[PATH_MAX + 1], key[28];
+	char filename[PATH_MAX + 1];
+	bdaddr_t dba;
 	sdp_buf_t buf;
-	int err, size, i;
-	char *str;
+	int err;
 
-	create_name(filename, PATH_MAX, STORAGEDIR, src, "sdp");
+	create_record_filename(filename, src);
 
 	create_file(filename, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
 
-	snprintf(key, sizeof(key), "%17s#%08X", dst, rec->handle);
-
 	if (sdp_gen_record_pdu(rec, &buf) < 0)
 		return -1;
 
-	size = buf.data_size;
-
-	str = g_malloc0(size*2+1);
+	str2ba(dst, &dba);
 
-	for (i = 0; i < size; i++)
-		sprintf(str + (i * 2), "%02X", buf.data[i]);
-
-	err = textfile_put(filename, key, str);
+	err = recordfile_put(filename, &dba, rec->handle, buf.data,
+							buf.data_size);
 
 	free(buf.data);
-	g_free(str);
 
 	return err;
 }
@@ -848,93 +920,81 @@ sdp_record_t *record_from_string(const gchar *str)
 	return rec;
 }
 
+static void extract_record(const bdaddr_t *dst, uint32_t handle,
+				const uint8_t *data, size_t len, void *user_data)
+{
+	sdp_record_t **rec = user_data;
+	int scanned;
+
+	*rec = sdp_extract_pdu(data, len, &scanned);
+}
 
 sdp_record_t *fetch_record(const gchar *src, const gchar *dst,
 						const uint32_t handle)
 {
-	char filename[PATH_MAX + 1], key[28], *str;
-	sdp_record_t *rec;
+	char filename[PATH_MAX + 1];
+	sdp_record_t *rec = NULL;
+	bdaddr_t dba;
 
-	create_name(filename, PATH_MAX, STORAGEDIR, src, "sdp");
+	create_record_filename(filename, src);
 
-	snprintf(key, sizeof(key), "%17s#%08X", dst, handle);
+	str2ba(dst, &dba);
 
-	str = textfile_get(filename, key);
-	if (!str)
+	if (recordfile_get(filename, &dba, handle, extract_record, &rec) < 0)
 		return NULL;
 
-	rec = record_from_string(str);
-	free(str);
-
 	return rec;
 }
 
 int delete_record(const gchar *src, const gchar *dst, const uint32_t handle)
 {
-	char filename[PATH_MAX + 1], key[28];
+	char filename[PATH_MAX + 1];
+	bdaddr_t dba;
 
-	create_name(filename, PATH_MAX, STORAGEDIR, src, "sdp");
+	create_record_filename(filename, src);
 
-	snprintf(key, sizeof(key), "%17s#%08X", dst, handle);
+	str2ba(dst, &dba);
 
-	return textfile_del(filename, key);
+	return recordfile_del(filename, &dba, handle);
 }
 
-struct record_list {
-	sdp_list_t *recs;
-	const gchar *addr;
-};
-
-static void create_stored_records_from_keys(char *key, char *value,
-							void *user_data)
+static void create_stored_records(const bdaddr_t *dst, uint32_t handle,
+				const uint8_t *data, size_t len, void *user_data)
 {
-	struct record_list *rec_list = user_data;
-	const gchar *addr = rec_list->addr;
+	sdp_list_t **recs = user_data;
 	sdp_record_t *rec;
+	int scanned;
 
-	if (strncmp(key, addr, 17))
+	rec = sdp_extract_pdu(data, len, &scanned);
+	if (!rec)
 		return;
 
-	rec = record_from_string(value);
-
-	rec_list->recs = sdp_list_append(rec_list->recs, rec);
+	*recs = sdp_list_append(*recs, rec);
 }
 
 void delete_all_records(const bdaddr_t *src, const bdaddr_t *dst)
 {
-	sdp_list_t *records, *seq;
-	char srcaddr[18], dstaddr[18];
+	char filename[PATH_MAX + 1], srcaddr[18];
 
 	ba2str(src, srcaddr);
-	ba2str(dst, dstaddr);
 
-	records = read_records(src, dst);
+	create_record_filename(filename, srcaddr);
 
-	for (seq = records; seq; seq = seq->next) {
-		sdp_record_t *rec = seq->data;
-		delete_record(srcaddr, dstaddr, rec->handle);
-	}
-
-	if (records)
-		sdp_list_free(records, (sdp_free_func_t) sdp_record_free);
+	recordfile_del_all(filename, dst);
 }
 
 sdp_list_t *read_records(const bdaddr_t *src, const bdaddr_t *dst)
 {
-	char filename[PATH_MAX + 1];
-	struct record_list rec_list;
-	char srcaddr[18], dstaddr[18];
+	char filename[PATH_MAX + 1], srcaddr[18];
+	sdp_list_t *recs = NULL;
 
 	ba2str(src, srcaddr);
-	ba2str(dst, dstaddr);
 
-	rec_list.addr = dstaddr;
-	rec_list.recs = NULL;
+	create_record_filename(filename, srcaddr);
 
-	create_name(filename, PATH_MAX, STORAGEDIR, srcaddr, "sdp");
-	textfile_foreach(filename, create_stored_records_from_keys, &rec_list);
+	recordfile_foreach(filename, dst, create_stored_records, &recs);
 
-	return rec_list.recs;
+	return recs;
 }
 
 sdp_record_t *find_record_in_list(sdp_list_t *recs, const char *uuid)
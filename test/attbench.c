@@ -0,0 +1,833 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <glib.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/uuid.h>
+#include <bluetooth/sdp.h>
+#include <bluetooth/sdp_lib.h>
+
+#include "log.h"
+#include "btio.h"
+#include "sdpd.h"
+#include "adapter.h"
+#include "device.h"
+#include "storage.h"
+#include "gattrib.h"
+#include "att.h"
+#include "gatt.h"
+#include "att-database.h"
+#include "attrib-server.h"
+
+/*
+ * Runs the attribute server from src/attrib-server.c against simulated
+ * clients. Every client is an AF_UNIX socketpair whose server end is
+ * wrapped in a GAttrib and handed to attrib_channel_attach(), exactly
+ * like an accepted L2CAP connection. The btio and adapter functions
+ * the server needs are replaced below, so no radio is involved.
+ */
+
+#define BENCH_SVC_UUID		0xB000
+#define BENCH_CHR_UUID		0xB800
+
+#define HIST_BUCKETS		24
+
+enum {
+	PHASE_PRIMARY,
+	PHASE_CHARACTERISTIC,
+	PHASE_DESCRIPTOR,
+	PHASE_ACCESS,
+};
+
+struct opcode_stats {
+	guint64 count;
+	guint64 errors;
+	guint64 total;
+	guint64 hist[HIST_BUCKETS];
+};
+
+struct client {
+	int fd;
+	GIOChannel *io;
+	guint watch;
+	bdaddr_t dst;
+	uint16_t cid;
+	uint16_t mtu;
+	int phase;
+	uint16_t next;
+	unsigned int services;
+	unsigned int characteristics;
+	uint8_t opcode;
+	gint64 sent;
+};
+
+static int opt_services = 16;
+static int opt_characteristics = 8;
+static int opt_value_len = 20;
+static int opt_clients = 16;
+static int opt_requests = 100000;
+static int opt_mtu = 0;
+
+static GMainLoop *main_loop;
+static GHashTable *channels;
+static GSList *records;
+static uint32_t next_record = 0x10000;
+
+static bdaddr_t adapter_addr = {{ 0x01, 0x00, 0x00, 0xc0, 0xa0, 0x00 }};
+static int dummy_adapter;
+#define ADAPTER ((struct btd_adapter *) &dummy_adapter)
+
+static struct client *clients;
+static uint16_t *values;
+static unsigned int num_values;
+
+static int outstanding;
+static int requests_sent;
+static int failures;
+
+static struct opcode_stats stats[256];
+
+static guint64 alloc_count;
+static guint64 free_count;
+
+static gpointer count_malloc(gsize n_bytes)
+{
+	alloc_count++;
+	return malloc(n_bytes);
+}
+
+static gpointer count_realloc(gpointer mem, gsize n_bytes)
+{
+	if (mem == NULL)
+		alloc_count++;
+	return realloc(mem, n_bytes);
+}
+
+static void count_free(gpointer mem)
+{
+	if (mem != NULL)
+		free_count++;
+	free(mem);
+}
+
+static gpointer count_calloc(gsize n_blocks, gsize n_block_bytes)
+{
+	alloc_count++;
+	return calloc(n_blocks, n_block_bytes);
+}
+
+static GMemVTable count_vtable = {
+	count_malloc,
+	count_realloc,
+	count_free,
+	count_calloc,
+	count_malloc,
+	count_realloc,
+};
+
+/* Replacements for the parts of bluetoothd the server calls into */
+
+void error(const char *format, ...)
+{
+	va_list ap;
+
+	va_start(ap, format);
+	vfprintf(stderr, format, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+}
+
+void btd_debug(const char *format, ...)
+{
+}
+
+GQuark bt_io_error_quark(void)
+{
+	return g_quark_from_static_string("bt-io-error-quark");
+}
+
+gboolean bt_io_get(GIOChannel *io, BtIOType type, GError **err,
+						BtIOOption opt1, ...)
+{
+	struct client *client;
+	BtIOOption opt = opt1;
+	va_list args;
+	int fd;
+
+	fd = g_io_channel_unix_get_fd(io);
+
+	client = g_hash_table_lookup(channels, GINT_TO_POINTER(fd));
+	if (client == NULL) {
+		g_set_error(err, BT_IO_ERROR, BT_IO_ERROR_INVALID_ARGS,
+							"Unknown channel");
+		return FALSE;
+	}
+
+	va_start(args, opt1);
+
+	while (opt != BT_IO_OPT_INVALID) {
+		switch (opt) {
+		case BT_IO_OPT_SOURCE_BDADDR:
+			bacpy(va_arg(args, bdaddr_t *), &adapter_addr);
+			break;
+		case BT_IO_OPT_DEST_BDADDR:
+			bacpy(va_arg(args, bdaddr_t *), &client->dst);
+			break;
+		case BT_IO_OPT_CID:
+			*(va_arg(args, uint16_t *)) = client->cid;
+			break;
+		case BT_IO_OPT_IMTU:
+		case BT_IO_OPT_OMTU:
+			*(va_arg(args, uint16_t *)) = client->mtu;
+			break;
+		case BT_IO_OPT_SEC_LEVEL:
+			*(va_arg(args, int *)) = BT_IO_SEC_LOW;
+			break;
+		default:
+			va_end(args);
+			g_set_error(err, BT_IO_ERROR, BT_IO_ERROR_INVALID_ARGS,
+						"Unknown option %d", opt);
+			return FALSE;
+		}
+
+		opt = va_arg(args, int);
+	}
+
+	va_end(args);
+
+	return TRUE;
+}
+
+GIOChannel *bt_io_listen(BtIOType type, BtIOConnect connect,
+				BtIOConfirm confirm, gpointer user_data,
+				GDestroyNotify destroy, GError **err,
+				BtIOOption opt1, ...)
+{
+	GIOChannel *io;
+	int sk;
+
+	sk = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+	if (sk < 0) {
+		g_set_error(err, BT_IO_ERROR, BT_IO_ERROR_FAILED,
+						"socket: %s", strerror(errno));
+		return NULL;
+	}
+
+	io = g_io_channel_unix_new(sk);
+	g_io_channel_set_close_on_unref(io, TRUE);
+
+	return io;
+}
+
+gboolean bt_io_accept(GIOChannel *io, BtIOConnect connect, gpointer user_data,
+					GDestroyNotify destroy, GError **err)
+{
+	g_set_error(err, BT_IO_ERROR, BT_IO_ERROR_FAILED, "Not supported");
+	return FALSE;
+}
+
+void adapter_get_address(struct btd_adapter *adapter, bdaddr_t *bdaddr)
+{
+	bacpy(bdaddr, &adapter_addr);
+}
+
+uint16_t adapter_get_dev_id(struct btd_adapter *adapter)
+{
+	return 0;
+}
+
+struct btd_adapter *btd_adapter_ref(struct btd_adapter *adapter)
+{
+	return adapter;
+}
+
+void btd_adapter_unref(struct btd_adapter *adapter)
+{
+}
+
+struct btd_device *adapter_find_device(struct btd_adapter *adapter,
+							const char *dest)
+{
+	return NULL;
+}
+
+struct btd_device *btd_device_ref(struct btd_device *device)
+{
+	return device;
+}
+
+void btd_device_unref(struct btd_device *device)
+{
+}
+
+gboolean device_is_bonded(struct btd_device *device)
+{
+	return FALSE;
+}
+
+uint8_t device_get_addr_type(struct btd_device *device)
+{
+	return 0;
+}
+
+int read_device_ccc(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
+					uint16_t handle, uint16_t *value)
+{
+	return -ENOENT;
+}
+
+int write_device_ccc(bdaddr_t *local, bdaddr_t *peer, uint8_t bdaddr_type,
+					uint16_t handle, uint16_t value)
+{
+	return 0;
+}
+
+void delete_device_ccc(bdaddr_t *local, bdaddr_t *peer)
+{
+}
+
+int add_record_to_server(const bdaddr_t *src, sdp_record_t *rec)
+{
+	rec->handle = next_record++;
+	records = g_slist_append(records, rec);
+
+	return 0;
+}
+
+int remove_record_from_server(uint32_t handle)
+{
+	GSList *l;
+
+	for (l = records; l; l = l->next) {
+		sdp_record_t *rec = l->data;
+
+		if (rec->handle != handle)
+			continue;
+
+		records = g_slist_remove(records, rec);
+		sdp_record_free(rec);
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static int create_database(void)
+{
+	uint8_t atval[ATT_MAX_MTU];
+	bt_uuid_t uuid, svc_uuid;
+	int i, j;
+
+	values = g_new0(uint16_t, opt_services * opt_characteristics);
+
+	for (i = 0; i < opt_services; i++) {
+		uint16_t h, nitems = 1 + opt_characteristics * 3;
+
+		bt_uuid16_create(&svc_uuid, BENCH_SVC_UUID + i);
+
+		h = attrib_db_find_avail(ADAPTER, &svc_uuid, nitems);
+		if (h == 0) {
+			error("Not enough free handles for service %d", i);
+			return -ENOSPC;
+		}
+
+		bt_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
+		att_put_u16(BENCH_SVC_UUID + i, &atval[0]);
+		attrib_db_add(ADAPTER, h++, &uuid, ATT_NONE, ATT_NOT_PERMITTED,
+								atval, 2);
+
+		for (j = 0; j < opt_characteristics; j++) {
+			/* Characteristic declaration */
+			bt_uuid16_create(&uuid, GATT_CHARAC_UUID);
+			atval[0] = ATT_CHAR_PROPER_READ | ATT_CHAR_PROPER_WRITE |
+							ATT_CHAR_PROPER_NOTIFY;
+			att_put_u16(h + 1, &atval[1]);
+			att_put_u16(BENCH_CHR_UUID + j, &atval[3]);
+			attrib_db_add(ADAPTER, h++, &uuid, ATT_NONE,
+						ATT_NOT_PERMITTED, atval, 5);
+
+			/* Characteristic value */
+			bt_uuid16_create(&uuid, BENCH_CHR_UUID + j);
+			memset(atval, i + j, opt_value_len);
+			values[num_values++] = h;
+			attrib_db_add(ADAPTER, h++, &uuid, ATT_NONE, ATT_NONE,
+							atval, opt_value_len);
+
+			/* Client characteristic configuration */
+			bt_uuid16_create(&uuid, GATT_CLIENT_CHARAC_CFG_UUID);
+			att_put_u16(0x0000, &atval[0]);
+			attrib_db_add(ADAPTER, h++, &uuid, ATT_NONE, ATT_NONE,
+								atval, 2);
+		}
+	}
+
+	return 0;
+}
+
+static void add_latency(uint8_t opcode, gboolean failed, gint64 usec)
+{
+	struct opcode_stats *s = &stats[opcode];
+	int bucket = 0;
+
+	while (bucket < HIST_BUCKETS - 1 && usec >= (1 << bucket))
+		bucket++;
+
+	s->count++;
+	s->total += usec;
+	s->hist[bucket]++;
+
+	if (failed)
+		s->errors++;
+}
+
+static uint16_t next_request(struct client *client, uint8_t *pdu)
+{
+	uint16_t mtu = client->mtu;
+	bt_uuid_t uuid;
+	uint8_t value[ATT_MAX_MTU];
+	uint16_t handle;
+	int vlen;
+
+	switch (client->phase) {
+	case PHASE_PRIMARY:
+		bt_uuid16_create(&uuid, GATT_PRIM_SVC_UUID);
+		return enc_read_by_grp_req(client->next, 0xffff, &uuid,
+								pdu, mtu);
+	case PHASE_CHARACTERISTIC:
+		bt_uuid16_create(&uuid, GATT_CHARAC_UUID);
+		return enc_read_by_type_req(client->next, 0xffff, &uuid,
+								pdu, mtu);
+	case PHASE_DESCRIPTOR:
+		return enc_find_info_req(client->next, 0xffff, pdu, mtu);
+	}
+
+	handle = values[g_random_int_range(0, num_values)];
+
+	/*
+	 * Writes never grow a value, so blob offsets below the
+	 * shortest possible length are always valid.
+	 */
+	vlen = MIN(opt_value_len, mtu - 3);
+
+	switch (g_random_int_range(0, 10)) {
+	case 0:
+	case 1:
+	case 2:
+		memset(value, g_random_int(), vlen);
+		return enc_write_req(handle, value, vlen, pdu, mtu);
+	case 3:
+		return enc_read_blob_req(handle,
+				g_random_int_range(0, MAX(vlen, 1)), pdu, mtu);
+	default:
+		return enc_read_req(handle, pdu, mtu);
+	}
+}
+
+static uint16_t last_handle(struct att_data_list *list, int offset)
+{
+	uint16_t handle;
+
+	handle = att_get_u16(&list->data[list->num - 1][offset]);
+	att_data_list_free(list);
+
+	return handle;
+}
+
+/*
+ * Advances the discovery state machine of a client. Returns FALSE
+ * if the response is not what the request asked for.
+ */
+static gboolean handle_response(struct client *client, const uint8_t *pdu,
+								ssize_t len)
+{
+	struct att_data_list *list;
+	uint16_t handle;
+	uint8_t format;
+
+	if (pdu[0] == ATT_OP_ERROR) {
+		if (len < 5 || pdu[1] != client->opcode)
+			return FALSE;
+
+		if (client->phase == PHASE_ACCESS)
+			return FALSE;
+
+		if (pdu[4] != ATT_ECODE_ATTR_NOT_FOUND)
+			return FALSE;
+
+		client->phase++;
+		client->next = 0x0001;
+		return TRUE;
+	}
+
+	switch (client->opcode) {
+	case ATT_OP_READ_BY_GROUP_REQ:
+		list = dec_read_by_grp_resp(pdu, len);
+		if (list == NULL)
+			return FALSE;
+
+		client->services += list->num;
+		handle = last_handle(list, 2);
+		break;
+	case ATT_OP_READ_BY_TYPE_REQ:
+		list = dec_read_by_type_resp(pdu, len);
+		if (list == NULL)
+			return FALSE;
+
+		client->characteristics += list->num;
+		handle = last_handle(list, 0);
+		break;
+	case ATT_OP_FIND_INFO_REQ:
+		list = dec_find_info_resp(pdu, len, &format);
+		if (list == NULL)
+			return FALSE;
+
+		handle = last_handle(list, 0);
+		break;
+	case ATT_OP_READ_REQ:
+		return pdu[0] == ATT_OP_READ_RESP;
+	case ATT_OP_READ_BLOB_REQ:
+		return pdu[0] == ATT_OP_READ_BLOB_RESP;
+	case ATT_OP_WRITE_REQ:
+		return pdu[0] == ATT_OP_WRITE_RESP;
+	default:
+		return FALSE;
+	}
+
+	if (handle == 0xffff) {
+		client->phase++;
+		client->next = 0x0001;
+	} else
+		client->next = handle + 1;
+
+	return TRUE;
+}
+
+static gboolean send_request(struct client *client)
+{
+	uint8_t pdu[ATT_MAX_MTU];
+	uint16_t len;
+
+	if (requests_sent >= opt_requests)
+		return FALSE;
+
+	len = next_request(client, pdu);
+	if (len == 0)
+		return FALSE;
+
+	client->opcode = pdu[0];
+	client->sent = g_get_monotonic_time();
+
+	if (write(client->fd, pdu, len) != len) {
+		error("write: %s (%d)", strerror(errno), errno);
+		return FALSE;
+	}
+
+	requests_sent++;
+	outstanding++;
+
+	return TRUE;
+}
+
+static gboolean client_event(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct client *client = user_data;
+	uint8_t pdu[ATT_MAX_MTU];
+	gboolean valid;
+	ssize_t len;
+
+	if (cond & (G_IO_HUP | G_IO_ERR | G_IO_NVAL))
+		goto failed;
+
+	len = read(client->fd, pdu, sizeof(pdu));
+	if (len <= 0)
+		goto failed;
+
+	/* Notifications and indications are not expected */
+	if (pdu[0] == ATT_OP_HANDLE_NOTIFY || pdu[0] == ATT_OP_HANDLE_IND)
+		return TRUE;
+
+	outstanding--;
+
+	valid = handle_response(client, pdu, len);
+	if (!valid)
+		failures++;
+
+	add_latency(client->opcode, !valid,
+				g_get_monotonic_time() - client->sent);
+
+	if (!send_request(client) && outstanding == 0)
+		g_main_loop_quit(main_loop);
+
+	return TRUE;
+
+failed:
+	error("Client %ld disconnected", (long) (client - clients));
+	client->watch = 0;
+	failures++;
+	outstanding--;
+
+	if (outstanding == 0)
+		g_main_loop_quit(main_loop);
+
+	return FALSE;
+}
+
+static int attach_client(struct client *client, int index)
+{
+	GIOChannel *io;
+	GAttrib *attrib;
+	int sv[2];
+	guint id;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) < 0)
+		return -errno;
+
+	client->fd = sv[0];
+	client->phase = PHASE_PRIMARY;
+	client->next = 0x0001;
+
+	bacpy(&client->dst, BDADDR_ANY);
+	client->dst.b[0] = index & 0xff;
+	client->dst.b[1] = index >> 8;
+
+	if (opt_mtu > 0) {
+		client->cid = 0x0040;
+		client->mtu = opt_mtu;
+	} else {
+		client->cid = ATT_CID;
+		client->mtu = ATT_DEFAULT_LE_MTU;
+	}
+
+	g_hash_table_insert(channels, GINT_TO_POINTER(sv[1]), client);
+
+	io = g_io_channel_unix_new(sv[1]);
+	g_io_channel_set_close_on_unref(io, TRUE);
+
+	attrib = g_attrib_new(io);
+	g_io_channel_unref(io);
+
+	if (attrib == NULL)
+		return -EIO;
+
+	id = attrib_channel_attach(attrib);
+	g_attrib_unref(attrib);
+
+	if (id == 0)
+		return -EIO;
+
+	client->io = g_io_channel_unix_new(sv[0]);
+	g_io_channel_set_close_on_unref(client->io, TRUE);
+	client->watch = g_io_add_watch(client->io,
+					G_IO_IN | G_IO_HUP | G_IO_ERR | G_IO_NVAL,
+					client_event, client);
+
+	return 0;
+}
+
+static void print_stats(uint8_t opcode, const char *name)
+{
+	struct opcode_stats *s = &stats[opcode];
+	guint64 max = 0;
+	int i, first = -1, last = 0;
+
+	if (s->count == 0)
+		return;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (s->hist[i] == 0)
+			continue;
+
+		if (first < 0)
+			first = i;
+		last = i;
+		max = MAX(max, s->hist[i]);
+	}
+
+	printf("\n%s: %" G_GUINT64_FORMAT " requests, %" G_GUINT64_FORMAT
+			" failed, mean %.1f us\n", name, s->count, s->errors,
+					(double) s->total / s->count);
+
+	for (i = first; i <= last; i++) {
+		int width = s->hist[i] * 50 / max;
+
+		printf("  < %7d us %10" G_GUINT64_FORMAT " %.*s\n", 1 << i,
+			s->hist[i], width,
+			"##################################################");
+	}
+}
+
+static GOptionEntry options[] = {
+	{ "services", 's', 0, G_OPTION_ARG_INT, &opt_services,
+				"Number of primary services" },
+	{ "characteristics", 'k', 0, G_OPTION_ARG_INT, &opt_characteristics,
+				"Characteristics per service" },
+	{ "value-length", 'l', 0, G_OPTION_ARG_INT, &opt_value_len,
+				"Length of characteristic values" },
+	{ "clients", 'c', 0, G_OPTION_ARG_INT, &opt_clients,
+				"Number of simulated clients" },
+	{ "requests", 'n', 0, G_OPTION_ARG_INT, &opt_requests,
+				"Total number of requests" },
+	{ "mtu", 'm', 0, G_OPTION_ARG_INT, &opt_mtu,
+				"Use BR/EDR channels with this MTU instead of LE" },
+	{ NULL },
+};
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *gerr = NULL;
+	guint64 allocs, frees;
+	gint64 start, elapsed;
+	guint64 pdus = 0;
+	int i, err;
+
+	/* Must run before anything else allocates through GLib */
+	g_mem_set_vtable(&count_vtable);
+
+	context = g_option_context_new(NULL);
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &gerr)) {
+		g_printerr("%s\n", gerr->message);
+		g_error_free(gerr);
+		exit(EXIT_FAILURE);
+	}
+
+	g_option_context_free(context);
+
+	if (opt_services <= 0 || opt_characteristics <= 0 ||
+				opt_clients <= 0 || opt_value_len <= 0 ||
+				opt_value_len > ATT_MAX_MTU ||
+				(opt_mtu != 0 && (opt_mtu < ATT_DEFAULT_LE_MTU ||
+						opt_mtu > ATT_MAX_MTU))) {
+		g_printerr("Invalid parameters\n");
+		exit(EXIT_FAILURE);
+	}
+
+	main_loop = g_main_loop_new(NULL, FALSE);
+	channels = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	if (btd_adapter_gatt_server_start(ADAPTER) < 0) {
+		g_printerr("Unable to start GATT server\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (create_database() < 0)
+		exit(EXIT_FAILURE);
+
+	clients = g_new0(struct client, opt_clients);
+
+	for (i = 0; i < opt_clients; i++) {
+		err = attach_client(&clients[i], i);
+		if (err < 0) {
+			g_printerr("Unable to attach client %d: %s\n", i,
+							strerror(-err));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	printf("%d services, %u values, %d clients, %s MTU %d\n",
+				opt_services, num_values, opt_clients,
+				opt_mtu ? "BR/EDR" : "LE", clients[0].mtu);
+
+	allocs = alloc_count;
+	frees = free_count;
+	start = g_get_monotonic_time();
+
+	for (i = 0; i < opt_clients; i++)
+		send_request(&clients[i]);
+
+	if (outstanding > 0)
+		g_main_loop_run(main_loop);
+
+	elapsed = g_get_monotonic_time() - start;
+	allocs = alloc_count - allocs;
+	frees = free_count - frees;
+
+	for (i = 0; i < 256; i++)
+		pdus += stats[i].count;
+
+	printf("%" G_GUINT64_FORMAT " PDUs in %.3f s, %.0f PDUs/s\n", pdus,
+				elapsed / 1e6, pdus * 1e6 / MAX(elapsed, 1));
+	printf("%" G_GUINT64_FORMAT " allocations, %" G_GUINT64_FORMAT
+			" frees, %.1f allocations per PDU\n", allocs, frees,
+					(double) allocs / MAX(pdus, 1));
+
+	print_stats(ATT_OP_READ_BY_GROUP_REQ, "Read By Group Type");
+	print_stats(ATT_OP_READ_BY_TYPE_REQ, "Read By Type");
+	print_stats(ATT_OP_FIND_INFO_REQ, "Find Information");
+	print_stats(ATT_OP_READ_REQ, "Read");
+	print_stats(ATT_OP_READ_BLOB_REQ, "Read Blob");
+	print_stats(ATT_OP_WRITE_REQ, "Write");
+
+	/* Services include GAP and GATT registered by the server itself */
+	for (i = 0; i < opt_clients; i++) {
+		struct client *client = &clients[i];
+
+		if (client->phase != PHASE_ACCESS)
+			continue;
+
+		if (client->services != (unsigned int) opt_services + 2 ||
+				client->characteristics < num_values) {
+			error("Client %d discovered %u services and %u "
+					"characteristics", i, client->services,
+					client->characteristics);
+			failures++;
+		}
+	}
+
+	printf("\n%d failures\n", failures);
+
+	for (i = 0; i < opt_clients; i++) {
+		if (clients[i].watch > 0)
+			g_source_remove(clients[i].watch);
+		g_io_channel_unref(clients[i].io);
+	}
+
+	/* Let the server notice the hangups and drop its channels */
+	while (g_main_context_iteration(NULL, FALSE))
+		;
+
+	btd_adapter_gatt_server_stop(ADAPTER);
+
+	g_free(clients);
+	g_free(values);
+	g_hash_table_destroy(channels);
+	g_main_loop_unref(main_loop);
+
+	return failures > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
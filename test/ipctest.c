@@ -37,6 +37,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <glib.h>
 
@@ -103,6 +105,11 @@ struct userdata {
 	struct hsp_info hsp;
 	size_t link_mtu;
 	size_t block_size;
+	gboolean use_ring;
+	struct bt_pcm_ring *ring;
+	size_t ring_size;
+	int ring_event_fd;
+	uint32_t ring_tail;
 	gboolean debug_stream_read : 1;
 	gboolean debug_stream_write : 1;
 };
@@ -110,6 +117,7 @@ struct userdata {
 static struct userdata data = {
 	.service_fd = -1,
 	.stream_fd = -1,
+	.ring_event_fd = -1,
 	.transport = BT_CAPABILITIES_TRANSPORT_A2DP,
 	.rate = 48000,
 	.channels = 2,
@@ -318,6 +326,8 @@ static int get_caps(struct userdata *u)
 			sizeof(msg.getcaps_req.destination));
 	msg.getcaps_req.transport = u->transport;
 	msg.getcaps_req.flags = BT_FLAG_AUTOCONNECT;
+	if (u->use_ring)
+		msg.getcaps_req.flags |= BT_FLAG_PCM_RING;
 
 	if (service_send(u, &msg.getcaps_req.h) < 0)
 		return -1;
@@ -827,6 +837,133 @@ fail:
 	return FALSE;
 }
 
+/* Keeps the PCM ring full of silence, bluetoothd paces it out */
+static void write_ring(struct userdata *u)
+{
+	static const uint8_t silence[BUFFER_SIZE];
+
+	while (bt_pcm_ring_write(u->ring, silence, sizeof(silence)) > 0);
+}
+
+static gboolean ring_cb(GIOChannel *gin, GIOCondition condition, gpointer data)
+{
+	struct userdata *u;
+	uint64_t count;
+
+	assert(u = data);
+
+	if (!(condition & G_IO_IN)) {
+		DBG("Got %d", condition);
+		g_main_loop_quit(main_loop);
+		return FALSE;
+	}
+
+	if (read(u->ring_event_fd, &count, sizeof(count)) < 0 &&
+							errno != EAGAIN) {
+		ERR("Failed to read ring event: %s", strerror(errno));
+		return FALSE;
+	}
+
+	if (u->debug_stream_write)
+		DBG("read_index %u", *(volatile uint32_t *) &u->ring->tail);
+
+	write_ring(u);
+
+	return TRUE;
+}
+
+static void close_ring(struct userdata *u)
+{
+	if (u->ring) {
+		munmap(u->ring, u->ring_size);
+		u->ring = NULL;
+	}
+
+	if (u->ring_event_fd != -1) {
+		close(u->ring_event_fd);
+		u->ring_event_fd = -1;
+	}
+}
+
+/* With BT_FLAG_PCM_RING the stream fd is the shared memory ring and the
+ * watch is on its eventfd */
+static int start_ring(struct userdata *u)
+{
+	struct stat st;
+	int fds[2];
+
+	if (bt_audio_service_get_data_fds(u->service_fd, fds, 2) < 2) {
+		DBG("Failed to get PCM ring from audio service.");
+		return -1;
+	}
+
+	u->stream_fd = fds[0];
+	u->ring_event_fd = fds[1];
+
+	if (fstat(u->stream_fd, &st) < 0 ||
+			(size_t) st.st_size < sizeof(struct bt_pcm_ring)) {
+		ERR("Invalid PCM ring size");
+		goto failed;
+	}
+
+	u->ring_size = st.st_size;
+	u->ring = mmap(NULL, u->ring_size, PROT_READ | PROT_WRITE,
+						MAP_SHARED, u->stream_fd, 0);
+	if (u->ring == MAP_FAILED) {
+		u->ring = NULL;
+		ERR("Failed to map PCM ring: %s", strerror(errno));
+		goto failed;
+	}
+
+	if (u->ring->magic != BT_PCM_RING_MAGIC ||
+			sizeof(struct bt_pcm_ring) + u->ring->size >
+							u->ring_size) {
+		ERR("Invalid PCM ring header");
+		goto failed;
+	}
+
+	DBG("PCM ring: size %u rate %u channels %u", u->ring->size,
+					u->ring->rate, u->ring->channels);
+
+	u->ring_tail = u->ring->tail;
+	write_ring(u);
+
+	make_fd_nonblock(u->ring_event_fd);
+
+	assert(u->stream_channel = g_io_channel_unix_new(u->ring_event_fd));
+
+	u->stream_watch = g_io_add_watch(u->stream_channel,
+					G_IO_IN|G_IO_ERR|G_IO_HUP|G_IO_NVAL,
+					ring_cb, u);
+
+	return 0;
+
+failed:
+	close_ring(u);
+	close(u->stream_fd);
+	u->stream_fd = -1;
+	return -1;
+}
+
+/* bluetoothd moves the read index as it encodes, so it has to have
+ * advanced while the stream was running */
+static int check_ring(struct userdata *u)
+{
+	uint32_t consumed;
+
+	consumed = *(volatile uint32_t *) &u->ring->tail - u->ring_tail;
+
+	DBG("read_index advanced by %u bytes, %u underruns", consumed,
+							u->ring->underruns);
+
+	if (consumed == 0) {
+		ERR("PCM ring was never read");
+		return -1;
+	}
+
+	return 0;
+}
+
 static int start_stream(struct userdata *u)
 {
 	union {
@@ -867,6 +1004,9 @@ static int start_stream(struct userdata *u)
 	if (service_expect(u, &msg.rsp, BT_NEW_STREAM) < 0)
 		return -1;
 
+	if (u->use_ring)
+		return start_ring(u);
+
 	if ((u->stream_fd = bt_audio_service_get_data_fd(u->service_fd)) < 0) {
 		DBG("Failed to get stream fd from audio service.");
 		return -1;
@@ -921,6 +1061,12 @@ static int stop_stream(struct userdata *u)
 		r = -1;
 
 done:
+	if (u->ring) {
+		if (check_ring(u) < 0)
+			r = -1;
+		close_ring(u);
+	}
+
 	close(u->stream_fd);
 	u->stream_fd = -1;
 
@@ -1021,6 +1167,16 @@ static gboolean input_cb(GIOChannel *gin, GIOCondition condition, gpointer data)
 		shutdown_bt(u);
 	}
 
+	IF_CMD(ring) {
+		int enable;
+
+		if (sscanf(line, "%*s %d", &enable) != 1)
+			DBG("ring [0|1]");
+		else
+			u->use_ring = enable;
+		DBG("ring %s", YES_NO(u->use_ring));
+	}
+
 	IF_CMD(rate) {
 		if (sscanf(line, "%*s %d", &u->rate) != 1)
 			DBG("set with rate RATE");
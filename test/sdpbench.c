@@ -0,0 +1,809 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+
+#include <bluetooth/bluetooth.h>
+#include <bluetooth/sdp.h>
+#include <bluetooth/sdp_lib.h>
+
+#include <glib.h>
+
+#include "sdpd.h"
+#include "log.h"
+#include "adapter.h"
+#include "manager.h"
+
+/*
+ * Drives the sdpd request handler in-process. Requests are passed
+ * directly to handle_request() with the server end of a socketpair,
+ * responses are read back from the other end. Since the peer is not
+ * an L2CAP socket the server uses its fixed local MTU, so smaller
+ * MTUs are emulated with the maximum byte and record counts which
+ * the server clamps against the MTU anyway.
+ */
+
+#define DEFAULT_RECORDS		256
+#define DEFAULT_OPERATIONS	100000
+
+#define MAX_PDU_SIZE		USHRT_MAX
+#define MAX_CSTATE_SIZE		16
+
+static const uint16_t class_list[] = {
+	SERIAL_PORT_SVCLASS_ID,
+	DIALUP_NET_SVCLASS_ID,
+	OBEX_OBJPUSH_SVCLASS_ID,
+	OBEX_FILETRANS_SVCLASS_ID,
+	HEADSET_SVCLASS_ID,
+	HEADSET_AGW_SVCLASS_ID,
+	HANDSFREE_SVCLASS_ID,
+	HANDSFREE_AGW_SVCLASS_ID,
+	AUDIO_SOURCE_SVCLASS_ID,
+	AUDIO_SINK_SVCLASS_ID,
+	AV_REMOTE_TARGET_SVCLASS_ID,
+	AV_REMOTE_SVCLASS_ID,
+	PANU_SVCLASS_ID,
+	NAP_SVCLASS_ID,
+	HID_SVCLASS_ID,
+	PNP_INFO_SVCLASS_ID,
+};
+
+#define CLASS_COUNT (sizeof(class_list) / sizeof(class_list[0]))
+
+struct bench_record {
+	sdp_record_t *rec;
+	uint16_t class;
+	sdp_buf_t pdu;
+};
+
+struct bench {
+	int sk[2];
+	int fuzz;
+	uint16_t tid;
+
+	struct bench_record *records;
+	unsigned int num_records;
+
+	unsigned long requests;
+	unsigned long operations;
+	unsigned long errors;
+	unsigned long failures;
+	unsigned long long bytes;
+
+	uint32_t *latency;
+	unsigned long latency_count;
+	unsigned long latency_size;
+
+	uint8_t req[MAX_PDU_SIZE];
+	uint8_t rsp[MAX_PDU_SIZE];
+	uint8_t data[MAX_PDU_SIZE * 4];
+};
+
+/* Stubs for the parts of bluetoothd the SDP server calls into */
+
+void error(const char *format, ...)
+{
+}
+
+void btd_debug(const char *format, ...)
+{
+}
+
+void manager_foreach_adapter(adapter_cb func, gpointer user_data)
+{
+}
+
+struct btd_adapter *manager_find_adapter(const bdaddr_t *sba)
+{
+	return NULL;
+}
+
+void adapter_service_insert(struct btd_adapter *adapter, void *rec)
+{
+}
+
+void adapter_service_remove(struct btd_adapter *adapter, void *rec)
+{
+}
+
+int service_register_req(sdp_req_t *req, sdp_buf_t *rsp)
+{
+	return SDP_INVALID_SYNTAX;
+}
+
+int service_update_req(sdp_req_t *req, sdp_buf_t *rsp)
+{
+	return SDP_INVALID_SYNTAX;
+}
+
+int service_remove_req(sdp_req_t *req, sdp_buf_t *rsp)
+{
+	return SDP_INVALID_SYNTAX;
+}
+
+uint32_t sdp_get_time(void)
+{
+	struct timeval tm;
+
+	gettimeofday(&tm, NULL);
+	return (uint32_t) tm.tv_sec;
+}
+
+static uint64_t get_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static sdp_record_t *create_record(unsigned int index, uint16_t class)
+{
+	sdp_list_t *svclass, *root, *proto, *aproto, *profiles;
+	uuid_t class_uuid, root_uuid, l2cap_uuid, rfcomm_uuid;
+	sdp_profile_desc_t profile;
+	sdp_data_t *channel;
+	sdp_record_t *rec;
+	char name[32], desc[1024];
+	uint8_t ch = index % 30 + 1;
+	unsigned int len;
+
+	rec = sdp_record_alloc();
+	if (!rec)
+		return NULL;
+
+	rec->handle = sdp_next_handle();
+	sdp_attr_add_new(rec, SDP_ATTR_RECORD_HANDLE, SDP_UINT32,
+								&rec->handle);
+
+	sdp_uuid16_create(&class_uuid, class);
+	svclass = sdp_list_append(NULL, &class_uuid);
+	sdp_set_service_classes(rec, svclass);
+
+	sdp_uuid16_create(&root_uuid, PUBLIC_BROWSE_GROUP);
+	root = sdp_list_append(NULL, &root_uuid);
+	sdp_set_browse_groups(rec, root);
+
+	sdp_uuid16_create(&l2cap_uuid, L2CAP_UUID);
+	proto = sdp_list_append(NULL, sdp_list_append(NULL, &l2cap_uuid));
+
+	sdp_uuid16_create(&rfcomm_uuid, RFCOMM_UUID);
+	channel = sdp_data_alloc(SDP_UINT8, &ch);
+	proto = sdp_list_append(proto, sdp_list_append(
+				sdp_list_append(NULL, &rfcomm_uuid), channel));
+
+	aproto = sdp_list_append(NULL, proto);
+	sdp_set_access_protos(rec, aproto);
+
+	sdp_uuid16_create(&profile.uuid, class);
+	profile.version = 0x0100;
+	profiles = sdp_list_append(NULL, &profile);
+	sdp_set_profile_descs(rec, profiles);
+
+	/* Vary the record size so that some need continuation */
+	len = (index * 131) % (sizeof(desc) - 1);
+	memset(desc, 'a' + index % 26, len);
+	desc[len] = '\0';
+
+	snprintf(name, sizeof(name), "Bench service %u", index);
+	sdp_set_info_attr(rec, name, "BlueZ", desc);
+
+	sdp_data_free(channel);
+	sdp_list_free(profiles, NULL);
+	sdp_list_free(proto->data, NULL);
+	sdp_list_free(proto->next->data, NULL);
+	sdp_list_free(proto, NULL);
+	sdp_list_free(aproto, NULL);
+	sdp_list_free(root, NULL);
+	sdp_list_free(svclass, NULL);
+
+	return rec;
+}
+
+static int create_records(struct bench *b, unsigned int count)
+{
+	unsigned int i;
+
+	b->records = calloc(count, sizeof(struct bench_record));
+	if (!b->records)
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++) {
+		struct bench_record *r = &b->records[i];
+
+		r->class = class_list[i % CLASS_COUNT];
+		r->rec = create_record(i, r->class);
+		if (!r->rec)
+			return -ENOMEM;
+
+		sdp_record_add(BDADDR_ANY, r->rec);
+
+		if (sdp_gen_record_pdu(r->rec, &r->pdu) < 0)
+			return -EIO;
+
+		b->num_records++;
+	}
+
+	return 0;
+}
+
+static void add_latency(struct bench *b, uint64_t nsec)
+{
+	if (b->latency_count == b->latency_size) {
+		unsigned long size = b->latency_size ? b->latency_size * 2 : 4096;
+		uint32_t *latency;
+
+		latency = realloc(b->latency, size * sizeof(uint32_t));
+		if (!latency)
+			return;
+
+		b->latency = latency;
+		b->latency_size = size;
+	}
+
+	if (nsec > UINT32_MAX)
+		nsec = UINT32_MAX;
+
+	b->latency[b->latency_count++] = nsec;
+}
+
+/*
+ * Sends one request PDU and reads back the response. The request
+ * buffer is handed over to the server, which frees it.
+ */
+static ssize_t transact(struct bench *b, uint8_t pdu_id, size_t plen)
+{
+	sdp_pdu_hdr_t *hdr = (sdp_pdu_hdr_t *) b->req;
+	size_t len = sizeof(sdp_pdu_hdr_t) + plen;
+	uint64_t start;
+	uint8_t *data;
+	ssize_t ret;
+
+	hdr->pdu_id = pdu_id;
+	hdr->tid = htons(++b->tid);
+	hdr->plen = htons(plen);
+
+	data = malloc(len);
+	if (!data)
+		return -ENOMEM;
+
+	memcpy(data, b->req, len);
+
+	start = get_nsec();
+	handle_request(b->sk[0], data, len);
+	ret = recv(b->sk[1], b->rsp, sizeof(b->rsp), 0);
+	add_latency(b, get_nsec() - start);
+
+	if (ret < 0)
+		return -errno;
+
+	b->requests++;
+	b->bytes += ret;
+
+	hdr = (sdp_pdu_hdr_t *) b->rsp;
+
+	if ((size_t) ret < sizeof(sdp_pdu_hdr_t) ||
+			ntohs(hdr->plen) != ret - sizeof(sdp_pdu_hdr_t) ||
+			ntohs(hdr->tid) != b->tid)
+		return -EPROTO;
+
+	if (hdr->pdu_id == SDP_ERROR_RSP) {
+		b->errors++;
+		return -EBADMSG;
+	}
+
+	if (hdr->pdu_id != pdu_id + 1)
+		return -EPROTO;
+
+	return ret - sizeof(sdp_pdu_hdr_t);
+}
+
+static uint8_t *put_pattern(uint8_t *ptr, uint16_t class)
+{
+	*ptr++ = SDP_SEQ8;
+	*ptr++ = 3;
+	*ptr++ = SDP_UUID16;
+	bt_put_unaligned(htons(class), (uint16_t *) ptr);
+
+	return ptr + sizeof(uint16_t);
+}
+
+static uint8_t *put_range(uint8_t *ptr, uint16_t low, uint16_t high)
+{
+	*ptr++ = SDP_SEQ8;
+	*ptr++ = 5;
+	*ptr++ = SDP_UINT32;
+	bt_put_unaligned(htonl(low << 16 | high), (uint32_t *) ptr);
+
+	return ptr + sizeof(uint32_t);
+}
+
+static uint8_t *put_cstate(uint8_t *ptr, const uint8_t *cstate)
+{
+	memcpy(ptr, cstate, cstate[0] + 1);
+
+	return ptr + cstate[0] + 1;
+}
+
+/* Returns 1 when the response carried a non-null continuation state */
+static int get_cstate(const uint8_t *ptr, size_t len, uint8_t *cstate)
+{
+	if (len < 1 || ptr[0] > MAX_CSTATE_SIZE || len != (size_t) ptr[0] + 1)
+		return -EPROTO;
+
+	memcpy(cstate, ptr, ptr[0] + 1);
+
+	return cstate[0] > 0;
+}
+
+static unsigned int count_matches(struct bench *b, uint16_t class)
+{
+	unsigned int i, count = 0;
+
+	for (i = 0; i < b->num_records; i++)
+		if (b->records[i].class == class)
+			count++;
+
+	return count;
+}
+
+static int search(struct bench *b, uint16_t class, uint16_t max_count)
+{
+	uint8_t cstate[MAX_CSTATE_SIZE + 1];
+	unsigned int total = 0, found = 0;
+	int more;
+
+	cstate[0] = 0;
+
+	do {
+		uint8_t *ptr = b->req + sizeof(sdp_pdu_hdr_t);
+		uint16_t current;
+		ssize_t len;
+
+		ptr = put_pattern(ptr, class);
+		bt_put_unaligned(htons(max_count), (uint16_t *) ptr);
+		ptr = put_cstate(ptr + sizeof(uint16_t), cstate);
+
+		len = transact(b, SDP_SVC_SEARCH_REQ,
+					ptr - b->req - sizeof(sdp_pdu_hdr_t));
+		if (len < 0)
+			return len;
+
+		ptr = b->rsp + sizeof(sdp_pdu_hdr_t);
+		if (len < 4)
+			return -EPROTO;
+
+		total = ntohs(bt_get_unaligned((uint16_t *) ptr));
+		current = ntohs(bt_get_unaligned((uint16_t *) (ptr + 2)));
+		if (4 + current * 4 > len)
+			return -EPROTO;
+
+		found += current;
+
+		more = get_cstate(ptr + 4 + current * 4,
+					len - 4 - current * 4, cstate);
+		if (more < 0)
+			return more;
+	} while (more);
+
+	if (found != total)
+		return -EPROTO;
+
+	/* The server stops at max_count matches */
+	if (total != MIN(count_matches(b, class), max_count))
+		return -EPROTO;
+
+	return 0;
+}
+
+/*
+ * Shared by ServiceAttribute and ServiceSearchAttribute, which
+ * only differ in their leading parameters. The attribute lists are
+ * reassembled into b->data.
+ */
+static ssize_t fetch_attrs(struct bench *b, uint8_t pdu_id,
+					uint32_t handle, uint16_t class,
+					uint16_t max_bytes)
+{
+	uint8_t cstate[MAX_CSTATE_SIZE + 1];
+	size_t size = 0;
+	int more;
+
+	cstate[0] = 0;
+
+	do {
+		uint8_t *ptr = b->req + sizeof(sdp_pdu_hdr_t);
+		uint16_t count;
+		ssize_t len;
+
+		if (pdu_id == SDP_SVC_ATTR_REQ) {
+			bt_put_unaligned(htonl(handle), (uint32_t *) ptr);
+			ptr += sizeof(uint32_t);
+		} else
+			ptr = put_pattern(ptr, class);
+
+		bt_put_unaligned(htons(max_bytes), (uint16_t *) ptr);
+		ptr = put_range(ptr + sizeof(uint16_t), 0x0000, 0xffff);
+		ptr = put_cstate(ptr, cstate);
+
+		len = transact(b, pdu_id,
+					ptr - b->req - sizeof(sdp_pdu_hdr_t));
+		if (len < 0)
+			return len;
+
+		ptr = b->rsp + sizeof(sdp_pdu_hdr_t);
+		if (len < 2)
+			return -EPROTO;
+
+		count = ntohs(bt_get_unaligned((uint16_t *) ptr));
+		if (2 + count > len || count > max_bytes)
+			return -EPROTO;
+
+		if (size + count > sizeof(b->data))
+			return -EOVERFLOW;
+
+		memcpy(b->data + size, ptr + 2, count);
+		size += count;
+
+		more = get_cstate(ptr + 2 + count, len - 2 - count, cstate);
+		if (more < 0)
+			return more;
+	} while (more);
+
+	return size;
+}
+
+static int service_attr(struct bench *b, struct bench_record *r,
+							uint16_t max_bytes)
+{
+	ssize_t size;
+
+	size = fetch_attrs(b, SDP_SVC_ATTR_REQ, r->rec->handle, 0, max_bytes);
+	if (size < 0)
+		return size;
+
+	/* A full range request returns the complete record */
+	if ((size_t) size != r->pdu.data_size ||
+				memcmp(b->data, r->pdu.data, size) != 0)
+		return -EPROTO;
+
+	return 0;
+}
+
+static int search_attr(struct bench *b, uint16_t class, uint16_t max_bytes)
+{
+	unsigned int i;
+	ssize_t size;
+	size_t off;
+	uint8_t dtd;
+	int seqlen;
+
+	size = fetch_attrs(b, SDP_SVC_SEARCH_ATTR_REQ, 0, class, max_bytes);
+	if (size < 0)
+		return size;
+
+	off = sdp_extract_seqtype(b->data, size, &dtd, &seqlen);
+	if (off == 0 || off + seqlen != (size_t) size)
+		return -EPROTO;
+
+	/* Matching records are returned in handle order */
+	for (i = 0; i < b->num_records; i++) {
+		struct bench_record *r = &b->records[i];
+
+		if (r->class != class)
+			continue;
+
+		if (off + r->pdu.data_size > (size_t) size ||
+				memcmp(b->data + off, r->pdu.data,
+						r->pdu.data_size) != 0)
+			return -EPROTO;
+
+		off += r->pdu.data_size;
+	}
+
+	if (off != (size_t) size)
+		return -EPROTO;
+
+	return 0;
+}
+
+static uint16_t random_max_bytes(void)
+{
+	switch (rand() % 4) {
+	case 0:
+		/* Smallest value the server accepts */
+		return 7 + rand() % 32;
+	case 1:
+		return 48 + rand() % 200;
+	case 2:
+		return 256 + rand() % 1024;
+	default:
+		return 0xffff;
+	}
+}
+
+static int run_operation(struct bench *b)
+{
+	struct bench_record *r = &b->records[rand() % b->num_records];
+	uint16_t class = class_list[rand() % CLASS_COUNT];
+
+	switch (rand() % 3) {
+	case 0:
+		return search(b, class, 1 + rand() % (b->num_records + 1));
+	case 1:
+		return service_attr(b, r, random_max_bytes());
+	default:
+		return search_attr(b, class, random_max_bytes());
+	}
+}
+
+/* Locates the continuation state of a response */
+static int rsp_cstate(struct bench *b, uint8_t pdu_id, size_t len,
+							uint8_t *cstate)
+{
+	uint8_t *ptr = b->rsp + sizeof(sdp_pdu_hdr_t);
+	size_t off;
+
+	if (pdu_id == SDP_SVC_SEARCH_REQ) {
+		if (len < 4)
+			return -EPROTO;
+		off = 4 + ntohs(bt_get_unaligned((uint16_t *) (ptr + 2))) * 4;
+	} else {
+		if (len < 2)
+			return -EPROTO;
+		off = 2 + ntohs(bt_get_unaligned((uint16_t *) ptr));
+	}
+
+	if (off >= len)
+		return -EPROTO;
+
+	return get_cstate(ptr + off, len - off, cstate);
+}
+
+/*
+ * Sends a mangled request. Continuation states are either taken from
+ * a real response and corrupted, so they hit the response cache, or
+ * forged from scratch. Only the framing of the reply is checked, the
+ * point is to run the server under valgrind or ASan.
+ */
+static int run_fuzz(struct bench *b)
+{
+	uint8_t pdu_ids[] = { SDP_SVC_SEARCH_REQ, SDP_SVC_ATTR_REQ,
+						SDP_SVC_SEARCH_ATTR_REQ };
+	uint8_t pdu_id = pdu_ids[rand() % 3];
+	uint8_t *start = b->req + sizeof(sdp_pdu_hdr_t);
+	uint8_t *ptr = start;
+	uint8_t cstate[MAX_CSTATE_SIZE + 1];
+	size_t plen;
+	ssize_t len;
+	unsigned int i;
+
+	if (pdu_id == SDP_SVC_ATTR_REQ) {
+		struct bench_record *r = &b->records[rand() % b->num_records];
+		bt_put_unaligned(htonl(r->rec->handle), (uint32_t *) ptr);
+		ptr += sizeof(uint32_t);
+	} else
+		ptr = put_pattern(ptr, class_list[rand() % CLASS_COUNT]);
+
+	bt_put_unaligned(htons(rand() % 64), (uint16_t *) ptr);
+	ptr += sizeof(uint16_t);
+
+	if (pdu_id != SDP_SVC_SEARCH_REQ)
+		ptr = put_range(ptr, 0x0000, 0xffff);
+
+	plen = ptr - start;
+
+	/* Get a live continuation state from the server */
+	*ptr = 0;
+	len = transact(b, pdu_id, plen + 1);
+	if (len < 0 && len != -EBADMSG)
+		return len;
+
+	if (len > 0 && rsp_cstate(b, pdu_id, len, cstate) > 0) {
+		/* Keep the timestamp, corrupt the offset or the size */
+		for (i = 5; i <= cstate[0]; i++)
+			cstate[i] = rand();
+
+		if (rand() % 4 == 0)
+			cstate[0] = rand() % (MAX_CSTATE_SIZE + 1);
+	} else {
+		cstate[0] = rand() % (MAX_CSTATE_SIZE + 1);
+		for (i = 1; i <= cstate[0]; i++)
+			cstate[i] = rand();
+	}
+
+	ptr = put_cstate(ptr, cstate);
+	plen = ptr - start;
+
+	switch (rand() % 4) {
+	case 0:
+		/* Parameters shorter than the request claims */
+		len = transact(b, pdu_id, plen - rand() % plen);
+		break;
+	case 1:
+		/* Random bit flip anywhere in the parameters */
+		start[rand() % plen] ^= 1 << (rand() % 8);
+		len = transact(b, pdu_id, plen);
+		break;
+	default:
+		len = transact(b, pdu_id, plen);
+		break;
+	}
+
+	if (len < 0 && len != -EBADMSG)
+		return len;
+
+	return 0;
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	uint32_t la = *(const uint32_t *) a, lb = *(const uint32_t *) b;
+
+	return la < lb ? -1 : la > lb;
+}
+
+static void report(struct bench *b, uint64_t elapsed)
+{
+	struct rusage usage;
+	double secs = elapsed / 1e9;
+	uint32_t p50 = 0, p99 = 0, max = 0;
+
+	if (b->latency_count > 0) {
+		qsort(b->latency, b->latency_count, sizeof(uint32_t),
+							compare_latency);
+		p50 = b->latency[b->latency_count / 2];
+		p99 = b->latency[b->latency_count * 99 / 100];
+		max = b->latency[b->latency_count - 1];
+	}
+
+	memset(&usage, 0, sizeof(usage));
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("%u records, %lu operations, %lu requests in %.3f s\n",
+			b->num_records, b->operations, b->requests, secs);
+	printf("%.0f requests/s, %.1f MB/s\n", b->requests / secs,
+					b->bytes / secs / (1024 * 1024));
+	printf("latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+				p50 / 1e3, p99 / 1e3, max / 1e3);
+	printf("peak memory %ld kB\n", usage.ru_maxrss);
+	printf("%lu error responses, %lu failures\n",
+						b->errors, b->failures);
+}
+
+static void usage(void)
+{
+	printf("sdpbench - SDP server benchmark\n"
+		"Usage:\n");
+	printf("\tsdpbench [options]\n");
+	printf("Options:\n"
+		"\t-n, --records <count>     Number of records (default %d)\n"
+		"\t-c, --count <count>       Number of operations (default %d)\n"
+		"\t-s, --seed <seed>         Random seed\n"
+		"\t-f, --fuzz                Send mangled requests\n"
+		"\t-h, --help                Show help options\n",
+				DEFAULT_RECORDS, DEFAULT_OPERATIONS);
+}
+
+static struct option main_options[] = {
+	{ "records",	1, 0, 'n' },
+	{ "count",	1, 0, 'c' },
+	{ "seed",	1, 0, 's' },
+	{ "fuzz",	0, 0, 'f' },
+	{ "help",	0, 0, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+int main(int argc, char *argv[])
+{
+	static struct bench b;
+	unsigned int records = DEFAULT_RECORDS;
+	unsigned long i, count = DEFAULT_OPERATIONS;
+	unsigned int seed = time(NULL);
+	uint64_t start;
+	int opt, err;
+
+	while ((opt = getopt_long(argc, argv, "+n:c:s:fh",
+						main_options, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			records = atoi(optarg);
+			break;
+		case 'c':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			b.fuzz = 1;
+			break;
+		case 'h':
+		default:
+			usage();
+			exit(0);
+		}
+	}
+
+	if (records == 0 || records > 0xffff) {
+		fprintf(stderr, "Invalid number of records\n");
+		exit(1);
+	}
+
+	printf("Seed %u\n", seed);
+	srand(seed);
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, b.sk) < 0) {
+		perror("Can't create socket pair");
+		exit(1);
+	}
+
+	err = create_records(&b, records);
+	if (err < 0) {
+		fprintf(stderr, "Can't create records: %s (%d)\n",
+							strerror(-err), -err);
+		exit(1);
+	}
+
+	start = get_nsec();
+
+	for (i = 0; i < count; i++) {
+		err = b.fuzz ? run_fuzz(&b) : run_operation(&b);
+		b.operations++;
+
+		if (err < 0) {
+			b.failures++;
+			fprintf(stderr, "Operation %lu failed: %s (%d)\n",
+						i, strerror(-err), -err);
+		}
+	}
+
+	report(&b, get_nsec() - start);
+
+	for (i = 0; i < b.num_records; i++)
+		free(b.records[i].pdu.data);
+
+	sdp_svcdb_reset();
+	free(b.records);
+	free(b.latency);
+
+	close(b.sk[0]);
+	close(b.sk[1]);
+
+	return b.failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2004-2010  Marcel Holtmann <marcel@holtmann.org>
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bluetooth/bluetooth.h>
+
+#include "recordfile.h"
+
+static void print_entry(const bdaddr_t *dst, uint32_t handle,
+				const uint8_t *data, size_t len, void *user_data)
+{
+	unsigned int *count = user_data;
+	char addr[18];
+
+	ba2str(dst, addr);
+	printf("%s#%08X %zu bytes\n", addr, handle, len);
+
+	if (count)
+		(*count)++;
+}
+
+int main(int argc, char *argv[])
+{
+	char filename[] = "/tmp/recordfile";
+	uint8_t value[512];
+	unsigned int i, count, max = 10;
+	bdaddr_t dst;
+	int fd;
+
+	fd = creat(filename, 0644);
+	if (fd < 0)
+		return -errno;
+
+	close(fd);
+
+	str2ba("00:00:00:00:00:01", &dst);
+
+	if (recordfile_del(filename, &dst, 0x10000) < 0)
+		fprintf(stderr, "%s (%d)\n", strerror(errno), errno);
+
+	if (recordfile_get(filename, &dst, 0x10000, print_entry, NULL) == 0)
+		fprintf(stderr, "Found record in empty file\n");
+
+	memset(value, 0, sizeof(value));
+
+	for (i = 1; i < max + 1; i++) {
+		char addr[18];
+
+		sprintf(addr, "00:00:00:00:00:%02X", max + 1 - i);
+		str2ba(addr, &dst);
+
+		memset(value, i, i);
+
+		if (recordfile_put(filename, &dst, 0x10000 + i, value, i) < 0) {
+			fprintf(stderr, "%s (%d)\n", strerror(errno), errno);
+			break;
+		}
+
+		if (recordfile_put(filename, &dst, 0x10000, value, i) < 0) {
+			fprintf(stderr, "%s (%d)\n", strerror(errno), errno);
+			break;
+		}
+	}
+
+	printf("\n");
+
+	count = 0;
+	recordfile_foreach(filename, NULL, print_entry, &count);
+	if (count != max * 2)
+		fprintf(stderr, "Expected %u records, found %u\n",
+							max * 2, count);
+
+	str2ba("00:00:00:00:00:02", &dst);
+
+	if (recordfile_get(filename, &dst, 0x10000 + max - 1,
+						print_entry, NULL) < 0)
+		fprintf(stderr, "No record for handle 0x%08X\n",
+							0x10000 + max - 1);
+
+	if (recordfile_del(filename, &dst, 0x10000) < 0)
+		fprintf(stderr, "%s (%d)\n", strerror(errno), errno);
+
+	if (recordfile_get(filename, &dst, 0x10000, print_entry, NULL) == 0)
+		fprintf(stderr, "Found deleted record\n");
+
+	printf("\n");
+
+	count = 0;
+	recordfile_foreach(filename, &dst, print_entry, &count);
+	if (count != 1)
+		fprintf(stderr, "Expected 1 record, found %u\n", count);
+
+	str2ba("00:00:00:00:00:05", &dst);
+
+	if (recordfile_del_all(filename, &dst) < 0)
+		fprintf(stderr, "%s (%d)\n", strerror(errno), errno);
+
+	printf("\n");
+
+	count = 0;
+	recordfile_foreach(filename, NULL, print_entry, &count);
+	if (count != max * 2 - 3)
+		fprintf(stderr, "Expected %u records, found %u\n",
+							max * 2 - 3, count);
+
+	return 0;
+}
@@ -0,0 +1,220 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <check.h>
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+#include "btsnoop.h"
+
+#define HDR_SIZE	16
+#define PKT_SIZE	24
+
+/* 2012-01-01 in microseconds since 0000-01-01 */
+#define TIMESTAMP	0x00e1931f34dc0000ULL
+
+#define MAX_RECORDS	8
+
+struct record {
+	uint16_t index;
+	uint16_t opcode;
+	uint16_t size;
+};
+
+static struct record records[MAX_RECORDS];
+static int record_count;
+
+static uint8_t capture[4096];
+static size_t capture_len;
+
+static void put_be32(uint8_t *ptr, uint32_t val)
+{
+	val = htonl(val);
+	memcpy(ptr, &val, 4);
+}
+
+static void capture_init(void)
+{
+	memset(capture, 0, sizeof(capture));
+	memcpy(capture, "btsnoop", 8);
+	put_be32(capture + 8, 1);
+	put_be32(capture + 12, BTSNOOP_TYPE_MONITOR);
+	capture_len = HDR_SIZE;
+}
+
+static void capture_add(uint16_t index, uint16_t opcode, const void *data,
+								uint32_t len)
+{
+	uint8_t *ptr = capture + capture_len;
+
+	ck_assert(capture_len + PKT_SIZE + len <= sizeof(capture));
+
+	put_be32(ptr, len);
+	put_be32(ptr + 4, len);
+	put_be32(ptr + 8, index << 16 | opcode);
+	put_be32(ptr + 12, 0);
+	put_be32(ptr + 16, TIMESTAMP >> 32);
+	put_be32(ptr + 20, TIMESTAMP & 0xffffffff);
+
+	if (len > 0 && data)
+		memcpy(ptr + PKT_SIZE, data, len);
+
+	capture_len += PKT_SIZE + len;
+}
+
+static void read_callback(struct timeval *tv, uint16_t index,
+					uint16_t opcode, uint32_t drops,
+					const void *data, uint16_t size,
+					void *user_data)
+{
+	ck_assert(record_count < MAX_RECORDS);
+
+	records[record_count].index = index;
+	records[record_count].opcode = opcode;
+	records[record_count].size = size;
+	record_count++;
+}
+
+static int capture_read(void)
+{
+	char path[] = "/tmp/test-btsnoop-XXXXXX";
+	int fd, count;
+
+	fd = mkstemp(path);
+	ck_assert(fd >= 0);
+	ck_assert(write(fd, capture, capture_len) == (ssize_t) capture_len);
+	close(fd);
+
+	record_count = 0;
+	count = btsnoop_read(path, read_callback, NULL);
+
+	unlink(path);
+
+	return count;
+}
+
+static const uint8_t new_index[16] = {
+	0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06,
+	'h', 'c', 'i', '0', 0x00, 0x00, 0x00, 0x00,
+};
+
+static const uint8_t reset_complete[6] = {
+	0x0e, 0x04, 0x01, 0x03, 0x0c, 0x00,
+};
+
+START_TEST(test_truncated_new_index)
+{
+	/* Fill a whole page so that the empty record ends the mapping */
+	capture_init();
+	capture_add(0, BTSNOOP_OPCODE_EVENT_PKT, NULL,
+				sizeof(capture) - HDR_SIZE - 2 * PKT_SIZE);
+	capture_add(0, BTSNOOP_OPCODE_NEW_INDEX, NULL, 0);
+	ck_assert(capture_len == sizeof(capture));
+
+	ck_assert(capture_read() == 1);
+	ck_assert(records[0].opcode == BTSNOOP_OPCODE_EVENT_PKT);
+}
+END_TEST
+
+START_TEST(test_short_new_index)
+{
+	capture_init();
+	capture_add(0, BTSNOOP_OPCODE_NEW_INDEX, new_index, 4);
+	capture_add(0, BTSNOOP_OPCODE_EVENT_PKT, reset_complete,
+						sizeof(reset_complete));
+	capture_add(1, BTSNOOP_OPCODE_NEW_INDEX, new_index,
+						sizeof(new_index));
+	capture_add(1, BTSNOOP_OPCODE_DEL_INDEX, NULL, 0);
+
+	ck_assert(capture_read() == 3);
+
+	ck_assert(records[0].opcode == BTSNOOP_OPCODE_EVENT_PKT);
+	ck_assert(records[0].size == sizeof(reset_complete));
+
+	ck_assert(records[1].index == 1);
+	ck_assert(records[1].opcode == BTSNOOP_OPCODE_NEW_INDEX);
+	ck_assert(records[1].size == sizeof(new_index));
+
+	ck_assert(records[2].opcode == BTSNOOP_OPCODE_DEL_INDEX);
+	ck_assert(records[2].size == 0);
+}
+END_TEST
+
+START_TEST(test_truncated_record)
+{
+	capture_init();
+	capture_add(0, BTSNOOP_OPCODE_EVENT_PKT, reset_complete,
+						sizeof(reset_complete));
+	capture_add(0, BTSNOOP_OPCODE_EVENT_PKT, reset_complete,
+						sizeof(reset_complete));
+
+	/* Cut the last record short in the middle of its payload */
+	capture_len -= 2;
+
+	ck_assert(capture_read() == 1);
+	ck_assert(records[0].size == sizeof(reset_complete));
+}
+END_TEST
+
+static void add_test(Suite *s, const char *name, TFun func)
+{
+	TCase *t;
+
+	t = tcase_create(name);
+	tcase_add_test(t, func);
+	suite_add_tcase(s, t);
+}
+
+int main(int argc, char *argv[])
+{
+	int fails;
+	SRunner *sr;
+	Suite *s;
+
+	s = suite_create("btsnoop");
+
+	add_test(s, "truncated new index", test_truncated_new_index);
+	add_test(s, "short new index", test_short_new_index);
+	add_test(s, "truncated record", test_truncated_record);
+
+	sr = srunner_create(s);
+
+	srunner_run_all(sr, CK_NORMAL);
+
+	fails = srunner_ntests_failed(sr);
+
+	srunner_free(sr);
+
+	if (fails > 0)
+		return -1;
+
+	return 0;
+}